@@ -27,6 +27,9 @@
 #include "cluster_conf.h"
 
 #define CLUSTER_TRANSPORT_DEFAULT "tcp"
+#define CLUSTER_NODE_CONNECTIONS_DEFAULT 1
+#define CLUSTER_NODE_CONNECTIONS_MAX 16
+#define CLUSTER_SHM_DIRECTORY_DEFAULT CTDB_RUNDIR "/shm"
 
 /*
  * Ideally this wants to be a void function but it also used directly
@@ -64,8 +67,18 @@ static bool validate_transport(const char *key,
 			       const char *new_transport,
 			       enum conf_update_mode mode)
 {
+	bool valid = false;
+
 	/* Don't allow "ib" for now.  It is broken! */
-	if (strcmp(new_transport, CLUSTER_TRANSPORT_DEFAULT) != 0) {
+	if (strcmp(new_transport, CLUSTER_TRANSPORT_DEFAULT) == 0) {
+		valid = true;
+	}
+#ifdef HAVE_EVENTFD
+	if (strcmp(new_transport, "shm") == 0) {
+		valid = true;
+	}
+#endif
+	if (!valid) {
 		D_ERR("Invalid value for [cluster] -> transport = %s\n",
 		      new_transport);
 		return false;
@@ -113,6 +126,29 @@ good:
 					  mode);
 }
 
+static bool validate_node_connections(const char *key,
+				      int old_connections,
+				      int new_connections,
+				      enum conf_update_mode mode)
+{
+	if (new_connections < 1 ||
+	    new_connections > CLUSTER_NODE_CONNECTIONS_MAX) {
+		D_ERR("Invalid value for [cluster] -> node connections = %d\n",
+		      new_connections);
+		return false;
+	}
+
+	if (mode == CONF_MODE_RELOAD) {
+		if (old_connections != new_connections) {
+			D_WARNING("Ignoring update of [%s] -> %s\n",
+				  CLUSTER_CONF_SECTION,
+				  key);
+		}
+	}
+
+	return true;
+}
+
 void cluster_conf_init(struct conf_context *conf)
 {
 	conf_define_section(conf, CLUSTER_CONF_SECTION, NULL);
@@ -132,4 +168,14 @@ void cluster_conf_init(struct conf_context *conf)
 			   CLUSTER_CONF_RECOVERY_LOCK,
 			   NULL,
 			   check_static_string_change);
+	conf_define_integer(conf,
+			    CLUSTER_CONF_SECTION,
+			    CLUSTER_CONF_NODE_CONNECTIONS,
+			    CLUSTER_NODE_CONNECTIONS_DEFAULT,
+			    validate_node_connections);
+	conf_define_string(conf,
+			   CLUSTER_CONF_SECTION,
+			   CLUSTER_CONF_SHM_DIRECTORY,
+			   CLUSTER_SHM_DIRECTORY_DEFAULT,
+			   check_static_string_change);
 }
@@ -27,6 +27,8 @@
 #define CLUSTER_CONF_TRANSPORT       "transport"
 #define CLUSTER_CONF_NODE_ADDRESS    "node address"
 #define CLUSTER_CONF_RECOVERY_LOCK   "recovery lock"
+#define CLUSTER_CONF_NODE_CONNECTIONS "node connections"
+#define CLUSTER_CONF_SHM_DIRECTORY   "shm directory"
 
 void cluster_conf_init(struct conf_context *conf);
 
@@ -33,6 +33,8 @@ int ctdb_queue_send(struct ctdb_queue *queue, uint8_t *data, uint32_t length);
 
 int ctdb_queue_set_fd(struct ctdb_queue *queue, int fd);
 
+int ctdb_queue_set_coalesce(struct ctdb_queue *queue);
+
 struct ctdb_queue *ctdb_queue_setup(struct ctdb_context *ctdb,
 				    TALLOC_CTX *mem_ctx, int fd, int alignment,
 				    ctdb_queue_cb_fn_t callback,
@@ -41,7 +43,8 @@ struct ctdb_queue *ctdb_queue_setup(struct ctdb_context *ctdb,
 
 /* From common/ctdb_ltdb.c */
 
-int ctdb_db_tdb_flags(uint8_t db_flags, bool with_valgrind, bool with_mutex);
+int ctdb_db_tdb_flags(uint8_t db_flags, bool with_valgrind, bool with_mutex,
+		      bool with_crc32c);
 
 struct ctdb_db_context *ctdb_db_handle(struct ctdb_context *ctdb,
 				       const char *name);
@@ -23,6 +23,7 @@
 #include "replace.h"
 #include "system/network.h"
 #include "system/filesys.h"
+#include "system/select.h"
 
 #include <tdb.h>
 #include <talloc.h>
@@ -60,6 +61,8 @@ struct ctdb_queue {
 	struct ctdb_buffer buffer; /* input buffer */
 	struct ctdb_queue_pkt *out_queue, *out_queue_tail;
 	uint32_t out_queue_length;
+	uint32_t out_queue_bytes;
+	struct tevent_immediate *flush_im;
 	struct tevent_fd *fde;
 	int fd;
 	size_t alignment;
@@ -269,11 +272,106 @@ static void queue_dead(struct tevent_context *ev, struct tevent_immediate *im,
 }
 
 
+/* the most packets written by a single writev() */
+#define QUEUE_IOV_MAX 64
+
+/* is the queue collecting packets to write them together? */
+static bool queue_coalescing(struct ctdb_queue *queue)
+{
+	return (queue->flush_im != NULL &&
+		queue->ctdb->tunable.queue_coalesce_limit != 0 &&
+		!(queue->ctdb->flags & CTDB_FLAG_TORTURE));
+}
+
+/*
+  write as many queued packets as possible with one system call
+*/
+static void queue_io_writev(struct ctdb_queue *queue)
+{
+	while (queue->out_queue) {
+		struct iovec iov[QUEUE_IOV_MAX];
+		struct ctdb_queue_pkt *pkt;
+		int count = 0;
+		ssize_t n;
+
+		for (pkt = queue->out_queue;
+		     pkt != NULL && count < QUEUE_IOV_MAX;
+		     pkt = pkt->next) {
+			iov[count].iov_base = pkt->data;
+			iov[count].iov_len = pkt->length;
+			count++;
+		}
+
+		n = writev(queue->fd, iov, count);
+
+		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			pkt = queue->out_queue;
+			if (pkt->length != pkt->full_length) {
+				/* partial packet sent - we have to drop it */
+				DLIST_REMOVE(queue->out_queue, pkt);
+				queue->out_queue_length--;
+				queue->out_queue_bytes -= pkt->length;
+				talloc_free(pkt);
+			}
+			talloc_free(queue->fde);
+			queue->fde = NULL;
+			queue->fd = -1;
+			tevent_schedule_immediate(queue->im, queue->ctdb->ev,
+						  queue_dead, queue);
+			return;
+		}
+		if (n <= 0) {
+			break;
+		}
+
+		CTDB_INCREMENT_STAT(queue->ctdb, transport.writes);
+		if (count > 1) {
+			CTDB_INCREMENT_STAT(queue->ctdb,
+					    transport.coalesced_writes);
+		}
+
+		queue->out_queue_bytes -= n;
+
+		while (n > 0) {
+			pkt = queue->out_queue;
+
+			if ((size_t)n < pkt->length) {
+				pkt->length -= n;
+				pkt->data += n;
+				break;
+			}
+
+			n -= pkt->length;
+			DLIST_REMOVE(queue->out_queue, pkt);
+			queue->out_queue_length--;
+			talloc_free(pkt);
+			CTDB_INCREMENT_STAT(queue->ctdb, transport.packets);
+		}
+
+		if (queue->out_queue != NULL &&
+		    queue->out_queue->length != queue->out_queue->full_length) {
+			/* short write, wait until the socket has room */
+			break;
+		}
+	}
+
+	if (queue->out_queue != NULL) {
+		TEVENT_FD_WRITEABLE(queue->fde);
+	} else {
+		TEVENT_FD_NOT_WRITEABLE(queue->fde);
+	}
+}
+
 /*
   called when an incoming connection is writeable
 */
 static void queue_io_write(struct ctdb_queue *queue)
 {
+	if (queue_coalescing(queue)) {
+		queue_io_writev(queue);
+		return;
+	}
+
 	while (queue->out_queue) {
 		struct ctdb_queue_pkt *pkt = queue->out_queue;
 		ssize_t n;
@@ -288,6 +386,7 @@ static void queue_io_write(struct ctdb_queue *queue)
 				/* partial packet sent - we have to drop it */
 				DLIST_REMOVE(queue->out_queue, pkt);
 				queue->out_queue_length--;
+				queue->out_queue_bytes -= pkt->length;
 				talloc_free(pkt);
 			}
 			talloc_free(queue->fde);
@@ -297,11 +396,22 @@ static void queue_io_write(struct ctdb_queue *queue)
 						  queue_dead, queue);
 			return;
 		}
-		if (n <= 0) return;
-		
+		if (n <= 0) {
+			/*
+			 * We may come from queue_flush_event() after
+			 * coalescing was switched off, so the fd is not
+			 * necessarily waiting for room yet.
+			 */
+			TEVENT_FD_WRITEABLE(queue->fde);
+			return;
+		}
+
+		queue->out_queue_bytes -= n;
+
 		if (n != pkt->length) {
 			pkt->length -= n;
 			pkt->data += n;
+			TEVENT_FD_WRITEABLE(queue->fde);
 			return;
 		}
 
@@ -329,6 +439,19 @@ static void queue_io_handler(struct tevent_context *ev, struct tevent_fd *fde,
 }
 
 
+/* write out packets collected during this event loop iteration */
+static void queue_flush_event(struct tevent_context *ev,
+			      struct tevent_immediate *im,
+			      void *private_data)
+{
+	struct ctdb_queue *queue = talloc_get_type_abort(
+		private_data, struct ctdb_queue);
+
+	if (queue->fd != -1 && queue->out_queue != NULL) {
+		queue_io_write(queue);
+	}
+}
+
 /*
   queue a packet for sending
 */
@@ -356,11 +479,14 @@ int ctdb_queue_send(struct ctdb_queue *queue, uint8_t *data, uint32_t length)
 	}
 
 	full_length = length2;
-	
+
 	/* if the queue is empty then try an immediate write, avoiding
-	   queue overhead. This relies on non-blocking sockets */
+	   queue overhead. This relies on non-blocking sockets.  When
+	   coalescing, the packet waits for the end of this event loop
+	   iteration instead, so that it can go out with any others */
 	if (queue->out_queue == NULL && queue->fd != -1 &&
-	    !(queue->ctdb->flags & CTDB_FLAG_TORTURE)) {
+	    !(queue->ctdb->flags & CTDB_FLAG_TORTURE) &&
+	    !queue_coalescing(queue)) {
 		ssize_t n = write(queue->fd, data, length2);
 		if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
 			talloc_free(queue->fde);
@@ -391,12 +517,19 @@ int ctdb_queue_send(struct ctdb_queue *queue, uint8_t *data, uint32_t length)
 	pkt->full_length = full_length;
 
 	if (queue->out_queue == NULL && queue->fd != -1) {
-		TEVENT_FD_WRITEABLE(queue->fde);
+		if (queue_coalescing(queue)) {
+			tevent_schedule_immediate(queue->flush_im,
+						  queue->ctdb->ev,
+						  queue_flush_event, queue);
+		} else {
+			TEVENT_FD_WRITEABLE(queue->fde);
+		}
 	}
 
 	DLIST_ADD_END(queue->out_queue, pkt);
 
 	queue->out_queue_length++;
+	queue->out_queue_bytes += length2;
 
 	if (queue->ctdb->tunable.verbose_memory_names != 0) {
 		switch (hdr->operation) {
@@ -420,6 +553,30 @@ int ctdb_queue_send(struct ctdb_queue *queue, uint8_t *data, uint32_t length)
 		}
 	}
 
+	/* don't let too much pile up before writing */
+	if (queue_coalescing(queue) &&
+	    queue->out_queue_bytes >=
+	    queue->ctdb->tunable.queue_coalesce_limit) {
+		CTDB_INCREMENT_STAT(queue->ctdb, transport.limit_flushes);
+		queue_io_write(queue);
+	}
+
+	return 0;
+}
+
+/*
+  collect packets sent during one event loop iteration and write them
+  with a single system call
+ */
+int ctdb_queue_set_coalesce(struct ctdb_queue *queue)
+{
+	if (queue->flush_im == NULL) {
+		queue->flush_im = tevent_create_immediate(queue);
+		if (queue->flush_im == NULL) {
+			return ENOMEM;
+		}
+	}
+
 	return 0;
 }
 
@@ -37,7 +37,8 @@
 /*
  * Calculate tdb flags based on databse type
  */
-int ctdb_db_tdb_flags(uint8_t db_flags, bool with_valgrind, bool with_mutex)
+int ctdb_db_tdb_flags(uint8_t db_flags, bool with_valgrind, bool with_mutex,
+		      bool with_crc32c)
 {
 	int tdb_flags = 0;
 
@@ -62,6 +63,16 @@ int ctdb_db_tdb_flags(uint8_t db_flags, bool with_valgrind, bool with_mutex)
 
 	}
 
+#ifdef TDB_CRC32C_HASH
+	/*
+	 * Changes the on-disk hash, older tdb versions can't open
+	 * such databases
+	 */
+	if (with_crc32c && !(db_flags & CTDB_DB_FLAGS_PERSISTENT)) {
+		tdb_flags |= TDB_CRC32C_HASH;
+	}
+#endif
+
 	tdb_flags |= TDB_DISALLOW_NESTING;
 	if (with_valgrind) {
 		tdb_flags |= TDB_NOMMAP;
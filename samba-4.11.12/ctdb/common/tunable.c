@@ -157,6 +157,16 @@ static struct {
 		offsetof(struct ctdb_tunable_list, ip_alloc_algorithm) },
 	{ "AllowMixedVersions", 0, false,
 		offsetof(struct ctdb_tunable_list, allow_mixed_versions) },
+	{ "ReadOnlyHotKeyReads", 0, false,
+		offsetof(struct ctdb_tunable_list, readonly_hot_key_reads) },
+	{ "ReadOnlyHotKeyRevokes", 5, false,
+		offsetof(struct ctdb_tunable_list, readonly_hot_key_revokes) },
+	{ "ReadOnlyHotKeyDuration", 10, false,
+		offsetof(struct ctdb_tunable_list, readonly_hot_key_duration) },
+	{ "QueueCoalesceLimit", 65536, false,
+		offsetof(struct ctdb_tunable_list, queue_coalesce_limit) },
+	{ "RecDeltaPull", 1, false,
+		offsetof(struct ctdb_tunable_list, rec_delta_pull) },
 	{ .obsolete = true, }
 };
 
@@ -37,6 +37,7 @@
 #define DATABASE_CONF_VOLATILE_DB_DIR_DEFAULT   CTDB_VARDIR "/volatile"
 #define DATABASE_CONF_PERSISTENT_DB_DIR_DEFAULT CTDB_VARDIR "/persistent"
 #define DATABASE_CONF_STATE_DB_DIR_DEFAULT      CTDB_VARDIR "/state"
+#define DATABASE_CONF_LOCK_WAIT_THREADS_DEFAULT 64
 
 static bool check_static_string_change(const char *key,
 				       const char *old_value,
@@ -70,6 +71,30 @@ static bool check_static_boolean_change(const char *key,
 	return true;
 }
 
+static bool database_conf_validate_lock_wait_threads(const char *key,
+						     int old_value,
+						     int new_value,
+						     enum conf_update_mode mode)
+{
+	if (new_value < 0) {
+		D_ERR("Invalid value for [%s] -> %s = %d\n",
+		      DATABASE_CONF_SECTION,
+		      key,
+		      new_value);
+		return false;
+	}
+
+	if (mode == CONF_MODE_RELOAD) {
+		if (old_value != new_value) {
+			D_WARNING("Ignoring update of [%s] -> %s\n",
+				  DATABASE_CONF_SECTION,
+				  key);
+		}
+	}
+
+	return true;
+}
+
 static bool database_conf_validate_lock_debug_script(const char *key,
 						     const char *old_script,
 						     const char *new_script,
@@ -162,4 +187,14 @@ void database_conf_init(struct conf_context *conf)
 			    DATABASE_CONF_TDB_MUTEXES,
 			    true,
 			    check_static_boolean_change);
+	conf_define_integer(conf,
+			    DATABASE_CONF_SECTION,
+			    DATABASE_CONF_LOCK_WAIT_THREADS,
+			    DATABASE_CONF_LOCK_WAIT_THREADS_DEFAULT,
+			    database_conf_validate_lock_wait_threads);
+	conf_define_boolean(conf,
+			    DATABASE_CONF_SECTION,
+			    DATABASE_CONF_TDB_CRC32C_HASH,
+			    false,
+			    check_static_boolean_change);
 }
@@ -29,6 +29,8 @@
 #define DATABASE_CONF_STATE_DB_DIR              "state database directory"
 #define DATABASE_CONF_LOCK_DEBUG_SCRIPT         "lock debug script"
 #define DATABASE_CONF_TDB_MUTEXES               "tdb mutexes"
+#define DATABASE_CONF_LOCK_WAIT_THREADS         "lock wait threads"
+#define DATABASE_CONF_TDB_CRC32C_HASH           "tdb crc32c hash"
 
 void database_conf_init(struct conf_context *conf);
 
@@ -302,7 +302,12 @@ NoIPFailback
 NoIPTakeover
 PullDBPreallocation
 QueueBufferSize
+QueueCoalesceLimit
+ReadOnlyHotKeyDuration
+ReadOnlyHotKeyReads
+ReadOnlyHotKeyRevokes
 RecBufferSizeLimit
+RecDeltaPull
 RecLockLatencyMs
 RecdFailCount
 RecdPingTimeout
@@ -247,6 +247,7 @@ struct ctdb_daemon_data {
 
 struct ctdb_cluster_mutex_handle;
 struct eventd_context;
+struct pthreadpool_tevent;
 
 enum ctdb_freeze_mode {CTDB_FREEZE_NONE, CTDB_FREEZE_PENDING, CTDB_FREEZE_FROZEN};
 
@@ -276,6 +277,8 @@ struct ctdb_context {
 	uint64_t max_persistent_check_errors;
 	const char *transport;
 	const char *recovery_lock;
+	uint32_t node_connections; /* tcp connections to each node */
+	const char *shm_directory; /* rings and sockets of shm transport */
 	uint32_t pnn; /* our own pnn */
 	uint32_t num_nodes;
 	uint32_t num_connected;
@@ -340,6 +343,21 @@ struct ctdb_context {
 	/* Used for locking record/db/alldb */
 	struct lock_context *lock_current;
 	struct lock_context *lock_pending;
+
+	/* Threads waiting for record locks in ctdbd */
+	struct pthreadpool_tevent *lock_wait_pool;
+	int lock_wait_num_busy;
+};
+
+/*
+ * The header carried by all records pushed by a recovery.  Records
+ * still carrying it on another node than dmaster have not changed since.
+ */
+struct ctdb_db_recovered {
+	bool valid;
+	uint32_t generation;
+	uint32_t dmaster;
+	uint64_t rsn;
 };
 
 struct ctdb_db_context {
@@ -380,6 +398,7 @@ struct ctdb_db_context {
 	struct lock_context *lock_pending;
 	int lock_num_current;
 	struct db_hash_context *lock_log;
+	bool lock_wait_disabled;
 
 	struct ctdb_call_state *pending_calls;
 
@@ -393,7 +412,12 @@ struct ctdb_db_context {
 	bool push_started;
 	void *push_state;
 
+	/* Set by the last committed recovery, used by DB_PULL_CHANGED */
+	struct ctdb_db_recovered recovered;
+	struct ctdb_db_recovered recovered_pending;
+
 	struct hash_count_context *migratedb;
+	struct ctdb_hot_readonly *hot_readonly;
 };
 
 
@@ -477,10 +501,11 @@ extern const char *ctdbd_pidfile;
 typedef void (*deferred_requeue_fn)(void *call_context, struct ctdb_req_header *hdr);
 
 
-/* from tcp/ and ib/ */
+/* from tcp/, ib/ and shm/ */
 
 int ctdb_tcp_init(struct ctdb_context *ctdb);
 int ctdb_ibw_init(struct ctdb_context *ctdb);
+int ctdb_shm_init(struct ctdb_context *ctdb);
 
 /* from ctdb_banning.c */
 
@@ -527,6 +552,10 @@ int ctdb_add_revoke_deferred_call(struct ctdb_context *ctdb,
 
 int ctdb_migration_init(struct ctdb_db_context *ctdb_db);
 
+bool ctdb_hot_readonly_enabled(struct ctdb_db_context *ctdb_db);
+bool ctdb_hot_readonly_check(struct ctdb_db_context *ctdb_db, TDB_DATA key);
+void ctdb_hot_readonly_revoked(struct ctdb_db_context *ctdb_db, TDB_DATA key);
+
 /* from server/ctdb_control.c */
 
 int32_t ctdb_dump_memory(struct ctdb_context *ctdb, TDB_DATA *outdata);
@@ -713,6 +742,8 @@ int32_t ctdb_control_db_set_healthy(struct ctdb_context *ctdb,
 int32_t ctdb_control_db_get_health(struct ctdb_context *ctdb,
 				   TDB_DATA indata, TDB_DATA *outdata);
 
+int ctdb_open_tracking_db(struct ctdb_context *ctdb,
+			  struct ctdb_db_context *ctdb_db);
 int ctdb_set_db_readonly(struct ctdb_context *ctdb,
 			 struct ctdb_db_context *ctdb_db);
 
@@ -796,6 +827,9 @@ int32_t ctdb_control_db_push_start(struct ctdb_context *ctdb,
 				   TDB_DATA indata);
 int32_t ctdb_control_db_push_confirm(struct ctdb_context *ctdb,
 				     TDB_DATA indata, TDB_DATA *outdata);
+int32_t ctdb_control_db_pull_changed(struct ctdb_context *ctdb,
+				     struct ctdb_req_control_old *c,
+				     TDB_DATA indata, TDB_DATA *outdata);
 
 int ctdb_deferred_drop_all_ips(struct ctdb_context *ctdb);
 
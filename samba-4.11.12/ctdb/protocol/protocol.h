@@ -375,6 +375,7 @@ enum ctdb_controls {CTDB_CONTROL_PROCESS_EXISTS          = 0,
 		    CTDB_CONTROL_TUNNEL_DEREGISTER       = 153,
 		    CTDB_CONTROL_VACUUM_FETCH            = 154,
 		    CTDB_CONTROL_DB_VACUUM               = 155,
+		    CTDB_CONTROL_DB_PULL_CHANGED         = 156,
 };
 
 #define MAX_COUNT_BUCKETS 16
@@ -428,6 +429,7 @@ struct ctdb_statistics {
 		uint32_t num_current;
 		uint32_t num_pending;
 		uint32_t num_failed;
+		uint32_t num_wait_fallbacks;
 		struct ctdb_latency_counter latency;
 		uint32_t buckets[MAX_COUNT_BUCKETS];
 	} locks;
@@ -446,6 +448,12 @@ struct ctdb_statistics {
 	struct timeval statistics_current_time;
 	uint32_t total_ro_delegations;
 	uint32_t total_ro_revokes;
+	struct {
+		uint32_t writes;
+		uint32_t packets;
+		uint32_t coalesced_writes;
+		uint32_t limit_flushes;
+	} transport;
 };
 
 #define INVALID_GENERATION 1
@@ -483,6 +491,19 @@ struct ctdb_pulldb_ext {
 	uint64_t srvid;
 };
 
+/*
+ * Result of pulling only the records changed since the last recovery.
+ * Records still carrying the rsn and dmaster pushed by the recovery that
+ * committed generation are not sent.
+ */
+struct ctdb_pulldb_changed {
+	uint32_t num_records;
+	uint32_t num_skipped;
+	uint32_t generation;
+	uint32_t dmaster;
+	uint64_t rsn;
+};
+
 #define CTDB_RECOVERY_NORMAL		0
 #define CTDB_RECOVERY_ACTIVE		1
 
@@ -658,6 +679,11 @@ struct ctdb_tunable_list {
 	uint32_t queue_buffer_size;
 	uint32_t ip_alloc_algorithm;
 	uint32_t allow_mixed_versions;
+	uint32_t readonly_hot_key_reads;
+	uint32_t readonly_hot_key_revokes;
+	uint32_t readonly_hot_key_duration;
+	uint32_t queue_coalesce_limit;
+	uint32_t rec_delta_pull;
 };
 
 struct ctdb_tickle_list {
@@ -719,9 +745,11 @@ struct ctdb_public_ip_list {
  */
 #define CTDB_CAP_PARALLEL_RECOVERY	0x00010000
 #define CTDB_CAP_FRAGMENTED_CONTROLS	0x00020000
+#define CTDB_CAP_PULL_CHANGED		0x00040000
 
 #define CTDB_CAP_FEATURES		(CTDB_CAP_PARALLEL_RECOVERY | \
-					 CTDB_CAP_FRAGMENTED_CONTROLS)
+					 CTDB_CAP_FRAGMENTED_CONTROLS | \
+					 CTDB_CAP_PULL_CHANGED)
 
 #define CTDB_CAP_DEFAULT		(CTDB_CAP_RECMASTER | \
 					 CTDB_CAP_LMASTER   | \
@@ -932,6 +960,7 @@ struct ctdb_reply_control_data {
 		enum ctdb_runstate runstate;
 		uint32_t num_records;
 		int tdb_flags;
+		struct ctdb_pulldb_changed *pulldb_changed;
 	} data;
 };
 
@@ -611,6 +611,12 @@ void ctdb_req_control_db_vacuum(struct ctdb_req_control *request,
 				struct ctdb_db_vacuum *db_vacuum);
 int ctdb_reply_control_db_vacuum(struct ctdb_reply_control *reply);
 
+void ctdb_req_control_db_pull_changed(struct ctdb_req_control *request,
+				      struct ctdb_pulldb_ext *pulldb_ext);
+int ctdb_reply_control_db_pull_changed(struct ctdb_reply_control *reply,
+				       TALLOC_CTX *mem_ctx,
+				       struct ctdb_pulldb_changed **changed);
+
 /* From protocol/protocol_debug.c */
 
 void ctdb_packet_print(uint8_t *buf, size_t buflen, FILE *fp);
@@ -2381,3 +2381,33 @@ int ctdb_reply_control_db_vacuum(struct ctdb_reply_control *reply)
 
 	return reply->status;
 }
+
+/* CTDB_CONTROL_DB_PULL_CHANGED */
+
+void ctdb_req_control_db_pull_changed(struct ctdb_req_control *request,
+				      struct ctdb_pulldb_ext *pulldb_ext)
+{
+	request->opcode = CTDB_CONTROL_DB_PULL_CHANGED;
+	request->pad = 0;
+	request->srvid = 0;
+	request->client_id = 0;
+	request->flags = 0;
+
+	request->rdata.opcode = CTDB_CONTROL_DB_PULL_CHANGED;
+	request->rdata.data.pulldb_ext = pulldb_ext;
+}
+
+int ctdb_reply_control_db_pull_changed(struct ctdb_reply_control *reply,
+				       TALLOC_CTX *mem_ctx,
+				       struct ctdb_pulldb_changed **changed)
+{
+	if (reply->rdata.opcode != CTDB_CONTROL_DB_PULL_CHANGED) {
+		return EPROTO;
+	}
+
+	if (reply->status == 0) {
+		*changed = talloc_steal(mem_ctx,
+					reply->rdata.data.pulldb_changed);
+	}
+	return reply->status;
+}
@@ -415,6 +415,10 @@ static size_t ctdb_req_control_data_len(struct ctdb_req_control_data *cd)
 	case CTDB_CONTROL_DB_VACUUM:
 		len = ctdb_db_vacuum_len(cd->data.db_vacuum);
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		len = ctdb_pulldb_ext_len(cd->data.pulldb_ext);
+		break;
 	}
 
 	return len;
@@ -698,6 +702,10 @@ static void ctdb_req_control_data_push(struct ctdb_req_control_data *cd,
 	case CTDB_CONTROL_DB_VACUUM:
 		ctdb_db_vacuum_push(cd->data.db_vacuum, buf, &np);
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		ctdb_pulldb_ext_push(cd->data.pulldb_ext, buf, &np);
+		break;
 	}
 
 	*npush = np;
@@ -1035,6 +1043,11 @@ static int ctdb_req_control_data_pull(uint8_t *buf, size_t buflen,
 					  &cd->data.db_vacuum,
 					  &np);
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		ret = ctdb_pulldb_ext_pull(buf, buflen, mem_ctx,
+					   &cd->data.pulldb_ext, &np);
+		break;
 	}
 
 	if (ret != 0) {
@@ -1398,6 +1411,10 @@ static size_t ctdb_reply_control_data_len(struct ctdb_reply_control_data *cd)
 
 	case CTDB_CONTROL_DB_VACUUM:
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		len = ctdb_pulldb_changed_len(cd->data.pulldb_changed);
+		break;
 	}
 
 	return len;
@@ -1558,6 +1575,10 @@ static void ctdb_reply_control_data_push(struct ctdb_reply_control_data *cd,
 
 	case CTDB_CONTROL_DB_VACUUM:
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		ctdb_pulldb_changed_push(cd->data.pulldb_changed, buf, &np);
+		break;
 	}
 
 	*npush = np;
@@ -1748,6 +1769,11 @@ static int ctdb_reply_control_data_pull(uint8_t *buf, size_t buflen,
 
 	case CTDB_CONTROL_DB_VACUUM:
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		ret = ctdb_pulldb_changed_pull(buf, buflen, mem_ctx,
+					       &cd->data.pulldb_changed, &np);
+		break;
 	}
 
 	if (ret != 0) {
@@ -93,6 +93,13 @@ int ctdb_db_vacuum_pull(uint8_t *buf,
 			struct ctdb_db_vacuum **out,
 			size_t *npull);
 
+size_t ctdb_pulldb_changed_len(struct ctdb_pulldb_changed *in);
+void ctdb_pulldb_changed_push(struct ctdb_pulldb_changed *in, uint8_t *buf,
+			      size_t *npush);
+int ctdb_pulldb_changed_pull(uint8_t *buf, size_t buflen,
+			     TALLOC_CTX *mem_ctx,
+			     struct ctdb_pulldb_changed **out, size_t *npull);
+
 size_t ctdb_traverse_start_len(struct ctdb_traverse_start *in);
 void ctdb_traverse_start_push(struct ctdb_traverse_start *in, uint8_t *buf,
 			      size_t *npush);
@@ -221,6 +221,8 @@ size_t ctdb_statistics_len(struct ctdb_statistics *in)
 		ctdb_uint32_len(&in->locks.num_current) +
 		ctdb_uint32_len(&in->locks.num_pending) +
 		ctdb_uint32_len(&in->locks.num_failed) +
+		ctdb_uint32_len(&in->locks.num_wait_fallbacks) +
+		ctdb_padding_len(4) +
 		ctdb_latency_counter_len(&in->locks.latency) +
 		MAX_COUNT_BUCKETS * ctdb_uint32_len(&in->locks.buckets[0]) +
 		ctdb_uint32_len(&in->total_calls) +
@@ -240,7 +242,11 @@ size_t ctdb_statistics_len(struct ctdb_statistics *in)
 		ctdb_timeval_len(&in->statistics_start_time) +
 		ctdb_timeval_len(&in->statistics_current_time) +
 		ctdb_uint32_len(&in->total_ro_delegations) +
-		ctdb_uint32_len(&in->total_ro_revokes);
+		ctdb_uint32_len(&in->total_ro_revokes) +
+		ctdb_uint32_len(&in->transport.writes) +
+		ctdb_uint32_len(&in->transport.packets) +
+		ctdb_uint32_len(&in->transport.coalesced_writes) +
+		ctdb_uint32_len(&in->transport.limit_flushes);
 }
 
 void ctdb_statistics_push(struct ctdb_statistics *in, uint8_t *buf,
@@ -345,6 +351,12 @@ void ctdb_statistics_push(struct ctdb_statistics *in, uint8_t *buf,
 	ctdb_uint32_push(&in->locks.num_failed, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->locks.num_wait_fallbacks, buf+offset, &np);
+	offset += np;
+
+	ctdb_padding_push(4, buf+offset, &np);
+	offset += np;
+
 	ctdb_latency_counter_push(&in->locks.latency, buf+offset, &np);
 	offset += np;
 
@@ -406,6 +418,18 @@ void ctdb_statistics_push(struct ctdb_statistics *in, uint8_t *buf,
 	ctdb_uint32_push(&in->total_ro_revokes, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->transport.writes, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->transport.packets, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->transport.coalesced_writes, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->transport.limit_flushes, buf+offset, &np);
+	offset += np;
+
 	*npush = offset;
 }
 
@@ -639,6 +663,19 @@ static int ctdb_statistics_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->locks.num_wait_fallbacks, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_padding_pull(buf+offset, buflen-offset, 4, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	ret = ctdb_latency_counter_pull(buf+offset, buflen-offset,
 					&out->locks.latency, &np);
 	if (ret != 0) {
@@ -774,6 +811,34 @@ static int ctdb_statistics_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->transport.writes, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->transport.packets, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->transport.coalesced_writes, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->transport.limit_flushes, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	*npull = offset;
 	return 0;
 }
@@ -1303,6 +1368,93 @@ fail:
 	return ret;
 }
 
+size_t ctdb_pulldb_changed_len(struct ctdb_pulldb_changed *in)
+{
+	return ctdb_uint32_len(&in->num_records) +
+		ctdb_uint32_len(&in->num_skipped) +
+		ctdb_uint32_len(&in->generation) +
+		ctdb_uint32_len(&in->dmaster) +
+		ctdb_uint64_len(&in->rsn);
+}
+
+void ctdb_pulldb_changed_push(struct ctdb_pulldb_changed *in, uint8_t *buf,
+			      size_t *npush)
+{
+	size_t offset = 0, np;
+
+	ctdb_uint32_push(&in->num_records, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->num_skipped, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->generation, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->dmaster, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint64_push(&in->rsn, buf+offset, &np);
+	offset += np;
+
+	*npush = offset;
+}
+
+int ctdb_pulldb_changed_pull(uint8_t *buf, size_t buflen,
+			     TALLOC_CTX *mem_ctx,
+			     struct ctdb_pulldb_changed **out, size_t *npull)
+{
+	struct ctdb_pulldb_changed *val;
+	size_t offset = 0, np;
+	int ret;
+
+	val = talloc(mem_ctx, struct ctdb_pulldb_changed);
+	if (val == NULL) {
+		return ENOMEM;
+	}
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset, &val->num_records,
+			       &np);
+	if (ret != 0) {
+		goto fail;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset, &val->num_skipped,
+			       &np);
+	if (ret != 0) {
+		goto fail;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset, &val->generation,
+			       &np);
+	if (ret != 0) {
+		goto fail;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset, &val->dmaster, &np);
+	if (ret != 0) {
+		goto fail;
+	}
+	offset += np;
+
+	ret = ctdb_uint64_pull(buf+offset, buflen-offset, &val->rsn, &np);
+	if (ret != 0) {
+		goto fail;
+	}
+	offset += np;
+
+	*out = val;
+	*npull = offset;
+	return 0;
+
+fail:
+	talloc_free(val);
+	return ret;
+}
+
 size_t ctdb_ltdb_header_len(struct ctdb_ltdb_header *in)
 {
 	return ctdb_uint64_len(&in->rsn) +
@@ -2624,7 +2776,12 @@ size_t ctdb_tunable_list_len(struct ctdb_tunable_list *in)
 		ctdb_uint32_len(&in->rec_buffer_size_limit) +
 		ctdb_uint32_len(&in->queue_buffer_size) +
 		ctdb_uint32_len(&in->ip_alloc_algorithm) +
-		ctdb_uint32_len(&in->allow_mixed_versions);
+		ctdb_uint32_len(&in->allow_mixed_versions) +
+		ctdb_uint32_len(&in->readonly_hot_key_reads) +
+		ctdb_uint32_len(&in->readonly_hot_key_revokes) +
+		ctdb_uint32_len(&in->readonly_hot_key_duration) +
+		ctdb_uint32_len(&in->queue_coalesce_limit) +
+		ctdb_uint32_len(&in->rec_delta_pull);
 }
 
 void ctdb_tunable_list_push(struct ctdb_tunable_list *in, uint8_t *buf,
@@ -2818,6 +2975,21 @@ void ctdb_tunable_list_push(struct ctdb_tunable_list *in, uint8_t *buf,
 	ctdb_uint32_push(&in->allow_mixed_versions, buf+offset, &np);
 	offset += np;
 
+	ctdb_uint32_push(&in->readonly_hot_key_reads, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->readonly_hot_key_revokes, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->readonly_hot_key_duration, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->queue_coalesce_limit, buf+offset, &np);
+	offset += np;
+
+	ctdb_uint32_push(&in->rec_delta_pull, buf+offset, &np);
+	offset += np;
+
 	*npush = offset;
 }
 
@@ -3263,6 +3435,41 @@ static int ctdb_tunable_list_pull_elems(uint8_t *buf, size_t buflen,
 	}
 	offset += np;
 
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->readonly_hot_key_reads, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->readonly_hot_key_revokes, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->readonly_hot_key_duration, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->queue_coalesce_limit, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
+	ret = ctdb_uint32_pull(buf+offset, buflen-offset,
+			       &out->rec_delta_pull, &np);
+	if (ret != 0) {
+		return ret;
+	}
+	offset += np;
+
 	*npull = offset;
 	return 0;
 }
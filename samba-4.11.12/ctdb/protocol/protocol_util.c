@@ -712,3 +712,56 @@ int ctdb_connection_list_read(TALLOC_CTX *mem_ctx,
 
 	return ret;
 }
+
+bool ctdb_pulldb_changed_skip(struct ctdb_pulldb_changed *last,
+			      uint32_t pnn, TDB_DATA data)
+{
+	struct ctdb_ltdb_header *header;
+
+	if (last->generation == INVALID_GENERATION) {
+		return false;
+	}
+
+	/*
+	 * The dmaster can change records without changing the header,
+	 * it always sends all of them.
+	 */
+	if (last->dmaster == pnn) {
+		return false;
+	}
+
+	if (data.dsize < sizeof(struct ctdb_ltdb_header)) {
+		return false;
+	}
+	header = (struct ctdb_ltdb_header *)data.dptr;
+
+	return (header->rsn == last->rsn && header->dmaster == last->dmaster);
+}
+
+bool ctdb_pulldb_changed_confirmed(struct ctdb_pulldb_changed *pulled,
+				   uint32_t *pnn_list, unsigned int count,
+				   unsigned int index)
+{
+	struct ctdb_pulldb_changed *last = &pulled[index];
+	struct ctdb_pulldb_changed *dmaster;
+	unsigned int i;
+
+	if (last->num_skipped == 0) {
+		return true;
+	}
+
+	for (i=0; i<count; i++) {
+		if (pnn_list[i] == last->dmaster) {
+			break;
+		}
+	}
+	if (i == count) {
+		return false;
+	}
+
+	dmaster = &pulled[i];
+
+	return (dmaster->generation == last->generation &&
+		dmaster->dmaster == last->dmaster &&
+		dmaster->rsn == last->rsn);
+}
@@ -74,4 +74,22 @@ int ctdb_connection_list_read(TALLOC_CTX *mem_ctx,
 			      bool client_first,
 			      struct ctdb_connection_list **conn_list);
 
+/*
+ * last describes the last recovery of a database on node pnn, as
+ * returned by DB_PULL_CHANGED.  A record can be left out of the pull
+ * if it still carries the header pushed by that recovery.
+ */
+bool ctdb_pulldb_changed_skip(struct ctdb_pulldb_changed *last,
+			      uint32_t pnn, TDB_DATA data);
+
+/*
+ * pulled holds the DB_PULL_CHANGED results from the nodes in pnn_list.
+ * The records skipped by node index are only safe to leave out if the
+ * dmaster of its last recovery was pulled and reports the same last
+ * recovery.
+ */
+bool ctdb_pulldb_changed_confirmed(struct ctdb_pulldb_changed *pulled,
+				   uint32_t *pnn_list, unsigned int count,
+				   unsigned int index);
+
 #endif /* __CTDB_PROTOCOL_UTIL_H__ */
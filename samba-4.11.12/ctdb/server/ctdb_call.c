@@ -960,9 +960,21 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 		return;
 	}
 
-	/* Dont do READONLY if we don't have a tracking database */
+	/* Dont do READONLY if we don't have a tracking database, unless
+	 * the record is read often enough to be delegated anyway.  Only
+	 * the dmaster can tell, so other nodes pass the request on.
+	 */
 	if ((c->flags & CTDB_WANT_READONLY) && !ctdb_db_readonly(ctdb_db)) {
-		c->flags &= ~CTDB_WANT_READONLY;
+		bool hot;
+
+		if (header.dmaster == ctdb->pnn) {
+			hot = ctdb_hot_readonly_check(ctdb_db, call->key);
+		} else {
+			hot = ctdb_hot_readonly_enabled(ctdb_db);
+		}
+		if (!hot) {
+			c->flags &= ~CTDB_WANT_READONLY;
+		}
 	}
 
 	if (header.flags & CTDB_REC_RO_REVOKE_COMPLETE) {
@@ -973,7 +985,8 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 			ctdb_fatal(ctdb, "Failed to write header with cleared REVOKE flag");
 		}
 		/* and clear out the tracking data */
-		if (tdb_delete(ctdb_db->rottdb, call->key) != 0) {
+		if (ctdb_db->rottdb != NULL &&
+		    tdb_delete(ctdb_db->rottdb, call->key) != 0) {
 			DEBUG(DEBUG_ERR,(__location__ " Failed to clear out trackingdb record\n"));
 		}
 	}
@@ -1018,6 +1031,8 @@ void ctdb_request_call(struct ctdb_context *ctdb, struct ctdb_req_header *hdr)
 		}
 		ret = ctdb_ltdb_unlock(ctdb_db, call->key);
 
+		ctdb_hot_readonly_revoked(ctdb_db, call->key);
+
 		if (ctdb_start_revoke_ro_record(ctdb, ctdb_db, call->key, &header, data) != 0) {
 			ctdb_fatal(ctdb, "Failed to start record revoke");
 		}
@@ -1848,7 +1863,10 @@ int ctdb_start_revoke_ro_record(struct ctdb_context *ctdb,
 		return -1;
 	}
 
-	tdata = tdb_fetch(ctdb_db->rottdb, key);
+	tdata = tdb_null;
+	if (ctdb_db->rottdb != NULL) {
+		tdata = tdb_fetch(ctdb_db->rottdb, key);
+	}
 	if (tdata.dsize > 0) {
 		uint8_t *tmp;
 
@@ -53,6 +53,14 @@ static void setup_config_pointers(struct conf_context *conf)
 				   CLUSTER_CONF_SECTION,
 				   CLUSTER_CONF_RECOVERY_LOCK,
 				   &ctdb_config.recovery_lock);
+	conf_assign_integer_pointer(conf,
+				    CLUSTER_CONF_SECTION,
+				    CLUSTER_CONF_NODE_CONNECTIONS,
+				    &ctdb_config.node_connections);
+	conf_assign_string_pointer(conf,
+				   CLUSTER_CONF_SECTION,
+				   CLUSTER_CONF_SHM_DIRECTORY,
+				   &ctdb_config.shm_directory);
 
 	/*
 	 * Database
@@ -78,6 +86,14 @@ static void setup_config_pointers(struct conf_context *conf)
 				    DATABASE_CONF_SECTION,
 				    DATABASE_CONF_TDB_MUTEXES,
 				    &ctdb_config.tdb_mutexes);
+	conf_assign_integer_pointer(conf,
+				    DATABASE_CONF_SECTION,
+				    DATABASE_CONF_LOCK_WAIT_THREADS,
+				    &ctdb_config.lock_wait_threads);
+	conf_assign_boolean_pointer(conf,
+				    DATABASE_CONF_SECTION,
+				    DATABASE_CONF_TDB_CRC32C_HASH,
+				    &ctdb_config.tdb_crc32c_hash);
 
 	/*
 	 * Event
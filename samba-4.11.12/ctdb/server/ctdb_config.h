@@ -27,6 +27,8 @@ struct ctdb_config {
 	const char *transport;
 	const char *node_address;
 	const char *recovery_lock;
+	int node_connections;
+	const char *shm_directory;
 
 	/* Database */
 	const char *dbdir_volatile;
@@ -34,6 +36,8 @@ struct ctdb_config {
 	const char *dbdir_state;
 	const char *lock_debug_script;
 	bool tdb_mutexes;
+	int lock_wait_threads;
+	bool tdb_crc32c_hash;
 
 	/* Event */
 	const char *event_debug_script;
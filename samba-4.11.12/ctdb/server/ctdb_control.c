@@ -741,6 +741,10 @@ static int32_t ctdb_control_dispatch(struct ctdb_context *ctdb,
 		return ctdb_control_db_vacuum(ctdb, c, indata, async_reply);
 	}
 
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		CHECK_CONTROL_DATA_SIZE(sizeof(struct ctdb_pulldb_ext));
+		return ctdb_control_db_pull_changed(ctdb, c, indata, outdata);
+
 	default:
 		DEBUG(DEBUG_CRIT,(__location__ " Unknown CTDB control opcode %u\n", opcode));
 		return -1;
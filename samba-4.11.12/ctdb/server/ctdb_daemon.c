@@ -804,8 +804,12 @@ static void daemon_request_call_from_client(struct ctdb_client *client,
 		}
 	}
 
-	/* Dont do READONLY if we don't have a tracking database */
-	if ((c->flags & CTDB_WANT_READONLY) && !ctdb_db_readonly(ctdb_db)) {
+	/* Dont do READONLY if we don't have a tracking database, unless
+	 * the dmaster may hand out delegations for hot records
+	 */
+	if ((c->flags & CTDB_WANT_READONLY) &&
+	    !ctdb_db_readonly(ctdb_db) &&
+	    !ctdb_hot_readonly_enabled(ctdb_db)) {
 		c->flags &= ~CTDB_WANT_READONLY;
 	}
 
@@ -817,7 +821,8 @@ static void daemon_request_call_from_client(struct ctdb_client *client,
 			ctdb_fatal(ctdb, "Failed to write header with cleared REVOKE flag");
 		}
 		/* and clear out the tracking data */
-		if (tdb_delete(ctdb_db->rottdb, key) != 0) {
+		if (ctdb_db->rottdb != NULL &&
+		    tdb_delete(ctdb_db->rottdb, key) != 0) {
 			DEBUG(DEBUG_ERR,(__location__ " Failed to clear out trackingdb record\n"));
 		}
 	}
@@ -845,6 +850,8 @@ static void daemon_request_call_from_client(struct ctdb_client *client,
 		}
 		ret = ctdb_ltdb_unlock(ctdb_db, key);
 
+		ctdb_hot_readonly_revoked(ctdb_db, key);
+
 		if (ctdb_start_revoke_ro_record(ctdb, ctdb_db, key, &header, data) != 0) {
 			ctdb_fatal(ctdb, "Failed to start record revoke");
 		}
@@ -1487,6 +1494,11 @@ int ctdb_start_daemon(struct ctdb_context *ctdb, bool do_fork)
 	if (strcmp(ctdb->transport, "ib") == 0) {
 		ret = ctdb_ibw_init(ctdb);
 	}
+#endif
+#ifdef HAVE_EVENTFD
+	if (strcmp(ctdb->transport, "shm") == 0) {
+		ret = ctdb_shm_init(ctdb);
+	}
 #endif
 	if (ret != 0) {
 		DEBUG(DEBUG_ERR,("Failed to initialise transport '%s'\n", ctdb->transport));
@@ -137,6 +137,7 @@ static int ctdb_db_freeze_handle_destructor(struct ctdb_db_freeze_handle *h)
 		db_transaction_cancel_handler(ctdb_db, NULL);
 		ctdb_db->freeze_transaction_started = false;
 	}
+	ctdb_db->recovered_pending.valid = false;
 	ctdb_db->freeze_mode = CTDB_FREEZE_NONE;
 	ctdb_db->freeze_handle = NULL;
 
@@ -690,6 +691,7 @@ static int db_start_transaction(struct ctdb_db_context *ctdb_db,
 
 	ctdb_db->freeze_transaction_started = true;
 	ctdb_db->freeze_transaction_id = state->transaction_id;
+	ctdb_db->recovered_pending.valid = false;
 
 	return 0;
 }
@@ -705,6 +707,7 @@ static int db_cancel_transaction(struct ctdb_db_context *ctdb_db,
 	}
 
 	ctdb_db->freeze_transaction_started = false;
+	ctdb_db->recovered_pending.valid = false;
 
 	return 0;
 }
@@ -749,6 +752,11 @@ static int db_commit_transaction(struct ctdb_db_context *ctdb_db,
 	ctdb_db->freeze_transaction_started = false;
 	ctdb_db->freeze_transaction_id = 0;
 	ctdb_db->generation = state->transaction_id;
+
+	/* Only valid if the records were pushed in this transaction */
+	ctdb_db->recovered = ctdb_db->recovered_pending;
+	ctdb_db->recovered.generation = state->transaction_id;
+	ctdb_db->recovered_pending.valid = false;
 	return 0;
 }
 
@@ -867,6 +875,8 @@ int32_t ctdb_control_wipe_database(struct ctdb_context *ctdb, TDB_DATA indata)
 		return -1;
 	}
 
+	ctdb_db->recovered.valid = false;
+
 	if (ctdb_db_volatile(ctdb_db)) {
 		talloc_free(ctdb_db->delete_queue);
 		talloc_free(ctdb_db->fetch_queue);
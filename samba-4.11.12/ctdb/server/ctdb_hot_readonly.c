@@ -0,0 +1,321 @@
+/*
+   Automatic readonly delegations for hot records
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/network.h"
+#include "system/time.h"
+
+#include <talloc.h>
+#include <tevent.h>
+
+#include "lib/util/debug.h"
+#include "lib/util/time.h"
+
+#include "ctdb_private.h"
+
+#include "common/common.h"
+#include "common/logging.h"
+#include "common/hash_count.h"
+#include "common/db_hash.h"
+
+/*
+ * Automatic readonly delegations for hot records
+ *
+ * Volatile databases without the READONLY flag normally migrate a record
+ * for every remote read.  If ReadOnlyHotKeyReads is set, the dmaster
+ * counts readonly fetch requests per record and hands out readonly
+ * delegations for records that are read that often per second.  Writes
+ * still revoke all delegations first.  A record that gets revoked more
+ * than ReadOnlyHotKeyRevokes times per second is written too often to
+ * benefit, and goes back to plain migration.  Both states last for
+ * ReadOnlyHotKeyDuration seconds after the last time they applied.
+ */
+
+struct ctdb_hot_readonly {
+	struct ctdb_db_context *ctdb_db;
+	struct hash_count_context *reads;
+	struct hash_count_context *revokes;
+	struct db_hash_context *keys;
+};
+
+struct ctdb_hot_readonly_key {
+	struct timeval expire;
+	bool hot;
+};
+
+static void ctdb_hot_readonly_set(struct ctdb_hot_readonly *hot,
+				  TDB_DATA key, bool is_hot)
+{
+	struct ctdb_context *ctdb = hot->ctdb_db->ctdb;
+	struct ctdb_hot_readonly_key value = {
+		.expire = timeval_current_ofs(
+			ctdb->tunable.readonly_hot_key_duration, 0),
+		.hot = is_hot,
+	};
+
+	(void) db_hash_add(hot->keys, key.dptr, key.dsize,
+			   (uint8_t *)&value, sizeof(value));
+}
+
+static int ctdb_hot_readonly_fetch_parser(uint8_t *keybuf, size_t keylen,
+					  uint8_t *databuf, size_t datalen,
+					  void *private_data)
+{
+	struct ctdb_hot_readonly_key *value =
+		(struct ctdb_hot_readonly_key *)private_data;
+
+	if (datalen != sizeof(struct ctdb_hot_readonly_key)) {
+		return EIO;
+	}
+
+	*value = *(struct ctdb_hot_readonly_key *)databuf;
+	return 0;
+}
+
+/*
+ * Look up whether a record is hot, or held back because of too many
+ * revokes.  Returns false if neither applies any more.
+ */
+static bool ctdb_hot_readonly_fetch(struct ctdb_hot_readonly *hot,
+				    TDB_DATA key, bool *is_hot)
+{
+	struct ctdb_hot_readonly_key value;
+	struct timeval now = timeval_current();
+	int ret;
+
+	ret = db_hash_fetch(hot->keys, key.dptr, key.dsize,
+			    ctdb_hot_readonly_fetch_parser, &value);
+	if (ret != 0) {
+		return false;
+	}
+
+	if (timeval_compare(&now, &value.expire) >= 0) {
+		return false;
+	}
+
+	*is_hot = value.hot;
+	return true;
+}
+
+static void ctdb_hot_readonly_read_handler(TDB_DATA key, uint64_t counter,
+					   void *private_data)
+{
+	struct ctdb_hot_readonly *hot = talloc_get_type_abort(
+		private_data, struct ctdb_hot_readonly);
+	struct ctdb_context *ctdb = hot->ctdb_db->ctdb;
+	bool is_hot;
+
+	if (counter < ctdb->tunable.readonly_hot_key_reads) {
+		return;
+	}
+
+	if (ctdb_hot_readonly_fetch(hot, key, &is_hot) && !is_hot) {
+		return;
+	}
+
+	if (counter == ctdb->tunable.readonly_hot_key_reads) {
+		D_INFO("Record in %s is read hot, "
+		       "enabling readonly delegations\n",
+		       hot->ctdb_db->db_name);
+	}
+	ctdb_hot_readonly_set(hot, key, true);
+}
+
+static void ctdb_hot_readonly_revoke_handler(TDB_DATA key, uint64_t counter,
+					     void *private_data)
+{
+	struct ctdb_hot_readonly *hot = talloc_get_type_abort(
+		private_data, struct ctdb_hot_readonly);
+	struct ctdb_context *ctdb = hot->ctdb_db->ctdb;
+
+	if (counter < ctdb->tunable.readonly_hot_key_revokes) {
+		return;
+	}
+
+	if (counter == ctdb->tunable.readonly_hot_key_revokes) {
+		D_INFO("Record in %s is revoked too often, "
+		       "disabling readonly delegations\n",
+		       hot->ctdb_db->db_name);
+	}
+	ctdb_hot_readonly_set(hot, key, false);
+}
+
+struct ctdb_hot_readonly_expire_state {
+	struct db_hash_context *dh;
+	struct timeval now;
+};
+
+static int ctdb_hot_readonly_expire_parser(uint8_t *keybuf, size_t keylen,
+					   uint8_t *databuf, size_t datalen,
+					   void *private_data)
+{
+	struct ctdb_hot_readonly_expire_state *state =
+		(struct ctdb_hot_readonly_expire_state *)private_data;
+	struct ctdb_hot_readonly_key *value;
+
+	if (datalen != sizeof(struct ctdb_hot_readonly_key)) {
+		return EIO;
+	}
+
+	value = (struct ctdb_hot_readonly_key *)databuf;
+	if (timeval_compare(&value->expire, &state->now) <= 0) {
+		return db_hash_delete(state->dh, keybuf, keylen);
+	}
+
+	return 0;
+}
+
+static void ctdb_hot_readonly_cleandb_event(struct tevent_context *ev,
+					    struct tevent_timer *te,
+					    struct timeval current_time,
+					    void *private_data)
+{
+	struct ctdb_hot_readonly *hot = talloc_get_type_abort(
+		private_data, struct ctdb_hot_readonly);
+	struct ctdb_db_context *ctdb_db = hot->ctdb_db;
+	struct ctdb_hot_readonly_expire_state state = {
+		.dh = hot->keys,
+		.now = timeval_current(),
+	};
+
+	hash_count_expire(hot->reads, NULL);
+	hash_count_expire(hot->revokes, NULL);
+	(void) db_hash_traverse_update(hot->keys,
+				       ctdb_hot_readonly_expire_parser,
+				       &state, NULL);
+
+	te = tevent_add_timer(ctdb_db->ctdb->ev, hot,
+			      tevent_timeval_current_ofs(10, 0),
+			      ctdb_hot_readonly_cleandb_event, hot);
+	if (te == NULL) {
+		DEBUG(DEBUG_ERR,
+		      ("Memory error in hot readonly cleandb event for %s\n",
+		       ctdb_db->db_name));
+		TALLOC_FREE(ctdb_db->hot_readonly);
+	}
+}
+
+static struct ctdb_hot_readonly *ctdb_hot_readonly_get(
+					struct ctdb_db_context *ctdb_db)
+{
+	struct ctdb_hot_readonly *hot;
+	struct timeval one_second = { 1, 0 };
+	struct tevent_timer *te;
+	int ret;
+
+	if (ctdb_db->hot_readonly != NULL) {
+		return ctdb_db->hot_readonly;
+	}
+
+	hot = talloc_zero(ctdb_db, struct ctdb_hot_readonly);
+	if (hot == NULL) {
+		goto fail;
+	}
+	hot->ctdb_db = ctdb_db;
+
+	ret = hash_count_init(hot, one_second,
+			      ctdb_hot_readonly_read_handler, hot,
+			      &hot->reads);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	ret = hash_count_init(hot, one_second,
+			      ctdb_hot_readonly_revoke_handler, hot,
+			      &hot->revokes);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	ret = db_hash_init(hot, "hot_readonly_keys", 1024, DB_HASH_COMPLEX,
+			   &hot->keys);
+	if (ret != 0) {
+		goto fail;
+	}
+
+	te = tevent_add_timer(ctdb_db->ctdb->ev, hot,
+			      tevent_timeval_current_ofs(10, 0),
+			      ctdb_hot_readonly_cleandb_event, hot);
+	if (te == NULL) {
+		goto fail;
+	}
+
+	ctdb_db->hot_readonly = hot;
+	return hot;
+
+fail:
+	DEBUG(DEBUG_ERR,
+	      ("Memory error in hot readonly init for %s\n",
+	       ctdb_db->db_name));
+	talloc_free(hot);
+	return NULL;
+}
+
+/*
+ * Can readonly requests for this database get delegations automatically?
+ */
+bool ctdb_hot_readonly_enabled(struct ctdb_db_context *ctdb_db)
+{
+	if (ctdb_db->ctdb->tunable.readonly_hot_key_reads == 0) {
+		return false;
+	}
+
+	return (ctdb_db_volatile(ctdb_db) && !ctdb_db_readonly(ctdb_db));
+}
+
+/*
+ * Called by the dmaster for a readonly request.  Counts the request and
+ * returns true if the record is hot enough to be delegated.
+ */
+bool ctdb_hot_readonly_check(struct ctdb_db_context *ctdb_db, TDB_DATA key)
+{
+	struct ctdb_hot_readonly *hot;
+	bool is_hot = false;
+
+	if (! ctdb_hot_readonly_enabled(ctdb_db)) {
+		return false;
+	}
+
+	hot = ctdb_hot_readonly_get(ctdb_db);
+	if (hot == NULL) {
+		return false;
+	}
+
+	(void) hash_count_increment(hot->reads, key);
+
+	if (! ctdb_hot_readonly_fetch(hot, key, &is_hot) || !is_hot) {
+		return false;
+	}
+
+	if (ctdb_open_tracking_db(ctdb_db->ctdb, ctdb_db) != 0) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Called by the dmaster when a write revokes readonly delegations
+ */
+void ctdb_hot_readonly_revoked(struct ctdb_db_context *ctdb_db, TDB_DATA key)
+{
+	if (ctdb_db->hot_readonly == NULL) {
+		return;
+	}
+
+	(void) hash_count_increment(ctdb_db->hot_readonly->revokes, key);
+}
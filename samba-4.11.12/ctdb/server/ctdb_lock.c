@@ -35,6 +35,12 @@
 #include "common/common.h"
 #include "common/logging.h"
 
+#include "server/ctdb_config.h"
+
+#ifdef WITH_PTHREADPOOL
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#endif
+
 /*
  * Non-blocking Locking API
  *
@@ -44,6 +50,10 @@
  * 4. If the child process cannot get locks within certain time,
  *    execute an external script to debug.
  *
+ * Record locks avoid the child process if possible: A thread waits
+ * for the lock to become free, then ctdbd takes it itself, see
+ * ctdb_lock_wait_start().
+ *
  * ctdb_lock_record()      - get a lock on a record
  * ctdb_lock_db()          - get a lock on a DB
  *
@@ -65,6 +75,7 @@ static const char * const lock_type_str[] = {
 };
 
 struct lock_request;
+struct lock_wait_state;
 
 /* lock_context is the common part for a lock request */
 struct lock_context {
@@ -83,6 +94,8 @@ struct lock_context {
 	struct timeval start_time;
 	uint32_t key_hash;
 	bool can_schedule;
+	bool in_process;
+	struct lock_wait_state *wait;
 };
 
 /* lock_request is the client specific part for a lock request */
@@ -182,6 +195,8 @@ int ctdb_lockdb_unmark(struct ctdb_db_context *ctdb_db)
 }
 
 static void ctdb_lock_schedule(struct ctdb_context *ctdb);
+static bool ctdb_lock_helper_start(struct lock_context *lock_ctx);
+static void ctdb_lock_wait_cancel(struct lock_context *lock_ctx);
 
 /*
  * Destructor to kill the child locking process
@@ -191,8 +206,11 @@ static int ctdb_lock_context_destructor(struct lock_context *lock_ctx)
 	if (lock_ctx->request) {
 		lock_ctx->request->lctx = NULL;
 	}
-	if (lock_ctx->child > 0) {
-		ctdb_kill(lock_ctx->ctdb, lock_ctx->child, SIGTERM);
+	if ((lock_ctx->child > 0) || lock_ctx->in_process) {
+		if (lock_ctx->child > 0) {
+			ctdb_kill(lock_ctx->ctdb, lock_ctx->child, SIGTERM);
+		}
+		ctdb_lock_wait_cancel(lock_ctx);
 		if (lock_ctx->type == LOCK_RECORD) {
 			DLIST_REMOVE(lock_ctx->ctdb_db->lock_current, lock_ctx);
 		} else {
@@ -245,6 +263,10 @@ static void process_callbacks(struct lock_context *lock_ctx, bool locked)
 	if (auto_mark && locked) {
 		switch (lock_ctx->type) {
 		case LOCK_RECORD:
+			if (lock_ctx->in_process) {
+				/* We already hold the real lock */
+				break;
+			}
 			tdb_chainlock_mark(lock_ctx->ctdb_db->ltdb->tdb, lock_ctx->key);
 			break;
 
@@ -274,6 +296,11 @@ static void process_callbacks(struct lock_context *lock_ctx, bool locked)
 	if (locked) {
 		switch (lock_ctx->type) {
 		case LOCK_RECORD:
+			if (lock_ctx->in_process) {
+				tdb_chainunlock(lock_ctx->ctdb_db->ltdb->tdb,
+						lock_ctx->key);
+				break;
+			}
 			tdb_chainlock_unmark(lock_ctx->ctdb_db->ltdb->tdb, lock_ctx->key);
 			break;
 
@@ -320,35 +347,20 @@ static int lock_bucket_id(double t)
 }
 
 /*
- * Callback routine when the required locks are obtained.
- * Called from parent context
+ * Update statistics and run the callbacks once the lock attempt is
+ * finished
  */
-static void ctdb_lock_handler(struct tevent_context *ev,
-			    struct tevent_fd *tfd,
-			    uint16_t flags,
-			    void *private_data)
+static void ctdb_lock_done(struct lock_context *lock_ctx, bool locked)
 {
-	struct lock_context *lock_ctx;
-	char c;
-	bool locked;
 	double t;
 	int id;
 
-	lock_ctx = talloc_get_type_abort(private_data, struct lock_context);
-
 	/* cancel the timeout event */
 	TALLOC_FREE(lock_ctx->ttimer);
 
 	t = timeval_elapsed(&lock_ctx->start_time);
 	id = lock_bucket_id(t);
 
-	/* Read the status from the child process */
-	if (sys_read(lock_ctx->fd[0], &c, 1) != 1) {
-		locked = false;
-	} else {
-		locked = (c == 0 ? true : false);
-	}
-
 	/* Update statistics */
 	CTDB_INCREMENT_STAT(lock_ctx->ctdb, locks.num_calls);
 	CTDB_INCREMENT_DB_STAT(lock_ctx->ctdb_db, locks.num_calls);
@@ -369,6 +381,31 @@ static void ctdb_lock_handler(struct tevent_context *ev,
 	process_callbacks(lock_ctx, locked);
 }
 
+/*
+ * Callback routine when the required locks are obtained.
+ * Called from parent context
+ */
+static void ctdb_lock_handler(struct tevent_context *ev,
+			    struct tevent_fd *tfd,
+			    uint16_t flags,
+			    void *private_data)
+{
+	struct lock_context *lock_ctx;
+	char c;
+	bool locked;
+
+	lock_ctx = talloc_get_type_abort(private_data, struct lock_context);
+
+	/* Read the status from the child process */
+	if (sys_read(lock_ctx->fd[0], &c, 1) != 1) {
+		locked = false;
+	} else {
+		locked = (c == 0 ? true : false);
+	}
+
+	ctdb_lock_done(lock_ctx, locked);
+}
+
 struct lock_log_entry {
 	struct db_hash_context *lock_log;
 	TDB_DATA key;
@@ -574,6 +611,250 @@ skip_lock_debug:
 					    (void *)lock_ctx);
 }
 
+#ifdef WITH_PTHREADPOOL
+
+/*
+ * In-process waiting for record locks
+ *
+ * Forking a lock helper for every contended record is expensive when
+ * a hot record is contended all the time. Instead, a thread from
+ * ctdb->lock_wait_pool blocks in tdb_chainlock_wait() until the
+ * record lock is free. Back in the main thread ctdbd takes the lock
+ * with tdb_chainlock_nonblock() and holds it itself while the callback
+ * runs. If someone else was faster, the thread waits again.
+ *
+ * A blocked thread can't be interrupted. If the lock request goes
+ * away, the wait state stays around until the thread returns. It
+ * keeps its own reference to the tdb so the database can't be closed
+ * under the thread.
+ *
+ * A hot record can be grabbed by someone else every time the thread
+ * sees it free. After LOCK_WAIT_MAX_RACES lost races the request is
+ * handed over to a lock helper, which queues in tdb_chainlock().
+ */
+#define LOCK_WAIT_MAX_RACES 3
+
+struct lock_wait_state {
+	struct ctdb_context *ctdb;
+	struct lock_context *lock_ctx;
+	struct tdb_wrap *ltdb;
+	TDB_DATA key;
+	unsigned int races;
+	int err;
+};
+
+static void ctdb_lock_wait_done(struct tevent_req *subreq);
+
+/* Runs in a helper thread, don't touch anything but state */
+static void ctdb_lock_wait_job(void *private_data)
+{
+	struct lock_wait_state *state = private_data;
+	int ret;
+
+	ret = tdb_chainlock_wait(state->ltdb->tdb, state->key);
+	state->err = (ret == 0) ? 0 : errno;
+}
+
+static bool ctdb_lock_wait_send(struct lock_wait_state *state)
+{
+	struct tevent_req *subreq;
+
+	subreq = pthreadpool_tevent_job_send(state,
+					     state->ctdb->ev,
+					     state->ctdb->lock_wait_pool,
+					     ctdb_lock_wait_job,
+					     state);
+	if (subreq == NULL) {
+		return false;
+	}
+	tevent_req_set_callback(subreq, ctdb_lock_wait_done, state);
+
+	return true;
+}
+
+/*
+ * Try to wait for a record lock in a thread instead of a lock helper
+ */
+static bool ctdb_lock_wait_start(struct lock_context *lock_ctx)
+{
+	struct ctdb_context *ctdb = lock_ctx->ctdb;
+	struct ctdb_db_context *ctdb_db = lock_ctx->ctdb_db;
+	struct lock_wait_state *state;
+	int ret;
+
+	/*
+	 * Database locks are held for a long time by the helper, and
+	 * without auto_mark the caller expects the lock to stay
+	 * around after the callback.
+	 */
+	if (lock_ctx->type != LOCK_RECORD || !lock_ctx->auto_mark) {
+		return false;
+	}
+	if (ctdb_db->lock_wait_disabled) {
+		return false;
+	}
+
+	/*
+	 * A blocked thread must not hold up locks for other records,
+	 * so don't queue in the pool but fall back to a helper.
+	 */
+	if (ctdb->lock_wait_num_busy >= ctdb_config.lock_wait_threads) {
+		return false;
+	}
+
+	if (ctdb->lock_wait_pool == NULL) {
+		ret = pthreadpool_tevent_init(ctdb,
+					      ctdb_config.lock_wait_threads,
+					      &ctdb->lock_wait_pool);
+		if (ret != 0) {
+			D_ERR("Failed to create lock wait threads: %s\n",
+			      strerror(ret));
+			return false;
+		}
+	}
+
+	state = talloc_zero(ctdb, struct lock_wait_state);
+	if (state == NULL) {
+		return false;
+	}
+	state->ctdb = ctdb;
+	state->lock_ctx = lock_ctx;
+
+	state->key.dsize = lock_ctx->key.dsize;
+	state->key.dptr = talloc_memdup(state,
+					lock_ctx->key.dptr,
+					lock_ctx->key.dsize);
+	if (state->key.dptr == NULL) {
+		talloc_free(state);
+		return false;
+	}
+
+	/* This just references the tdb opened in ctdb_local_attach() */
+	state->ltdb = tdb_wrap_open(state, ctdb_db->db_path, 0, 0, O_RDWR, 0);
+	if (state->ltdb == NULL) {
+		talloc_free(state);
+		return false;
+	}
+
+	if (!ctdb_lock_wait_send(state)) {
+		talloc_free(state);
+		return false;
+	}
+
+	ctdb->lock_wait_num_busy += 1;
+	lock_ctx->wait = state;
+	lock_ctx->in_process = true;
+
+	return true;
+}
+
+/*
+ * Give up waiting in process, let a lock helper take the record lock
+ */
+static void ctdb_lock_wait_fallback(struct lock_context *lock_ctx)
+{
+	CTDB_INCREMENT_STAT(lock_ctx->ctdb, locks.num_wait_fallbacks);
+
+	TALLOC_FREE(lock_ctx->ttimer);
+	lock_ctx->in_process = false;
+
+	if (!ctdb_lock_helper_start(lock_ctx)) {
+		/* Still current, the destructor has to know */
+		lock_ctx->in_process = true;
+		ctdb_lock_done(lock_ctx, false);
+	}
+}
+
+/*
+ * The lock context goes away, let the thread finish on its own
+ */
+static void ctdb_lock_wait_cancel(struct lock_context *lock_ctx)
+{
+	if (lock_ctx->wait != NULL) {
+		lock_ctx->wait->lock_ctx = NULL;
+		lock_ctx->wait = NULL;
+	}
+}
+
+static void ctdb_lock_wait_done(struct tevent_req *subreq)
+{
+	struct lock_wait_state *state = tevent_req_callback_data(
+		subreq, struct lock_wait_state);
+	struct ctdb_context *ctdb = state->ctdb;
+	struct lock_context *lock_ctx = state->lock_ctx;
+	struct ctdb_db_context *ctdb_db;
+	bool locked = false;
+	bool fallback = false;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+	if (ret == 0) {
+		ret = state->err;
+	}
+
+	if (lock_ctx == NULL) {
+		/* Nobody is interested anymore */
+		ctdb->lock_wait_num_busy -= 1;
+		talloc_free(state);
+		return;
+	}
+	ctdb_db = lock_ctx->ctdb_db;
+
+	if (ret != 0) {
+		D_WARNING("Waiting for record lock on database %s failed "
+			  "(%s), using lock helper instead\n",
+			  ctdb_db->db_name,
+			  strerror(ret));
+		ctdb_db->lock_wait_disabled = true;
+		fallback = true;
+		goto done;
+	}
+
+	ret = tdb_chainlock_nonblock(ctdb_db->ltdb->tdb, lock_ctx->key);
+	if (ret == 0) {
+		locked = true;
+		goto done;
+	}
+	if (errno == EACCES || errno == EAGAIN || errno == EDEADLK) {
+		/* Someone else got the lock first */
+		state->races += 1;
+		if (state->races >= LOCK_WAIT_MAX_RACES) {
+			fallback = true;
+			goto done;
+		}
+		if (ctdb_lock_wait_send(state)) {
+			return;
+		}
+	}
+
+done:
+	ctdb->lock_wait_num_busy -= 1;
+	lock_ctx->wait = NULL;
+	talloc_free(state);
+
+	if (fallback) {
+		ctdb_lock_wait_fallback(lock_ctx);
+		return;
+	}
+
+	ctdb_lock_done(lock_ctx, locked);
+}
+
+#else
+
+static bool ctdb_lock_wait_start(struct lock_context *lock_ctx)
+{
+	return false;
+}
+
+static void ctdb_lock_wait_cancel(struct lock_context *lock_ctx)
+{
+	return;
+}
+
+#endif /* WITH_PTHREADPOOL */
+
 static bool lock_helper_args(TALLOC_CTX *mem_ctx,
 			     struct lock_context *lock_ctx, int fd,
 			     int *argc, const char ***argv)
@@ -695,12 +976,33 @@ static struct lock_context *ctdb_find_lock_context(struct ctdb_context *ctdb)
 }
 
 /*
- * Schedule a new lock child process
+ * Move a lock context from pending to current
+ */
+static void ctdb_lock_set_current(struct lock_context *lock_ctx)
+{
+	struct ctdb_context *ctdb = lock_ctx->ctdb;
+
+	if (lock_ctx->type == LOCK_RECORD) {
+		DLIST_REMOVE(lock_ctx->ctdb_db->lock_pending, lock_ctx);
+		DLIST_ADD_END(lock_ctx->ctdb_db->lock_current, lock_ctx);
+	} else {
+		DLIST_REMOVE(ctdb->lock_pending, lock_ctx);
+		DLIST_ADD_END(ctdb->lock_current, lock_ctx);
+	}
+	CTDB_DECREMENT_STAT(lock_ctx->ctdb, locks.num_pending);
+	CTDB_INCREMENT_STAT(lock_ctx->ctdb, locks.num_current);
+	lock_ctx->ctdb_db->lock_num_current++;
+	CTDB_DECREMENT_DB_STAT(lock_ctx->ctdb_db, locks.num_pending);
+	CTDB_INCREMENT_DB_STAT(lock_ctx->ctdb_db, locks.num_current);
+}
+
+/*
+ * Start a lock child process for a lock context
  * Set up callback handler and timeout handler
  */
-static void ctdb_lock_schedule(struct ctdb_context *ctdb)
+static bool ctdb_lock_helper_start(struct lock_context *lock_ctx)
 {
-	struct lock_context *lock_ctx;
+	struct ctdb_context *ctdb = lock_ctx->ctdb;
 	int ret, argc;
 	TALLOC_CTX *tmp_ctx;
 	static char prog[PATH_MAX+1] = "";
@@ -714,17 +1016,11 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 			 " Unable to set lock helper\n");
 	}
 
-	/* Find a lock context with requests */
-	lock_ctx = ctdb_find_lock_context(ctdb);
-	if (lock_ctx == NULL) {
-		return;
-	}
-
 	lock_ctx->child = -1;
 	ret = pipe(lock_ctx->fd);
 	if (ret != 0) {
 		DEBUG(DEBUG_ERR, ("Failed to create pipe in ctdb_lock_schedule\n"));
-		return;
+		return false;
 	}
 
 	set_close_on_exec(lock_ctx->fd[0]);
@@ -735,7 +1031,7 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 		DEBUG(DEBUG_ERR, ("Failed to allocate memory for helper args\n"));
 		close(lock_ctx->fd[0]);
 		close(lock_ctx->fd[1]);
-		return;
+		return false;
 	}
 
 	if (! ctdb->do_setsched) {
@@ -753,7 +1049,7 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 		close(lock_ctx->fd[0]);
 		close(lock_ctx->fd[1]);
 		talloc_free(tmp_ctx);
-		return;
+		return false;
 	}
 
 	lock_ctx->child = ctdb_vfork_exec(lock_ctx, ctdb, prog, argc,
@@ -763,7 +1059,7 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 		close(lock_ctx->fd[0]);
 		close(lock_ctx->fd[1]);
 		talloc_free(tmp_ctx);
-		return;
+		return false;
 	}
 
 	/* Parent process */
@@ -781,7 +1077,7 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 		ctdb_kill(ctdb, lock_ctx->child, SIGTERM);
 		lock_ctx->child = -1;
 		close(lock_ctx->fd[0]);
-		return;
+		return false;
 	}
 
 	/* Set up callback */
@@ -796,23 +1092,46 @@ static void ctdb_lock_schedule(struct ctdb_context *ctdb)
 		ctdb_kill(ctdb, lock_ctx->child, SIGTERM);
 		lock_ctx->child = -1;
 		close(lock_ctx->fd[0]);
-		return;
+		return false;
 	}
 	tevent_fd_set_auto_close(lock_ctx->tfd);
 
-	/* Move the context from pending to current */
-	if (lock_ctx->type == LOCK_RECORD) {
-		DLIST_REMOVE(lock_ctx->ctdb_db->lock_pending, lock_ctx);
-		DLIST_ADD_END(lock_ctx->ctdb_db->lock_current, lock_ctx);
-	} else {
-		DLIST_REMOVE(ctdb->lock_pending, lock_ctx);
-		DLIST_ADD_END(ctdb->lock_current, lock_ctx);
+	return true;
+}
+
+/*
+ * Schedule a new lock child process
+ */
+static void ctdb_lock_schedule(struct ctdb_context *ctdb)
+{
+	struct lock_context *lock_ctx;
+
+	/* Find a lock context with requests */
+	lock_ctx = ctdb_find_lock_context(ctdb);
+	if (lock_ctx == NULL) {
+		return;
 	}
-	CTDB_DECREMENT_STAT(lock_ctx->ctdb, locks.num_pending);
-	CTDB_INCREMENT_STAT(lock_ctx->ctdb, locks.num_current);
-	lock_ctx->ctdb_db->lock_num_current++;
-	CTDB_DECREMENT_DB_STAT(lock_ctx->ctdb_db, locks.num_pending);
-	CTDB_INCREMENT_DB_STAT(lock_ctx->ctdb_db, locks.num_current);
+
+	if (ctdb_lock_wait_start(lock_ctx)) {
+		lock_ctx->ttimer = tevent_add_timer(ctdb->ev,
+						    lock_ctx,
+						    timeval_current_ofs(10, 0),
+						    ctdb_lock_timeout_handler,
+						    (void *)lock_ctx);
+		if (lock_ctx->ttimer == NULL) {
+			ctdb_lock_wait_cancel(lock_ctx);
+			lock_ctx->in_process = false;
+			return;
+		}
+		ctdb_lock_set_current(lock_ctx);
+		return;
+	}
+
+	if (!ctdb_lock_helper_start(lock_ctx)) {
+		return;
+	}
+
+	ctdb_lock_set_current(lock_ctx);
 }
 
 
@@ -699,20 +699,18 @@ int32_t ctdb_control_db_get_health(struct ctdb_context *ctdb,
 }
 
 
-int ctdb_set_db_readonly(struct ctdb_context *ctdb, struct ctdb_db_context *ctdb_db)
+/*
+  open the tracking database used for readonly delegations
+ */
+int ctdb_open_tracking_db(struct ctdb_context *ctdb,
+			  struct ctdb_db_context *ctdb_db)
 {
 	char *ropath;
 
-	if (ctdb_db_readonly(ctdb_db)) {
+	if (ctdb_db->rottdb != NULL) {
 		return 0;
 	}
 
-	if (! ctdb_db_volatile(ctdb_db)) {
-		DEBUG(DEBUG_ERR,
-		      ("Non-volatile databases do not support readonly flag\n"));
-		return -1;
-	}
-
 	ropath = talloc_asprintf(ctdb_db, "%s.RO", ctdb_db->db_path);
 	if (ropath == NULL) {
 		DEBUG(DEBUG_CRIT,("Failed to asprintf the tracking database\n"));
@@ -730,11 +728,30 @@ int ctdb_set_db_readonly(struct ctdb_context *ctdb, struct ctdb_db_context *ctdb
 
 	DEBUG(DEBUG_NOTICE,("OPENED tracking database : '%s'\n", ropath));
 
+	talloc_free(ropath);
+	return 0;
+}
+
+int ctdb_set_db_readonly(struct ctdb_context *ctdb, struct ctdb_db_context *ctdb_db)
+{
+	if (ctdb_db_readonly(ctdb_db)) {
+		return 0;
+	}
+
+	if (! ctdb_db_volatile(ctdb_db)) {
+		DEBUG(DEBUG_ERR,
+		      ("Non-volatile databases do not support readonly flag\n"));
+		return -1;
+	}
+
+	if (ctdb_open_tracking_db(ctdb, ctdb_db) != 0) {
+		return -1;
+	}
+
 	ctdb_db_set_readonly(ctdb_db);
 
 	DEBUG(DEBUG_NOTICE, ("Readonly property set on DB %s\n", ctdb_db->db_name));
 
-	talloc_free(ropath);
 	return 0;
 }
 
@@ -838,7 +855,8 @@ static int ctdb_local_attach(struct ctdb_context *ctdb, const char *db_name,
 
 	tdb_flags = ctdb_db_tdb_flags(db_flags,
 				      ctdb->valgrinding,
-				      ctdb_config.tdb_mutexes);
+				      ctdb_config.tdb_mutexes,
+				      ctdb_config.tdb_crc32c_hash);
 
 again:
 	ctdb_db->ltdb = tdb_wrap_open(ctdb_db, ctdb_db->db_path,
@@ -1292,8 +1310,9 @@ int32_t ctdb_control_db_detach(struct ctdb_context *ctdb, TDB_DATA indata,
 	}
 
 	/* Free readonly tracking database */
-	if (ctdb_db_readonly(ctdb_db)) {
-		talloc_free(ctdb_db->rottdb);
+	if (ctdb_db->rottdb != NULL) {
+		tdb_close(ctdb_db->rottdb);
+		ctdb_db->rottdb = NULL;
 	}
 
 	DLIST_REMOVE(ctdb->db_list, ctdb_db);
@@ -36,6 +36,9 @@
 #include "ctdb_private.h"
 #include "ctdb_client.h"
 
+#include "protocol/protocol_private.h"
+#include "protocol/protocol_util.h"
+
 #include "common/system.h"
 #include "common/common.h"
 #include "common/logging.h"
@@ -320,6 +323,9 @@ struct db_pull_state {
 	uint32_t pnn;
 	uint64_t srvid;
 	uint32_t num_records;
+	bool changed;
+	struct ctdb_pulldb_changed last;
+	uint32_t num_skipped;
 };
 
 static int traverse_db_pull(struct tdb_context *tdb, TDB_DATA key,
@@ -328,6 +334,12 @@ static int traverse_db_pull(struct tdb_context *tdb, TDB_DATA key,
 	struct db_pull_state *state = (struct db_pull_state *)private_data;
 	struct ctdb_marshall_buffer *recs;
 
+	if (state->changed &&
+	    ctdb_pulldb_changed_skip(&state->last, state->ctdb->pnn, data)) {
+		state->num_skipped += 1;
+		return 0;
+	}
+
 	recs = ctdb_marshall_add(state->ctdb, state->recs,
 				 state->ctdb_db->db_id, 0, key, NULL, data);
 	if (recs == NULL) {
@@ -356,17 +368,23 @@ static int traverse_db_pull(struct tdb_context *tdb, TDB_DATA key,
 	return 0;
 }
 
-int32_t ctdb_control_db_pull(struct ctdb_context *ctdb,
-			     struct ctdb_req_control_old *c,
-			     TDB_DATA indata, TDB_DATA *outdata)
+/*
+ * Send the records of a database to the requesting node as messages.
+ *
+ * If changed is set, records that still carry the header pushed by the
+ * last recovery are left out, unless this node was their dmaster after
+ * that recovery.  Only the dmaster can have changed such records
+ * without changing the header.
+ */
+static int db_pull(struct ctdb_context *ctdb,
+		   struct ctdb_req_control_old *c,
+		   struct ctdb_pulldb_ext *pulldb_ext,
+		   bool changed,
+		   struct db_pull_state *state)
 {
-	struct ctdb_pulldb_ext *pulldb_ext;
 	struct ctdb_db_context *ctdb_db;
-	struct db_pull_state state;
 	int ret;
 
-	pulldb_ext = (struct ctdb_pulldb_ext *)indata.dptr;
-
 	ctdb_db = find_ctdb_db(ctdb, pulldb_ext->db_id);
 	if (ctdb_db == NULL) {
 		DEBUG(DEBUG_ERR,(__location__ " Unknown db 0x%08x\n",
@@ -387,16 +405,28 @@ int32_t ctdb_control_db_pull(struct ctdb_context *ctdb,
 		       ctdb_db->db_name, ctdb_db->unhealthy_reason));
 	}
 
-	state.ctdb = ctdb;
-	state.ctdb_db = ctdb_db;
-	state.recs = NULL;
-	state.pnn = c->hdr.srcnode;
-	state.srvid = pulldb_ext->srvid;
-	state.num_records = 0;
+	state->ctdb = ctdb;
+	state->ctdb_db = ctdb_db;
+	state->recs = NULL;
+	state->pnn = c->hdr.srcnode;
+	state->srvid = pulldb_ext->srvid;
+	state->num_records = 0;
+	state->changed = changed;
+	state->num_skipped = 0;
+
+	if (ctdb_db->recovered.valid) {
+		state->last.generation = ctdb_db->recovered.generation;
+		state->last.dmaster = ctdb_db->recovered.dmaster;
+		state->last.rsn = ctdb_db->recovered.rsn;
+	} else {
+		state->last.generation = INVALID_GENERATION;
+		state->last.dmaster = CTDB_UNKNOWN_PNN;
+		state->last.rsn = 0;
+	}
 
 	/* If the records are invalid, we are done */
 	if (ctdb_db->invalid_records) {
-		goto done;
+		return 0;
 	}
 
 	if (ctdb_lockdb_mark(ctdb_db) != 0) {
@@ -405,7 +435,7 @@ int32_t ctdb_control_db_pull(struct ctdb_context *ctdb,
 		return -1;
 	}
 
-	ret = tdb_traverse_read(ctdb_db->ltdb->tdb, traverse_db_pull, &state);
+	ret = tdb_traverse_read(ctdb_db->ltdb->tdb, traverse_db_pull, state);
 	if (ret == -1) {
 		DEBUG(DEBUG_ERR,
 		      (__location__ " Failed to get traverse db '%s'\n",
@@ -415,25 +445,42 @@ int32_t ctdb_control_db_pull(struct ctdb_context *ctdb,
 	}
 
 	/* Last few records */
-	if (state.recs != NULL) {
+	if (state->recs != NULL) {
 		TDB_DATA buffer;
 
-		buffer = ctdb_marshall_finish(state.recs);
-		ret = ctdb_daemon_send_message(state.ctdb, state.pnn,
-					       state.srvid, buffer);
+		buffer = ctdb_marshall_finish(state->recs);
+		ret = ctdb_daemon_send_message(state->ctdb, state->pnn,
+					       state->srvid, buffer);
 		if (ret != 0) {
-			TALLOC_FREE(state.recs);
+			TALLOC_FREE(state->recs);
 			ctdb_lockdb_unmark(ctdb_db);
 			return -1;
 		}
 
-		state.num_records += state.recs->count;
-		TALLOC_FREE(state.recs);
+		state->num_records += state->recs->count;
+		TALLOC_FREE(state->recs);
 	}
 
 	ctdb_lockdb_unmark(ctdb_db);
 
-done:
+	return 0;
+}
+
+int32_t ctdb_control_db_pull(struct ctdb_context *ctdb,
+			     struct ctdb_req_control_old *c,
+			     TDB_DATA indata, TDB_DATA *outdata)
+{
+	struct ctdb_pulldb_ext *pulldb_ext;
+	struct db_pull_state state;
+	int ret;
+
+	pulldb_ext = (struct ctdb_pulldb_ext *)indata.dptr;
+
+	ret = db_pull(ctdb, c, pulldb_ext, false, &state);
+	if (ret != 0) {
+		return -1;
+	}
+
 	outdata->dptr = talloc_size(outdata, sizeof(uint32_t));
 	if (outdata->dptr == NULL) {
 		DEBUG(DEBUG_ERR, (__location__ " Memory allocation error\n"));
@@ -446,6 +493,43 @@ done:
 	return 0;
 }
 
+int32_t ctdb_control_db_pull_changed(struct ctdb_context *ctdb,
+				     struct ctdb_req_control_old *c,
+				     TDB_DATA indata, TDB_DATA *outdata)
+{
+	struct ctdb_pulldb_ext *pulldb_ext;
+	struct db_pull_state state;
+	struct ctdb_pulldb_changed changed;
+	size_t np;
+	int ret;
+
+	pulldb_ext = (struct ctdb_pulldb_ext *)indata.dptr;
+
+	ret = db_pull(ctdb, c, pulldb_ext, true, &state);
+	if (ret != 0) {
+		return -1;
+	}
+
+	changed = state.last;
+	changed.num_records = state.num_records;
+	changed.num_skipped = state.num_skipped;
+
+	DEBUG(DEBUG_INFO, ("Pulled %u records of db %s, skipped %u\n",
+			   changed.num_records, state.ctdb_db->db_name,
+			   changed.num_skipped));
+
+	outdata->dsize = ctdb_pulldb_changed_len(&changed);
+	outdata->dptr = talloc_size(outdata, outdata->dsize);
+	if (outdata->dptr == NULL) {
+		DEBUG(DEBUG_ERR, (__location__ " Memory allocation error\n"));
+		return -1;
+	}
+
+	ctdb_pulldb_changed_push(&changed, outdata->dptr, &np);
+
+	return 0;
+}
+
 /*
   push a bunch of records into a ltdb, filtering by rsn
  */
@@ -479,6 +563,9 @@ int32_t ctdb_control_push_db(struct ctdb_context *ctdb, TDB_DATA indata)
 		return -1;
 	}
 
+	/* Records pushed this way are not tracked */
+	ctdb_db->recovered_pending.valid = false;
+
 	rec = (struct ctdb_rec_data_old *)&reply->data[0];
 
 	DEBUG(DEBUG_INFO,("starting push of %u records for dbid 0x%x\n",
@@ -518,7 +605,7 @@ int32_t ctdb_control_push_db(struct ctdb_context *ctdb, TDB_DATA indata)
 	DEBUG(DEBUG_DEBUG,("finished push of %u records for dbid 0x%x\n",
 		 reply->count, reply->db_id));
 
-	if (ctdb_db_readonly(ctdb_db)) {
+	if (ctdb_db->rottdb != NULL) {
 		DEBUG(DEBUG_CRIT,("Clearing the tracking database for dbid 0x%x\n",
 				  ctdb_db->db_id));
 		if (tdb_wipe_all(ctdb_db->rottdb) != 0) {
@@ -546,6 +633,10 @@ struct db_push_state {
 	uint64_t srvid;
 	uint32_t num_records;
 	bool failed;
+	/* header shared by all pushed records, if any */
+	bool mixed;
+	uint64_t rsn;
+	uint32_t dmaster;
 };
 
 static void db_push_msg_handler(uint64_t srvid, TDB_DATA indata,
@@ -588,6 +679,15 @@ static void db_push_msg_handler(uint64_t srvid, TDB_DATA indata,
 		 */
 		hdr->flags &= ~CTDB_REC_RO_FLAGS;
 
+		/* Storing may update the header, so look at it first */
+		if (state->num_records == 0 && i == 0) {
+			state->rsn = hdr->rsn;
+			state->dmaster = hdr->dmaster;
+		} else if (hdr->rsn != state->rsn ||
+			   hdr->dmaster != state->dmaster) {
+			state->mixed = true;
+		}
+
 		data.dptr += sizeof(*hdr);
 		data.dsize -= sizeof(*hdr);
 
@@ -657,6 +757,9 @@ int32_t ctdb_control_db_push_start(struct ctdb_context *ctdb, TDB_DATA indata)
 	state->ctdb_db = ctdb_db;
 	state->srvid = pulldb_ext->srvid;
 	state->failed = false;
+	state->mixed = false;
+
+	ctdb_db->recovered_pending.valid = false;
 
 	ret = srvid_register(ctdb->srv, state, state->srvid,
 			     db_push_msg_handler, state);
@@ -707,7 +810,7 @@ int32_t ctdb_control_db_push_confirm(struct ctdb_context *ctdb,
 		return -1;
 	}
 
-	if (ctdb_db_readonly(ctdb_db)) {
+	if (ctdb_db->rottdb != NULL) {
 		DEBUG(DEBUG_ERR,
 		      ("Clearing the tracking database for dbid 0x%x\n",
 		       ctdb_db->db_id));
@@ -747,6 +850,17 @@ int32_t ctdb_control_db_push_confirm(struct ctdb_context *ctdb,
 	memcpy(outdata->dptr, (uint8_t *)&state->num_records, sizeof(uint32_t));
 	outdata->dsize = sizeof(uint32_t);
 
+	/*
+	 * If all records were pushed with the same header, remember it.
+	 * It is used once the recovery transaction is committed.
+	 */
+	if (ctdb_db_volatile(ctdb_db) &&
+	    !state->failed && !state->mixed && state->num_records > 0) {
+		ctdb_db->recovered_pending.valid = true;
+		ctdb_db->recovered_pending.dmaster = state->dmaster;
+		ctdb_db->recovered_pending.rsn = state->rsn;
+	}
+
 	talloc_free(state);
 	ctdb_db->push_started = false;
 	ctdb_db->push_state = NULL;
@@ -35,6 +35,7 @@
 
 #include "protocol/protocol.h"
 #include "protocol/protocol_api.h"
+#include "protocol/protocol_util.h"
 #include "client/client.h"
 
 #include "common/logging.h"
@@ -448,6 +449,8 @@ struct recdb_context {
 	const char *db_path;
 	struct tdb_wrap *db;
 	bool persistent;
+	uint64_t max_rsn;
+	uint64_t rsn;
 };
 
 static struct recdb_context *recdb_create(TALLOC_CTX *mem_ctx, uint32_t db_id,
@@ -491,6 +494,8 @@ static struct recdb_context *recdb_create(TALLOC_CTX *mem_ctx, uint32_t db_id,
 	}
 
 	recdb->persistent = persistent;
+	recdb->max_rsn = 0;
+	recdb->rsn = 0;
 
 	return recdb;
 }
@@ -520,6 +525,15 @@ static bool recdb_persistent(struct recdb_context *recdb)
 	return recdb->persistent;
 }
 
+/*
+ * Push all records with the same rsn, higher than any collected rsn.
+ * Nodes can then tell which records have not changed since.
+ */
+static void recdb_set_rsn(struct recdb_context *recdb)
+{
+	recdb->rsn = recdb->max_rsn + 1;
+}
+
 struct recdb_add_traverse_state {
 	struct recdb_context *recdb;
 	uint32_t mypnn;
@@ -542,6 +556,10 @@ static int recdb_add_traverse(uint32_t reqid, struct ctdb_ltdb_header *header,
 
 	hdr = (struct ctdb_ltdb_header *)data.dptr;
 
+	if (hdr->rsn > state->recdb->max_rsn) {
+		state->recdb->max_rsn = hdr->rsn;
+	}
+
 	/* fetch the existing record, if any */
 	prev_data = tdb_fetch(recdb_tdb(state->recdb), key);
 
@@ -583,7 +601,7 @@ static bool recdb_add(struct recdb_context *recdb, int mypnn,
 
 /* This function decides which records from recdb are retained */
 static int recbuf_filter_add(struct ctdb_rec_buffer *recbuf, bool persistent,
-			     uint32_t reqid, uint32_t dmaster,
+			     uint32_t reqid, uint32_t dmaster, uint64_t rsn,
 			     TDB_DATA key, TDB_DATA data)
 {
 	struct ctdb_ltdb_header *header;
@@ -599,6 +617,9 @@ static int recbuf_filter_add(struct ctdb_rec_buffer *recbuf, bool persistent,
 	if (!persistent) {
 		header->dmaster = dmaster;
 		header->flags |= CTDB_REC_FLAG_MIGRATED_WITH_DATA;
+		if (rsn != 0) {
+			header->rsn = rsn;
+		}
 	}
 
 	ret = ctdb_rec_buffer_add(recbuf, recbuf, reqid, NULL, key, data);
@@ -612,6 +633,7 @@ static int recbuf_filter_add(struct ctdb_rec_buffer *recbuf, bool persistent,
 struct recdb_records_traverse_state {
 	struct ctdb_rec_buffer *recbuf;
 	uint32_t dmaster;
+	uint64_t rsn;
 	uint32_t reqid;
 	bool persistent;
 	bool failed;
@@ -626,7 +648,8 @@ static int recdb_records_traverse(struct tdb_context *tdb,
 	int ret;
 
 	ret = recbuf_filter_add(state->recbuf, state->persistent,
-				state->reqid, state->dmaster, key, data);
+				state->reqid, state->dmaster, state->rsn,
+				key, data);
 	if (ret != 0) {
 		state->failed = true;
 		return ret;
@@ -647,6 +670,7 @@ static struct ctdb_rec_buffer *recdb_records(struct recdb_context *recdb,
 		return NULL;
 	}
 	state.dmaster = dmaster;
+	state.rsn = recdb->rsn;
 	state.reqid = 0;
 	state.persistent = recdb_persistent(recdb);
 	state.failed = false;
@@ -668,6 +692,7 @@ struct recdb_file_traverse_state {
 	struct recdb_context *recdb;
 	TALLOC_CTX *mem_ctx;
 	uint32_t dmaster;
+	uint64_t rsn;
 	uint32_t reqid;
 	bool persistent;
 	bool failed;
@@ -685,7 +710,8 @@ static int recdb_file_traverse(struct tdb_context *tdb,
 	int ret;
 
 	ret = recbuf_filter_add(state->recbuf, state->persistent,
-				state->reqid, state->dmaster, key, data);
+				state->reqid, state->dmaster, state->rsn,
+				key, data);
 	if (ret != 0) {
 		state->failed = true;
 		return ret;
@@ -727,6 +753,7 @@ static int recdb_file(struct recdb_context *recdb, TALLOC_CTX *mem_ctx,
 	state.recdb = recdb;
 	state.mem_ctx = mem_ctx;
 	state.dmaster = dmaster;
+	state.rsn = recdb->rsn;
 	state.reqid = 0;
 	state.persistent = recdb_persistent(recdb);
 	state.failed = false;
@@ -757,6 +784,9 @@ static int recdb_file(struct recdb_context *recdb, TALLOC_CTX *mem_ctx,
 
 /*
  * Pull database from a single node
+ *
+ * If changed is set, only pull the records changed since the last
+ * recovery.  The node must have CTDB_CAP_PULL_CHANGED.
  */
 
 struct pull_database_state {
@@ -765,7 +795,9 @@ struct pull_database_state {
 	struct recdb_context *recdb;
 	uint32_t pnn;
 	uint64_t srvid;
+	bool changed;
 	unsigned int num_records;
+	struct ctdb_pulldb_changed pulled;
 	int result;
 };
 
@@ -781,7 +813,8 @@ static struct tevent_req *pull_database_send(
 			struct tevent_context *ev,
 			struct ctdb_client_context *client,
 			uint32_t pnn, uint32_t caps,
-			struct recdb_context *recdb)
+			struct recdb_context *recdb,
+			bool changed)
 {
 	struct tevent_req *req, *subreq;
 	struct pull_database_state *state;
@@ -797,6 +830,13 @@ static struct tevent_req *pull_database_send(
 	state->recdb = recdb;
 	state->pnn = pnn;
 	state->srvid = srvid_next();
+	state->changed = changed;
+
+	state->pulled.num_records = 0;
+	state->pulled.num_skipped = 0;
+	state->pulled.generation = INVALID_GENERATION;
+	state->pulled.dmaster = CTDB_UNKNOWN_PNN;
+	state->pulled.rsn = 0;
 
 	if (caps & CTDB_CAP_FRAGMENTED_CONTROLS) {
 		subreq = ctdb_client_set_message_handler_send(
@@ -896,7 +936,11 @@ static void pull_database_register_done(struct tevent_req *subreq)
 	pulldb_ext.lmaster = CTDB_LMASTER_ANY;
 	pulldb_ext.srvid = state->srvid;
 
-	ctdb_req_control_db_pull(&request, &pulldb_ext);
+	if (state->changed) {
+		ctdb_req_control_db_pull_changed(&request, &pulldb_ext);
+	} else {
+		ctdb_req_control_db_pull(&request, &pulldb_ext);
+	}
 	subreq = ctdb_client_control_send(state, state->ev, state->client,
 					  state->pnn, TIMEOUT(), &request);
 	if (tevent_req_nomem(subreq, req)) {
@@ -956,6 +1000,7 @@ static void pull_database_new_done(struct tevent_req *subreq)
 	struct pull_database_state *state = tevent_req_data(
 		req, struct pull_database_state);
 	struct ctdb_reply_control *reply;
+	struct ctdb_pulldb_changed *pulled;
 	uint32_t num_records;
 	int ret;
 	bool status;
@@ -969,8 +1014,23 @@ static void pull_database_new_done(struct tevent_req *subreq)
 		goto unregister;
 	}
 
-	ret = ctdb_reply_control_db_pull(reply, &num_records);
+	if (state->changed) {
+		ret = ctdb_reply_control_db_pull_changed(reply, state,
+							 &pulled);
+		if (ret == 0) {
+			state->pulled = *pulled;
+			num_records = pulled->num_records;
+		}
+	} else {
+		ret = ctdb_reply_control_db_pull(reply, &num_records);
+	}
 	talloc_free(reply);
+	if (ret != 0) {
+		D_ERR("control DB_PULL failed for %s on node %u, ret=%d\n",
+		      recdb_name(state->recdb), state->pnn, ret);
+		state->result = ret;
+		goto unregister;
+	}
 	if (num_records != state->num_records) {
 		D_ERR("mismatch (%u != %u) in DB_PULL records for db %s\n",
 		      num_records, state->num_records,
@@ -979,8 +1039,9 @@ static void pull_database_new_done(struct tevent_req *subreq)
 		goto unregister;
 	}
 
-	D_INFO("Pulled %d records for db %s from node %d\n",
-	       state->num_records, recdb_name(state->recdb), state->pnn);
+	D_INFO("Pulled %d records for db %s from node %d, skipped %u\n",
+	       state->num_records, recdb_name(state->recdb), state->pnn,
+	       state->pulled.num_skipped);
 
 unregister:
 
@@ -1019,9 +1080,21 @@ static void pull_database_unregister_done(struct tevent_req *subreq)
 	tevent_req_done(req);
 }
 
-static bool pull_database_recv(struct tevent_req *req, int *perr)
+static bool pull_database_recv(struct tevent_req *req, int *perr,
+			       struct ctdb_pulldb_changed *pulled)
 {
-	return generic_recv(req, perr);
+	struct pull_database_state *state = tevent_req_data(
+		req, struct pull_database_state);
+
+	if (! generic_recv(req, perr)) {
+		return false;
+	}
+
+	if (pulled != NULL) {
+		*pulled = state->pulled;
+		pulled->num_records = state->num_records;
+	}
+	return true;
 }
 
 /*
@@ -1668,7 +1741,8 @@ static void collect_highseqnum_db_seqnum_done(struct tevent_req *subreq)
 				    state->client,
 				    state->max_pnn,
 				    max_caps,
-				    state->recdb);
+				    state->recdb,
+				    false);
 	if (tevent_req_nomem(subreq, req)) {
 		return;
 	}
@@ -1685,7 +1759,7 @@ static void collect_highseqnum_db_pulldb_done(struct tevent_req *subreq)
 	int ret;
 	bool status;
 
-	status = pull_database_recv(subreq, &ret);
+	status = pull_database_recv(subreq, &ret, NULL);
 	TALLOC_FREE(subreq);
 	if (! status) {
 		node_list_ban_credits(state->nlist, state->max_pnn);
@@ -1703,6 +1777,16 @@ static bool collect_highseqnum_db_recv(struct tevent_req *req, int *perr)
 
 /*
  * Collect all databases
+ *
+ * Pull from all nodes in parallel.  If changed is set, nodes that
+ * support it only send the records changed since the last recovery.
+ *
+ * A node skips records that still carry the header pushed by the last
+ * recovery.  Only the node that was made dmaster by that recovery can
+ * change such records without changing the header, and it never skips
+ * records.  So the skipped records are only safe to leave out if that
+ * node takes part in this recovery and reports the same last recovery.
+ * Otherwise pull again all the records from the node.
  */
 
 struct collect_all_db_state {
@@ -1712,10 +1796,24 @@ struct collect_all_db_state {
 	uint32_t db_id;
 	struct recdb_context *recdb;
 
-	struct ctdb_pulldb pulldb;
+	struct ctdb_pulldb_changed *pulled;
+	unsigned int num_pulls;
+	unsigned int num_replies;
+	bool repull;
+	int result;
+
+	unsigned int num_records;
+	unsigned int num_skipped;
+	unsigned int num_repulled;
+};
+
+struct collect_all_db_one_state {
+	struct tevent_req *req;
 	unsigned int index;
 };
 
+static bool collect_all_db_pull(struct tevent_req *req, unsigned int index,
+				bool changed);
 static void collect_all_db_pulldb_done(struct tevent_req *subreq);
 
 static struct tevent_req *collect_all_db_send(
@@ -1724,10 +1822,12 @@ static struct tevent_req *collect_all_db_send(
 			struct ctdb_client_context *client,
 			struct node_list *nlist,
 			uint32_t db_id,
-			struct recdb_context *recdb)
+			struct recdb_context *recdb,
+			bool changed)
 {
-	struct tevent_req *req, *subreq;
+	struct tevent_req *req;
 	struct collect_all_db_state *state;
+	unsigned int i;
 
 	req = tevent_req_create(mem_ctx, &state,
 				struct collect_all_db_state);
@@ -1740,61 +1840,148 @@ static struct tevent_req *collect_all_db_send(
 	state->nlist = nlist;
 	state->db_id = db_id;
 	state->recdb = recdb;
-	state->index = 0;
 
-	subreq = pull_database_send(state,
-				    ev,
-				    client,
-				    nlist->pnn_list[state->index],
-				    nlist->caps[state->index],
-				    recdb);
-	if (tevent_req_nomem(subreq, req)) {
+	state->pulled = talloc_zero_array(state, struct ctdb_pulldb_changed,
+					  nlist->count);
+	if (tevent_req_nomem(state->pulled, req)) {
 		return tevent_req_post(req, ev);
 	}
-	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, req);
+
+	for (i=0; i<nlist->count; i++) {
+		bool ok;
+
+		ok = collect_all_db_pull(
+			req, i,
+			changed && (nlist->caps[i] & CTDB_CAP_PULL_CHANGED));
+		if (! ok) {
+			return tevent_req_post(req, ev);
+		}
+	}
 
 	return req;
 }
 
+static bool collect_all_db_pull(struct tevent_req *req, unsigned int index,
+				bool changed)
+{
+	struct collect_all_db_state *state = tevent_req_data(
+		req, struct collect_all_db_state);
+	struct collect_all_db_one_state *substate;
+	struct tevent_req *subreq;
+
+	substate = talloc_zero(state, struct collect_all_db_one_state);
+	if (tevent_req_nomem(substate, req)) {
+		return false;
+	}
+
+	substate->req = req;
+	substate->index = index;
+
+	subreq = pull_database_send(substate,
+				    state->ev,
+				    state->client,
+				    state->nlist->pnn_list[index],
+				    state->nlist->caps[index],
+				    state->recdb,
+				    changed);
+	if (tevent_req_nomem(subreq, req)) {
+		return false;
+	}
+	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, substate);
+
+	state->num_pulls += 1;
+	return true;
+}
+
 static void collect_all_db_pulldb_done(struct tevent_req *subreq)
 {
-	struct tevent_req *req = tevent_req_callback_data(
-		subreq, struct tevent_req);
+	struct collect_all_db_one_state *substate = tevent_req_callback_data(
+		subreq, struct collect_all_db_one_state);
+	struct tevent_req *req = substate->req;
 	struct collect_all_db_state *state = tevent_req_data(
 		req, struct collect_all_db_state);
+	unsigned int index = substate->index;
+	unsigned int i;
 	int ret;
 	bool status;
 
-	status = pull_database_recv(subreq, &ret);
+	status = pull_database_recv(subreq, &ret, &state->pulled[index]);
 	TALLOC_FREE(subreq);
+	talloc_free(substate);
 	if (! status) {
 		node_list_ban_credits(state->nlist,
-				      state->nlist->pnn_list[state->index]);
-		tevent_req_error(req, ret);
+				      state->nlist->pnn_list[index]);
+		if (state->result == 0) {
+			state->result = ret;
+		}
+	} else {
+		state->num_records += state->pulled[index].num_records;
+	}
+
+	/*
+	 * Wait for all the pulls to finish, they are still receiving
+	 * records into recdb
+	 */
+	state->num_replies += 1;
+	if (state->num_replies < state->num_pulls) {
 		return;
 	}
 
-	state->index += 1;
-	if (state->index == state->nlist->count) {
-		tevent_req_done(req);
+	if (state->result != 0) {
+		tevent_req_error(req, state->result);
 		return;
 	}
 
-	subreq = pull_database_send(state,
-				    state->ev,
-				    state->client,
-				    state->nlist->pnn_list[state->index],
-				    state->nlist->caps[state->index],
-				    state->recdb);
-	if (tevent_req_nomem(subreq, req)) {
+	if (state->repull) {
+		tevent_req_done(req);
 		return;
 	}
-	tevent_req_set_callback(subreq, collect_all_db_pulldb_done, req);
+
+	state->repull = true;
+	state->num_pulls = 0;
+	state->num_replies = 0;
+
+	for (i=0; i<state->nlist->count; i++) {
+		if (ctdb_pulldb_changed_confirmed(state->pulled,
+						  state->nlist->pnn_list,
+						  state->nlist->count, i)) {
+			state->num_skipped += state->pulled[i].num_skipped;
+			continue;
+		}
+
+		D_NOTICE("Pull db %s again from node %u, "
+			 "skipped records not confirmed by node %u\n",
+			 recdb_name(state->recdb),
+			 state->nlist->pnn_list[i],
+			 state->pulled[i].dmaster);
+
+		if (! collect_all_db_pull(req, i, false)) {
+			return;
+		}
+		state->num_repulled += 1;
+	}
+
+	if (state->num_pulls == 0) {
+		tevent_req_done(req);
+	}
 }
 
-static bool collect_all_db_recv(struct tevent_req *req, int *perr)
+static bool collect_all_db_recv(struct tevent_req *req, int *perr,
+				unsigned int *num_records,
+				unsigned int *num_skipped,
+				unsigned int *num_repulled)
 {
-	return generic_recv(req, perr);
+	struct collect_all_db_state *state = tevent_req_data(
+		req, struct collect_all_db_state);
+
+	if (! generic_recv(req, perr)) {
+		return false;
+	}
+
+	*num_records = state->num_records;
+	*num_skipped = state->num_skipped;
+	*num_repulled = state->num_repulled;
+	return true;
 }
 
 
@@ -1810,8 +1997,20 @@ static bool collect_all_db_recv(struct tevent_req *req, int *perr)
  *  - Push database to all nodes
  *  - Commit transaction on all nodes
  *  - Thaw database on all nodes
+ *
+ * The time taken by each step from freezing onwards is logged.
  */
 
+struct recover_db_timing {
+	double freeze;
+	double transaction;
+	double collect;
+	double wipe;
+	double push;
+	double commit;
+	double thaw;
+};
+
 struct recover_db_state {
 	struct tevent_context *ev;
 	struct ctdb_client_context *client;
@@ -1824,6 +2023,12 @@ struct recover_db_state {
 
 	const char *db_name, *db_path;
 	struct recdb_context *recdb;
+
+	struct timeval start, lap;
+	struct recover_db_timing timing;
+	unsigned int num_records;
+	unsigned int num_skipped;
+	unsigned int num_repulled;
 };
 
 static void recover_db_name_done(struct tevent_req *subreq);
@@ -1837,6 +2042,15 @@ static void recover_db_pushdb_done(struct tevent_req *subreq);
 static void recover_db_transaction_committed(struct tevent_req *subreq);
 static void recover_db_thaw_done(struct tevent_req *subreq);
 
+/* Time since the previous step finished */
+static double recover_db_lap(struct recover_db_state *state)
+{
+	double elapsed = timeval_elapsed(&state->lap);
+
+	state->lap = timeval_current();
+	return elapsed;
+}
+
 static struct tevent_req *recover_db_send(TALLOC_CTX *mem_ctx,
 					  struct tevent_context *ev,
 					  struct ctdb_client_context *client,
@@ -1863,6 +2077,7 @@ static struct tevent_req *recover_db_send(TALLOC_CTX *mem_ctx,
 	state->destnode = ctdb_client_pnn(client);
 	state->transdb.db_id = db->db_id;
 	state->transdb.tid = generation;
+	state->start = timeval_current();
 
 	ctdb_req_control_get_dbname(&request, db->db_id);
 	subreq = ctdb_client_control_multi_send(state,
@@ -2029,6 +2244,8 @@ static void recover_db_path_done(struct tevent_req *subreq)
 
 	talloc_free(reply);
 
+	state->lap = timeval_current();
+
 	ctdb_req_control_db_freeze(&request, state->db->db_id);
 	subreq = ctdb_client_control_multi_send(state,
 						state->ev,
@@ -2079,6 +2296,8 @@ static void recover_db_freeze_done(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.freeze = recover_db_lap(state);
+
 	ctdb_req_control_db_transaction_start(&request, &state->transdb);
 	subreq = ctdb_client_control_multi_send(state,
 						state->ev,
@@ -2127,6 +2346,8 @@ static void recover_db_transaction_started(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.transaction = recover_db_lap(state);
+
 	flags = state->db->db_flags;
 	state->recdb = recdb_create(state,
 				    state->db->db_id,
@@ -2152,7 +2373,8 @@ static void recover_db_transaction_started(struct tevent_req *subreq)
 					     state->client,
 					     state->nlist,
 					     state->db->db_id,
-					     state->recdb);
+					     state->recdb,
+					     state->tun_list->rec_delta_pull != 0);
 	}
 	if (tevent_req_nomem(subreq, req)) {
 		return;
@@ -2174,7 +2396,10 @@ static void recover_db_collect_done(struct tevent_req *subreq)
 	    (state->db->db_flags & CTDB_DB_FLAGS_REPLICATED)) {
 		status = collect_highseqnum_db_recv(subreq, &ret);
 	} else {
-		status = collect_all_db_recv(subreq, &ret);
+		status = collect_all_db_recv(subreq, &ret,
+					     &state->num_records,
+					     &state->num_skipped,
+					     &state->num_repulled);
 	}
 	TALLOC_FREE(subreq);
 	if (! status) {
@@ -2182,6 +2407,14 @@ static void recover_db_collect_done(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.collect = recover_db_lap(state);
+
+	if (!(state->db->db_flags & CTDB_DB_FLAGS_PERSISTENT) &&
+	    !(state->db->db_flags & CTDB_DB_FLAGS_REPLICATED) &&
+	    state->tun_list->rec_delta_pull != 0) {
+		recdb_set_rsn(state->recdb);
+	}
+
 	ctdb_req_control_wipe_database(&request, &state->transdb);
 	subreq = ctdb_client_control_multi_send(state,
 						state->ev,
@@ -2228,6 +2461,8 @@ static void recover_db_wipedb_done(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.wipe = recover_db_lap(state);
+
 	subreq = push_database_send(state,
 				    state->ev,
 				    state->client,
@@ -2257,6 +2492,8 @@ static void recover_db_pushdb_done(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.push = recover_db_lap(state);
+
 	TALLOC_FREE(state->recdb);
 
 	ctdb_req_control_db_transaction_commit(&request, &state->transdb);
@@ -2307,6 +2544,8 @@ static void recover_db_transaction_committed(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.commit = recover_db_lap(state);
+
 	ctdb_req_control_db_thaw(&request, state->db->db_id);
 	subreq = ctdb_client_control_multi_send(state,
 						state->ev,
@@ -2353,6 +2592,27 @@ static void recover_db_thaw_done(struct tevent_req *subreq)
 		return;
 	}
 
+	state->timing.thaw = recover_db_lap(state);
+
+	D_NOTICE("Recovered db %s in %.3lf seconds, pulled %u records, "
+		 "skipped %u unchanged, pulled again from %u nodes\n",
+		 state->db_name,
+		 timeval_elapsed(&state->start),
+		 state->num_records,
+		 state->num_skipped,
+		 state->num_repulled);
+	D_NOTICE("Recovery times for db %s: freeze %.3lf, transaction %.3lf, "
+		 "pull %.3lf, wipe %.3lf, push %.3lf, commit %.3lf, "
+		 "thaw %.3lf\n",
+		 state->db_name,
+		 state->timing.freeze,
+		 state->timing.transaction,
+		 state->timing.collect,
+		 state->timing.wipe,
+		 state->timing.push,
+		 state->timing.commit,
+		 state->timing.thaw);
+
 	tevent_req_done(req);
 }
 
@@ -2740,6 +3000,7 @@ struct recovery_state {
 	struct ctdb_tunable_list *tun_list;
 	struct ctdb_vnn_map *vnnmap;
 	struct db_list *dblist;
+	struct timeval start;
 };
 
 static void recovery_tunables_done(struct tevent_req *subreq);
@@ -2773,6 +3034,7 @@ static struct tevent_req *recovery_send(TALLOC_CTX *mem_ctx,
 	state->client = client;
 	state->generation = generation;
 	state->destnode = ctdb_client_pnn(client);
+	state->start = timeval_current();
 
 	ctdb_req_control_get_all_tunables(&request);
 	subreq = ctdb_client_control_send(state, state->ev, state->client,
@@ -3325,7 +3587,8 @@ static void recovery_db_recovery_done(struct tevent_req *subreq)
 	status = db_recovery_recv(subreq, &count);
 	TALLOC_FREE(subreq);
 
-	D_ERR("%d of %d databases recovered\n", count, state->dblist->num_dbs);
+	D_ERR("%d of %d databases recovered in %.3lf seconds\n",
+	      count, state->dblist->num_dbs, timeval_elapsed(&state->start));
 
 	if (! status) {
 		subreq = ban_node_send(state,
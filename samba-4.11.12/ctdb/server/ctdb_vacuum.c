@@ -47,6 +47,15 @@
 
 #define TIMELIMIT() timeval_current_ofs(10, 0)
 
+/* hash chains or freelist entries per tdb_compact_step() call */
+#define VACUUM_COMPACT_STEP_SIZE 100
+/* upper bound on compaction steps per vacuum run */
+#define VACUUM_COMPACT_MAX_STEPS 10000
+/* give up compacting if we keep finding locks busy */
+#define VACUUM_COMPACT_MAX_BUSY 10
+/* pause after a step that found locks busy, in microseconds */
+#define VACUUM_COMPACT_BUSY_DELAY 10000
+
 enum vacuum_child_status { VACUUM_RUNNING, VACUUM_OK, VACUUM_ERROR, VACUUM_TIMEOUT};
 
 struct ctdb_vacuum_child_context {
@@ -1271,12 +1280,42 @@ static int ctdb_vacuum_and_repack_db(struct ctdb_db_context *ctdb_db,
 	uint32_t repack_limit = ctdb_db->ctdb->tunable.repack_limit;
 	const char *name = ctdb_db->db_name;
 	int freelist_size = 0;
-	int ret;
+	unsigned int i, busy = 0;
+	int ret = 0;
 
 	if (ctdb_vacuum_db(ctdb_db, full_vacuum_run) != 0) {
 		DEBUG(DEBUG_ERR,(__location__ " Failed to vacuum '%s'\n", name));
 	}
 
+	/*
+	 * Purge dead records and merge free space in small steps, so
+	 * that the clients are never locked out for long. This keeps
+	 * the freelist short and the expensive repack below rare.
+	 * Back off when clients hold the locks we need, and leave the
+	 * rest to the next run if they keep doing so.
+	 */
+	for (i = 0; i < VACUUM_COMPACT_MAX_STEPS; i++) {
+		ret = tdb_compact_step(ctdb_db->ltdb->tdb,
+				       VACUUM_COMPACT_STEP_SIZE);
+		if (ret == TDB_COMPACT_BUSY) {
+			busy += 1;
+			if (busy >= VACUUM_COMPACT_MAX_BUSY) {
+				DEBUG(DEBUG_INFO, (__location__
+				      " Compacting '%s' postponed, "
+				      "locks are busy\n", name));
+				break;
+			}
+			usleep(VACUUM_COMPACT_BUSY_DELAY);
+			continue;
+		}
+		if (ret != 0) {
+			break;
+		}
+	}
+	if (ret == -1) {
+		DEBUG(DEBUG_ERR,(__location__ " Failed to compact '%s'\n", name));
+	}
+
 	freelist_size = tdb_freelist_size(ctdb_db->ltdb->tdb);
 	if (freelist_size == -1) {
 		DEBUG(DEBUG_ERR,(__location__ " Failed to get freelist size for '%s'\n", name));
@@ -288,6 +288,9 @@ int main(int argc, const char *argv[])
 	}
 	ctdb->recovery_lock = ctdb_config.recovery_lock;
 
+	ctdb->node_connections = ctdb_config.node_connections;
+	ctdb->shm_directory = ctdb_config.shm_directory;
+
 	/* tell ctdb what address to listen on */
 	if (ctdb_config.node_address) {
 		ret = ctdb_set_address(ctdb, ctdb_config.node_address);
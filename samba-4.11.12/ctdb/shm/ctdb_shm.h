@@ -0,0 +1,116 @@
+/*
+   ctdb over shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CTDB_SHM_H
+#define _CTDB_SHM_H
+
+/*
+  Each node sends to another node through a ring in shared memory that
+  it creates.  The ring and two eventfds are passed to the other node
+  over a unix domain socket, which stays open to notice when either
+  side goes away.
+
+  The sender signals data_fd when the receiver waits for data and the
+  receiver signals space_fd when the sender waits for space.
+*/
+
+#define CTDB_SHM_RING_SIZE	(1024*1024)
+#define CTDB_SHM_ALIGNMENT	8
+
+/* sent over the unix domain socket together with the three fds */
+struct ctdb_shm_hello {
+	uint32_t magic;
+	uint32_t ring_size;
+	ctdb_sock_addr address;
+};
+
+#define CTDB_SHM_HELLO_MAGIC	0x4c454853	/* "SHEL" */
+
+/* ctdb_shm main state */
+struct ctdb_shm {
+	struct ctdb_context *ctdb;
+	int listen_fd;
+	char *socket_path;
+};
+
+/* a packet waiting for space in the ring */
+struct ctdb_shm_pkt {
+	struct ctdb_shm_pkt *next, *prev;
+	uint32_t length;
+	uint32_t done;
+	uint8_t buf[];
+};
+
+/* the ring to a node */
+struct ctdb_shm_out {
+	struct ctdb_node *node;
+	int sock_fd;
+	struct tevent_fd *sock_fde;
+	void *map;
+	size_t map_size;
+	struct shm_ring *ring;
+	int data_fd;
+	int space_fd;
+	struct tevent_fd *space_fde;
+	struct ctdb_shm_pkt *queue;
+};
+
+/* the ring from a node */
+struct ctdb_shm_in {
+	struct ctdb_node *node;
+	int sock_fd;
+	struct tevent_fd *sock_fde;
+	void *map;
+	size_t map_size;
+	struct shm_ring *ring;
+	int data_fd;
+	struct tevent_fd *data_fde;
+	int space_fd;
+	struct tevent_immediate *im;
+	/* the packet being read */
+	uint8_t *pkt;
+	uint32_t pkt_length;
+	uint32_t pkt_done;
+};
+
+/*
+  state associated with one shm node
+*/
+struct ctdb_shm_node {
+	struct ctdb_context *ctdb;
+	struct ctdb_shm_out *out;
+	struct ctdb_shm_in *in;
+	struct tevent_timer *connect_te;
+};
+
+
+/* prototypes internal to shm transport */
+int ctdb_shm_queue_pkt(struct ctdb_node *node, uint8_t *data,
+		       uint32_t length);
+int ctdb_shm_listen(struct ctdb_context *ctdb);
+void ctdb_shm_node_connect(struct tevent_context *ev, struct tevent_timer *te,
+			   struct timeval t, void *private_data);
+void ctdb_shm_stop_outgoing(struct ctdb_node *node);
+void ctdb_shm_stop_incoming(struct ctdb_node *node);
+void ctdb_shm_signal(int fd);
+void ctdb_shm_space_handler(struct tevent_context *ev, struct tevent_fd *fde,
+			    uint16_t flags, void *private_data);
+void ctdb_shm_data_handler(struct tevent_context *ev, struct tevent_fd *fde,
+			   uint16_t flags, void *private_data);
+void ctdb_shm_start_reading(struct ctdb_shm_in *in);
+
+#endif /* _CTDB_SHM_H */
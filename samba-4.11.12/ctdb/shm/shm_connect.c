@@ -0,0 +1,711 @@
+/*
+   ctdb over shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/network.h"
+#include "system/filesys.h"
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <talloc.h>
+#include <tevent.h>
+
+#include "lib/util/debug.h"
+#include "lib/util/samba_util.h"
+#include "lib/util/time.h"
+#include "lib/util/blocking.h"
+#include "lib/util/sys_rw.h"
+#include "lib/util/msghdr.h"
+
+#include "ctdb_private.h"
+
+#include "common/system.h"
+#include "common/common.h"
+#include "common/logging.h"
+
+#include "shm/shm_ring.h"
+#include "ctdb_shm.h"
+
+/* mem_fd, data_fd, space_fd */
+#define CTDB_SHM_NUM_FDS 3
+
+static int shm_out_destructor(struct ctdb_shm_out *out)
+{
+	if (out->map != NULL) {
+		munmap(out->map, out->map_size);
+	}
+	if (out->data_fd != -1) {
+		close(out->data_fd);
+	}
+	return 0;
+}
+
+static int shm_in_destructor(struct ctdb_shm_in *in)
+{
+	if (in->map != NULL) {
+		munmap(in->map, in->map_size);
+	}
+	if (in->space_fd != -1) {
+		close(in->space_fd);
+	}
+	return 0;
+}
+
+/*
+  stop any outgoing connection to a node
+ */
+void ctdb_shm_stop_outgoing(struct ctdb_node *node)
+{
+	struct ctdb_shm_node *snode = talloc_get_type(
+		node->transport_data, struct ctdb_shm_node);
+
+	TALLOC_FREE(snode->out);
+	TALLOC_FREE(snode->connect_te);
+}
+
+/*
+  stop incoming connection to a node
+ */
+void ctdb_shm_stop_incoming(struct ctdb_node *node)
+{
+	struct ctdb_shm_node *snode = talloc_get_type(
+		node->transport_data, struct ctdb_shm_node);
+
+	TALLOC_FREE(snode->in);
+}
+
+/*
+  the socket of a connection is only used to notice that the other side
+  has gone away
+ */
+static void ctdb_shm_sock_handler(struct tevent_context *ev,
+				  struct tevent_fd *fde,
+				  uint16_t flags, void *private_data)
+{
+	struct ctdb_node *node = talloc_get_type_abort(private_data,
+						       struct ctdb_node);
+
+	node->ctdb->upcalls->node_dead(node);
+}
+
+static void ctdb_shm_retry(struct ctdb_node *node)
+{
+	struct ctdb_shm_node *snode = talloc_get_type(node->transport_data,
+						      struct ctdb_shm_node);
+
+	ctdb_shm_stop_outgoing(node);
+	snode->connect_te = tevent_add_timer(node->ctdb->ev,
+					     snode,
+					     timeval_current_ofs(1, 0),
+					     ctdb_shm_node_connect,
+					     node);
+}
+
+/*
+  whoever is at the other end of a socket gets our ring memory and
+  eventfds, so it has to be a ctdbd running as the same user as we do,
+  which is root in production
+ */
+static bool ctdb_shm_check_peer(int fd)
+{
+	uid_t uid;
+	gid_t gid;
+	int ret;
+
+	ret = getpeereid(fd, &uid, &gid);
+	if (ret != 0) {
+		DBG_ERR("Failed to get peer credentials (%s)\n",
+			strerror(errno));
+		return false;
+	}
+
+	if (uid != geteuid()) {
+		DBG_ERR("Refusing peer with uid %u\n", (unsigned int)uid);
+		return false;
+	}
+
+	return true;
+}
+
+static char *ctdb_shm_socket_path(TALLOC_CTX *mem_ctx,
+				  struct ctdb_context *ctdb,
+				  ctdb_sock_addr *addr)
+{
+	return talloc_asprintf(mem_ctx,
+			       "%s/ctdb-%s:%u.sock",
+			       ctdb->shm_directory,
+			       ctdb_addr_to_str(addr),
+			       ctdb_addr_to_port(addr));
+}
+
+static int ctdb_shm_socket_addr(struct ctdb_context *ctdb,
+				ctdb_sock_addr *addr,
+				struct sockaddr_un *sun)
+{
+	char *path;
+	size_t len;
+
+	path = ctdb_shm_socket_path(ctdb, ctdb, addr);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+
+	*sun = (struct sockaddr_un) { .sun_family = AF_UNIX };
+	len = strlcpy(sun->sun_path, path, sizeof(sun->sun_path));
+	talloc_free(path);
+	if (len >= sizeof(sun->sun_path)) {
+		return ENAMETOOLONG;
+	}
+
+	return 0;
+}
+
+/*
+  create the ring to a node in an unlinked file, so that it goes away
+  with the last mapping
+*/
+static int ctdb_shm_create_ring(struct ctdb_shm_out *out)
+{
+	struct ctdb_context *ctdb = out->node->ctdb;
+	char *template;
+	int fd, ret;
+
+	template = talloc_asprintf(out, "%s/ctdb-ring.XXXXXX",
+				   ctdb->shm_directory);
+	if (template == NULL) {
+		return -1;
+	}
+
+	fd = mkstemp(template);
+	if (fd == -1) {
+		DBG_ERR("Failed to create %s (%s)\n",
+			template, strerror(errno));
+		talloc_free(template);
+		return -1;
+	}
+	unlink(template);
+	talloc_free(template);
+
+	out->map_size = shm_ring_mapsize(CTDB_SHM_RING_SIZE);
+
+	ret = ftruncate(fd, out->map_size);
+	if (ret != 0) {
+		DBG_ERR("Failed to size ring (%s)\n", strerror(errno));
+		goto fail;
+	}
+
+	out->map = mmap(NULL, out->map_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (out->map == MAP_FAILED) {
+		DBG_ERR("Failed to map ring (%s)\n", strerror(errno));
+		out->map = NULL;
+		goto fail;
+	}
+
+	out->ring = shm_ring_init(out, out->map, CTDB_SHM_RING_SIZE);
+	if (out->ring == NULL) {
+		goto fail;
+	}
+
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static int ctdb_shm_send_hello(struct ctdb_shm_out *out, int mem_fd)
+{
+	struct ctdb_context *ctdb = out->node->ctdb;
+	struct ctdb_shm_hello hello = {
+		.magic = CTDB_SHM_HELLO_MAGIC,
+		.ring_size = CTDB_SHM_RING_SIZE,
+		.address = *ctdb->address,
+	};
+	int fds[CTDB_SHM_NUM_FDS] = { mem_fd, out->data_fd, out->space_fd };
+	struct iovec iov = {
+		.iov_base = &hello,
+		.iov_len = sizeof(hello),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	uint8_t buf[CMSG_SPACE(sizeof(fds))];
+	ssize_t fdlen, n;
+
+	fdlen = msghdr_prep_fds(&msg, buf, sizeof(buf),
+				fds, CTDB_SHM_NUM_FDS);
+	if (fdlen == -1 || (size_t)fdlen > sizeof(buf)) {
+		return EINVAL;
+	}
+
+	n = sendmsg(out->sock_fd, &msg, 0);
+	if (n != sizeof(hello)) {
+		return errno;
+	}
+
+	return 0;
+}
+
+/*
+  called when we should try and set up the ring to a node
+*/
+static void ctdb_shm_start_outgoing(struct ctdb_node *node)
+{
+	struct ctdb_shm_node *snode = talloc_get_type(node->transport_data,
+						      struct ctdb_shm_node);
+	struct ctdb_context *ctdb = node->ctdb;
+	struct ctdb_shm_out *out;
+	struct sockaddr_un sun;
+	int mem_fd;
+	int ret;
+
+	out = talloc_zero(snode, struct ctdb_shm_out);
+	if (out == NULL) {
+		DBG_ERR("Memory allocation error\n");
+		goto failed;
+	}
+	out->node = node;
+	out->sock_fd = -1;
+	out->data_fd = -1;
+	out->space_fd = -1;
+	talloc_set_destructor(out, shm_out_destructor);
+	snode->out = out;
+
+	ret = ctdb_shm_socket_addr(ctdb, &node->address, &sun);
+	if (ret != 0) {
+		DBG_ERR("Invalid socket path for node %s\n", node->name);
+		goto failed;
+	}
+
+	out->sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (out->sock_fd == -1) {
+		DBG_ERR("Failed to create socket\n");
+		goto failed;
+	}
+	set_close_on_exec(out->sock_fd);
+
+	ret = connect(out->sock_fd, (struct sockaddr *)&sun, sizeof(sun));
+	if (ret != 0) {
+		/* The other node is not there yet */
+		DBG_DEBUG("Failed to connect to %s (%s)\n",
+			  sun.sun_path, strerror(errno));
+		close(out->sock_fd);
+		goto failed;
+	}
+
+	if (!ctdb_shm_check_peer(out->sock_fd)) {
+		DBG_ERR("Not sending ring to %s\n", sun.sun_path);
+		close(out->sock_fd);
+		goto failed;
+	}
+
+	out->sock_fde = tevent_add_fd(ctdb->ev, out, out->sock_fd,
+				      TEVENT_FD_READ,
+				      ctdb_shm_sock_handler, node);
+	if (out->sock_fde == NULL) {
+		close(out->sock_fd);
+		goto failed;
+	}
+	tevent_fd_set_auto_close(out->sock_fde);
+
+	out->data_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (out->data_fd == -1) {
+		DBG_ERR("Failed to create eventfd (%s)\n", strerror(errno));
+		goto failed;
+	}
+
+	out->space_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (out->space_fd == -1) {
+		DBG_ERR("Failed to create eventfd (%s)\n", strerror(errno));
+		goto failed;
+	}
+
+	out->space_fde = tevent_add_fd(ctdb->ev, out, out->space_fd,
+				       TEVENT_FD_READ,
+				       ctdb_shm_space_handler, out);
+	if (out->space_fde == NULL) {
+		close(out->space_fd);
+		goto failed;
+	}
+	tevent_fd_set_auto_close(out->space_fde);
+
+	mem_fd = ctdb_shm_create_ring(out);
+	if (mem_fd == -1) {
+		goto failed;
+	}
+
+	ret = ctdb_shm_send_hello(out, mem_fd);
+	close(mem_fd);
+	if (ret != 0) {
+		DBG_ERR("Failed to send ring to node %s (%s)\n",
+			node->name, strerror(ret));
+		goto failed;
+	}
+
+	ret = set_blocking(out->sock_fd, false);
+	if (ret != 0) {
+		DBG_ERR("Failed to set socket non-blocking (%s)\n",
+			strerror(errno));
+		goto failed;
+	}
+
+	/*
+	 * Mark the node as connected, but only if the ring from the
+	 * node is also set up
+	 */
+	if (snode->in != NULL) {
+		node->ctdb->upcalls->node_connected(node);
+	}
+
+	return;
+
+failed:
+	ctdb_shm_retry(node);
+}
+
+void ctdb_shm_node_connect(struct tevent_context *ev,
+			   struct tevent_timer *te,
+			   struct timeval t,
+			   void *private_data)
+{
+	struct ctdb_node *node = talloc_get_type_abort(private_data,
+						       struct ctdb_node);
+
+	ctdb_shm_start_outgoing(node);
+}
+
+/* an accepted connection waiting for the hello */
+struct ctdb_shm_accept {
+	struct ctdb_context *ctdb;
+	int fd;
+};
+
+static int shm_accept_destructor(struct ctdb_shm_accept *acc)
+{
+	if (acc->fd != -1) {
+		close(acc->fd);
+	}
+	return 0;
+}
+
+static int ctdb_shm_recv_hello(int fd, struct ctdb_shm_hello *hello,
+			       int fds[CTDB_SHM_NUM_FDS])
+{
+	struct iovec iov = {
+		.iov_base = hello,
+		.iov_len = sizeof(*hello),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	uint8_t buf[CMSG_SPACE(sizeof(int) * CTDB_SHM_NUM_FDS)];
+	size_t num_fds, i;
+	ssize_t n;
+
+	msghdr_prep_recv_fds(&msg, buf, sizeof(buf), CTDB_SHM_NUM_FDS);
+
+	n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	if (n == -1) {
+		return errno;
+	}
+
+	num_fds = msghdr_extract_fds(&msg, fds, CTDB_SHM_NUM_FDS);
+	if (num_fds != CTDB_SHM_NUM_FDS) {
+		if (num_fds < CTDB_SHM_NUM_FDS) {
+			for (i = 0; i < num_fds; i++) {
+				close(fds[i]);
+			}
+		}
+		return EINVAL;
+	}
+
+	if (n != sizeof(*hello) || hello->magic != CTDB_SHM_HELLO_MAGIC) {
+		for (i = 0; i < num_fds; i++) {
+			close(fds[i]);
+		}
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+  map the ring from a node
+*/
+static int ctdb_shm_map_ring(struct ctdb_shm_in *in, int mem_fd,
+			     uint32_t ring_size)
+{
+	struct stat st;
+	int ret;
+
+	in->map_size = shm_ring_mapsize(ring_size);
+
+	ret = fstat(mem_fd, &st);
+	if (ret != 0 || (size_t)st.st_size < in->map_size) {
+		return EINVAL;
+	}
+
+	in->map = mmap(NULL, in->map_size, PROT_READ|PROT_WRITE,
+		       MAP_SHARED, mem_fd, 0);
+	if (in->map == MAP_FAILED) {
+		in->map = NULL;
+		return errno;
+	}
+
+	in->ring = shm_ring_attach(in, in->map, in->map_size);
+	if (in->ring == NULL) {
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static void ctdb_shm_hello_handler(struct tevent_context *ev,
+				   struct tevent_fd *fde,
+				   uint16_t flags, void *private_data)
+{
+	struct ctdb_shm_accept *acc = talloc_get_type_abort(
+		private_data, struct ctdb_shm_accept);
+	struct ctdb_context *ctdb = acc->ctdb;
+	struct ctdb_shm_hello hello;
+	int fds[CTDB_SHM_NUM_FDS];
+	struct ctdb_node *node;
+	struct ctdb_shm_node *snode;
+	struct ctdb_shm_in *in;
+	int ret;
+
+	ret = ctdb_shm_recv_hello(acc->fd, &hello, fds);
+	if (ret != 0) {
+		DBG_ERR("Invalid connection request (%s)\n", strerror(ret));
+		talloc_free(acc);
+		return;
+	}
+
+	/* fds[] holds the ring memory, the data and the space eventfd */
+
+	node = ctdb_ip_to_node(ctdb, &hello.address);
+	if (node == NULL) {
+		D_ERR("Refused connection from unknown node %s\n",
+		      ctdb_addr_to_str(&hello.address));
+		goto done;
+	}
+
+	snode = talloc_get_type_abort(node->transport_data,
+				      struct ctdb_shm_node);
+
+	if (snode->in != NULL) {
+		DBG_ERR("Incoming ring active, rejecting connection from %s\n",
+			ctdb_addr_to_str(&hello.address));
+		goto done;
+	}
+
+	in = talloc_zero(snode, struct ctdb_shm_in);
+	if (in == NULL) {
+		DBG_ERR("Memory allocation error\n");
+		goto done;
+	}
+	in->node = node;
+	in->sock_fd = -1;
+	in->data_fd = -1;
+	in->space_fd = -1;
+	talloc_set_destructor(in, shm_in_destructor);
+
+	ret = ctdb_shm_map_ring(in, fds[0], hello.ring_size);
+	if (ret != 0) {
+		DBG_ERR("Failed to map ring from node %s\n", node->name);
+		talloc_free(in);
+		goto done;
+	}
+
+	in->im = tevent_create_immediate(in);
+	if (in->im == NULL) {
+		talloc_free(in);
+		goto done;
+	}
+
+	in->data_fde = tevent_add_fd(ctdb->ev, in, fds[1], TEVENT_FD_READ,
+				     ctdb_shm_data_handler, in);
+	if (in->data_fde == NULL) {
+		talloc_free(in);
+		goto done;
+	}
+	tevent_fd_set_auto_close(in->data_fde);
+	in->data_fd = fds[1];
+	fds[1] = -1;
+
+	in->space_fd = fds[2];
+	fds[2] = -1;
+
+	/* The accepted socket now belongs to the connection */
+	in->sock_fde = tevent_add_fd(ctdb->ev, in, acc->fd, TEVENT_FD_READ,
+				     ctdb_shm_sock_handler, node);
+	if (in->sock_fde == NULL) {
+		talloc_free(in);
+		goto done;
+	}
+	tevent_fd_set_auto_close(in->sock_fde);
+	in->sock_fd = acc->fd;
+	acc->fd = -1;
+
+	snode->in = in;
+
+	/* Pick up anything that was sent before we got here */
+	ctdb_shm_start_reading(in);
+
+	/*
+	 * Mark the connecting node as connected, but only if the
+	 * corresponding outbound ring is also up
+	 */
+	if (snode->out != NULL && snode->out->ring != NULL) {
+		node->ctdb->upcalls->node_connected(node);
+	}
+
+done:
+	close(fds[0]);
+	if (fds[1] != -1) {
+		close(fds[1]);
+	}
+	if (fds[2] != -1) {
+		close(fds[2]);
+	}
+	talloc_free(acc);
+}
+
+/*
+  called when we get contacted by another node
+*/
+static void ctdb_shm_listen_event(struct tevent_context *ev,
+				  struct tevent_fd *fde,
+				  uint16_t flags, void *private_data)
+{
+	struct ctdb_context *ctdb = talloc_get_type(private_data,
+						    struct ctdb_context);
+	struct ctdb_shm *cshm = talloc_get_type(ctdb->transport_data,
+						struct ctdb_shm);
+	struct ctdb_shm_accept *acc;
+	struct tevent_fd *hello_fde;
+	int fd;
+
+	fd = accept(cshm->listen_fd, NULL, NULL);
+	if (fd == -1) {
+		return;
+	}
+	smb_set_close_on_exec(fd);
+
+	if (!ctdb_shm_check_peer(fd)) {
+		close(fd);
+		return;
+	}
+
+	acc = talloc_zero(cshm, struct ctdb_shm_accept);
+	if (acc == NULL) {
+		close(fd);
+		return;
+	}
+	acc->ctdb = ctdb;
+	acc->fd = fd;
+	talloc_set_destructor(acc, shm_accept_destructor);
+
+	hello_fde = tevent_add_fd(ctdb->ev, acc, fd, TEVENT_FD_READ,
+				  ctdb_shm_hello_handler, acc);
+	if (hello_fde == NULL) {
+		talloc_free(acc);
+		return;
+	}
+}
+
+/*
+  listen on the socket for our own address
+*/
+int ctdb_shm_listen(struct ctdb_context *ctdb)
+{
+	struct ctdb_shm *cshm = talloc_get_type(ctdb->transport_data,
+						struct ctdb_shm);
+	struct sockaddr_un sun;
+	struct tevent_fd *fde;
+	int ret;
+
+	/* There is no address to bind to, so it has to be configured */
+	if (ctdb->address == NULL) {
+		D_ERR("The shm transport needs [cluster] -> node address\n");
+		return -1;
+	}
+
+	/*
+	 * Anybody who can create files in the directory can take
+	 * over the socket of a node that is not running
+	 */
+	if (!directory_create_or_exist_strict(ctdb->shm_directory,
+					      geteuid(),
+					      0700)) {
+		D_ERR("%s must be a directory with mode 0700 "
+		      "owned by the user running ctdbd\n",
+		      ctdb->shm_directory);
+		return -1;
+	}
+
+	ret = ctdb_shm_socket_addr(ctdb, ctdb->address, &sun);
+	if (ret != 0) {
+		D_ERR("Invalid socket path in %s\n", ctdb->shm_directory);
+		return -1;
+	}
+
+	cshm->socket_path = talloc_strdup(cshm, sun.sun_path);
+	if (cshm->socket_path == NULL) {
+		return -1;
+	}
+
+	cshm->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (cshm->listen_fd == -1) {
+		ctdb_set_error(ctdb, "socket failed\n");
+		return -1;
+	}
+
+	set_close_on_exec(cshm->listen_fd);
+
+	/* Left over from a previous run */
+	unlink(sun.sun_path);
+
+	ret = bind(cshm->listen_fd, (struct sockaddr *)&sun, sizeof(sun));
+	if (ret != 0) {
+		D_ERR("Failed to bind to %s (%s)\n",
+		      sun.sun_path, strerror(errno));
+		goto failed;
+	}
+
+	if (listen(cshm->listen_fd, 10) == -1) {
+		goto failed;
+	}
+
+	fde = tevent_add_fd(ctdb->ev, cshm, cshm->listen_fd, TEVENT_FD_READ,
+			    ctdb_shm_listen_event, ctdb);
+	if (fde == NULL) {
+		goto failed;
+	}
+	tevent_fd_set_auto_close(fde);
+
+	return 0;
+
+failed:
+	close(cshm->listen_fd);
+	cshm->listen_fd = -1;
+	return -1;
+}
@@ -0,0 +1,205 @@
+/*
+   ctdb over shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/network.h"
+#include "system/filesys.h"
+
+#include <talloc.h>
+#include <tevent.h>
+
+#include "lib/util/time.h"
+#include "lib/util/debug.h"
+
+#include "ctdb_private.h"
+
+#include "common/common.h"
+#include "common/logging.h"
+
+#include "ctdb_shm.h"
+
+/*
+  initialise shm portion of a ctdb node
+*/
+static int ctdb_shm_add_node(struct ctdb_node *node)
+{
+	struct ctdb_shm_node *snode;
+
+	snode = talloc_zero(node, struct ctdb_shm_node);
+	CTDB_NO_MEMORY(node->ctdb, snode);
+
+	snode->ctdb = node->ctdb;
+	node->transport_data = snode;
+
+	return 0;
+}
+
+/*
+  initialise transport structures
+*/
+static int ctdb_shm_initialise(struct ctdb_context *ctdb)
+{
+	unsigned int i;
+
+	/* listen on our own address */
+	if (ctdb_shm_listen(ctdb) != 0) {
+		DEBUG(DEBUG_CRIT, (__location__ " Failed to start listening on the CTDB socket\n"));
+		exit(1);
+	}
+
+	for (i=0; i < ctdb->num_nodes; i++) {
+		if (ctdb->nodes[i]->flags & NODE_FLAGS_DELETED) {
+			continue;
+		}
+		if (ctdb_shm_add_node(ctdb->nodes[i]) != 0) {
+			DEBUG(DEBUG_CRIT, ("methods->add_node failed at %d\n", i));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+  start the protocol going
+*/
+static int ctdb_shm_connect_node(struct ctdb_node *node)
+{
+	struct ctdb_context *ctdb = node->ctdb;
+	struct ctdb_shm_node *snode = talloc_get_type(
+		node->transport_data, struct ctdb_shm_node);
+
+	/* startup connection to the other server - will happen on
+	   next event loop */
+	if (!ctdb_same_address(ctdb->address, &node->address)) {
+		snode->connect_te = tevent_add_timer(ctdb->ev, snode,
+						     timeval_zero(),
+						     ctdb_shm_node_connect,
+						     node);
+	}
+
+	return 0;
+}
+
+/*
+  shutdown and try to restart a connection to a node after it has been
+  disconnected
+*/
+static void ctdb_shm_restart(struct ctdb_node *node)
+{
+	struct ctdb_shm_node *snode = talloc_get_type(
+		node->transport_data, struct ctdb_shm_node);
+
+	DEBUG(DEBUG_NOTICE,("Tearing down connection to dead node :%d\n", node->pnn));
+	ctdb_shm_stop_incoming(node);
+	ctdb_shm_stop_outgoing(node);
+
+	snode->connect_te = tevent_add_timer(node->ctdb->ev, snode,
+					     timeval_zero(),
+					     ctdb_shm_node_connect, node);
+}
+
+
+/*
+  shutdown the transport
+*/
+static void ctdb_shm_shutdown(struct ctdb_context *ctdb)
+{
+	struct ctdb_shm *cshm = talloc_get_type(ctdb->transport_data,
+						struct ctdb_shm);
+	uint32_t i;
+
+	talloc_free(cshm);
+	ctdb->transport_data = NULL;
+
+	for (i=0; i<ctdb->num_nodes; i++) {
+		TALLOC_FREE(ctdb->nodes[i]->transport_data);
+	}
+}
+
+/*
+  start the transport
+*/
+static int ctdb_shm_start(struct ctdb_context *ctdb)
+{
+	unsigned int i;
+
+	for (i=0; i < ctdb->num_nodes; i++) {
+		if (ctdb->nodes[i]->flags & NODE_FLAGS_DELETED) {
+			continue;
+		}
+		ctdb_shm_connect_node(ctdb->nodes[i]);
+	}
+
+	return 0;
+}
+
+
+/*
+  transport packet allocator - allows transport to control memory for packets
+*/
+static void *ctdb_shm_allocate_pkt(TALLOC_CTX *mem_ctx, size_t size)
+{
+	/* packets are copied through the ring as a byte stream, keep
+	   the same alignment as tcp so that the length header and 64
+	   bit elements line up on both sides */
+	size = (size+(CTDB_SHM_ALIGNMENT-1)) & ~(CTDB_SHM_ALIGNMENT-1);
+	return talloc_size(mem_ctx, size);
+}
+
+
+static const struct ctdb_methods ctdb_shm_methods = {
+	.initialise   = ctdb_shm_initialise,
+	.start        = ctdb_shm_start,
+	.queue_pkt    = ctdb_shm_queue_pkt,
+	.add_node     = ctdb_shm_add_node,
+	.connect_node = ctdb_shm_connect_node,
+	.allocate_pkt = ctdb_shm_allocate_pkt,
+	.shutdown     = ctdb_shm_shutdown,
+	.restart      = ctdb_shm_restart,
+};
+
+static int shm_cshm_destructor(struct ctdb_shm *cshm)
+{
+	if (cshm->listen_fd != -1 && cshm->socket_path != NULL) {
+		unlink(cshm->socket_path);
+	}
+
+	cshm->ctdb->transport_data = NULL;
+	cshm->ctdb->methods = NULL;
+
+	return 0;
+}
+
+
+/*
+  initialise shm portion of ctdb
+*/
+int ctdb_shm_init(struct ctdb_context *ctdb)
+{
+	struct ctdb_shm *cshm;
+	cshm = talloc_zero(ctdb, struct ctdb_shm);
+	CTDB_NO_MEMORY(ctdb, cshm);
+
+	cshm->listen_fd = -1;
+	cshm->ctdb      = ctdb;
+	ctdb->transport_data = cshm;
+	ctdb->methods = &ctdb_shm_methods;
+
+	talloc_set_destructor(cshm, shm_cshm_destructor);
+	return 0;
+}
@@ -0,0 +1,279 @@
+/*
+   ctdb over shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/network.h"
+#include "system/filesys.h"
+
+#include <talloc.h>
+#include <tevent.h>
+
+#include "lib/util/dlinklist.h"
+#include "lib/util/debug.h"
+#include "lib/util/sys_rw.h"
+
+#include "ctdb_private.h"
+
+#include "common/common.h"
+#include "common/logging.h"
+
+#include "shm/shm_ring.h"
+#include "ctdb_shm.h"
+
+/*
+  wake up the other side
+*/
+void ctdb_shm_signal(int fd)
+{
+	uint64_t one = 1;
+	ssize_t n;
+
+	n = sys_write(fd, &one, sizeof(one));
+	if (n != sizeof(one)) {
+		DBG_WARNING("Failed to signal eventfd (%s)\n",
+			    strerror(errno));
+	}
+}
+
+static void ctdb_shm_clear(int fd)
+{
+	uint64_t val;
+
+	(void)sys_read(fd, &val, sizeof(val));
+}
+
+/*
+  move queued packets into the ring, for as long as there is space
+*/
+static void ctdb_shm_flush(struct ctdb_shm_out *out)
+{
+	struct ctdb_shm_pkt *pkt;
+	bool wakeup;
+	uint32_t n;
+
+	while ((pkt = out->queue) != NULL) {
+		n = shm_ring_write(out->ring,
+				   pkt->buf + pkt->done,
+				   pkt->length - pkt->done,
+				   &wakeup);
+		if (wakeup) {
+			ctdb_shm_signal(out->data_fd);
+		}
+		pkt->done += n;
+
+		if (pkt->done < pkt->length) {
+			if (shm_ring_wait_space(out->ring)) {
+				return;
+			}
+			continue;
+		}
+
+		DLIST_REMOVE(out->queue, pkt);
+		talloc_free(pkt);
+	}
+}
+
+/*
+  called when the other side has made space in the ring
+*/
+void ctdb_shm_space_handler(struct tevent_context *ev, struct tevent_fd *fde,
+			    uint16_t flags, void *private_data)
+{
+	struct ctdb_shm_out *out = talloc_get_type_abort(
+		private_data, struct ctdb_shm_out);
+
+	ctdb_shm_clear(out->space_fd);
+	ctdb_shm_flush(out);
+}
+
+/*
+  queue a packet for sending
+*/
+int ctdb_shm_queue_pkt(struct ctdb_node *node, uint8_t *data,
+		       uint32_t length)
+{
+	struct ctdb_shm_node *snode = talloc_get_type(node->transport_data,
+						      struct ctdb_shm_node);
+	struct ctdb_shm_out *out = snode->out;
+	struct ctdb_shm_pkt *pkt;
+	bool wakeup;
+	uint32_t n = 0;
+
+	if (out == NULL || out->ring == NULL) {
+		DBG_DEBUG("No outgoing connection, dropping packet\n");
+		return 0;
+	}
+
+	/* Nothing is queued, so the packet can go straight into the ring */
+	if (out->queue == NULL) {
+		n = shm_ring_write(out->ring, data, length, &wakeup);
+		if (wakeup) {
+			ctdb_shm_signal(out->data_fd);
+		}
+		if (n == length) {
+			return 0;
+		}
+	}
+
+	pkt = talloc_size(out, offsetof(struct ctdb_shm_pkt, buf) +
+			  length - n);
+	CTDB_NO_MEMORY(node->ctdb, pkt);
+	talloc_set_name_const(pkt, "struct ctdb_shm_pkt");
+
+	memcpy(pkt->buf, data + n, length - n);
+	pkt->length = length - n;
+	pkt->done = 0;
+
+	DLIST_ADD_END(out->queue, pkt);
+
+	if (pkt == out->queue) {
+		ctdb_shm_flush(out);
+	}
+
+	return 0;
+}
+
+static void ctdb_shm_process_event(struct tevent_context *ev,
+				   struct tevent_immediate *im,
+				   void *private_data);
+
+/*
+  Read at most one packet from the ring and pass it up.  The upcall may
+  free the connection, so further packets are handled from an immediate
+  event, as in the socket queues.
+*/
+static void ctdb_shm_process(struct ctdb_shm_in *in)
+{
+	struct ctdb_node *node = in->node;
+	struct ctdb_req_header *hdr;
+	uint8_t *data;
+	uint32_t length;
+	bool wakeup;
+	uint32_t needed = 1;
+	uint32_t n;
+
+	if (in->pkt == NULL) {
+		n = shm_ring_peek(in->ring, (uint8_t *)&length,
+				  sizeof(length));
+		if (n < sizeof(length)) {
+			/* Don't spin on a partial length */
+			needed = sizeof(length);
+			goto wait;
+		}
+		if (length < sizeof(struct ctdb_req_header)) {
+			DEBUG(DEBUG_ALERT, (__location__
+					    " Bad packet length %u\n",
+					    length));
+			goto failed;
+		}
+
+		in->pkt = talloc_size(in, length);
+		if (in->pkt == NULL) {
+			DBG_ERR("Memory allocation error\n");
+			goto failed;
+		}
+		in->pkt_length = length;
+		in->pkt_done = 0;
+	}
+
+	n = shm_ring_read(in->ring,
+			  in->pkt + in->pkt_done,
+			  in->pkt_length - in->pkt_done,
+			  &wakeup);
+	if (wakeup) {
+		ctdb_shm_signal(in->space_fd);
+	}
+	in->pkt_done += n;
+
+	if (in->pkt_done < in->pkt_length) {
+		goto wait;
+	}
+
+	data = in->pkt;
+	length = in->pkt_length;
+	in->pkt = NULL;
+
+	/* Check for more before the upcall */
+	tevent_schedule_immediate(in->im, node->ctdb->ev,
+				  ctdb_shm_process_event, in);
+
+	hdr = (struct ctdb_req_header *)data;
+
+	if (hdr->ctdb_magic != CTDB_MAGIC) {
+		DEBUG(DEBUG_ALERT, (__location__
+				    " Non CTDB packet 0x%x rejected\n",
+				    hdr->ctdb_magic));
+		TALLOC_FREE(data);
+		goto failed;
+	}
+
+	if (hdr->ctdb_version != CTDB_PROTOCOL) {
+		DEBUG(DEBUG_ALERT, (__location__
+				    " Bad CTDB version 0x%x rejected\n",
+				    hdr->ctdb_version));
+		TALLOC_FREE(data);
+		goto failed;
+	}
+
+	/* tell the ctdb layer above that we have a packet */
+	node->ctdb->upcalls->recv_pkt(node->ctdb, data, length);
+	return;
+
+wait:
+	if (!shm_ring_wait_data(in->ring, needed)) {
+		/* More data arrived in the meantime */
+		tevent_schedule_immediate(in->im, node->ctdb->ev,
+					  ctdb_shm_process_event, in);
+	}
+	return;
+
+failed:
+	tevent_schedule_immediate(in->im, NULL, NULL, NULL);
+	node->ctdb->upcalls->node_dead(node);
+}
+
+static void ctdb_shm_process_event(struct tevent_context *ev,
+				   struct tevent_immediate *im,
+				   void *private_data)
+{
+	struct ctdb_shm_in *in = talloc_get_type_abort(
+		private_data, struct ctdb_shm_in);
+
+	ctdb_shm_process(in);
+}
+
+/*
+  start reading from a new ring
+*/
+void ctdb_shm_start_reading(struct ctdb_shm_in *in)
+{
+	tevent_schedule_immediate(in->im, in->node->ctdb->ev,
+				  ctdb_shm_process_event, in);
+}
+
+/*
+  called when the other side has written into the ring
+*/
+void ctdb_shm_data_handler(struct tevent_context *ev, struct tevent_fd *fde,
+			   uint16_t flags, void *private_data)
+{
+	struct ctdb_shm_in *in = talloc_get_type_abort(
+		private_data, struct ctdb_shm_in);
+
+	ctdb_shm_clear(in->data_fd);
+	ctdb_shm_process(in);
+}
@@ -0,0 +1,288 @@
+/*
+   Single producer, single consumer byte ring in shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/threads.h"
+
+#include <talloc.h>
+
+#include "shm/shm_ring.h"
+
+#define SHM_RING_MAGIC	0x4d485343	/* "CSHM" */
+#define SHM_RING_LINE	64
+
+/*
+ * The positions run freely and wrap at 2^32, so head - tail is always
+ * the amount of data in the ring.  The writer and reader fields live in
+ * separate cache lines.
+ */
+struct shm_ring_shared {
+	uint32_t magic;
+	uint32_t size;
+	uint8_t pad1[SHM_RING_LINE - 2 * sizeof(uint32_t)];
+
+	/* Advanced by the writer */
+	volatile uint32_t head;
+	volatile uint32_t need_space;
+	uint8_t pad2[SHM_RING_LINE - 2 * sizeof(uint32_t)];
+
+	/* Advanced by the reader */
+	volatile uint32_t tail;
+	volatile uint32_t need_data;
+	uint8_t pad3[SHM_RING_LINE - 2 * sizeof(uint32_t)];
+
+	uint8_t data[];
+};
+
+struct shm_ring {
+	struct shm_ring_shared *shared;
+	/* Don't trust the shared copy after setup */
+	uint32_t size;
+};
+
+static bool shm_ring_valid_size(uint32_t size)
+{
+	if (size == 0 || size > (UINT32_MAX >> 1)) {
+		return false;
+	}
+
+	return ((size & (size - 1)) == 0);
+}
+
+size_t shm_ring_mapsize(uint32_t size)
+{
+	return sizeof(struct shm_ring_shared) + size;
+}
+
+struct shm_ring *shm_ring_init(TALLOC_CTX *mem_ctx, void *buf,
+			       uint32_t size)
+{
+	struct shm_ring *ring;
+
+	if (!shm_ring_valid_size(size)) {
+		return NULL;
+	}
+
+	ring = talloc_zero(mem_ctx, struct shm_ring);
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	ring->shared = (struct shm_ring_shared *)buf;
+	ring->size = size;
+
+	ring->shared->size = size;
+	ring->shared->head = 0;
+	ring->shared->tail = 0;
+	ring->shared->need_space = 0;
+	ring->shared->need_data = 0;
+	atomic_thread_fence(memory_order_release);
+	ring->shared->magic = SHM_RING_MAGIC;
+
+	return ring;
+}
+
+struct shm_ring *shm_ring_attach(TALLOC_CTX *mem_ctx, void *buf,
+				 size_t buflen)
+{
+	struct shm_ring_shared *shared = (struct shm_ring_shared *)buf;
+	struct shm_ring *ring;
+	uint32_t size;
+
+	if (buflen < sizeof(struct shm_ring_shared)) {
+		return NULL;
+	}
+
+	if (shared->magic != SHM_RING_MAGIC) {
+		return NULL;
+	}
+	atomic_thread_fence(memory_order_acquire);
+
+	size = shared->size;
+	if (!shm_ring_valid_size(size) || buflen < shm_ring_mapsize(size)) {
+		return NULL;
+	}
+
+	ring = talloc_zero(mem_ctx, struct shm_ring);
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	ring->shared = shared;
+	ring->size = size;
+
+	return ring;
+}
+
+uint32_t shm_ring_size(struct shm_ring *ring)
+{
+	return ring->size;
+}
+
+uint32_t shm_ring_used(struct shm_ring *ring)
+{
+	uint32_t used;
+
+	used = ring->shared->head - ring->shared->tail;
+	atomic_thread_fence(memory_order_acquire);
+
+	/* Only a broken writer can get here */
+	if (used > ring->size) {
+		return 0;
+	}
+
+	return used;
+}
+
+static uint32_t shm_ring_free(struct shm_ring *ring)
+{
+	uint32_t used;
+
+	used = ring->shared->head - ring->shared->tail;
+	atomic_thread_fence(memory_order_acquire);
+
+	if (used > ring->size) {
+		return 0;
+	}
+
+	return ring->size - used;
+}
+
+/*
+ * Copy between the ring and a linear buffer, wrapping at the end of the
+ * ring
+ */
+static void shm_ring_copy_in(struct shm_ring *ring, uint32_t pos,
+			     const uint8_t *data, uint32_t len)
+{
+	uint32_t offset = pos & (ring->size - 1);
+	uint32_t n = MIN(len, ring->size - offset);
+
+	memcpy(ring->shared->data + offset, data, n);
+	memcpy(ring->shared->data, data + n, len - n);
+}
+
+static void shm_ring_copy_out(struct shm_ring *ring, uint32_t pos,
+			      uint8_t *data, uint32_t len)
+{
+	uint32_t offset = pos & (ring->size - 1);
+	uint32_t n = MIN(len, ring->size - offset);
+
+	memcpy(data, ring->shared->data + offset, n);
+	memcpy(data + n, ring->shared->data, len - n);
+}
+
+uint32_t shm_ring_write(struct shm_ring *ring, const uint8_t *data,
+			uint32_t len, bool *wakeup)
+{
+	uint32_t head = ring->shared->head;
+	uint32_t n;
+
+	*wakeup = false;
+
+	n = MIN(len, shm_ring_free(ring));
+	if (n == 0) {
+		return 0;
+	}
+
+	shm_ring_copy_in(ring, head, data, n);
+
+	/* Publish the data, then check whether the reader sleeps */
+	atomic_thread_fence(memory_order_release);
+	ring->shared->head = head + n;
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (ring->shared->need_data != 0) {
+		ring->shared->need_data = 0;
+		*wakeup = true;
+	}
+
+	return n;
+}
+
+uint32_t shm_ring_peek(struct shm_ring *ring, uint8_t *data, uint32_t len)
+{
+	uint32_t n;
+
+	n = MIN(len, shm_ring_used(ring));
+	if (n == 0) {
+		return 0;
+	}
+
+	shm_ring_copy_out(ring, ring->shared->tail, data, n);
+
+	return n;
+}
+
+uint32_t shm_ring_read(struct shm_ring *ring, uint8_t *data, uint32_t len,
+		       bool *wakeup)
+{
+	uint32_t tail = ring->shared->tail;
+	uint32_t n;
+
+	*wakeup = false;
+
+	n = MIN(len, shm_ring_used(ring));
+	if (n == 0) {
+		return 0;
+	}
+
+	shm_ring_copy_out(ring, tail, data, n);
+
+	/* Release the space, then check whether the writer sleeps */
+	atomic_thread_fence(memory_order_release);
+	ring->shared->tail = tail + n;
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (ring->shared->need_space != 0) {
+		ring->shared->need_space = 0;
+		*wakeup = true;
+	}
+
+	return n;
+}
+
+/*
+ * The flag is set before checking the ring again.  Together with the
+ * check of the flag after moving head or tail, either this side sees
+ * the update or the other side sees the flag.
+ */
+bool shm_ring_wait_data(struct shm_ring *ring, uint32_t needed)
+{
+	ring->shared->need_data = 1;
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (shm_ring_used(ring) >= MAX(needed, 1)) {
+		ring->shared->need_data = 0;
+		return false;
+	}
+
+	return true;
+}
+
+bool shm_ring_wait_space(struct shm_ring *ring)
+{
+	ring->shared->need_space = 1;
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (shm_ring_free(ring) > 0) {
+		ring->shared->need_space = 0;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,135 @@
+/*
+   Single producer, single consumer byte ring in shared memory
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CTDB_SHM_RING_H__
+#define __CTDB_SHM_RING_H__
+
+/**
+ * @file shm_ring.h
+ *
+ * @brief Lock-free byte stream between two processes
+ *
+ * One process writes into the ring and another one reads from it.  The
+ * ring does not know about packet boundaries, it behaves like a pipe.
+ *
+ * Neither side ever blocks.  When the reader runs out of data, or the
+ * writer runs out of space, it says so with shm_ring_wait_data() or
+ * shm_ring_wait_space().  The other side is then told to wake it up,
+ * via the wakeup argument of shm_ring_write() or shm_ring_read().  How
+ * the wakeup is delivered is up to the caller.
+ */
+
+struct shm_ring;
+
+/**
+ * @brief Return the size of the memory needed for a ring
+ *
+ * @param[in] size The number of data bytes, a power of 2
+ * @return the number of bytes to allocate
+ */
+size_t shm_ring_mapsize(uint32_t size);
+
+/**
+ * @brief Initialise a new ring
+ *
+ * @param[in] mem_ctx Talloc memory context
+ * @param[in] buf Zeroed memory of shm_ring_mapsize(size) bytes
+ * @param[in] size The number of data bytes, a power of 2
+ * @return ring on success, NULL on failure
+ *
+ * The memory is not owned by the ring, it has to stay valid for as long
+ * as the ring is used.
+ */
+struct shm_ring *shm_ring_init(TALLOC_CTX *mem_ctx, void *buf,
+			       uint32_t size);
+
+/**
+ * @brief Use a ring initialised by another process
+ *
+ * @param[in] mem_ctx Talloc memory context
+ * @param[in] buf The shared memory
+ * @param[in] buflen The size of the shared memory
+ * @return ring on success, NULL if buf does not contain a valid ring
+ */
+struct shm_ring *shm_ring_attach(TALLOC_CTX *mem_ctx, void *buf,
+				 size_t buflen);
+
+/**
+ * @brief Return the number of data bytes of a ring
+ */
+uint32_t shm_ring_size(struct shm_ring *ring);
+
+/**
+ * @brief Return the number of bytes that can be read
+ */
+uint32_t shm_ring_used(struct shm_ring *ring);
+
+/**
+ * @brief Write as much data as fits into the ring
+ *
+ * @param[in] ring The ring
+ * @param[in] data The data to write
+ * @param[in] len The length of the data
+ * @param[out] wakeup Set to true if the reader has to be woken up
+ * @return the number of bytes written
+ */
+uint32_t shm_ring_write(struct shm_ring *ring, const uint8_t *data,
+			uint32_t len, bool *wakeup);
+
+/**
+ * @brief Copy data from the ring without consuming it
+ *
+ * @param[in] ring The ring
+ * @param[in] data The buffer to copy into
+ * @param[in] len The length of the buffer
+ * @return the number of bytes copied
+ */
+uint32_t shm_ring_peek(struct shm_ring *ring, uint8_t *data, uint32_t len);
+
+/**
+ * @brief Read as much data as is available from the ring
+ *
+ * @param[in] ring The ring
+ * @param[in] data The buffer to read into
+ * @param[in] len The length of the buffer
+ * @param[out] wakeup Set to true if the writer has to be woken up
+ * @return the number of bytes read
+ */
+uint32_t shm_ring_read(struct shm_ring *ring, uint8_t *data, uint32_t len,
+		       bool *wakeup);
+
+/**
+ * @brief Ask to be woken up when data is written
+ *
+ * @param[in] ring The ring
+ * @param[in] needed The number of bytes the reader needs to proceed
+ * @return true if the reader should wait, false if enough data has arrived
+ *
+ * Every write wakes the reader up, it has to wait again if there is
+ * still not enough data.
+ */
+bool shm_ring_wait_data(struct shm_ring *ring, uint32_t needed);
+
+/**
+ * @brief Ask to be woken up when data is read
+ *
+ * @param[in] ring The ring
+ * @return true if the writer should wait, false if space has been freed
+ */
+bool shm_ring_wait_space(struct shm_ring *ring);
+
+#endif /* __CTDB_SHM_RING_H__ */
@@ -26,6 +26,19 @@ struct ctdb_tcp {
 	int listen_fd;
 };
 
+/*
+  an additional connection to or from a node, see [cluster] -> node
+  connections.  Losing any connection to or from a node makes the
+  node dead, as for the main connection.
+*/
+struct ctdb_tcp_conn {
+	struct ctdb_node *node;
+	struct ctdb_tcp_conn **slot;
+	int fd;
+	struct tevent_fd *connect_fde;
+	struct ctdb_queue *queue;
+};
+
 /*
   state associated with one tcp node
 */
@@ -38,6 +51,10 @@ struct ctdb_tcp_node {
 
 	struct ctdb_context *ctdb;
 	struct ctdb_queue *in_queue;
+
+	uint32_t num_extra;
+	struct ctdb_tcp_conn **out_extra;
+	struct ctdb_tcp_conn **in_extra;
 };
 
 
@@ -46,6 +63,7 @@ int ctdb_tcp_queue_pkt(struct ctdb_node *node, uint8_t *data, uint32_t length);
 int ctdb_tcp_listen(struct ctdb_context *ctdb);
 void ctdb_tcp_node_connect(struct tevent_context *ev, struct tevent_timer *te,
 			   struct timeval t, void *private_data);
+bool ctdb_tcp_out_ready(struct ctdb_tcp_node *tnode);
 void ctdb_tcp_read_cb(uint8_t *data, size_t cnt, void *args);
 void ctdb_tcp_tnode_cb(uint8_t *data, size_t cnt, void *private_data);
 void ctdb_tcp_stop_outgoing(struct ctdb_node *node);
@@ -37,6 +37,50 @@
 
 #include "ctdb_tcp.h"
 
+static int tcp_conn_destructor(struct ctdb_tcp_conn *conn)
+{
+	if (conn->fd != -1) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	*conn->slot = NULL;
+
+	return 0;
+}
+
+/*
+  add an additional connection to a node in the given slot
+ */
+static struct ctdb_tcp_conn *ctdb_tcp_conn_new(struct ctdb_node *node,
+					       struct ctdb_tcp_conn **extra,
+					       uint32_t i)
+{
+	struct ctdb_tcp_conn *conn;
+
+	conn = talloc_zero(extra, struct ctdb_tcp_conn);
+	if (conn == NULL) {
+		return NULL;
+	}
+
+	conn->node = node;
+	conn->slot = &extra[i];
+	conn->fd = -1;
+	extra[i] = conn;
+	talloc_set_destructor(conn, tcp_conn_destructor);
+
+	return conn;
+}
+
+static void ctdb_tcp_free_extra(struct ctdb_tcp_node *tnode,
+				struct ctdb_tcp_conn **extra)
+{
+	uint32_t i;
+
+	for (i = 0; i < tnode->num_extra; i++) {
+		TALLOC_FREE(extra[i]);
+	}
+}
+
 /*
   stop any outgoing connection (established or pending) to a node
  */
@@ -45,6 +89,7 @@ void ctdb_tcp_stop_outgoing(struct ctdb_node *node)
 	struct ctdb_tcp_node *tnode = talloc_get_type(
 		node->transport_data, struct ctdb_tcp_node);
 
+	ctdb_tcp_free_extra(tnode, tnode->out_extra);
 	TALLOC_FREE(tnode->out_queue);
 	TALLOC_FREE(tnode->connect_te);
 	TALLOC_FREE(tnode->connect_fde);
@@ -62,9 +107,32 @@ void ctdb_tcp_stop_incoming(struct ctdb_node *node)
 	struct ctdb_tcp_node *tnode = talloc_get_type(
 		node->transport_data, struct ctdb_tcp_node);
 
+	ctdb_tcp_free_extra(tnode, tnode->in_extra);
 	TALLOC_FREE(tnode->in_queue);
 }
 
+/*
+  are all the outgoing connections to a node up?  Until they are,
+  packets to the node are dropped and it is not marked as connected.
+ */
+bool ctdb_tcp_out_ready(struct ctdb_tcp_node *tnode)
+{
+	uint32_t i;
+
+	if (tnode->out_queue == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < tnode->num_extra; i++) {
+		if (tnode->out_extra[i] == NULL ||
+		    tnode->out_extra[i]->queue == NULL) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 /*
   called when a complete packet has come in - should not happen on this socket
   unless the other side closes the connection with RST or FIN
@@ -78,6 +146,161 @@ void ctdb_tcp_tnode_cb(uint8_t *data, size_t cnt, void *private_data)
 	TALLOC_FREE(data);
 }
 
+static void ctdb_tcp_set_sockopts(int fd)
+{
+	int one = 1;
+	int ret;
+
+	ret = setsockopt(fd,
+			 IPPROTO_TCP,
+			 TCP_NODELAY,
+			 (char *)&one,
+			 sizeof(one));
+	if (ret == -1) {
+		DBG_WARNING("Failed to set TCP_NODELAY on fd - %s\n",
+			  strerror(errno));
+	}
+	ret = setsockopt(fd,
+			 SOL_SOCKET,
+			 SO_KEEPALIVE,(char *)&one,
+			 sizeof(one));
+	if (ret == -1) {
+		DBG_WARNING("Failed to set KEEPALIVE on fd - %s\n",
+			    strerror(errno));
+	}
+}
+
+static int ctdb_tcp_connect_socket(struct ctdb_node *node);
+static void ctdb_tcp_node_connect_timeout(struct tevent_context *ev,
+					  struct tevent_timer *te,
+					  struct timeval t,
+					  void *private_data);
+
+/*
+  the outgoing connections are only used together, start again from
+  the main connection if one of them can't be set up
+*/
+static void ctdb_tcp_extra_connect_failed(struct ctdb_node *node)
+{
+	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
+						      struct ctdb_tcp_node);
+
+	ctdb_tcp_stop_outgoing(node);
+	tnode->connect_te = tevent_add_timer(node->ctdb->ev,
+					     tnode,
+					     timeval_current_ofs(1, 0),
+					     ctdb_tcp_node_connect,
+					     node);
+}
+
+/*
+  called when socket becomes writeable on connect of an additional
+  connection
+*/
+static void ctdb_tcp_extra_connect_write(struct tevent_context *ev,
+					 struct tevent_fd *fde,
+					 uint16_t flags, void *private_data)
+{
+	struct ctdb_tcp_conn *conn = talloc_get_type_abort(
+		private_data, struct ctdb_tcp_conn);
+	struct ctdb_node *node = conn->node;
+	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
+						      struct ctdb_tcp_node);
+	int error = 0;
+	socklen_t len = sizeof(error);
+	int ret;
+
+	ret = getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+	if (ret != 0 || error != 0) {
+		D_NOTICE("Failed to set up additional connection "
+			 "to node %s\n",
+			 node->name);
+		ctdb_tcp_extra_connect_failed(node);
+		return;
+	}
+
+	TALLOC_FREE(conn->connect_fde);
+
+	ctdb_tcp_set_sockopts(conn->fd);
+
+	conn->queue = ctdb_queue_setup(node->ctdb,
+				       conn,
+				       conn->fd,
+				       CTDB_TCP_ALIGNMENT,
+				       ctdb_tcp_tnode_cb,
+				       node,
+				       "to-node-%s",
+				       node->name);
+	if (conn->queue == NULL) {
+		DBG_ERR("Failed to set up outgoing queue\n");
+		ctdb_tcp_extra_connect_failed(node);
+		return;
+	}
+
+	/* the queue subsystem now owns this fd */
+	conn->fd = -1;
+
+	ret = ctdb_queue_set_coalesce(conn->queue);
+	if (ret != 0) {
+		DBG_WARNING("Failed to enable packet coalescing\n");
+	}
+
+	if (!ctdb_tcp_out_ready(tnode)) {
+		return;
+	}
+
+	TALLOC_FREE(tnode->connect_te);
+
+	if (tnode->in_queue != NULL) {
+		node->ctdb->upcalls->node_connected(node);
+	}
+}
+
+/*
+  open the additional connections to a node, once the main connection
+  is up.  If they are not all up within a second, start again.
+*/
+static void ctdb_tcp_start_extra_outgoing(struct ctdb_node *node)
+{
+	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
+						      struct ctdb_tcp_node);
+	struct ctdb_tcp_conn *conn;
+	uint32_t i;
+
+	for (i = 0; i < tnode->num_extra; i++) {
+		if (tnode->out_extra[i] != NULL) {
+			continue;
+		}
+
+		conn = ctdb_tcp_conn_new(node, tnode->out_extra, i);
+		if (conn == NULL) {
+			DBG_ERR("Memory allocation error\n");
+			break;
+		}
+
+		conn->fd = ctdb_tcp_connect_socket(node);
+		if (conn->fd == -1) {
+			break;
+		}
+
+		conn->connect_fde = tevent_add_fd(node->ctdb->ev,
+						  conn,
+						  conn->fd,
+						  TEVENT_FD_WRITE|TEVENT_FD_READ,
+						  ctdb_tcp_extra_connect_write,
+						  conn);
+		if (conn->connect_fde == NULL) {
+			break;
+		}
+	}
+
+	tnode->connect_te = tevent_add_timer(node->ctdb->ev,
+					     tnode,
+					     timeval_current_ofs(1, 0),
+					     ctdb_tcp_node_connect_timeout,
+					     node);
+}
+
 /*
   called when socket becomes writeable on connect
 */
@@ -92,7 +315,6 @@ static void ctdb_node_connect_write(struct tevent_context *ev,
 	struct ctdb_context *ctdb = node->ctdb;
 	int error = 0;
 	socklen_t len = sizeof(error);
-	int one = 1;
 	int ret;
 
 	talloc_free(tnode->connect_te);
@@ -110,23 +332,7 @@ static void ctdb_node_connect_write(struct tevent_context *ev,
 	talloc_free(tnode->connect_fde);
 	tnode->connect_fde = NULL;
 
-	ret = setsockopt(tnode->out_fd,
-			 IPPROTO_TCP,
-			 TCP_NODELAY,
-			 (char *)&one,
-			 sizeof(one));
-	if (ret == -1) {
-		DBG_WARNING("Failed to set TCP_NODELAY on fd - %s\n",
-			  strerror(errno));
-	}
-	ret = setsockopt(tnode->out_fd,
-			 SOL_SOCKET,
-			 SO_KEEPALIVE,(char *)&one,
-			 sizeof(one));
-	if (ret == -1) {
-		DBG_WARNING("Failed to set KEEPALIVE on fd - %s\n",
-			    strerror(errno));
-	}
+	ctdb_tcp_set_sockopts(tnode->out_fd);
 
 	tnode->out_queue = ctdb_queue_setup(node->ctdb,
 					    tnode,
@@ -150,6 +356,16 @@ static void ctdb_node_connect_write(struct tevent_context *ev,
 	/* the queue subsystem now owns this fd */
 	tnode->out_fd = -1;
 
+	ret = ctdb_queue_set_coalesce(tnode->out_queue);
+	if (ret != 0) {
+		DBG_WARNING("Failed to enable packet coalescing\n");
+	}
+
+	if (tnode->num_extra > 0) {
+		ctdb_tcp_start_extra_outgoing(node);
+		return;
+	}
+
 	/*
 	 * Mark the node to which this connection has been established
 	 * as connected, but only if the corresponding listening
@@ -161,43 +377,37 @@ static void ctdb_node_connect_write(struct tevent_context *ev,
 }
 
 
-static void ctdb_tcp_node_connect_timeout(struct tevent_context *ev,
-					  struct tevent_timer *te,
-					  struct timeval t,
-					  void *private_data);
-
 /*
-  called when we should try and establish a tcp connection to a node
+  create a socket and start a non-blocking connect to a node
 */
-static void ctdb_tcp_start_outgoing(struct ctdb_node *node)
+static int ctdb_tcp_connect_socket(struct ctdb_node *node)
 {
-	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
-						      struct ctdb_tcp_node);
 	struct ctdb_context *ctdb = node->ctdb;
         ctdb_sock_addr sock_in;
 	int sockin_size;
 	int sockout_size;
         ctdb_sock_addr sock_out;
+	int fd;
 	int ret;
 
 	sock_out = node->address;
 
-	tnode->out_fd = socket(sock_out.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
-	if (tnode->out_fd == -1) {
+	fd = socket(sock_out.sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+	if (fd == -1) {
 		DBG_ERR("Failed to create socket\n");
-		goto failed;
+		return -1;
 	}
 
-	ret = set_blocking(tnode->out_fd, false);
+	ret = set_blocking(fd, false);
 	if (ret != 0) {
 		DBG_ERR("Failed to set socket non-blocking (%s)\n",
 			strerror(errno));
 		goto failed;
 	}
 
-	set_close_on_exec(tnode->out_fd);
+	set_close_on_exec(fd);
 
-	DBG_DEBUG("Created TCP SOCKET FD:%d\n", tnode->out_fd);
+	DBG_DEBUG("Created TCP SOCKET FD:%d\n", fd);
 
 	/* Bind our side of the socketpair to the same address we use to listen
 	 * on incoming CTDB traffic.
@@ -229,19 +439,40 @@ static void ctdb_tcp_start_outgoing(struct ctdb_node *node)
 		goto failed;
 	}
 
-	ret = bind(tnode->out_fd, (struct sockaddr *)&sock_in, sockin_size);
+	ret = bind(fd, (struct sockaddr *)&sock_in, sockin_size);
 	if (ret == -1) {
 		DBG_ERR("Failed to bind socket (%s)\n", strerror(errno));
 		goto failed;
 	}
 
-	ret = connect(tnode->out_fd,
+	ret = connect(fd,
 		      (struct sockaddr *)&sock_out,
 		      sockout_size);
 	if (ret != 0 && errno != EINPROGRESS) {
 		goto failed;
 	}
 
+	return fd;
+
+failed:
+	close(fd);
+	return -1;
+}
+
+/*
+  called when we should try and establish a tcp connection to a node
+*/
+static void ctdb_tcp_start_outgoing(struct ctdb_node *node)
+{
+	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
+						      struct ctdb_tcp_node);
+	struct ctdb_context *ctdb = node->ctdb;
+
+	tnode->out_fd = ctdb_tcp_connect_socket(node);
+	if (tnode->out_fd == -1) {
+		goto failed;
+	}
+
 	/* non-blocking connect - wait for write event */
 	tnode->connect_fde = tevent_add_fd(node->ctdb->ev,
 					   tnode,
@@ -293,6 +524,41 @@ static void ctdb_tcp_node_connect_timeout(struct tevent_context *ev,
 	ctdb_tcp_start_outgoing(node);
 }
 
+/*
+  set up an additional incoming connection from a node
+*/
+static void ctdb_tcp_extra_incoming(struct ctdb_node *node,
+				    uint32_t i,
+				    int fd,
+				    ctdb_sock_addr *addr)
+{
+	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
+						      struct ctdb_tcp_node);
+	struct ctdb_tcp_conn *conn;
+
+	conn = ctdb_tcp_conn_new(node, tnode->in_extra, i);
+	if (conn == NULL) {
+		DBG_ERR("Memory allocation error\n");
+		close(fd);
+		return;
+	}
+
+	conn->queue = ctdb_queue_setup(node->ctdb,
+				       conn,
+				       fd,
+				       CTDB_TCP_ALIGNMENT,
+				       ctdb_tcp_read_cb,
+				       node,
+				       "ctdbd-%s",
+				       ctdb_addr_to_str(addr));
+	if (conn->queue == NULL) {
+		DBG_ERR("Failed to set up incoming queue\n");
+		close(fd);
+		talloc_free(conn);
+		return;
+	}
+}
+
 /*
   called when we get contacted by another node
   currently makes no attempt to check if the connection is really from a ctdb
@@ -309,6 +575,7 @@ static void ctdb_listen_event(struct tevent_context *ev, struct tevent_fd *fde,
 	int fd;
 	struct ctdb_node *node;
 	struct ctdb_tcp_node *tnode;
+	uint32_t i = 0;
 	int one = 1;
 	int ret;
 
@@ -337,10 +604,19 @@ static void ctdb_listen_event(struct tevent_context *ev, struct tevent_fd *fde,
 	}
 
 	if (tnode->in_queue != NULL) {
-		DBG_ERR("Incoming queue active, rejecting connection from %s\n",
-			ctdb_addr_to_str(&addr));
-		close(fd);
-		return;
+		/* Maybe an additional connection */
+		for (i = 0; i < tnode->num_extra; i++) {
+			if (tnode->in_extra[i] == NULL) {
+				break;
+			}
+		}
+		if (i == tnode->num_extra) {
+			DBG_ERR("Incoming queue active, "
+				"rejecting connection from %s\n",
+				ctdb_addr_to_str(&addr));
+			close(fd);
+			return;
+		}
 	}
 
 	ret = set_blocking(fd, false);
@@ -365,6 +641,11 @@ static void ctdb_listen_event(struct tevent_context *ev, struct tevent_fd *fde,
 			    strerror(errno));
 	}
 
+	if (tnode->in_queue != NULL) {
+		ctdb_tcp_extra_incoming(node, i, fd, &addr);
+		return;
+	}
+
 	tnode->in_queue = ctdb_queue_setup(ctdb,
 					   tnode,
 					   fd,
@@ -383,7 +664,7 @@ static void ctdb_listen_event(struct tevent_context *ev, struct tevent_fd *fde,
 	* Mark the connecting node as connected, but only if the
 	* corresponding outbound connected is also up
 	*/
-	if (tnode->out_queue != NULL) {
+	if (ctdb_tcp_out_ready(tnode)) {
 		node->ctdb->upcalls->node_connected(node);
 	}
  }
@@ -58,6 +58,18 @@ static int ctdb_tcp_add_node(struct ctdb_node *node)
 	tnode->out_fd = -1;
 	tnode->ctdb = node->ctdb;
 
+	if (node->ctdb->node_connections > 1) {
+		tnode->num_extra = node->ctdb->node_connections - 1;
+		tnode->out_extra = talloc_zero_array(tnode,
+						     struct ctdb_tcp_conn *,
+						     tnode->num_extra);
+		CTDB_NO_MEMORY(node->ctdb, tnode->out_extra);
+		tnode->in_extra = talloc_zero_array(tnode,
+						    struct ctdb_tcp_conn *,
+						    tnode->num_extra);
+		CTDB_NO_MEMORY(node->ctdb, tnode->in_extra);
+	}
+
 	node->transport_data = tnode;
 	talloc_set_destructor(tnode, tnode_destructor);
 
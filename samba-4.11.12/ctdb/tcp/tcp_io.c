@@ -80,6 +80,69 @@ failed:
 	TALLOC_FREE(data);
 }
 
+/*
+  Choose the connection for a packet.  All packets about one record go
+  over the same connection, so that they are not reordered.  Everything
+  else uses the main connection.  Packets are only sent once all the
+  connections are up, see ctdb_tcp_out_ready(), so a record never moves
+  to another connection while packets for it are in flight.
+*/
+static struct ctdb_queue *ctdb_tcp_select_queue(struct ctdb_tcp_node *tnode,
+						uint8_t *data,
+						uint32_t length)
+{
+	struct ctdb_req_header *hdr = (struct ctdb_req_header *)data;
+	uint32_t db_id, keylen;
+	uint8_t *key;
+	size_t offset;
+	TDB_DATA k;
+	uint32_t i;
+
+	switch (hdr->operation) {
+	case CTDB_REQ_CALL: {
+		struct ctdb_req_call_old *c =
+			(struct ctdb_req_call_old *)data;
+		offset = offsetof(struct ctdb_req_call_old, data);
+		db_id = c->db_id;
+		keylen = c->keylen;
+		key = c->data;
+		break;
+	}
+	case CTDB_REQ_DMASTER: {
+		struct ctdb_req_dmaster_old *c =
+			(struct ctdb_req_dmaster_old *)data;
+		offset = offsetof(struct ctdb_req_dmaster_old, data);
+		db_id = c->db_id;
+		keylen = c->keylen;
+		key = c->data;
+		break;
+	}
+	case CTDB_REPLY_DMASTER: {
+		struct ctdb_reply_dmaster_old *c =
+			(struct ctdb_reply_dmaster_old *)data;
+		offset = offsetof(struct ctdb_reply_dmaster_old, data);
+		db_id = c->db_id;
+		keylen = c->keylen;
+		key = c->data;
+		break;
+	}
+	default:
+		return tnode->out_queue;
+	}
+
+	if (length < offset || keylen > length - offset) {
+		return tnode->out_queue;
+	}
+
+	k = (TDB_DATA) { .dptr = key, .dsize = keylen };
+	i = (ctdb_hash(&k) ^ db_id) % (tnode->num_extra + 1);
+	if (i == 0) {
+		return tnode->out_queue;
+	}
+
+	return tnode->out_extra[i-1]->queue;
+}
+
 /*
   queue a packet for sending
 */
@@ -87,10 +150,17 @@ int ctdb_tcp_queue_pkt(struct ctdb_node *node, uint8_t *data, uint32_t length)
 {
 	struct ctdb_tcp_node *tnode = talloc_get_type(node->transport_data,
 						      struct ctdb_tcp_node);
-	if (tnode->out_queue == NULL) {
+	struct ctdb_queue *queue;
+
+	if (!ctdb_tcp_out_ready(tnode)) {
 		DBG_DEBUG("No outgoing connection, dropping packet\n");
 		return 0;
 	}
 
-	return ctdb_queue_send(tnode->out_queue, data, length);
+	queue = tnode->out_queue;
+	if (tnode->num_extra > 0) {
+		queue = ctdb_tcp_select_queue(tnode, data, length);
+	}
+
+	return ctdb_queue_send(queue, data, length);
 }
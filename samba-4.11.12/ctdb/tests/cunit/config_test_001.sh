@@ -17,6 +17,7 @@ test_cleanup remove_files
 
 # Get the default values that are dependent on install prefix
 logging_location=$(ctdb-config get "logging" "location")
+cluster_shm_directory=$(ctdb-config get "cluster" "shm directory")
 database_volatile_dbdir=$(ctdb-config get \
 				      "database" \
 				      "volatile database directory")
@@ -35,12 +36,16 @@ ok <<EOF
 	# transport = tcp
 	# node address = 
 	# recovery lock = 
+	# node connections = 1
+	# shm directory = ${cluster_shm_directory}
 [database]
 	# volatile database directory = ${database_volatile_dbdir}
 	# persistent database directory = ${database_persistent_dbdir}
 	# state database directory = ${database_state_dbdir}
 	# lock debug script = 
 	# tdb mutexes = true
+	# lock wait threads = 64
+	# tdb crc32c hash = false
 [event]
 	# debug script = 
 [failover]
@@ -8,3 +8,5 @@ unit_test ctdb_io_test 1
 unit_test ctdb_io_test 2
 unit_test ctdb_io_test 3
 unit_test ctdb_io_test 4
+unit_test ctdb_io_test 5
+unit_test ctdb_io_test 6
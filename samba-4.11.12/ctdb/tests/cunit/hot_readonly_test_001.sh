@@ -0,0 +1,10 @@
+#!/bin/sh
+
+. "${TEST_SCRIPTS_DIR}/unit.sh"
+
+ok_null
+
+unit_test hot_readonly_test 1
+unit_test hot_readonly_test 2
+unit_test hot_readonly_test 3
+unit_test hot_readonly_test 4
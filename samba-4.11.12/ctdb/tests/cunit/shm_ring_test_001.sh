@@ -0,0 +1,11 @@
+#!/bin/sh
+
+. "${TEST_SCRIPTS_DIR}/unit.sh"
+
+ok_null
+
+unit_test shm_ring_test 1
+unit_test shm_ring_test 2
+unit_test shm_ring_test 3
+unit_test shm_ring_test 4
+unit_test shm_ring_test 5
@@ -19,6 +19,7 @@
 
 #include "replace.h"
 #include "system/filesys.h"
+#include "system/network.h"
 
 #include <assert.h>
 
@@ -320,6 +321,170 @@ static void test4(void)
 	TALLOC_FREE(ctdb);
 }
 
+static size_t test5_pending(int fd)
+{
+	int num_ready = 0;
+	int ret;
+
+	ret = ioctl(fd, FIONREAD, &num_ready);
+	assert(ret == 0);
+
+	return num_ready;
+}
+
+static void test5(void)
+{
+	struct ctdb_context *ctdb;
+	struct ctdb_queue *queue;
+	uint8_t pkt[512];
+	uint8_t buf[1024];
+	int sv[2], ret, i;
+	ssize_t n;
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	assert(ret == 0);
+
+	ctdb = talloc_zero(NULL, struct ctdb_context);
+	assert(ctdb != NULL);
+
+	ctdb->ev = tevent_context_init(ctdb);
+	assert(ctdb->ev != NULL);
+
+	ctdb->tunable.queue_coalesce_limit = sizeof(buf);
+
+	queue = ctdb_queue_setup(ctdb, ctdb, sv[0], 0, test_cb,
+				 NULL, "test queue");
+	assert(queue != NULL);
+
+	ret = ctdb_queue_set_coalesce(queue);
+	assert(ret == 0);
+
+	/* small packets wait for the end of the event loop iteration */
+	for (i = 0; i < 3; i++) {
+		memset(pkt, i, 64);
+		*(uint32_t *)pkt = 64;
+		ret = ctdb_queue_send(queue, pkt, 64);
+		assert(ret == 0);
+	}
+
+	assert(queue->out_queue_length == 3);
+	assert(test5_pending(sv[1]) == 0);
+
+	tevent_loop_once(ctdb->ev);
+
+	assert(queue->out_queue == NULL);
+	assert(queue->out_queue_bytes == 0);
+	assert(ctdb->statistics.transport.writes == 1);
+	assert(ctdb->statistics.transport.packets == 3);
+	assert(ctdb->statistics.transport.coalesced_writes == 1);
+
+	n = read(sv[1], buf, sizeof(buf));
+	assert(n == 3 * 64);
+	for (i = 0; i < 3; i++) {
+		assert(*(uint32_t *)(buf + i * 64) == 64);
+		assert(buf[i * 64 + 63] == i);
+	}
+
+	/* reaching the limit writes immediately */
+	memset(pkt, 0, sizeof(pkt));
+	*(uint32_t *)pkt = sizeof(pkt);
+	ret = ctdb_queue_send(queue, pkt, sizeof(pkt));
+	assert(ret == 0);
+	assert(queue->out_queue_length == 1);
+
+	ret = ctdb_queue_send(queue, pkt, sizeof(pkt));
+	assert(ret == 0);
+	assert(queue->out_queue == NULL);
+	assert(ctdb->statistics.transport.limit_flushes == 1);
+	assert(ctdb->statistics.transport.packets == 5);
+
+	n = read(sv[1], buf, sizeof(buf));
+	assert(n == sizeof(buf));
+
+	/* the flush scheduled for the first packet finds nothing to do */
+	tevent_loop_once(ctdb->ev);
+	assert(ctdb->statistics.transport.writes == 2);
+
+	/* a limit of 0 disables coalescing */
+	ctdb->tunable.queue_coalesce_limit = 0;
+	ret = ctdb_queue_send(queue, pkt, 64);
+	assert(ret == 0);
+	assert(queue->out_queue == NULL);
+	assert(test5_pending(sv[1]) == 64);
+
+	close(sv[1]);
+	TALLOC_FREE(ctdb);
+}
+
+/*
+ * Switching coalescing off while a flush is pending must not leave
+ * packets stuck in the queue if the socket is full.
+ */
+static void test6(void)
+{
+	struct ctdb_context *ctdb;
+	struct ctdb_queue *queue;
+	uint8_t pkt[64];
+	uint8_t buf[4096];
+	int sv[2], ret;
+	ssize_t n;
+
+	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	assert(ret == 0);
+	ret = fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	assert(ret == 0);
+	ret = fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	assert(ret == 0);
+
+	ctdb = talloc_zero(NULL, struct ctdb_context);
+	assert(ctdb != NULL);
+
+	ctdb->ev = tevent_context_init(ctdb);
+	assert(ctdb->ev != NULL);
+
+	ctdb->tunable.queue_coalesce_limit = sizeof(buf);
+
+	queue = ctdb_queue_setup(ctdb, ctdb, sv[0], 0, test_cb,
+				 NULL, "test queue");
+	assert(queue != NULL);
+
+	ret = ctdb_queue_set_coalesce(queue);
+	assert(ret == 0);
+
+	memset(pkt, 0, sizeof(pkt));
+	*(uint32_t *)pkt = sizeof(pkt);
+	ret = ctdb_queue_send(queue, pkt, sizeof(pkt));
+	assert(ret == 0);
+	assert(queue->out_queue_length == 1);
+
+	/* fill the socket */
+	do {
+		n = write(sv[0], buf, sizeof(buf));
+	} while (n > 0);
+	assert(errno == EAGAIN || errno == EWOULDBLOCK);
+
+	ctdb->tunable.queue_coalesce_limit = 0;
+
+	tevent_loop_once(ctdb->ev);
+	assert(queue->out_queue_length == 1);
+	assert(tevent_fd_get_flags(queue->fde) & TEVENT_FD_WRITE);
+
+	/* make room, the packet goes out once the socket is writeable */
+	do {
+		n = read(sv[1], buf, sizeof(buf));
+	} while (n > 0);
+
+	tevent_loop_once(ctdb->ev);
+	assert(queue->out_queue == NULL);
+	assert(!(tevent_fd_get_flags(queue->fde) & TEVENT_FD_WRITE));
+
+	n = read(sv[1], buf, sizeof(buf));
+	assert(n == sizeof(pkt));
+
+	close(sv[1]);
+	TALLOC_FREE(ctdb);
+}
+
 int main(int argc, const char **argv)
 {
 	int num;
@@ -348,6 +513,14 @@ int main(int argc, const char **argv)
 		test4();
 		break;
 
+	case 5:
+		test5();
+		break;
+
+	case 6:
+		test6();
+		break;
+
 	default:
 		fprintf(stderr, "Unknown test number %s\n", argv[1]);
 	}
@@ -0,0 +1,280 @@
+/*
+   Automatic readonly delegation tests
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+
+#include <assert.h>
+
+#include "common/db_hash.c"
+#include "common/hash_count.c"
+#include "server/ctdb_hot_readonly.c"
+
+#define KEY1	"this_is_a_test_key"
+#define KEY2	"this_is_another_key"
+
+/* Stubs for the server functions used by ctdb_hot_readonly.c */
+
+static int num_tracking_opens;
+
+int ctdb_open_tracking_db(struct ctdb_context *ctdb,
+			  struct ctdb_db_context *ctdb_db)
+{
+	num_tracking_opens += 1;
+	return 0;
+}
+
+bool ctdb_db_volatile(struct ctdb_db_context *ctdb_db)
+{
+	if ((ctdb_db->db_flags & CTDB_DB_FLAGS_PERSISTENT) ||
+	    (ctdb_db->db_flags & CTDB_DB_FLAGS_REPLICATED)) {
+		return false;
+	}
+	return true;
+}
+
+bool ctdb_db_readonly(struct ctdb_db_context *ctdb_db)
+{
+	return ((ctdb_db->db_flags & CTDB_DB_FLAGS_READONLY) != 0);
+}
+
+static TDB_DATA test_key(const char *str)
+{
+	return (TDB_DATA) {
+		.dptr = discard_const(str),
+		.dsize = strlen(str),
+	};
+}
+
+static struct ctdb_db_context *test_setup(TALLOC_CTX *mem_ctx)
+{
+	struct ctdb_context *ctdb;
+	struct ctdb_db_context *ctdb_db;
+
+	ctdb = talloc_zero(mem_ctx, struct ctdb_context);
+	assert(ctdb != NULL);
+
+	ctdb->ev = tevent_context_init(ctdb);
+	assert(ctdb->ev != NULL);
+
+	ctdb->tunable.readonly_hot_key_reads = 3;
+	ctdb->tunable.readonly_hot_key_revokes = 2;
+	ctdb->tunable.readonly_hot_key_duration = 1;
+
+	ctdb_db = talloc_zero(ctdb, struct ctdb_db_context);
+	assert(ctdb_db != NULL);
+
+	ctdb_db->ctdb = ctdb;
+	ctdb_db->db_name = "test.tdb";
+
+	return ctdb_db;
+}
+
+/*
+ * Only volatile databases without the READONLY flag qualify, and only
+ * if the tunable is set
+ */
+static void test1(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct ctdb_db_context *ctdb_db;
+	TDB_DATA key = test_key(KEY1);
+	int i;
+
+	ctdb_db = test_setup(mem_ctx);
+	assert(ctdb_hot_readonly_enabled(ctdb_db));
+
+	ctdb_db->db_flags = CTDB_DB_FLAGS_PERSISTENT;
+	assert(!ctdb_hot_readonly_enabled(ctdb_db));
+
+	ctdb_db->db_flags = CTDB_DB_FLAGS_REPLICATED;
+	assert(!ctdb_hot_readonly_enabled(ctdb_db));
+
+	ctdb_db->db_flags = CTDB_DB_FLAGS_READONLY;
+	assert(!ctdb_hot_readonly_enabled(ctdb_db));
+
+	ctdb_db->db_flags = 0;
+	ctdb_db->ctdb->tunable.readonly_hot_key_reads = 0;
+	assert(!ctdb_hot_readonly_enabled(ctdb_db));
+
+	for (i = 0; i < 10; i++) {
+		assert(!ctdb_hot_readonly_check(ctdb_db, key));
+	}
+	assert(ctdb_db->hot_readonly == NULL);
+
+	/* Nothing to count before the first read */
+	ctdb_hot_readonly_revoked(ctdb_db, key);
+	assert(ctdb_db->hot_readonly == NULL);
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * A record gets delegations once it is read often enough, other
+ * records are not affected
+ */
+static void test2(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct ctdb_db_context *ctdb_db;
+	TDB_DATA key1 = test_key(KEY1);
+	TDB_DATA key2 = test_key(KEY2);
+	int i;
+
+	ctdb_db = test_setup(mem_ctx);
+	num_tracking_opens = 0;
+
+	assert(!ctdb_hot_readonly_check(ctdb_db, key1));
+	assert(!ctdb_hot_readonly_check(ctdb_db, key1));
+	assert(num_tracking_opens == 0);
+
+	for (i = 0; i < 5; i++) {
+		assert(ctdb_hot_readonly_check(ctdb_db, key1));
+	}
+	assert(num_tracking_opens == 5);
+
+	assert(!ctdb_hot_readonly_check(ctdb_db, key2));
+	assert(!ctdb_hot_readonly_check(ctdb_db, key2));
+	assert(ctdb_hot_readonly_check(ctdb_db, key2));
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * A record revoked too often goes back to migration, even if it is
+ * still read a lot
+ */
+static void test3(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct ctdb_db_context *ctdb_db;
+	TDB_DATA key1 = test_key(KEY1);
+	TDB_DATA key2 = test_key(KEY2);
+	int i;
+
+	ctdb_db = test_setup(mem_ctx);
+
+	for (i = 0; i < 3; i++) {
+		(void) ctdb_hot_readonly_check(ctdb_db, key1);
+		(void) ctdb_hot_readonly_check(ctdb_db, key2);
+	}
+	assert(ctdb_hot_readonly_check(ctdb_db, key1));
+	assert(ctdb_hot_readonly_check(ctdb_db, key2));
+
+	/* Below the cut-off */
+	ctdb_hot_readonly_revoked(ctdb_db, key1);
+	assert(ctdb_hot_readonly_check(ctdb_db, key1));
+
+	ctdb_hot_readonly_revoked(ctdb_db, key1);
+	for (i = 0; i < 10; i++) {
+		assert(!ctdb_hot_readonly_check(ctdb_db, key1));
+	}
+
+	assert(ctdb_hot_readonly_check(ctdb_db, key2));
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * Both states end ReadOnlyHotKeyDuration seconds after they last
+ * applied, and the cleanup removes them
+ */
+static void test4(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct ctdb_db_context *ctdb_db;
+	struct ctdb_hot_readonly *hot;
+	TDB_DATA key1 = test_key(KEY1);
+	TDB_DATA key2 = test_key(KEY2);
+	int ret, i;
+
+	ctdb_db = test_setup(mem_ctx);
+
+	/* key1 is hot, key2 is revoked too often */
+	for (i = 0; i < 3; i++) {
+		(void) ctdb_hot_readonly_check(ctdb_db, key1);
+		(void) ctdb_hot_readonly_check(ctdb_db, key2);
+	}
+	ctdb_hot_readonly_revoked(ctdb_db, key2);
+	ctdb_hot_readonly_revoked(ctdb_db, key2);
+	assert(ctdb_hot_readonly_check(ctdb_db, key1));
+	assert(!ctdb_hot_readonly_check(ctdb_db, key2));
+
+	hot = ctdb_db->hot_readonly;
+	assert(hot != NULL);
+
+	/* Still valid, cleanup keeps them */
+	ctdb_hot_readonly_cleandb_event(ctdb_db->ctdb->ev, NULL,
+					timeval_current(), hot);
+	ret = db_hash_exists(hot->keys, key1.dptr, key1.dsize);
+	assert(ret == 0);
+	ret = db_hash_exists(hot->keys, key2.dptr, key2.dsize);
+	assert(ret == 0);
+
+	sleep(2);
+
+	/* Expired, a single read does not make key1 hot again */
+	assert(!ctdb_hot_readonly_check(ctdb_db, key1));
+
+	ctdb_hot_readonly_cleandb_event(ctdb_db->ctdb->ev, NULL,
+					timeval_current(), hot);
+	ret = db_hash_exists(hot->keys, key1.dptr, key1.dsize);
+	assert(ret == ENOENT);
+	ret = db_hash_exists(hot->keys, key2.dptr, key2.dsize);
+	assert(ret == ENOENT);
+
+	/* key2 gets delegations again once it is read often enough */
+	assert(!ctdb_hot_readonly_check(ctdb_db, key2));
+	assert(!ctdb_hot_readonly_check(ctdb_db, key2));
+	assert(ctdb_hot_readonly_check(ctdb_db, key2));
+
+	talloc_free(mem_ctx);
+}
+
+int main(int argc, const char **argv)
+{
+	int num;
+
+	if (argc != 2) {
+		fprintf(stderr, "%s <testnum>\n", argv[0]);
+		exit(1);
+	}
+
+	num = atoi(argv[1]);
+	switch (num) {
+	case 1:
+		test1();
+		break;
+
+	case 2:
+		test2();
+		break;
+
+	case 3:
+		test3();
+		break;
+
+	case 4:
+		test4();
+		break;
+
+	default:
+		fprintf(stderr, "Unknown test %d\n", num);
+		exit(1);
+	}
+
+	return 0;
+}
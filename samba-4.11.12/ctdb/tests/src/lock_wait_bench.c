@@ -0,0 +1,418 @@
+/*
+   Compare the cost of waiting for a contended record lock in a lock
+   helper process with waiting in a thread
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/wait.h"
+
+#include <talloc.h>
+#include <tevent.h>
+#include <tdb.h>
+#include <assert.h>
+
+#include "lib/util/time.h"
+#include "lib/util/sys_rw.h"
+
+#ifdef WITH_PTHREADPOOL
+#include "lib/pthreadpool/pthreadpool_tevent.h"
+#endif
+
+/*
+ * A holder process takes the chain lock of a hot record.  For each
+ * iteration, the main process finds the record locked, starts waiting
+ * for it and asks the holder to let go.  The time measured is from the
+ * start of the wait until the main process is told the lock is free,
+ * which is the latency ctdbd adds to every contended record lock.
+ *
+ * The helper variant forks a child that reopens the database and blocks
+ * in tdb_chainlock(), as ctdb_lock_helper does, but without the exec.
+ * The real helper is therefore somewhat slower than measured here.
+ */
+
+struct bench_state {
+	struct tevent_context *ev;
+	struct tdb_context *tdb;
+	TDB_DATA key;
+	int to_holder;
+	int from_holder;
+#ifdef WITH_PTHREADPOOL
+	struct pthreadpool_tevent *pool;
+#endif
+	bool done;
+	int err;
+};
+
+static void holder_loop(struct tdb_context *tdb, TDB_DATA key,
+			int cmd_fd, int reply_fd)
+{
+	char c;
+
+	if (tdb_reopen(tdb) != 0) {
+		fprintf(stderr, "holder: failed to reopen database\n");
+		_exit(1);
+	}
+
+	while (sys_read(cmd_fd, &c, 1) == 1) {
+		if (c == 'l') {
+			if (tdb_chainlock(tdb, key) != 0) {
+				_exit(1);
+			}
+			sys_write(reply_fd, &c, 1);
+		} else {
+			tdb_chainunlock(tdb, key);
+		}
+	}
+
+	tdb_close(tdb);
+	_exit(0);
+}
+
+static int holder_lock(struct bench_state *state)
+{
+	char c = 'l';
+
+	if (sys_write(state->to_holder, &c, 1) != 1) {
+		return EIO;
+	}
+	if (sys_read(state->from_holder, &c, 1) != 1) {
+		return EIO;
+	}
+
+	if (tdb_chainlock_nonblock(state->tdb, state->key) == 0) {
+		fprintf(stderr, "record not locked by holder\n");
+		tdb_chainunlock(state->tdb, state->key);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static void holder_unlock(struct bench_state *state)
+{
+	char c = 'u';
+
+	sys_write(state->to_holder, &c, 1);
+}
+
+static void wait_start(struct bench_state *state)
+{
+	state->done = false;
+	state->err = 0;
+}
+
+static int wait_until_done(struct bench_state *state)
+{
+	while (!state->done) {
+		if (tevent_loop_once(state->ev) != 0) {
+			return errno;
+		}
+	}
+
+	return state->err;
+}
+
+static void print_result(const char *name, int num_locks, double t)
+{
+	printf("%-8s %d locks in %.3f secs, %.0f locks/sec, "
+	       "%.1f usec avg latency\n",
+	       name, num_locks, t, num_locks / t, t * 1.0e6 / num_locks);
+}
+
+/*
+ * Wait in a child process
+ */
+
+static void helper_handler(struct tevent_context *ev,
+			   struct tevent_fd *fde,
+			   uint16_t flags,
+			   void *private_data)
+{
+	struct bench_state *state = talloc_get_type_abort(
+		private_data, struct bench_state);
+
+	state->done = true;
+}
+
+static int helper_wait_once(struct bench_state *state)
+{
+	struct tevent_fd *fde;
+	int fd[2];
+	pid_t pid;
+	char c = 0;
+	int ret;
+
+	ret = pipe(fd);
+	if (ret != 0) {
+		return errno;
+	}
+
+	wait_start(state);
+
+	pid = fork();
+	if (pid == -1) {
+		ret = errno;
+		close(fd[0]);
+		close(fd[1]);
+		return ret;
+	}
+
+	if (pid == 0) {
+		close(fd[0]);
+		if (tdb_reopen(state->tdb) != 0 ||
+		    tdb_chainlock(state->tdb, state->key) != 0) {
+			_exit(1);
+		}
+		sys_write(fd[1], &c, 1);
+		while (true) {
+			pause();
+		}
+	}
+
+	close(fd[1]);
+
+	fde = tevent_add_fd(state->ev, state, fd[0], TEVENT_FD_READ,
+			    helper_handler, state);
+	if (fde == NULL) {
+		ret = ENOMEM;
+		goto done;
+	}
+
+	holder_unlock(state);
+
+	ret = wait_until_done(state);
+	if (ret == 0 && sys_read(fd[0], &c, 1) != 1) {
+		ret = EIO;
+	}
+
+done:
+	TALLOC_FREE(fde);
+	close(fd[0]);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return ret;
+}
+
+static int bench_helper(struct bench_state *state, int num_locks)
+{
+	struct timeval start;
+	double t = 0;
+	int i, ret;
+
+	for (i = 0; i < num_locks; i++) {
+		ret = holder_lock(state);
+		if (ret != 0) {
+			return ret;
+		}
+
+		start = timeval_current();
+		ret = helper_wait_once(state);
+		if (ret != 0) {
+			return ret;
+		}
+		t += timeval_elapsed(&start);
+	}
+
+	print_result("helper", num_locks, t);
+	return 0;
+}
+
+/*
+ * Wait in a thread
+ */
+
+#ifdef WITH_PTHREADPOOL
+
+static void thread_job(void *private_data)
+{
+	struct bench_state *state = talloc_get_type_abort(
+		private_data, struct bench_state);
+
+	if (tdb_chainlock_wait(state->tdb, state->key) != 0) {
+		state->err = errno;
+	}
+}
+
+static void thread_done(struct tevent_req *req)
+{
+	struct bench_state *state = tevent_req_callback_data(
+		req, struct bench_state);
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(req);
+	TALLOC_FREE(req);
+	if (ret != 0) {
+		state->err = ret;
+	}
+	state->done = true;
+}
+
+static int thread_wait_once(struct bench_state *state)
+{
+	struct tevent_req *req;
+	int ret;
+
+	wait_start(state);
+	req = pthreadpool_tevent_job_send(state, state->ev, state->pool,
+					  thread_job, state);
+	if (req == NULL) {
+		return ENOMEM;
+	}
+	tevent_req_set_callback(req, thread_done, state);
+
+	holder_unlock(state);
+
+	while (true) {
+		ret = wait_until_done(state);
+		if (ret != 0) {
+			return ret;
+		}
+
+		/* As ctdbd does, take the lock in the main thread */
+		if (tdb_chainlock_nonblock(state->tdb, state->key) == 0) {
+			tdb_chainunlock(state->tdb, state->key);
+			return 0;
+		}
+
+		wait_start(state);
+		req = pthreadpool_tevent_job_send(state, state->ev,
+						  state->pool,
+						  thread_job, state);
+		if (req == NULL) {
+			return ENOMEM;
+		}
+		tevent_req_set_callback(req, thread_done, state);
+	}
+}
+
+static int bench_thread(struct bench_state *state, int num_locks)
+{
+	struct timeval start;
+	double t = 0;
+	int i, ret;
+
+	ret = pthreadpool_tevent_init(state, 1, &state->pool);
+	if (ret != 0) {
+		return ret;
+	}
+
+	for (i = 0; i < num_locks; i++) {
+		ret = holder_lock(state);
+		if (ret != 0) {
+			return ret;
+		}
+
+		start = timeval_current();
+		ret = thread_wait_once(state);
+		if (ret != 0) {
+			return ret;
+		}
+		t += timeval_elapsed(&start);
+	}
+
+	print_result("thread", num_locks, t);
+	return 0;
+}
+
+#else
+
+static int bench_thread(struct bench_state *state, int num_locks)
+{
+	printf("thread   skipped, built without pthreadpool\n");
+	return 0;
+}
+
+#endif /* WITH_PTHREADPOOL */
+
+int main(int argc, const char *argv[])
+{
+	struct bench_state *state;
+	const char *tdb_file;
+	uint32_t val = 0;
+	int to_holder[2], from_holder[2];
+	int num_locks = 1000;
+	pid_t holder;
+	int ret;
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: %s <tdb file> [<num_locks>]\n",
+			argv[0]);
+		exit(1);
+	}
+
+	if (argc == 3) {
+		num_locks = atoi(argv[2]);
+		if (num_locks <= 0) {
+			fprintf(stderr, "Invalid number of locks %s\n",
+				argv[2]);
+			exit(1);
+		}
+	}
+
+	state = talloc_zero(NULL, struct bench_state);
+	assert(state != NULL);
+
+	tdb_file = argv[1];
+	state->key.dptr = (uint8_t *)&val;
+	state->key.dsize = sizeof(val);
+
+	state->ev = tevent_context_init(state);
+	assert(state->ev != NULL);
+
+	state->tdb = tdb_open(tdb_file, 0, TDB_DEFAULT,
+			      O_CREAT|O_TRUNC|O_RDWR, 0600);
+	if (state->tdb == NULL) {
+		fprintf(stderr, "Failed to open %s\n", tdb_file);
+		exit(1);
+	}
+
+	ret = pipe(to_holder);
+	assert(ret == 0);
+	ret = pipe(from_holder);
+	assert(ret == 0);
+
+	holder = fork();
+	assert(holder != -1);
+
+	if (holder == 0) {
+		close(to_holder[1]);
+		close(from_holder[0]);
+		holder_loop(state->tdb, state->key,
+			    to_holder[0], from_holder[1]);
+	}
+
+	close(to_holder[0]);
+	close(from_holder[1]);
+	state->to_holder = to_holder[1];
+	state->from_holder = from_holder[0];
+
+	ret = bench_helper(state, num_locks);
+	if (ret == 0) {
+		ret = bench_thread(state, num_locks);
+	}
+	if (ret != 0) {
+		fprintf(stderr, "Benchmark failed, ret=%d\n", ret);
+	}
+
+	close(state->to_holder);
+	waitpid(holder, NULL, 0);
+
+	tdb_close(state->tdb);
+	talloc_free(state);
+
+	return (ret == 0 ? 0 : 1);
+}
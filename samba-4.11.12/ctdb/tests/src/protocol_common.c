@@ -126,6 +126,7 @@ void fill_ctdb_statistics(TALLOC_CTX *mem_ctx, struct ctdb_statistics *p)
 	p->locks.num_current = rand32();
 	p->locks.num_pending = rand32();
 	p->locks.num_failed = rand32();
+	p->locks.num_wait_fallbacks = rand32();
 	fill_ctdb_latency_counter(&p->locks.latency);
 	for (i=0; i<MAX_COUNT_BUCKETS; i++) {
 		p->locks.buckets[i] = rand32();
@@ -148,6 +149,10 @@ void fill_ctdb_statistics(TALLOC_CTX *mem_ctx, struct ctdb_statistics *p)
 	fill_ctdb_timeval(&p->statistics_current_time);
 	p->total_ro_delegations = rand32();
 	p->total_ro_revokes = rand32();
+	p->transport.writes = rand32();
+	p->transport.packets = rand32();
+	p->transport.coalesced_writes = rand32();
+	p->transport.limit_flushes = rand32();
 }
 
 void verify_ctdb_statistics(struct ctdb_statistics *p1,
@@ -189,6 +194,7 @@ void verify_ctdb_statistics(struct ctdb_statistics *p1,
 	assert(p1->locks.num_current == p2->locks.num_current);
 	assert(p1->locks.num_pending == p2->locks.num_pending);
 	assert(p1->locks.num_failed == p2->locks.num_failed);
+	assert(p1->locks.num_wait_fallbacks == p2->locks.num_wait_fallbacks);
 	verify_ctdb_latency_counter(&p1->locks.latency, &p2->locks.latency);
 	for (i=0; i<MAX_COUNT_BUCKETS; i++) {
 		assert(p1->locks.buckets[i] == p2->locks.buckets[i]);
@@ -214,6 +220,11 @@ void verify_ctdb_statistics(struct ctdb_statistics *p1,
 			    &p2->statistics_current_time);
 	assert(p1->total_ro_delegations == p2->total_ro_delegations);
 	assert(p1->total_ro_revokes == p2->total_ro_revokes);
+	assert(p1->transport.writes == p2->transport.writes);
+	assert(p1->transport.packets == p2->transport.packets);
+	assert(p1->transport.coalesced_writes ==
+	       p2->transport.coalesced_writes);
+	assert(p1->transport.limit_flushes == p2->transport.limit_flushes);
 }
 
 void fill_ctdb_vnn_map(TALLOC_CTX *mem_ctx, struct ctdb_vnn_map *p)
@@ -323,6 +334,26 @@ void verify_ctdb_db_vacuum(struct ctdb_db_vacuum *p1,
 	verify_ctdb_bool(&p1->full_vacuum_run, &p2->full_vacuum_run);
 }
 
+void fill_ctdb_pulldb_changed(TALLOC_CTX *mem_ctx,
+			      struct ctdb_pulldb_changed *p)
+{
+	fill_ctdb_uint32(&p->num_records);
+	fill_ctdb_uint32(&p->num_skipped);
+	fill_ctdb_uint32(&p->generation);
+	fill_ctdb_uint32(&p->dmaster);
+	fill_ctdb_uint64(&p->rsn);
+}
+
+void verify_ctdb_pulldb_changed(struct ctdb_pulldb_changed *p1,
+				struct ctdb_pulldb_changed *p2)
+{
+	verify_ctdb_uint32(&p1->num_records, &p2->num_records);
+	verify_ctdb_uint32(&p1->num_skipped, &p2->num_skipped);
+	verify_ctdb_uint32(&p1->generation, &p2->generation);
+	verify_ctdb_uint32(&p1->dmaster, &p2->dmaster);
+	verify_ctdb_uint64(&p1->rsn, &p2->rsn);
+}
+
 void fill_ctdb_ltdb_header(struct ctdb_ltdb_header *p)
 {
 	p->rsn = rand64();
@@ -656,6 +687,11 @@ void fill_ctdb_tunable_list(TALLOC_CTX *mem_ctx, struct ctdb_tunable_list *p)
 	p->queue_buffer_size = rand32();
 	p->ip_alloc_algorithm = rand32();
 	p->allow_mixed_versions = rand32();
+	p->readonly_hot_key_reads = rand32();
+	p->readonly_hot_key_revokes = rand32();
+	p->readonly_hot_key_duration = rand32();
+	p->queue_coalesce_limit = rand32();
+	p->rec_delta_pull = rand32();
 }
 
 void verify_ctdb_tunable_list(struct ctdb_tunable_list *p1,
@@ -723,6 +759,12 @@ void verify_ctdb_tunable_list(struct ctdb_tunable_list *p1,
 	assert(p1->queue_buffer_size == p2->queue_buffer_size);
 	assert(p1->ip_alloc_algorithm == p2->ip_alloc_algorithm);
 	assert(p1->allow_mixed_versions == p2->allow_mixed_versions);
+	assert(p1->readonly_hot_key_reads == p2->readonly_hot_key_reads);
+	assert(p1->readonly_hot_key_revokes == p2->readonly_hot_key_revokes);
+	assert(p1->readonly_hot_key_duration ==
+	       p2->readonly_hot_key_duration);
+	assert(p1->queue_coalesce_limit == p2->queue_coalesce_limit);
+	assert(p1->rec_delta_pull == p2->rec_delta_pull);
 }
 
 void fill_ctdb_tickle_list(TALLOC_CTX *mem_ctx, struct ctdb_tickle_list *p)
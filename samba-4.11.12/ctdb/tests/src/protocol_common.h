@@ -68,6 +68,11 @@ void fill_ctdb_db_vacuum(TALLOC_CTX *mem_ctx, struct ctdb_db_vacuum *p);
 void verify_ctdb_db_vacuum(struct ctdb_db_vacuum *p1,
 			   struct ctdb_db_vacuum *p2);
 
+void fill_ctdb_pulldb_changed(TALLOC_CTX *mem_ctx,
+			      struct ctdb_pulldb_changed *p);
+void verify_ctdb_pulldb_changed(struct ctdb_pulldb_changed *p1,
+				struct ctdb_pulldb_changed *p2);
+
 void fill_ctdb_ltdb_header(struct ctdb_ltdb_header *p);
 void verify_ctdb_ltdb_header(struct ctdb_ltdb_header *p1,
 			     struct ctdb_ltdb_header *p2);
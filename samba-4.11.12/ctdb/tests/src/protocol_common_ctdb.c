@@ -600,6 +600,12 @@ void fill_ctdb_req_control_data(TALLOC_CTX *mem_ctx,
 		assert(cd->data.db_vacuum != NULL);
 		fill_ctdb_db_vacuum(mem_ctx, cd->data.db_vacuum);
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		cd->data.pulldb_ext = talloc(mem_ctx, struct ctdb_pulldb_ext);
+		assert(cd->data.pulldb_ext != NULL);
+		fill_ctdb_pulldb_ext(mem_ctx, cd->data.pulldb_ext);
+		break;
 	}
 }
 
@@ -994,6 +1000,11 @@ void verify_ctdb_req_control_data(struct ctdb_req_control_data *cd,
 	case CTDB_CONTROL_DB_VACUUM:
 		verify_ctdb_db_vacuum(cd->data.db_vacuum, cd2->data.db_vacuum);
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		verify_ctdb_pulldb_ext(cd->data.pulldb_ext,
+				       cd2->data.pulldb_ext);
+		break;
 	}
 }
 
@@ -1393,6 +1404,13 @@ void fill_ctdb_reply_control_data(TALLOC_CTX *mem_ctx,
 
 	case CTDB_CONTROL_DB_VACUUM:
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		cd->data.pulldb_changed = talloc(mem_ctx,
+						 struct ctdb_pulldb_changed);
+		assert(cd->data.pulldb_changed != NULL);
+		fill_ctdb_pulldb_changed(mem_ctx, cd->data.pulldb_changed);
+		break;
 	}
 }
 
@@ -1733,6 +1751,11 @@ void verify_ctdb_reply_control_data(struct ctdb_reply_control_data *cd,
 
 	case CTDB_CONTROL_DB_VACUUM:
 		break;
+
+	case CTDB_CONTROL_DB_PULL_CHANGED:
+		verify_ctdb_pulldb_changed(cd->data.pulldb_changed,
+					   cd2->data.pulldb_changed);
+		break;
 	}
 }
 
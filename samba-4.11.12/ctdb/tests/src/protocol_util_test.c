@@ -283,6 +283,142 @@ static void test_connection_list_read_bad(const char *s1)
 	talloc_free(tmp_ctx);
 }
 
+/*
+ * Test skipping of records with DB_PULL_CHANGED
+ */
+
+#define PULL_GENERATION	0x12345678
+#define PULL_DMASTER	0
+#define PULL_RSN	100
+
+static void test_pulldb_changed_skip(void)
+{
+	struct ctdb_pulldb_changed last = {
+		.generation = PULL_GENERATION,
+		.dmaster = PULL_DMASTER,
+		.rsn = PULL_RSN,
+	};
+	struct ctdb_ltdb_header header = {
+		.rsn = PULL_RSN,
+		.dmaster = PULL_DMASTER,
+	};
+	TDB_DATA data = {
+		.dptr = (uint8_t *)&header,
+		.dsize = sizeof(header),
+	};
+
+	/* Unchanged since the last recovery */
+	assert(ctdb_pulldb_changed_skip(&last, 1, data));
+	assert(ctdb_pulldb_changed_skip(&last, 2, data));
+
+	/* The dmaster of the last recovery always sends all records */
+	assert(! ctdb_pulldb_changed_skip(&last, PULL_DMASTER, data));
+
+	/* Migrated to node 1 after the last recovery */
+	header.rsn = PULL_RSN + 1;
+	header.dmaster = 1;
+	assert(! ctdb_pulldb_changed_skip(&last, 1, data));
+	assert(! ctdb_pulldb_changed_skip(&last, 2, data));
+
+	/* Migrated away and back, the rsn tells */
+	header.dmaster = PULL_DMASTER;
+	assert(! ctdb_pulldb_changed_skip(&last, 1, data));
+
+	/* Same rsn, different dmaster */
+	header.rsn = PULL_RSN;
+	header.dmaster = 2;
+	assert(! ctdb_pulldb_changed_skip(&last, 1, data));
+
+	/* No record header */
+	header.dmaster = PULL_DMASTER;
+	data.dsize = sizeof(header) - 1;
+	assert(! ctdb_pulldb_changed_skip(&last, 1, data));
+	data.dsize = sizeof(header);
+	assert(ctdb_pulldb_changed_skip(&last, 1, data));
+
+	/* No last recovery, e.g. after a restart */
+	last.generation = INVALID_GENERATION;
+	last.dmaster = CTDB_UNKNOWN_PNN;
+	last.rsn = 0;
+	header.rsn = 0;
+	header.dmaster = CTDB_UNKNOWN_PNN;
+	assert(! ctdb_pulldb_changed_skip(&last, 1, data));
+}
+
+/*
+ * Test confirming the skipped records, otherwise the node is pulled
+ * again in full
+ */
+
+static void test_pulldb_changed_set(struct ctdb_pulldb_changed *pulled,
+				    uint32_t num_skipped,
+				    uint32_t generation,
+				    uint32_t dmaster,
+				    uint64_t rsn)
+{
+	*pulled = (struct ctdb_pulldb_changed) {
+		.num_records = 10,
+		.num_skipped = num_skipped,
+		.generation = generation,
+		.dmaster = dmaster,
+		.rsn = rsn,
+	};
+}
+
+static void test_pulldb_changed_confirmed(void)
+{
+	struct ctdb_pulldb_changed pulled[3];
+	uint32_t pnn_list[3] = { 0, 1, 2 };
+	uint32_t pnn_list_no_dmaster[2] = { 1, 2 };
+	unsigned int i;
+
+	/* All nodes agree on the last recovery */
+	test_pulldb_changed_set(&pulled[0], 0,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	test_pulldb_changed_set(&pulled[1], 5,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	test_pulldb_changed_set(&pulled[2], 5,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	for (i=0; i<3; i++) {
+		assert(ctdb_pulldb_changed_confirmed(pulled, pnn_list, 3, i));
+	}
+
+	/* The dmaster of the last recovery takes no part */
+	test_pulldb_changed_set(&pulled[0], 5,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	test_pulldb_changed_set(&pulled[1], 0,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	assert(! ctdb_pulldb_changed_confirmed(
+		       pulled, pnn_list_no_dmaster, 2, 0));
+	assert(ctdb_pulldb_changed_confirmed(
+		       pulled, pnn_list_no_dmaster, 2, 1));
+
+	/* Node 2 missed the last recovery */
+	test_pulldb_changed_set(&pulled[0], 0,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	test_pulldb_changed_set(&pulled[1], 5,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	test_pulldb_changed_set(&pulled[2], 5,
+				PULL_GENERATION - 1, PULL_DMASTER, PULL_RSN);
+	assert(ctdb_pulldb_changed_confirmed(pulled, pnn_list, 3, 0));
+	assert(ctdb_pulldb_changed_confirmed(pulled, pnn_list, 3, 1));
+	assert(! ctdb_pulldb_changed_confirmed(pulled, pnn_list, 3, 2));
+
+	/* The dmaster was restarted and lost the last recovery */
+	test_pulldb_changed_set(&pulled[0], 0,
+				INVALID_GENERATION, CTDB_UNKNOWN_PNN, 0);
+	test_pulldb_changed_set(&pulled[2], 5,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN);
+	for (i=1; i<3; i++) {
+		assert(! ctdb_pulldb_changed_confirmed(pulled, pnn_list, 3, i));
+	}
+
+	/* Same generation, different rsn */
+	test_pulldb_changed_set(&pulled[0], 0,
+				PULL_GENERATION, PULL_DMASTER, PULL_RSN + 1);
+	assert(! ctdb_pulldb_changed_confirmed(pulled, pnn_list, 3, 1));
+}
+
 /*
  * Use macros for these to make them easy to concatenate
  */
@@ -394,5 +530,8 @@ int main(int argc, char *argv[])
 				      "# Comment\n\n127.0.0.1: 127.0.0.1:124\n"
 				      CONN6);
 
+	test_pulldb_changed_skip();
+	test_pulldb_changed_confirmed();
+
 	return 0;
 }
@@ -0,0 +1,371 @@
+/*
+   shm_ring tests
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/wait.h"
+
+#include <sys/mman.h>
+#include <assert.h>
+
+#include "lib/util/sys_rw.h"
+
+#include "shm/shm_ring.c"
+
+static struct shm_ring *test_setup(TALLOC_CTX *mem_ctx, uint32_t size)
+{
+	struct shm_ring *ring;
+	void *buf;
+
+	buf = talloc_zero_size(mem_ctx, shm_ring_mapsize(size));
+	assert(buf != NULL);
+
+	ring = shm_ring_init(mem_ctx, buf, size);
+	assert(ring != NULL);
+
+	return ring;
+}
+
+/*
+ * Sizes must be a power of 2 and attach must reject foreign memory
+ */
+static void test1(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct shm_ring *ring;
+	size_t len = shm_ring_mapsize(64);
+	void *buf;
+
+	buf = talloc_zero_size(mem_ctx, len);
+	assert(buf != NULL);
+
+	assert(shm_ring_init(mem_ctx, buf, 0) == NULL);
+	assert(shm_ring_init(mem_ctx, buf, 100) == NULL);
+
+	assert(shm_ring_attach(mem_ctx, buf, len) == NULL);
+
+	ring = shm_ring_init(mem_ctx, buf, 64);
+	assert(ring != NULL);
+	assert(shm_ring_size(ring) == 64);
+
+	assert(shm_ring_attach(mem_ctx, buf, len - 1) == NULL);
+	ring = shm_ring_attach(mem_ctx, buf, len);
+	assert(ring != NULL);
+	assert(shm_ring_size(ring) == 64);
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * Writes stop when the ring is full and data comes out in order across
+ * the end of the ring
+ */
+static void test2(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct shm_ring *ring;
+	uint8_t in[100], out[100];
+	bool wakeup;
+	uint32_t n, i, j;
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = i;
+	}
+
+	ring = test_setup(mem_ctx, 64);
+
+	n = shm_ring_write(ring, in, sizeof(in), &wakeup);
+	assert(n == 64);
+	assert(!wakeup);
+	assert(shm_ring_used(ring) == 64);
+
+	n = shm_ring_write(ring, in, sizeof(in), &wakeup);
+	assert(n == 0);
+
+	n = shm_ring_read(ring, out, 40, &wakeup);
+	assert(n == 40);
+	assert(!wakeup);
+	assert(memcmp(out, in, 40) == 0);
+
+	/* Wraps at the end of the ring */
+	n = shm_ring_write(ring, in + 64, 36, &wakeup);
+	assert(n == 36);
+	assert(shm_ring_used(ring) == 60);
+
+	n = shm_ring_peek(ring, out, 4);
+	assert(n == 4);
+	assert(memcmp(out, in + 40, 4) == 0);
+	assert(shm_ring_used(ring) == 60);
+
+	n = shm_ring_read(ring, out, sizeof(out), &wakeup);
+	assert(n == 60);
+	assert(memcmp(out, in + 40, 60) == 0);
+	assert(shm_ring_used(ring) == 0);
+
+	n = shm_ring_read(ring, out, sizeof(out), &wakeup);
+	assert(n == 0);
+
+	/* Lots of odd sized chunks, going around many times */
+	for (i = 0; i < 1000; i++) {
+		uint32_t len = (i % 63) + 1;
+
+		for (j = 0; j < len; j++) {
+			in[j] = i + j;
+		}
+		n = shm_ring_write(ring, in, len, &wakeup);
+		assert(n == len);
+		n = shm_ring_read(ring, out, sizeof(out), &wakeup);
+		assert(n == len);
+		assert(memcmp(out, in, len) == 0);
+	}
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * The positions keep working when they wrap at 2^32
+ */
+static void test3(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct shm_ring *ring;
+	uint8_t in[48], out[48];
+	bool wakeup;
+	uint32_t n, i;
+
+	for (i = 0; i < sizeof(in); i++) {
+		in[i] = 0xff - i;
+	}
+
+	ring = test_setup(mem_ctx, 64);
+	ring->shared->head = UINT32_MAX - 10;
+	ring->shared->tail = UINT32_MAX - 10;
+
+	n = shm_ring_write(ring, in, sizeof(in), &wakeup);
+	assert(n == sizeof(in));
+	assert(ring->shared->head < ring->shared->tail);
+	assert(shm_ring_used(ring) == sizeof(in));
+
+	n = shm_ring_write(ring, in, sizeof(in), &wakeup);
+	assert(n == 64 - sizeof(in));
+
+	n = shm_ring_read(ring, out, sizeof(out), &wakeup);
+	assert(n == sizeof(out));
+	assert(memcmp(out, in, sizeof(out)) == 0);
+
+	n = shm_ring_read(ring, out, sizeof(out), &wakeup);
+	assert(n == 64 - sizeof(in));
+	assert(memcmp(out, in, n) == 0);
+
+	/* A corrupt head looks like an empty ring */
+	ring->shared->head = ring->shared->tail + 65;
+	assert(shm_ring_used(ring) == 0);
+	n = shm_ring_write(ring, in, sizeof(in), &wakeup);
+	assert(n == 0);
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * A side that waits is woken up exactly once
+ */
+static void test4(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	struct shm_ring *ring;
+	uint8_t buf[64] = { 0 };
+	bool wakeup;
+	uint32_t n;
+
+	ring = test_setup(mem_ctx, 64);
+
+	/* Reader waits for data */
+	assert(shm_ring_wait_data(ring, 1));
+
+	n = shm_ring_write(ring, buf, 10, &wakeup);
+	assert(n == 10);
+	assert(wakeup);
+
+	n = shm_ring_write(ring, buf, 10, &wakeup);
+	assert(n == 10);
+	assert(!wakeup);
+
+	/* Data is there, no need to wait */
+	assert(!shm_ring_wait_data(ring, 20));
+	n = shm_ring_write(ring, buf, 10, &wakeup);
+	assert(n == 10);
+	assert(!wakeup);
+
+	/* Not enough data, wait for more */
+	assert(shm_ring_wait_data(ring, 31));
+	n = shm_ring_write(ring, buf, 1, &wakeup);
+	assert(n == 1);
+	assert(wakeup);
+	assert(!shm_ring_wait_data(ring, 31));
+
+	/* Fill the ring, writer waits for space */
+	n = shm_ring_write(ring, buf, sizeof(buf), &wakeup);
+	assert(n == 33);
+	assert(shm_ring_wait_space(ring));
+
+	n = shm_ring_read(ring, buf, 1, &wakeup);
+	assert(n == 1);
+	assert(wakeup);
+
+	n = shm_ring_read(ring, buf, 1, &wakeup);
+	assert(n == 1);
+	assert(!wakeup);
+
+	/* Space is there, no need to wait */
+	assert(!shm_ring_wait_space(ring));
+
+	talloc_free(mem_ctx);
+}
+
+/*
+ * Stream data between two processes through shared memory, using pipes
+ * for the wakeups
+ */
+static void test5(void)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(NULL);
+	const uint32_t total = 16 * 1024 * 1024;
+	const uint32_t size = 4096;
+	struct shm_ring *ring;
+	int data_pipe[2], space_pipe[2];
+	size_t maplen = shm_ring_mapsize(size);
+	uint8_t buf[1000];
+	void *map;
+	pid_t pid;
+	bool wakeup;
+	char c;
+	uint32_t pos, n, i;
+	int ret, status;
+
+	map = mmap(NULL, maplen, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	assert(map != MAP_FAILED);
+
+	ring = shm_ring_init(mem_ctx, map, size);
+	assert(ring != NULL);
+
+	ret = pipe(data_pipe);
+	assert(ret == 0);
+	ret = pipe(space_pipe);
+	assert(ret == 0);
+
+	pid = fork();
+	assert(pid != -1);
+
+	if (pid == 0) {
+		/* Writer */
+		ring = shm_ring_attach(mem_ctx, map, maplen);
+		assert(ring != NULL);
+
+		pos = 0;
+		while (pos < total) {
+			uint32_t len = MIN(sizeof(buf), total - pos);
+
+			for (i = 0; i < len; i++) {
+				buf[i] = (pos + i) % 251;
+			}
+
+			i = 0;
+			while (i < len) {
+				n = shm_ring_write(ring, buf + i, len - i,
+						   &wakeup);
+				if (wakeup) {
+					ret = sys_write(data_pipe[1], "x", 1);
+					assert(ret == 1);
+				}
+				i += n;
+				if (i < len && shm_ring_wait_space(ring)) {
+					ret = sys_read(space_pipe[0], &c, 1);
+					assert(ret == 1);
+				}
+			}
+			pos += len;
+		}
+
+		_exit(0);
+	}
+
+	/* Reader */
+	pos = 0;
+	while (pos < total) {
+		n = shm_ring_read(ring, buf, sizeof(buf), &wakeup);
+		if (wakeup) {
+			ret = sys_write(space_pipe[1], "x", 1);
+			assert(ret == 1);
+		}
+		for (i = 0; i < n; i++) {
+			assert(buf[i] == (pos + i) % 251);
+		}
+		pos += n;
+		if (n == 0 && shm_ring_wait_data(ring, 1)) {
+			ret = sys_read(data_pipe[0], &c, 1);
+			assert(ret == 1);
+		}
+	}
+
+	ret = waitpid(pid, &status, 0);
+	assert(ret == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	assert(shm_ring_used(ring) == 0);
+
+	munmap(map, maplen);
+	talloc_free(mem_ctx);
+}
+
+int main(int argc, const char **argv)
+{
+	int num;
+
+	if (argc != 2) {
+		fprintf(stderr, "%s <testnum>\n", argv[0]);
+		exit(1);
+	}
+
+	num = atoi(argv[1]);
+	switch (num) {
+	case 1:
+		test1();
+		break;
+
+	case 2:
+		test2();
+		break;
+
+	case 3:
+		test3();
+		break;
+
+	case 4:
+		test4();
+		break;
+
+	case 5:
+		test5();
+		break;
+
+	default:
+		fprintf(stderr, "Unknown test number %s\n", argv[1]);
+	}
+
+	return 0;
+}
@@ -62,6 +62,11 @@ RecBufferSizeLimit         = 1000000
 QueueBufferSize            = 1024
 IPAllocAlgorithm           = 2
 AllowMixedVersions         = 0
+ReadOnlyHotKeyReads        = 0
+ReadOnlyHotKeyRevokes      = 5
+ReadOnlyHotKeyDuration     = 10
+QueueCoalesceLimit         = 65536
+RecDeltaPull               = 1
 EOF
 
 simple_test
@@ -1177,6 +1177,7 @@ const struct {
 	STATISTICS_FIELD(locks.num_current),
 	STATISTICS_FIELD(locks.num_pending),
 	STATISTICS_FIELD(locks.num_failed),
+	STATISTICS_FIELD(locks.num_wait_fallbacks),
 	STATISTICS_FIELD(total_calls),
 	STATISTICS_FIELD(pending_calls),
 	STATISTICS_FIELD(childwrite_calls),
@@ -1185,6 +1186,10 @@ const struct {
 	STATISTICS_FIELD(max_hop_count),
 	STATISTICS_FIELD(total_ro_delegations),
 	STATISTICS_FIELD(total_ro_revokes),
+	STATISTICS_FIELD(transport.writes),
+	STATISTICS_FIELD(transport.packets),
+	STATISTICS_FIELD(transport.coalesced_writes),
+	STATISTICS_FIELD(transport.limit_flushes),
 };
 
 #define LATENCY_AVG(v)	((v).num ? (v).total / (v).num : 0.0 )
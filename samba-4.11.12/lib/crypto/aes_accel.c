@@ -0,0 +1,400 @@
+/*
+   AES-NI/PCLMULQDQ kernels for AES-GCM-128 and AES-CCM-128
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "lib/crypto/aes.h"
+#include "lib/crypto/aes_accel.h"
+
+#if defined(HAVE_AES_CLMUL_INTRINSICS)
+
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+/*
+ * The functions using the intrinsics are compiled for
+ * the required instruction set extensions, only the
+ * callers of aes_accel_available() make sure the
+ * CPU supports them.
+ */
+#define AES_ACCEL_TARGET __attribute__((target("aes,pclmul,ssse3")))
+
+/* Number of blocks encrypted in parallel by aes_accel_ctr32() */
+#define AES_ACCEL_CTR_STRIDE 8
+
+static inline void aes_accel_cpuid(unsigned int where[4], unsigned int leaf)
+{
+	asm volatile("cpuid" :
+			"=a" (where[0]),
+			"=b" (where[1]),
+			"=c" (where[2]),
+			"=d" (where[3]): "a" (leaf), "c" (0));
+}
+
+bool aes_accel_available(void)
+{
+	static int available = -1;
+	unsigned int cpuid_results[4];
+	const unsigned int needed = (1 << 25) | /* AES */
+				    (1 << 9) |  /* SSSE3 */
+				    (1 << 1);   /* PCLMULQDQ */
+
+	if (available != -1) {
+		return (bool)available;
+	}
+
+	aes_accel_cpuid(cpuid_results, 1);
+	available = ((cpuid_results[2] & needed) == needed);
+	return (bool)available;
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_load(const uint8_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)(const void *)p);
+}
+
+static inline AES_ACCEL_TARGET void aes_accel_store(uint8_t *p, __m128i v)
+{
+	_mm_storeu_si128((__m128i *)(void *)p, v);
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_bswap(__m128i v)
+{
+	const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+					  8, 9, 10, 11, 12, 13, 14, 15);
+
+	return _mm_shuffle_epi8(v, mask);
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_expand(__m128i key,
+							__m128i gen)
+{
+	gen = _mm_shuffle_epi32(gen, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, gen);
+}
+
+AES_ACCEL_TARGET
+void aes_accel_set_key_128(struct aes_accel_key_128 *key,
+			   const uint8_t K[AES_BLOCK_SIZE])
+{
+	__m128i rk = aes_accel_load(K);
+
+	aes_accel_store(key->rk[0], rk);
+
+/* _mm_aeskeygenassist_si128() needs a constant rcon */
+#define AES_ACCEL_EXPAND(i, rcon) do { \
+	rk = aes_accel_expand(rk, _mm_aeskeygenassist_si128(rk, rcon)); \
+	aes_accel_store(key->rk[i], rk); \
+} while (0)
+
+	AES_ACCEL_EXPAND(1, 0x01);
+	AES_ACCEL_EXPAND(2, 0x02);
+	AES_ACCEL_EXPAND(3, 0x04);
+	AES_ACCEL_EXPAND(4, 0x08);
+	AES_ACCEL_EXPAND(5, 0x10);
+	AES_ACCEL_EXPAND(6, 0x20);
+	AES_ACCEL_EXPAND(7, 0x40);
+	AES_ACCEL_EXPAND(8, 0x80);
+	AES_ACCEL_EXPAND(9, 0x1b);
+	AES_ACCEL_EXPAND(10, 0x36);
+
+#undef AES_ACCEL_EXPAND
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_encrypt(const __m128i rk[],
+							 __m128i b)
+{
+	size_t r;
+
+	b = _mm_xor_si128(b, rk[0]);
+	for (r = 1; r < AES_ACCEL_128_ROUNDS; r++) {
+		b = _mm_aesenc_si128(b, rk[r]);
+	}
+	return _mm_aesenclast_si128(b, rk[AES_ACCEL_128_ROUNDS]);
+}
+
+static inline AES_ACCEL_TARGET void aes_accel_load_key(
+	const struct aes_accel_key_128 *key,
+	__m128i rk[AES_ACCEL_128_ROUNDS + 1])
+{
+	size_t r;
+
+	for (r = 0; r <= AES_ACCEL_128_ROUNDS; r++) {
+		rk[r] = aes_accel_load(key->rk[r]);
+	}
+}
+
+AES_ACCEL_TARGET
+void aes_accel_ctr32(const struct aes_accel_key_128 *key,
+		     uint8_t CB[AES_BLOCK_SIZE],
+		     uint8_t *m, size_t nblocks)
+{
+	__m128i rk[AES_ACCEL_128_ROUNDS + 1];
+	/*
+	 * With the bytes reversed the big endian
+	 * counter is the lowest 32-bit lane.
+	 */
+	__m128i ctr = aes_accel_bswap(aes_accel_load(CB));
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+
+	aes_accel_load_key(key, rk);
+
+	while (nblocks >= AES_ACCEL_CTR_STRIDE) {
+		__m128i b[AES_ACCEL_CTR_STRIDE];
+		size_t i, r;
+
+		for (i = 0; i < AES_ACCEL_CTR_STRIDE; i++) {
+			ctr = _mm_add_epi32(ctr, one);
+			b[i] = _mm_xor_si128(aes_accel_bswap(ctr), rk[0]);
+		}
+		for (r = 1; r < AES_ACCEL_128_ROUNDS; r++) {
+			for (i = 0; i < AES_ACCEL_CTR_STRIDE; i++) {
+				b[i] = _mm_aesenc_si128(b[i], rk[r]);
+			}
+		}
+		for (i = 0; i < AES_ACCEL_CTR_STRIDE; i++) {
+			uint8_t *p = m + i * AES_BLOCK_SIZE;
+
+			b[i] = _mm_aesenclast_si128(b[i],
+						    rk[AES_ACCEL_128_ROUNDS]);
+			aes_accel_store(p, _mm_xor_si128(b[i],
+							 aes_accel_load(p)));
+		}
+
+		m += AES_ACCEL_CTR_STRIDE * AES_BLOCK_SIZE;
+		nblocks -= AES_ACCEL_CTR_STRIDE;
+	}
+
+	while (nblocks > 0) {
+		__m128i b;
+
+		ctr = _mm_add_epi32(ctr, one);
+		b = aes_accel_encrypt(rk, aes_accel_bswap(ctr));
+		aes_accel_store(m, _mm_xor_si128(b, aes_accel_load(m)));
+
+		m += AES_BLOCK_SIZE;
+		nblocks -= 1;
+	}
+
+	aes_accel_store(CB, aes_accel_bswap(ctr));
+}
+
+AES_ACCEL_TARGET
+void aes_accel_cbc_mac(const struct aes_accel_key_128 *key,
+		       uint8_t X[AES_BLOCK_SIZE],
+		       const uint8_t *in, size_t nblocks)
+{
+	__m128i rk[AES_ACCEL_128_ROUNDS + 1];
+	__m128i x = aes_accel_load(X);
+
+	aes_accel_load_key(key, rk);
+
+	while (nblocks > 0) {
+		x = _mm_xor_si128(x, aes_accel_load(in));
+		x = aes_accel_encrypt(rk, x);
+
+		in += AES_BLOCK_SIZE;
+		nblocks -= 1;
+	}
+
+	aes_accel_store(X, x);
+}
+
+/*
+ * Carry-less multiplication in GF(2^128) on byte reflected
+ * values, see the Intel white paper "Intel Carry-Less
+ * Multiplication Instruction and its Usage for Computing
+ * the GCM Mode".
+ *
+ * aes_accel_clmul() returns the unreduced 256-bit product,
+ * as the reduction is linear, the products of several blocks
+ * can be xor'ed and reduced once.
+ */
+static inline AES_ACCEL_TARGET void aes_accel_clmul(__m128i a, __m128i b,
+						    __m128i *lo, __m128i *hi)
+{
+	__m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	__m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	__m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	__m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t1 = _mm_xor_si128(t1, t2);
+	*lo = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+	*hi = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_reduce(__m128i lo, __m128i hi)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	/* shift the 256-bit value left by one bit */
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	/* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+static inline AES_ACCEL_TARGET __m128i aes_accel_gfmul(__m128i a, __m128i b)
+{
+	__m128i lo, hi;
+
+	aes_accel_clmul(a, b, &lo, &hi);
+	return aes_accel_reduce(lo, hi);
+}
+
+AES_ACCEL_TARGET
+void aes_accel_ghash_init(struct aes_accel_ghash *g,
+			  const uint8_t H[AES_BLOCK_SIZE])
+{
+	__m128i h1 = aes_accel_bswap(aes_accel_load(H));
+	__m128i hn = h1;
+	size_t i;
+
+	aes_accel_store(g->H[0], h1);
+	for (i = 1; i < AES_ACCEL_GHASH_STRIDE; i++) {
+		hn = aes_accel_gfmul(hn, h1);
+		aes_accel_store(g->H[i], hn);
+	}
+}
+
+AES_ACCEL_TARGET
+void aes_accel_ghash(const struct aes_accel_ghash *g,
+		     uint8_t Y[AES_BLOCK_SIZE],
+		     const uint8_t *in, size_t nblocks)
+{
+	__m128i h[AES_ACCEL_GHASH_STRIDE];
+	__m128i y = aes_accel_bswap(aes_accel_load(Y));
+	size_t i;
+
+	for (i = 0; i < AES_ACCEL_GHASH_STRIDE; i++) {
+		h[i] = aes_accel_load(g->H[i]);
+	}
+
+	/*
+	 * Y' = ((Y ^ X_0) * H^4) ^ (X_1 * H^3) ^ (X_2 * H^2) ^ (X_3 * H)
+	 */
+	while (nblocks >= AES_ACCEL_GHASH_STRIDE) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+
+		for (i = 0; i < AES_ACCEL_GHASH_STRIDE; i++) {
+			const uint8_t *p = in + i * AES_BLOCK_SIZE;
+			__m128i x = aes_accel_bswap(aes_accel_load(p));
+			__m128i l, u;
+
+			if (i == 0) {
+				x = _mm_xor_si128(x, y);
+			}
+			aes_accel_clmul(x, h[AES_ACCEL_GHASH_STRIDE - 1 - i],
+					&l, &u);
+			lo = _mm_xor_si128(lo, l);
+			hi = _mm_xor_si128(hi, u);
+		}
+		y = aes_accel_reduce(lo, hi);
+
+		in += AES_ACCEL_GHASH_STRIDE * AES_BLOCK_SIZE;
+		nblocks -= AES_ACCEL_GHASH_STRIDE;
+	}
+
+	while (nblocks > 0) {
+		__m128i x = aes_accel_bswap(aes_accel_load(in));
+
+		y = aes_accel_gfmul(_mm_xor_si128(x, y), h[0]);
+
+		in += AES_BLOCK_SIZE;
+		nblocks -= 1;
+	}
+
+	aes_accel_store(Y, aes_accel_bswap(y));
+}
+
+#else /* defined(HAVE_AES_CLMUL_INTRINSICS) */
+
+/*
+ * Dummy implementations if no intrinsics are available.
+ * Only aes_accel_available() will ever be called.
+ */
+
+bool aes_accel_available(void)
+{
+	return false;
+}
+
+void aes_accel_set_key_128(struct aes_accel_key_128 *key,
+			   const uint8_t K[AES_BLOCK_SIZE])
+{
+	abort();
+}
+
+void aes_accel_ctr32(const struct aes_accel_key_128 *key,
+		     uint8_t CB[AES_BLOCK_SIZE],
+		     uint8_t *m, size_t nblocks)
+{
+	abort();
+}
+
+void aes_accel_cbc_mac(const struct aes_accel_key_128 *key,
+		       uint8_t X[AES_BLOCK_SIZE],
+		       const uint8_t *in, size_t nblocks)
+{
+	abort();
+}
+
+void aes_accel_ghash_init(struct aes_accel_ghash *g,
+			  const uint8_t H[AES_BLOCK_SIZE])
+{
+	abort();
+}
+
+void aes_accel_ghash(const struct aes_accel_ghash *g,
+		     uint8_t Y[AES_BLOCK_SIZE],
+		     const uint8_t *in, size_t nblocks)
+{
+	abort();
+}
+
+#endif /* defined(HAVE_AES_CLMUL_INTRINSICS) */
@@ -0,0 +1,69 @@
+/*
+   AES-NI/PCLMULQDQ kernels for AES-GCM-128 and AES-CCM-128
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIB_CRYPTO_AES_ACCEL_H
+#define LIB_CRYPTO_AES_ACCEL_H
+
+#define AES_ACCEL_128_ROUNDS 10
+#define AES_ACCEL_GHASH_STRIDE 4
+
+struct aes_accel_key_128 {
+	uint8_t rk[AES_ACCEL_128_ROUNDS + 1][AES_BLOCK_SIZE];
+};
+
+struct aes_accel_ghash {
+	/* H^1 .. H^4, byte reflected */
+	uint8_t H[AES_ACCEL_GHASH_STRIDE][AES_BLOCK_SIZE];
+};
+
+/*
+ * Returns true if the CPU supports AES-NI, PCLMULQDQ and SSSE3
+ * and we were built with support for them.
+ *
+ * The other functions must only be called if this returns true.
+ */
+bool aes_accel_available(void);
+
+void aes_accel_set_key_128(struct aes_accel_key_128 *key,
+			   const uint8_t K[AES_BLOCK_SIZE]);
+
+/*
+ * For each block: increment the last 32 bits of CB (big endian),
+ * encrypt CB and xor the result into m.
+ */
+void aes_accel_ctr32(const struct aes_accel_key_128 *key,
+		     uint8_t CB[AES_BLOCK_SIZE],
+		     uint8_t *m, size_t nblocks);
+
+/*
+ * For each block: X = E(X ^ in)
+ */
+void aes_accel_cbc_mac(const struct aes_accel_key_128 *key,
+		       uint8_t X[AES_BLOCK_SIZE],
+		       const uint8_t *in, size_t nblocks);
+
+void aes_accel_ghash_init(struct aes_accel_ghash *g,
+			  const uint8_t H[AES_BLOCK_SIZE]);
+
+/*
+ * For each block: Y = (Y ^ in) * H
+ */
+void aes_accel_ghash(const struct aes_accel_ghash *g,
+		     uint8_t Y[AES_BLOCK_SIZE],
+		     const uint8_t *in, size_t nblocks);
+
+#endif /* LIB_CRYPTO_AES_ACCEL_H */
@@ -33,6 +33,10 @@ void aes_ccm_128_init(struct aes_ccm_128_context *ctx,
 	ZERO_STRUCTP(ctx);
 
 	AES_set_encrypt_key(K, 128, &ctx->aes_key);
+	ctx->accel = aes_accel_available();
+	if (ctx->accel) {
+		aes_accel_set_key_128(&ctx->accel_key, K);
+	}
 	memcpy(ctx->nonce, N, AES_CCM_128_NONCE_SIZE);
 	ctx->a_remain = a_total;
 	ctx->m_remain = m_total;
@@ -114,6 +118,15 @@ void aes_ccm_128_update(struct aes_ccm_128_context *ctx,
 		ctx->B_i_ofs = 0;
 	}
 
+	if (ctx->accel && v_len >= AES_BLOCK_SIZE) {
+		size_t n = v_len / AES_BLOCK_SIZE;
+
+		aes_accel_cbc_mac(&ctx->accel_key, ctx->X_i, v, n);
+		v += n * AES_BLOCK_SIZE;
+		v_len -= n * AES_BLOCK_SIZE;
+		*remain -= n * AES_BLOCK_SIZE;
+	}
+
 	while (v_len >= AES_BLOCK_SIZE) {
 		aes_block_xor(ctx->X_i, v, ctx->B_i);
 		AES_encrypt(ctx->B_i, ctx->X_i, &ctx->aes_key);
@@ -154,6 +167,26 @@ void aes_ccm_128_crypt(struct aes_ccm_128_context *ctx,
 		       uint8_t *m, size_t m_len)
 {
 	while (m_len > 0) {
+		if (ctx->accel &&
+		    ctx->S_i_ofs == AES_BLOCK_SIZE &&
+		    m_len >= AES_BLOCK_SIZE)
+		{
+			size_t n = m_len / AES_BLOCK_SIZE;
+
+			/*
+			 * aes_accel_ctr32() increments the counter
+			 * before each block, so we start with the
+			 * last used one.
+			 */
+			RSIVAL(ctx->A_i, (AES_BLOCK_SIZE - AES_CCM_128_L),
+			       ctx->S_i_ctr);
+			aes_accel_ctr32(&ctx->accel_key, ctx->A_i, m, n);
+			ctx->S_i_ctr += n;
+			m += n * AES_BLOCK_SIZE;
+			m_len -= n * AES_BLOCK_SIZE;
+			continue;
+		}
+
 		if (ctx->S_i_ofs == AES_BLOCK_SIZE) {
 			ctx->S_i_ctr += 1;
 			aes_ccm_128_S_i(ctx, ctx->S_i, ctx->S_i_ctr);
@@ -20,6 +20,8 @@
 #ifndef LIB_CRYPTO_AES_CCM_128_H
 #define LIB_CRYPTO_AES_CCM_128_H
 
+#include "lib/crypto/aes_accel.h"
+
 #define AES_CCM_128_M 16
 #define AES_CCM_128_L 4
 #define AES_CCM_128_NONCE_SIZE (15 - AES_CCM_128_L)
@@ -42,6 +44,9 @@ struct aes_ccm_128_context {
 	size_t B_i_ofs;
 	size_t S_i_ofs;
 	size_t S_i_ctr;
+
+	bool accel;
+	struct aes_accel_key_128 accel_key;
 };
 
 void aes_ccm_128_init(struct aes_ccm_128_context *ctx,
@@ -22,10 +22,140 @@
 #include "lib/crypto/aes_ccm_128.h"
 #include "lib/crypto/aes_test.h"
 
+#ifdef HAVE_GNUTLS_AEAD
+#include <gnutls/gnutls.h>
+#include <gnutls/crypto.h>
+#endif
+
 #ifndef AES_CCM_128_ONLY_TESTVECTORS
 struct torture_context;
 bool torture_local_crypto_aes_ccm_128(struct torture_context *torture);
 
+#define AES_CCM_128_LONG_SIZE (1024 * 1024)
+
+/*
+ Encrypts a buffer of a typical SMB3 size, which is not a multiple of
+ the block size, using the same sequence of calls as
+ smb2_signing_encrypt_pdu(). The result is checked against gnutls and
+ by decrypting it again.
+*/
+static bool aes_ccm_128_test_long(struct torture_context *tctx)
+{
+	struct aes_ccm_128_context ctx;
+	uint8_t K[AES_BLOCK_SIZE];
+	uint8_t N[AES_CCM_128_NONCE_SIZE];
+	uint8_t A[32];
+	uint8_t T[AES_BLOCK_SIZE];
+	uint8_t T2[AES_BLOCK_SIZE];
+	uint8_t *P = NULL;
+	uint8_t *C = NULL;
+	/* not a multiple of the block size */
+	size_t len = AES_CCM_128_LONG_SIZE - 7;
+	size_t i;
+	int e;
+
+	P = talloc_array(tctx, uint8_t, AES_CCM_128_LONG_SIZE);
+	C = talloc_array(tctx, uint8_t, AES_CCM_128_LONG_SIZE);
+	if (P == NULL || C == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < sizeof(K); i++) {
+		K[i] = i;
+	}
+	for (i = 0; i < sizeof(N); i++) {
+		N[i] = 0xF0 + i;
+	}
+	for (i = 0; i < sizeof(A); i++) {
+		A[i] = 0x80 + i;
+	}
+	for (i = 0; i < AES_CCM_128_LONG_SIZE; i++) {
+		P[i] = i * 7;
+	}
+	memcpy(C, P, len);
+
+	aes_ccm_128_init(&ctx, K, N, sizeof(A), len);
+	aes_ccm_128_update(&ctx, A, sizeof(A));
+	aes_ccm_128_update(&ctx, C, len);
+	aes_ccm_128_crypt(&ctx, C, len);
+	aes_ccm_128_digest(&ctx, T);
+
+#ifdef HAVE_GNUTLS_AEAD
+	{
+		gnutls_aead_cipher_hd_t cipher_hnd = NULL;
+		const gnutls_datum_t key = {
+			.data = K,
+			.size = sizeof(K),
+		};
+		uint8_t *R = NULL;
+		size_t r_len = len + sizeof(T);
+		int rc;
+
+		R = talloc_array(tctx, uint8_t, r_len);
+		if (R == NULL) {
+			return false;
+		}
+
+		rc = gnutls_aead_cipher_init(&cipher_hnd,
+					     GNUTLS_CIPHER_AES_128_CCM,
+					     &key);
+		if (rc < 0) {
+			printf("gnutls_aead_cipher_init failed: %s\n",
+			       gnutls_strerror(rc));
+			return false;
+		}
+		rc = gnutls_aead_cipher_encrypt(cipher_hnd,
+						N, sizeof(N),
+						A, sizeof(A),
+						sizeof(T),
+						P, len,
+						R, &r_len);
+		gnutls_aead_cipher_deinit(cipher_hnd);
+		if (rc < 0) {
+			printf("gnutls_aead_cipher_encrypt failed: %s\n",
+			       gnutls_strerror(rc));
+			return false;
+		}
+
+		e = memcmp(R, C, len);
+		if (e != 0) {
+			printf("ciphertext differs from gnutls\n");
+			return false;
+		}
+		e = memcmp(R + len, T, sizeof(T));
+		if (e != 0) {
+			printf("tag differs from gnutls\n");
+			return false;
+		}
+		TALLOC_FREE(R);
+	}
+#endif /* HAVE_GNUTLS_AEAD */
+
+	/*
+	 * Decrypt it again
+	 */
+	aes_ccm_128_init(&ctx, K, N, sizeof(A), len);
+	aes_ccm_128_update(&ctx, A, sizeof(A));
+	aes_ccm_128_crypt(&ctx, C, len);
+	aes_ccm_128_update(&ctx, C, len);
+	aes_ccm_128_digest(&ctx, T2);
+
+	e = memcmp(T2, T, sizeof(T));
+	if (e != 0) {
+		printf("tag mismatch after decryption\n");
+		return false;
+	}
+	e = memcmp(P, C, len);
+	if (e != 0) {
+		printf("plaintext mismatch after decryption\n");
+		return false;
+	}
+
+	TALLOC_FREE(P);
+	TALLOC_FREE(C);
+	return true;
+}
+
 /*
  This uses our own test values as we rely on a 11 byte nonce
  and the values from rfc rfc3610 use 13 byte nonce.
@@ -370,8 +500,72 @@ bool torture_local_crypto_aes_ccm_128(struct torture_context *tctx)
 		}
 	}
 
+	ret = aes_ccm_128_test_long(tctx);
+
  fail:
 	return ret;
 }
 
+#define AES_CCM_128_BENCH_SECS 1.0
+
+bool torture_local_crypto_aes_ccm_128_bench(struct torture_context *tctx);
+
+/*
+ Encrypts a buffer of a typical SMB3 size for about a second,
+ using the same sequence of calls as smb2_signing_encrypt_pdu().
+*/
+bool torture_local_crypto_aes_ccm_128_bench(struct torture_context *tctx)
+{
+	struct aes_ccm_128_context ctx;
+	uint8_t K[AES_BLOCK_SIZE];
+	uint8_t N[AES_CCM_128_NONCE_SIZE];
+	uint8_t A[32];
+	uint8_t T[AES_BLOCK_SIZE];
+	uint8_t *P = NULL;
+	struct timeval start;
+	double secs;
+	size_t loops = 0;
+	size_t i;
+
+	P = talloc_array(tctx, uint8_t, AES_CCM_128_LONG_SIZE);
+	if (P == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < sizeof(K); i++) {
+		K[i] = i;
+	}
+	for (i = 0; i < sizeof(N); i++) {
+		N[i] = 0xF0 + i;
+	}
+	for (i = 0; i < sizeof(A); i++) {
+		A[i] = 0x80 + i;
+	}
+	for (i = 0; i < AES_CCM_128_LONG_SIZE; i++) {
+		P[i] = i * 7;
+	}
+
+	start = timeval_current();
+	do {
+		aes_ccm_128_init(&ctx, K, N, sizeof(A),
+				 AES_CCM_128_LONG_SIZE);
+		aes_ccm_128_update(&ctx, A, sizeof(A));
+		aes_ccm_128_update(&ctx, P, AES_CCM_128_LONG_SIZE);
+		aes_ccm_128_crypt(&ctx, P, AES_CCM_128_LONG_SIZE);
+		aes_ccm_128_digest(&ctx, T);
+		loops += 1;
+		secs = timeval_elapsed(&start);
+	} while (secs < AES_CCM_128_BENCH_SECS);
+
+	printf("aes_ccm_128 (%s): %u x %u bytes in %.3f secs: %.1f MB/sec\n",
+	       aes_accel_available() ? "aesni" : "generic",
+	       (unsigned)loops,
+	       (unsigned)AES_CCM_128_LONG_SIZE,
+	       secs,
+	       (loops * AES_CCM_128_LONG_SIZE) /
+	       (secs * 1024 * 1024));
+
+	TALLOC_FREE(P);
+	return true;
+}
 #endif /* AES_CCM_128_ONLY_TESTVECTORS */
@@ -67,6 +67,11 @@ static inline void aes_gcm_128_mul(const uint8_t x[AES_BLOCK_SIZE],
 static inline void aes_gcm_128_ghash_block(struct aes_gcm_128_context *ctx,
 					   const uint8_t in[AES_BLOCK_SIZE])
 {
+	if (ctx->accel) {
+		aes_accel_ghash(&ctx->accel_ghash, ctx->Y, in, 1);
+		return;
+	}
+
 	aes_block_xor(ctx->Y, in, ctx->y.block);
 	aes_gcm_128_mul(ctx->y.block, ctx->H, ctx->v.block, ctx->Y);
 }
@@ -84,6 +89,12 @@ void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
 	 */
 	AES_encrypt(ctx->Y, ctx->H, &ctx->aes_key);
 
+	ctx->accel = aes_accel_available();
+	if (ctx->accel) {
+		aes_accel_set_key_128(&ctx->accel_key, K);
+		aes_accel_ghash_init(&ctx->accel_ghash, ctx->H);
+	}
+
 	/*
 	 * Step 2: generate J0
 	 */
@@ -117,6 +128,14 @@ static inline void aes_gcm_128_update_tmp(struct aes_gcm_128_context *ctx,
 		tmp->ofs = 0;
 	}
 
+	if (ctx->accel && v_len >= AES_BLOCK_SIZE) {
+		size_t n = v_len / AES_BLOCK_SIZE;
+
+		aes_accel_ghash(&ctx->accel_ghash, ctx->Y, v, n);
+		v += n * AES_BLOCK_SIZE;
+		v_len -= n * AES_BLOCK_SIZE;
+	}
+
 	while (v_len >= AES_BLOCK_SIZE) {
 		aes_gcm_128_ghash_block(ctx, v);
 		v += AES_BLOCK_SIZE;
@@ -156,6 +175,23 @@ static inline void aes_gcm_128_crypt_tmp(struct aes_gcm_128_context *ctx,
 	tmp->total += m_len;
 
 	while (m_len > 0) {
+		if (ctx->accel &&
+		    tmp->ofs == AES_BLOCK_SIZE &&
+		    m_len >= AES_BLOCK_SIZE)
+		{
+			size_t n = m_len / AES_BLOCK_SIZE;
+
+			/*
+			 * Encrypt all full blocks at once,
+			 * this leaves CB at the last used
+			 * counter, just as the loop below.
+			 */
+			aes_accel_ctr32(&ctx->accel_key, ctx->CB, m, n);
+			m += n * AES_BLOCK_SIZE;
+			m_len -= n * AES_BLOCK_SIZE;
+			continue;
+		}
+
 		if (tmp->ofs == AES_BLOCK_SIZE) {
 			aes_gcm_128_inc32(ctx->CB);
 			AES_encrypt(ctx->CB, tmp->block, &ctx->aes_key);
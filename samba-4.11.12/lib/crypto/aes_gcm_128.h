@@ -20,6 +20,8 @@
 #ifndef LIB_CRYPTO_AES_GCM_128_H
 #define LIB_CRYPTO_AES_GCM_128_H
 
+#include "lib/crypto/aes_accel.h"
+
 #define AES_GCM_128_IV_SIZE (12)
 
 struct aes_gcm_128_context {
@@ -38,6 +40,10 @@ struct aes_gcm_128_context {
 	uint8_t CB[AES_BLOCK_SIZE];
 	uint8_t Y[AES_BLOCK_SIZE];
 	uint8_t AC[AES_BLOCK_SIZE];
+
+	bool accel;
+	struct aes_accel_key_128 accel_key;
+	struct aes_accel_ghash accel_ghash;
 };
 
 void aes_gcm_128_init(struct aes_gcm_128_context *ctx,
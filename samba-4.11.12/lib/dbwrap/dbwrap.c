@@ -386,6 +386,35 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 	return NT_STATUS_OK;
 }
 
+NTSTATUS dbwrap_traverse_read_parallel(struct db_context *db,
+				       int (*f)(struct db_record*, void*),
+				       void *private_data,
+				       unsigned num_threads,
+				       int *count)
+{
+	int ret;
+
+	if (num_threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = (cpus > 0) ? cpus : 1;
+	}
+
+	if ((num_threads < 2) || (db->traverse_read_parallel == NULL)) {
+		return dbwrap_traverse_read(db, f, private_data, count);
+	}
+
+	ret = db->traverse_read_parallel(db, f, private_data, num_threads);
+	if (ret < 0) {
+		return NT_STATUS_INTERNAL_DB_CORRUPTION;
+	}
+
+	if (count != NULL) {
+		*count = ret;
+	}
+
+	return NT_STATUS_OK;
+}
+
 static void dbwrap_null_parser(TDB_DATA key, TDB_DATA val, void* data)
 {
 	return;
@@ -549,6 +578,119 @@ NTSTATUS dbwrap_do_locked(struct db_context *db, TDB_DATA key,
 	return NT_STATUS_OK;
 }
 
+struct dbwrap_multi_key {
+	TDB_DATA key;
+	size_t idx;
+};
+
+static int dbwrap_multi_key_cmp(const void *p1, const void *p2)
+{
+	const struct dbwrap_multi_key *k1 = p1;
+	const struct dbwrap_multi_key *k2 = p2;
+	int ret;
+
+	ret = memcmp(k1->key.dptr, k2->key.dptr,
+		     MIN(k1->key.dsize, k2->key.dsize));
+	if (ret != 0) {
+		return ret;
+	}
+	if (k1->key.dsize == k2->key.dsize) {
+		return 0;
+	}
+	return (k1->key.dsize < k2->key.dsize) ? -1 : 1;
+}
+
+/*
+ * Fallback for backends without a native do_locked_multi: Lock the
+ * records one by one in key order via fetch_locked.
+ */
+static NTSTATUS dbwrap_fallback_do_locked_multi(
+	struct db_context *db, const TDB_DATA *keys, size_t num_keys,
+	void (*fn)(struct db_record **recs, size_t num_recs,
+		   void *private_data),
+	void *private_data)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct dbwrap_multi_key *sorted = NULL;
+	struct db_record **recs = NULL;
+	size_t i;
+
+	sorted = talloc_array(frame, struct dbwrap_multi_key, num_keys);
+	recs = talloc_zero_array(frame, struct db_record *, num_keys);
+	if ((sorted == NULL) || (recs == NULL)) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	for (i=0; i<num_keys; i++) {
+		sorted[i] = (struct dbwrap_multi_key) {
+			.key = keys[i], .idx = i
+		};
+	}
+	qsort(sorted, num_keys, sizeof(struct dbwrap_multi_key),
+	      dbwrap_multi_key_cmp);
+
+	for (i=0; i<num_keys; i++) {
+		size_t idx = sorted[i].idx;
+
+		recs[idx] = db->fetch_locked(db, recs, keys[idx]);
+		if (recs[idx] == NULL) {
+			TALLOC_FREE(frame);
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+
+	fn(recs, num_keys, private_data);
+
+	TALLOC_FREE(frame);
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS dbwrap_do_locked_multi(struct db_context *db,
+				const TDB_DATA *keys, size_t num_keys,
+				void (*fn)(struct db_record **recs,
+					   size_t num_recs,
+					   void *private_data),
+				void *private_data)
+{
+	struct db_context **lockptr = NULL;
+	NTSTATUS status;
+	size_t i, j;
+
+	if (num_keys == 0) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	for (i=0; i<num_keys; i++) {
+		for (j=i+1; j<num_keys; j++) {
+			if (tdb_data_equal(keys[i], keys[j])) {
+				DBG_WARNING("Duplicate key %zu/%zu\n", i, j);
+				return NT_STATUS_INVALID_PARAMETER;
+			}
+		}
+	}
+
+	if (db->lock_order != DBWRAP_LOCK_ORDER_NONE) {
+		dbwrap_lock_order_lock(db, &lockptr);
+	}
+
+	if (db->do_locked_multi != NULL) {
+		status = db->do_locked_multi(db, keys, num_keys,
+					     fn, private_data);
+	} else {
+		status = dbwrap_fallback_do_locked_multi(db, keys, num_keys,
+							 fn, private_data);
+	}
+
+	if (db->lock_order != DBWRAP_LOCK_ORDER_NONE &&
+	    lockptr != NULL) {
+		dbwrap_lock_order_unlock(db, lockptr);
+	}
+
+	return status;
+}
+
 int dbwrap_wipe(struct db_context *db)
 {
 	if (db->wipe == NULL) {
@@ -87,6 +87,19 @@ NTSTATUS dbwrap_do_locked(struct db_context *db, TDB_DATA key,
 				     void *private_data),
 			  void *private_data);
 
+/*
+ * Lock several distinct records of one database at once and run fn
+ * on all of them. recs[i] belongs to keys[i]. The locks are taken in
+ * a fixed order, so concurrent callers with overlapping key sets do
+ * not deadlock.
+ */
+NTSTATUS dbwrap_do_locked_multi(struct db_context *db,
+				const TDB_DATA *keys, size_t num_keys,
+				void (*fn)(struct db_record **recs,
+					   size_t num_recs,
+					   void *private_data),
+				void *private_data);
+
 NTSTATUS dbwrap_delete(struct db_context *db, TDB_DATA key);
 NTSTATUS dbwrap_store(struct db_context *db, TDB_DATA key,
 		      TDB_DATA data, int flags);
@@ -101,6 +114,20 @@ NTSTATUS dbwrap_traverse_read(struct db_context *db,
 			      int (*f)(struct db_record*, void*),
 			      void *private_data,
 			      int *count);
+
+/*
+ * Like dbwrap_traverse_read, but the backend may call f from
+ * num_threads helper threads at the same time. f must be thread
+ * safe: no talloc on shared contexts, no dbwrap calls. Writers are
+ * blocked for the whole traverse. num_threads==0 uses one thread per
+ * online cpu. Backends without parallel support traverse
+ * sequentially.
+ */
+NTSTATUS dbwrap_traverse_read_parallel(struct db_context *db,
+				       int (*f)(struct db_record*, void*),
+				       void *private_data,
+				       unsigned num_threads,
+				       int *count);
 NTSTATUS dbwrap_parse_record(struct db_context *db, TDB_DATA key,
 			     void (*parser)(TDB_DATA key, TDB_DATA data,
 					    void *private_data),
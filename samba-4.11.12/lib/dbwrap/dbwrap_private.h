@@ -50,6 +50,11 @@ struct db_context {
 			     int (*f)(struct db_record *rec,
 				      void *private_data),
 			     void *private_data);
+	int (*traverse_read_parallel)(struct db_context *db,
+				      int (*f)(struct db_record *rec,
+					       void *private_data),
+				      void *private_data,
+				      unsigned num_threads);
 	int (*get_seqnum)(struct db_context *db);
 	int (*transaction_start)(struct db_context *db);
 	NTSTATUS (*transaction_start_nonblock)(struct db_context *db);
@@ -72,6 +77,12 @@ struct db_context {
 			      void (*fn)(struct db_record *rec,
 					 void *private_data),
 			      void *private_data);
+	NTSTATUS (*do_locked_multi)(struct db_context *db,
+				    const TDB_DATA *keys, size_t num_keys,
+				    void (*fn)(struct db_record **recs,
+					       size_t num_recs,
+					       void *private_data),
+				    void *private_data);
 	int (*exists)(struct db_context *db,TDB_DATA key);
 	int (*wipe)(struct db_context *db);
 	int (*check)(struct db_context *db);
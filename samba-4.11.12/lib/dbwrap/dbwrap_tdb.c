@@ -26,6 +26,12 @@
 #include "system/filesys.h"
 #include "lib/param/param.h"
 #include "libcli/util/error.h"
+#ifdef WITH_PTHREADPOOL
+#include "system/threads.h"
+#include "lib/pthreadpool/pthreadpool.h"
+#endif
+
+struct db_tdb_parallel_state;
 
 struct db_tdb_ctx {
 	struct tdb_wrap *wtdb;
@@ -34,6 +40,9 @@ struct db_tdb_ctx {
 		dev_t dev;
 		ino_t ino;
 	} id;
+
+	/* Threads for traverse_read_parallel, created on first use */
+	struct db_tdb_parallel_state *parallel;
 };
 
 static NTSTATUS db_tdb_storev(struct db_record *rec,
@@ -225,6 +234,70 @@ static NTSTATUS db_tdb_do_locked(struct db_context *db, TDB_DATA key,
 	return NT_STATUS_OK;
 }
 
+static NTSTATUS db_tdb_do_locked_multi(struct db_context *db,
+				       const TDB_DATA *keys, size_t num_keys,
+				       void (*fn)(struct db_record **recs,
+						  size_t num_recs,
+						  void *private_data),
+				       void *private_data)
+{
+	struct db_tdb_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_tdb_ctx);
+	TALLOC_CTX *frame = NULL;
+	struct db_record *recs = NULL;
+	struct db_record **precs = NULL;
+	NTSTATUS status = NT_STATUS_OK;
+	size_t i;
+	int ret;
+
+	frame = talloc_stackframe();
+
+	recs = talloc_array(frame, struct db_record, num_keys);
+	precs = talloc_array(frame, struct db_record *, num_keys);
+	if ((recs == NULL) || (precs == NULL)) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	ret = tdb_chainlock_multi(ctx->wtdb->tdb, keys, num_keys);
+	if (ret == -1) {
+		enum TDB_ERROR err = tdb_error(ctx->wtdb->tdb);
+		DBG_DEBUG("tdb_chainlock_multi failed: %s\n",
+			  tdb_errorstr(ctx->wtdb->tdb));
+		TALLOC_FREE(frame);
+		return map_nt_error_from_tdb(err);
+	}
+
+	for (i=0; i<num_keys; i++) {
+		uint8_t *buf = NULL;
+
+		ret = tdb_fetch_talloc(ctx->wtdb->tdb, keys[i], frame, &buf);
+		if ((ret != 0) && (ret != ENOENT)) {
+			DBG_DEBUG("tdb_fetch_talloc failed: %s\n",
+				  strerror(errno));
+			status = map_nt_error_from_unix_common(ret);
+			goto done;
+		}
+
+		recs[i] = (struct db_record) {
+			.db = db, .key = keys[i],
+			.value = (struct TDB_DATA) {
+				.dptr = buf, .dsize = talloc_get_size(buf) },
+			.storev = db_tdb_storev, .delete_rec = db_tdb_delete,
+			.private_data = ctx
+		};
+		precs[i] = &recs[i];
+	}
+
+	fn(precs, num_keys, private_data);
+
+done:
+	tdb_chainunlock_multi(ctx->wtdb->tdb, keys, num_keys);
+	TALLOC_FREE(frame);
+
+	return status;
+}
+
 static int db_tdb_exists(struct db_context *db, TDB_DATA key)
 {
 	struct db_tdb_ctx *ctx = talloc_get_type_abort(
@@ -400,6 +473,188 @@ static int db_tdb_traverse_read(struct db_context *db,
 	return tdb_traverse_read(db_ctx->wtdb->tdb, db_tdb_traverse_read_func, &ctx);
 }
 
+#ifdef WITH_PTHREADPOOL
+
+struct db_tdb_parallel_part {
+	void (*part_fn)(unsigned part, void *part_state);
+	void *part_state;
+	unsigned part;
+};
+
+struct db_tdb_parallel_state {
+	struct pthreadpool *pool;
+	unsigned num_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned pending;
+};
+
+static void db_tdb_parallel_job(void *private_data)
+{
+	struct db_tdb_parallel_part *p = private_data;
+	p->part_fn(p->part, p->part_state);
+}
+
+static int db_tdb_parallel_done(int jobid,
+				void (*job_fn)(void *private_data),
+				void *job_fn_private_data,
+				void *private_data)
+{
+	struct db_tdb_parallel_state *state = private_data;
+
+	pthread_mutex_lock(&state->mutex);
+	state->pending -= 1;
+	if (state->pending == 0) {
+		pthread_cond_signal(&state->cond);
+	}
+	pthread_mutex_unlock(&state->mutex);
+
+	return 0;
+}
+
+static int db_tdb_parallel_state_destructor(
+	struct db_tdb_parallel_state *state)
+{
+	/* No jobs are pending, db_tdb_run_parts() waits for them */
+	pthreadpool_destroy(state->pool);
+	pthread_cond_destroy(&state->cond);
+	pthread_mutex_destroy(&state->mutex);
+	return 0;
+}
+
+/*
+ * Keep the threads around for the next traverse, creating them is
+ * not free.
+ */
+static struct db_tdb_parallel_state *db_tdb_parallel_state(
+	struct db_tdb_ctx *db_ctx, unsigned num_threads)
+{
+	struct db_tdb_parallel_state *state = db_ctx->parallel;
+	int ret;
+
+	if ((state != NULL) && (state->num_threads == num_threads)) {
+		return state;
+	}
+	TALLOC_FREE(db_ctx->parallel);
+
+	state = talloc_zero(db_ctx, struct db_tdb_parallel_state);
+	if (state == NULL) {
+		return NULL;
+	}
+	state->num_threads = num_threads;
+
+	ret = pthread_mutex_init(&state->mutex, NULL);
+	if (ret != 0) {
+		TALLOC_FREE(state);
+		return NULL;
+	}
+	ret = pthread_cond_init(&state->cond, NULL);
+	if (ret != 0) {
+		pthread_mutex_destroy(&state->mutex);
+		TALLOC_FREE(state);
+		return NULL;
+	}
+	ret = pthreadpool_init(num_threads, &state->pool,
+			       db_tdb_parallel_done, state);
+	if (ret != 0) {
+		pthread_cond_destroy(&state->cond);
+		pthread_mutex_destroy(&state->mutex);
+		TALLOC_FREE(state);
+		return NULL;
+	}
+	talloc_set_destructor(state, db_tdb_parallel_state_destructor);
+
+	db_ctx->parallel = state;
+	return state;
+}
+
+/*
+ * Run the parts tdb_traverse_read_parallel() hands us on our
+ * pthreadpool and wait for all of them to finish.
+ */
+static int db_tdb_run_parts(unsigned num_parts,
+			    void (*part_fn)(unsigned part, void *part_state),
+			    void *part_state,
+			    void *private_data)
+{
+	struct db_tdb_parallel_state *state = private_data;
+	struct db_tdb_parallel_part *parts = NULL;
+	unsigned i;
+	int ret;
+
+	parts = talloc_array(talloc_tos(), struct db_tdb_parallel_part,
+			     num_parts);
+	if (parts == NULL) {
+		return ENOMEM;
+	}
+
+	for (i=0; i<num_parts; i++) {
+		parts[i] = (struct db_tdb_parallel_part) {
+			.part_fn = part_fn, .part_state = part_state,
+			.part = i,
+		};
+
+		pthread_mutex_lock(&state->mutex);
+		state->pending += 1;
+		pthread_mutex_unlock(&state->mutex);
+
+		ret = pthreadpool_add_job(state->pool, i, db_tdb_parallel_job,
+					  &parts[i]);
+		if (ret == 0) {
+			continue;
+		}
+
+		pthread_mutex_lock(&state->mutex);
+		state->pending -= 1;
+		pthread_mutex_unlock(&state->mutex);
+
+		/* No thread for this part, do it ourselves */
+		part_fn(i, part_state);
+	}
+
+	pthread_mutex_lock(&state->mutex);
+	while (state->pending != 0) {
+		pthread_cond_wait(&state->cond, &state->mutex);
+	}
+	pthread_mutex_unlock(&state->mutex);
+
+	TALLOC_FREE(parts);
+
+	return 0;
+}
+
+static int db_tdb_traverse_read_parallel(
+	struct db_context *db,
+	int (*f)(struct db_record *rec, void *private_data),
+	void *private_data,
+	unsigned num_threads)
+{
+	struct db_tdb_ctx *db_ctx =
+		talloc_get_type_abort(db->private_data, struct db_tdb_ctx);
+	struct db_tdb_parallel_state *state = NULL;
+	struct db_tdb_traverse_ctx ctx;
+
+	ctx.db = db;
+	ctx.f = f;
+	ctx.private_data = private_data;
+
+	state = db_tdb_parallel_state(db_ctx, num_threads);
+	if (state == NULL) {
+		return tdb_traverse_read(db_ctx->wtdb->tdb,
+					 db_tdb_traverse_read_func, &ctx);
+	}
+
+	/*
+	 * More parts than threads balance chains of different
+	 * lengths across the threads.
+	 */
+	return tdb_traverse_read_parallel(db_ctx->wtdb->tdb, num_threads * 4,
+					  db_tdb_run_parts, state,
+					  db_tdb_traverse_read_func, &ctx);
+}
+
+#endif
+
 static int db_tdb_get_seqnum(struct db_context *db)
 
 {
@@ -472,7 +727,7 @@ struct db_context *db_open_tdb(TALLOC_CTX *mem_ctx,
 		goto fail;
 	}
 
-	result->private_data = db_tdb = talloc(result, struct db_tdb_ctx);
+	result->private_data = db_tdb = talloc_zero(result, struct db_tdb_ctx);
 	if (db_tdb == NULL) {
 		DEBUG(0, ("talloc failed\n"));
 		goto fail;
@@ -498,8 +753,12 @@ struct db_context *db_open_tdb(TALLOC_CTX *mem_ctx,
 	result->fetch_locked = db_tdb_fetch_locked;
 	result->try_fetch_locked = db_tdb_try_fetch_locked;
 	result->do_locked = db_tdb_do_locked;
+	result->do_locked_multi = db_tdb_do_locked_multi;
 	result->traverse = db_tdb_traverse;
 	result->traverse_read = db_tdb_traverse_read;
+#ifdef WITH_PTHREADPOOL
+	result->traverse_read_parallel = db_tdb_traverse_read_parallel;
+#endif
 	result->parse_record = db_tdb_parse;
 	result->get_seqnum = db_tdb_get_seqnum;
 	result->persistent = ((tdb_flags & TDB_CLEAR_IF_FIRST) == 0);
@@ -441,6 +441,16 @@ _PUBLIC_ int tdb_check(struct tdb_context *tdb,
 			}
 			found_recovery = true;
 			break;
+		case TDB_SEQLOCK_MAGIC:
+			if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) ||
+			    (off != TDB_DATA_START(tdb->hash_size))) {
+				TDB_LOG((tdb, TDB_DEBUG_ERROR,
+					 "Unexpected seqlock record at offset %u\n",
+					 off));
+				tdb->ecode = TDB_ERR_CORRUPT;
+				goto free;
+			}
+			break;
 		default: ;
 		corrupt:
 			tdb->ecode = TDB_ERR_CORRUPT;
@@ -66,7 +66,7 @@ static int tdb_dump_chain(struct tdb_context *tdb, int i)
 	if (i == -1) {
 		top = FREELIST_TOP;
 	} else {
-		top = TDB_HASH_TOP(i);
+		top = TDB_CHAIN_TOP(i);
 	}
 
 	if (tdb_lock(tdb, i, F_WRLCK) != 0)
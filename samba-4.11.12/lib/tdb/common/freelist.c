@@ -539,12 +539,12 @@ static tdb_off_t tdb_allocate_from_freelist(
 }
 
 static bool tdb_alloc_dead(
-	struct tdb_context *tdb, int hash, tdb_len_t length,
+	struct tdb_context *tdb, uint32_t list, tdb_len_t length,
 	tdb_off_t *rec_ptr, struct tdb_record *rec)
 {
 	tdb_off_t last_ptr;
 
-	*rec_ptr = tdb_find_dead(tdb, hash, rec, length, &last_ptr);
+	*rec_ptr = tdb_find_dead(tdb, list, rec, length, &last_ptr);
 	if (*rec_ptr == 0) {
 		return false;
 	}
@@ -555,13 +555,13 @@ static bool tdb_alloc_dead(
 	return (tdb_ofs_write(tdb, last_ptr, &rec->next) == 0);
 }
 
-static void tdb_purge_dead(struct tdb_context *tdb, uint32_t hash)
+static void tdb_purge_dead(struct tdb_context *tdb, uint32_t list)
 {
 	int max_dead_records = tdb->max_dead_records;
 
 	tdb->max_dead_records = 0;
 
-	tdb_trim_dead(tdb, hash);
+	tdb_trim_dead(tdb, list);
 
 	tdb->max_dead_records = max_dead_records;
 }
@@ -599,7 +599,7 @@ tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 
 		int list;
 
-		list = BUCKET(hash+i);
+		list = (BUCKET(hash)+i) % tdb->hash_size;
 
 		if (tdb_lock_nonblock(tdb, list, F_WRLCK) == 0) {
 			bool got_dead;
@@ -617,7 +617,7 @@ tdb_off_t tdb_allocate(struct tdb_context *tdb, int hash, tdb_len_t length,
 			 * Under the freelist lock take the chance to give
 			 * back our dead records.
 			 */
-			tdb_purge_dead(tdb, hash);
+			tdb_purge_dead(tdb, BUCKET(hash));
 
 			ret = tdb_allocate_from_freelist(tdb, length, rec);
 			tdb_unlock(tdb, -1, F_WRLCK);
@@ -635,7 +635,7 @@ blocking_freelist_allocate:
 	 * are older than the max_dead_records concept: They happen if
 	 * tdb_delete happens concurrently with a traverse.
 	 */
-	tdb_purge_dead(tdb, hash);
+	tdb_purge_dead(tdb, BUCKET(hash));
 	ret = tdb_allocate_from_freelist(tdb, length, rec);
 	tdb_unlock(tdb, -1, F_WRLCK);
 	return ret;
@@ -745,3 +745,199 @@ _PUBLIC_ int tdb_freelist_size(struct tdb_context *tdb)
 
 	return count;
 }
+
+/*
+ * Purge the dead records of up to max_work hash chains, starting at
+ * the compaction cursor. Chains that are locked by someone else are
+ * skipped, we will see them again in the next pass. Purging needs the
+ * freelist lock as well, we take it up front so that tdb_trim_dead()
+ * does not wait for it. If it is busy we stop and retry that chain in
+ * the next step. Returns true if any lock was busy.
+ */
+static bool tdb_compact_chains(struct tdb_context *tdb,
+			       unsigned int max_work)
+{
+	unsigned int work = 0;
+	bool busy = false;
+
+	while ((tdb->compact.chain < tdb->hash_size) && (work < max_work)) {
+		uint32_t list = tdb->compact.chain;
+
+		work += 1;
+
+		if (tdb_lock_nonblock(tdb, list, F_WRLCK) != 0) {
+			tdb->compact.chain += 1;
+			busy = true;
+			continue;
+		}
+		if (tdb_lock_nonblock(tdb, -1, F_WRLCK) != 0) {
+			tdb_unlock(tdb, list, F_WRLCK);
+			return true;
+		}
+		tdb->compact.chain += 1;
+
+		tdb_purge_dead(tdb, list);
+		tdb_unlock(tdb, -1, F_WRLCK);
+		tdb_unlock(tdb, list, F_WRLCK);
+	}
+
+	return busy;
+}
+
+/*
+ * The freelist might have changed since our last step. The compaction
+ * cursor is still on it if it has the free magic and the record on its
+ * left ends right where it starts. A free record that has been merged
+ * into its left neighbour keeps its header, but the neighbour covers
+ * it.
+ */
+static bool tdb_compact_cursor_valid(struct tdb_context *tdb, tdb_off_t off)
+{
+	struct tdb_record rec, left_rec;
+	tdb_off_t left_ptr;
+	int ret;
+
+	if (off == FREELIST_TOP) {
+		return true;
+	}
+
+	if (off < TDB_DATA_START(tdb->hash_size)) {
+		return false;
+	}
+	if (tdb_oob(tdb, off, sizeof(rec), 1) != 0) {
+		return false;
+	}
+
+	ret = tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec), DOCONV());
+	if (ret == -1 || rec.magic != TDB_FREE_MAGIC) {
+		return false;
+	}
+
+	ret = read_record_on_left(tdb, off, &left_ptr, &left_rec);
+	if (ret == -1) {
+		/* only the first record has nothing on its left */
+		return (off == TDB_DATA_START(tdb->hash_size));
+	}
+
+	return (left_ptr + sizeof(left_rec) + left_rec.rec_len == off);
+}
+
+/*
+ * Look at up to max_work freelist entries behind the compaction
+ * cursor, merging each one into a free neighbour on its left. Returns
+ * 1 when the end of the freelist was reached, 0 if there is more to
+ * do and TDB_COMPACT_BUSY if the freelist is locked by someone else.
+ */
+static int tdb_compact_freelist(struct tdb_context *tdb, unsigned int max_work)
+{
+	tdb_off_t cur, next;
+	unsigned int work = 0;
+	int ret;
+
+	if (tdb_lock_nonblock(tdb, -1, F_WRLCK) != 0) {
+		return TDB_COMPACT_BUSY;
+	}
+
+	cur = tdb->compact.free_cur;
+	if (!tdb_compact_cursor_valid(tdb, cur)) {
+		/* Start the freelist over, merging is idempotent */
+		cur = FREELIST_TOP;
+	}
+
+	while (work < max_work) {
+		tdb_off_t next2;
+
+		ret = tdb_ofs_read(tdb, cur, &next);
+		if (ret != 0) {
+			goto fail;
+		}
+		if (next == 0) {
+			goto finished;
+		}
+
+		work += 1;
+
+		ret = check_merge_ptr_with_left_record(tdb, next, &next2);
+		if (ret == -1) {
+			goto fail;
+		}
+		if (ret == 1) {
+			/*
+			 * merged: unlink next, it is now part of its
+			 * left neighbour
+			 */
+			ret = tdb_ofs_write(tdb, cur, &next2);
+			if (ret != 0) {
+				goto fail;
+			}
+			continue;
+		}
+
+		cur = next;
+	}
+
+	tdb->compact.free_cur = cur;
+	tdb_unlock(tdb, -1, F_WRLCK);
+	return 0;
+
+finished:
+	tdb->compact.free_cur = FREELIST_TOP;
+	tdb_unlock(tdb, -1, F_WRLCK);
+	return 1;
+
+fail:
+	tdb->compact.free_cur = FREELIST_TOP;
+	tdb_unlock(tdb, -1, F_WRLCK);
+	return -1;
+}
+
+/**
+ * Do a bounded amount of free space compaction
+ *
+ * Unlike tdb_repack() this never blocks other users of the database
+ * for longer than max_work steps: A pass first purges the dead
+ * records of all hash chains and then merges adjacent free records,
+ * max_work chains or freelist entries per call. Locks that are busy
+ * are skipped rather than waited for.
+ *
+ * Returns 1 when a full pass has been completed, 0 if there is more
+ * work to do, TDB_COMPACT_BUSY if some of the work had to be skipped
+ * because locks were held by others and -1 on error. Callers looping
+ * over this should back off or stop on TDB_COMPACT_BUSY, the next
+ * call picks up where this one left off.
+ */
+_PUBLIC_ int tdb_compact_step(struct tdb_context *tdb, unsigned int max_work)
+{
+	int ret;
+
+	if (tdb->read_only || tdb->traverse_read) {
+		tdb->ecode = TDB_ERR_RDONLY;
+		return -1;
+	}
+	if (tdb->transaction != NULL) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_compact_step: "
+			 "not allowed inside a transaction\n"));
+		tdb->ecode = TDB_ERR_EINVAL;
+		return -1;
+	}
+	if (max_work == 0) {
+		return 0;
+	}
+
+	if (tdb->compact.chain < tdb->hash_size) {
+		if (tdb_compact_chains(tdb, max_work)) {
+			return TDB_COMPACT_BUSY;
+		}
+		return 0;
+	}
+
+	ret = tdb_compact_freelist(tdb, max_work);
+	if (ret == TDB_COMPACT_BUSY) {
+		return ret;
+	}
+	if (ret != 0) {
+		/* Finished or failed, start over next time */
+		tdb->compact.chain = 0;
+	}
+	return ret;
+}
@@ -318,14 +318,14 @@ static void tdb_next_hash_chain(struct tdb_context *tdb, uint32_t *chain)
 	uint32_t h = *chain;
 	if (tdb->map_ptr) {
 		for (;h < tdb->hash_size;h++) {
-			if (0 != *(uint32_t *)(TDB_HASH_TOP(h) + (unsigned char *)tdb->map_ptr)) {
+			if (0 != *(uint32_t *)(TDB_CHAIN_TOP(h) + (unsigned char *)tdb->map_ptr)) {
 				break;
 			}
 		}
 	} else {
 		uint32_t off=0;
 		for (;h < tdb->hash_size;h++) {
-			if (tdb_ofs_read(tdb, TDB_HASH_TOP(h), &off) != 0 || off != 0) {
+			if (tdb_ofs_read(tdb, TDB_CHAIN_TOP(h), &off) != 0 || off != 0) {
 				break;
 			}
 		}
@@ -393,6 +393,19 @@ int tdb_mmap(struct tdb_context *tdb)
 #else
 	tdb->map_ptr = NULL;
 #endif
+
+	if ((tdb->map_ptr == NULL) &&
+	    (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) &&
+	    !tdb->read_only) {
+		/*
+		 * Lock-free readers only see the seqlock counters of
+		 * writers through the shared mapping.
+		 */
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_mmap: can't write to a "
+			 "tdb with lock-free reads without mmap\n"));
+		tdb->ecode = TDB_ERR_IO;
+		return -1;
+	}
 	return 0;
 }
 
@@ -169,6 +169,91 @@ static tdb_off_t lock_offset(int list)
 	return FREELIST_TOP + 4*list;
 }
 
+/*
+ * Make sure we can count a write lock before we take it. A failed
+ * remap in tdb_oob() or tdb_expand() leaves us without the mapping.
+ */
+static int tdb_seqlock_check(struct tdb_context *tdb)
+{
+#ifdef USE_TDB_SEQLOCK
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) ||
+	    tdb->read_only || (tdb->map_ptr != NULL)) {
+		return 0;
+	}
+	if (tdb_mmap(tdb) != 0) {
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * The seqlock counters in the current mapping, NULL if there is no
+ * mapping or the tdb does not have them.
+ */
+struct tdb_seqlock_area *tdb_seqlock_area(struct tdb_context *tdb)
+{
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) ||
+	    (tdb->map_ptr == NULL) ||
+	    (tdb->seqlock_area > tdb->map_size) ||
+	    (tdb->map_size - tdb->seqlock_area <
+	     TDB_SEQLOCK_AREA_SIZE(tdb->hash_size))) {
+		return NULL;
+	}
+	return (struct tdb_seqlock_area *)
+		((char *)tdb->map_ptr + tdb->seqlock_area);
+}
+
+/*
+ * Count a write lock on a hash chain for the lock-free readers, see
+ * TDB_FEATURE_FLAG_SEQLOCK. Only hash chain locks are counted, the
+ * freelist lock does not protect anything a reader looks at. list -1
+ * counts the allrecord lock.
+ */
+static void tdb_seqlock_inc(struct tdb_context *tdb, int list, bool finished)
+{
+#ifdef USE_TDB_SEQLOCK
+	struct tdb_seqlock_area *area;
+	struct tdb_seqlock_chain *chain;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) ||
+	    tdb->read_only) {
+		return;
+	}
+
+	area = tdb_seqlock_area(tdb);
+	if (area == NULL) {
+		/*
+		 * tdb_seqlock_check() made sure we counted the start,
+		 * the mapping went away under the lock. Without the
+		 * finish, readers of the chain just keep using locks.
+		 */
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_seqlock_inc: no mapping "
+			 "to count the %s of a write lock\n",
+			 finished ? "end" : "start"));
+		return;
+	}
+
+	chain = (list >= 0) ? &area->chains[list] : &area->all;
+
+	if (finished) {
+		__sync_fetch_and_add(&chain->finished, 1);
+	} else {
+		__sync_fetch_and_add(&chain->started, 1);
+	}
+#endif
+}
+
+static void tdb_seqlock_lock_offset(struct tdb_context *tdb,
+				    uint32_t offset, bool finished)
+{
+	if (offset < lock_offset(0)) {
+		/* freelist, OPEN_LOCK and friends */
+		return;
+	}
+	tdb_seqlock_inc(tdb, (offset - lock_offset(0)) / 4, finished);
+}
+
 /* a byte range locking function - return 0 on success
    this functions locks/unlocks "len" byte at the specified offset.
 
@@ -347,6 +432,11 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 	if (tdb->flags & TDB_NOLOCK)
 		return 0;
 
+	if ((ltype == F_WRLCK) && (offset >= lock_offset(0)) &&
+	    (tdb_seqlock_check(tdb) != 0)) {
+		return -1;
+	}
+
 	new_lck = find_nestlock(tdb, offset);
 	if (new_lck) {
 		if ((new_lck->ltype == F_RDLCK) && (ltype == F_WRLCK)) {
@@ -364,6 +454,7 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 				}
 			}
 			new_lck->ltype = F_WRLCK;
+			tdb_seqlock_lock_offset(tdb, offset, false);
 		}
 		/*
 		 * Just increment the in-memory struct, posix locks
@@ -398,6 +489,10 @@ int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 	new_lck->ltype = ltype;
 	tdb->num_lockrecs++;
 
+	if (ltype == F_WRLCK) {
+		tdb_seqlock_lock_offset(tdb, offset, false);
+	}
+
 	return 0;
 }
 
@@ -405,6 +500,10 @@ static int tdb_lock_and_recover(struct tdb_context *tdb)
 {
 	int ret;
 
+	if (tdb_seqlock_check(tdb) != 0) {
+		return -1;
+	}
+
 	/* We need to match locking order in transaction commit. */
 	if (tdb_brlock(tdb, F_WRLCK, FREELIST_TOP, 0, TDB_LOCK_WAIT)) {
 		return -1;
@@ -415,7 +514,9 @@ static int tdb_lock_and_recover(struct tdb_context *tdb)
 		return -1;
 	}
 
+	tdb_seqlock_inc(tdb, -1, false);
 	ret = tdb_transaction_recover(tdb);
+	tdb_seqlock_inc(tdb, -1, true);
 
 	tdb_brunlock(tdb, F_WRLCK, OPEN_LOCK, 1);
 	tdb_brunlock(tdb, F_WRLCK, FREELIST_TOP, 0);
@@ -511,6 +612,49 @@ _PUBLIC_ int tdb_lock_nonblock(struct tdb_context *tdb, int list, int ltype)
 	return tdb_lock_list(tdb, list, ltype, TDB_LOCK_NOWAIT);
 }
 
+/*
+ * Lock the hash chain of a hash value. With TDB_FEATURE_FLAG_REHASH
+ * the chain might have been split while we waited for the lock, so
+ * check that the hash still lives in the chain we locked.
+ */
+static int tdb_lock_hash_list(struct tdb_context *tdb, uint32_t hash,
+			      int ltype, enum tdb_lock_flags waitflag)
+{
+	while (true) {
+		uint32_t list = BUCKET(hash);
+		int ret;
+
+		ret = tdb_lock_list(tdb, list, ltype, waitflag);
+		if (ret != 0) {
+			return ret;
+		}
+		if (BUCKET(hash) == list) {
+			return 0;
+		}
+		tdb_unlock(tdb, list, ltype);
+	}
+}
+
+/* lock the list of a hash value */
+int tdb_lock_hash(struct tdb_context *tdb, uint32_t hash, int ltype)
+{
+	int ret;
+
+	ret = tdb_lock_hash_list(tdb, hash, ltype, TDB_LOCK_WAIT);
+	if (ret) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_lock failed on list %u "
+			 "ltype=%d (%s)\n", BUCKET(hash), ltype,
+			 strerror(errno)));
+	}
+	return ret;
+}
+
+/* lock the list of a hash value, non-blocking */
+int tdb_lock_hash_nonblock(struct tdb_context *tdb, uint32_t hash, int ltype)
+{
+	return tdb_lock_hash_list(tdb, hash, ltype, TDB_LOCK_NOWAIT);
+}
+
 
 int tdb_nest_unlock(struct tdb_context *tdb, uint32_t offset, int ltype,
 		    bool mark_lock)
@@ -545,6 +689,10 @@ int tdb_nest_unlock(struct tdb_context *tdb, uint32_t offset, int ltype,
 	 * anyway.
 	 */
 
+	if (lck->ltype == F_WRLCK) {
+		tdb_seqlock_lock_offset(tdb, offset, true);
+	}
+
 	if (mark_lock) {
 		ret = 0;
 	} else {
@@ -679,6 +827,11 @@ int tdb_allrecord_lock(struct tdb_context *tdb, int ltype,
 		return 0;
 	}
 
+	if (((ltype == F_WRLCK) || upgradable) &&
+	    (tdb_seqlock_check(tdb) != 0)) {
+		return -1;
+	}
+
 	/* We cover two kinds of locks:
 	 * 1) Normal chain locks.  Taken for almost all operations.
 	 * 2) Individual records locks.  Taken after normal or free
@@ -716,6 +869,10 @@ int tdb_allrecord_lock(struct tdb_context *tdb, int ltype,
 	tdb->allrecord_lock.ltype = upgradable ? F_WRLCK : ltype;
 	tdb->allrecord_lock.off = upgradable;
 
+	if (tdb->allrecord_lock.ltype == F_WRLCK) {
+		tdb_seqlock_inc(tdb, -1, false);
+	}
+
 	if (tdb_needs_recovery(tdb)) {
 		bool mark = flags & TDB_LOCK_MARK_ONLY;
 		tdb_allrecord_unlock(tdb, ltype, mark);
@@ -783,6 +940,10 @@ int tdb_allrecord_unlock(struct tdb_context *tdb, int ltype, bool mark_lock)
 		}
 	}
 
+	if (tdb->allrecord_lock.ltype == F_WRLCK) {
+		tdb_seqlock_inc(tdb, -1, true);
+	}
+
 	tdb->allrecord_lock.count = 0;
 	tdb->allrecord_lock.ltype = 0;
 
@@ -851,7 +1012,7 @@ _PUBLIC_ int tdb_unlockall_read(struct tdb_context *tdb)
    contention - it cannot guarantee how many records will be locked */
 _PUBLIC_ int tdb_chainlock(struct tdb_context *tdb, TDB_DATA key)
 {
-	int ret = tdb_lock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
+	int ret = tdb_lock_hash(tdb, tdb->hash_fn(&key), F_WRLCK);
 	tdb_trace_1rec(tdb, "tdb_chainlock", key);
 	return ret;
 }
@@ -861,7 +1022,7 @@ _PUBLIC_ int tdb_chainlock(struct tdb_context *tdb, TDB_DATA key)
    locked */
 _PUBLIC_ int tdb_chainlock_nonblock(struct tdb_context *tdb, TDB_DATA key)
 {
-	int ret = tdb_lock_nonblock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
+	int ret = tdb_lock_hash_nonblock(tdb, tdb->hash_fn(&key), F_WRLCK);
 	tdb_trace_1rec_ret(tdb, "tdb_chainlock_nonblock", key, ret);
 	return ret;
 }
@@ -883,16 +1044,224 @@ _PUBLIC_ int tdb_chainlock_unmark(struct tdb_context *tdb, TDB_DATA key)
 			       F_WRLCK, true);
 }
 
+/*
+ * Wait for a fcntl lock to become free with an open file description
+ * lock. Those are owned by tdb->fd's file description, not by our
+ * process, so they conflict with fcntl locks our own process holds.
+ */
+static int tdb_ofd_wait(struct tdb_context *tdb, int ltype, tdb_off_t off)
+{
+#ifdef F_OFD_SETLKW
+	struct flock fl = {
+		.l_type = ltype,
+		.l_whence = SEEK_SET,
+		.l_start = off,
+		.l_len = 1,
+		.l_pid = 0,
+	};
+	int ret;
+
+	do {
+		ret = fcntl(tdb->fd, F_OFD_SETLKW, &fl);
+	} while ((ret == -1) && (errno == EINTR));
+
+	if (ret == -1) {
+		return -1;
+	}
+
+	fl.l_type = F_UNLCK;
+	return fcntl(tdb->fd, F_OFD_SETLK, &fl);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Wait until the chain lock of key is free without taking it. This is
+ * called from helper threads, so it must not touch anything in tdb
+ * that changes after tdb_open(), not even tdb->ecode.
+ */
+_PUBLIC_ int tdb_chainlock_wait(struct tdb_context *tdb, TDB_DATA key)
+{
+	uint32_t list;
+	int ret;
+
+	if (tdb->flags & TDB_NOLOCK) {
+		return 0;
+	}
+
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_REHASH) {
+		/*
+		 * The chain of a key moves while the db grows, we
+		 * can't look at that from another thread.
+		 */
+		errno = EINVAL;
+		return -1;
+	}
+
+	list = tdb->hash_fn(&key) % tdb->hash_size;
+
+	if (tdb_have_mutexes(tdb)) {
+		ret = tdb_mutex_chain_wait(tdb, list);
+		if (ret != 0) {
+			errno = ret;
+			return -1;
+		}
+		return 0;
+	}
+
+	return tdb_ofd_wait(tdb, tdb->read_only ? F_RDLCK : F_WRLCK,
+			    lock_offset(list));
+}
+
 _PUBLIC_ int tdb_chainunlock(struct tdb_context *tdb, TDB_DATA key)
 {
+	int ret;
+
 	tdb_trace_1rec(tdb, "tdb_chainunlock", key);
-	return tdb_unlock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
+	ret = tdb_unlock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
+	tdb_rehash_maybe(tdb);
+	return ret;
+}
+
+static int tdb_chain_list_cmp(const void *p1, const void *p2)
+{
+	const uint32_t *l1 = p1;
+	const uint32_t *l2 = p2;
+
+	if (*l1 == *l2) {
+		return 0;
+	}
+	return (*l1 < *l2) ? -1 : 1;
+}
+
+/*
+ * Calculate the sorted, unique list of hash chains covering keys.
+ * Taking chain locks in this order from all processes makes holding
+ * several chain locks at once deadlock-free.
+ */
+static uint32_t *tdb_chain_lists(struct tdb_context *tdb,
+				 const TDB_DATA *keys, size_t num_keys,
+				 size_t *num_lists)
+{
+	uint32_t *lists;
+	size_t i, num;
+
+	lists = malloc(sizeof(uint32_t) * (num_keys ? num_keys : 1));
+	if (lists == NULL) {
+		tdb->ecode = TDB_ERR_OOM;
+		return NULL;
+	}
+
+	for (i=0; i<num_keys; i++) {
+		lists[i] = BUCKET(tdb->hash_fn(discard_const_p(TDB_DATA,
+							       &keys[i])));
+	}
+	qsort(lists, num_keys, sizeof(uint32_t), tdb_chain_list_cmp);
+
+	num = 0;
+	for (i=0; i<num_keys; i++) {
+		if ((num == 0) || (lists[i] != lists[num-1])) {
+			lists[num++] = lists[i];
+		}
+	}
+
+	*num_lists = num;
+	return lists;
+}
+
+/* lock the hash chains of several keys at once, in hash chain order */
+_PUBLIC_ int tdb_chainlock_multi(struct tdb_context *tdb,
+				 const TDB_DATA *keys, size_t num_keys)
+{
+	uint32_t *lists, *check;
+	size_t i, num_lists, num_check;
+	int ret = 0;
+
+	lists = tdb_chain_lists(tdb, keys, num_keys, &num_lists);
+	if (lists == NULL) {
+		return -1;
+	}
+
+again:
+	for (i=0; i<num_lists; i++) {
+		ret = tdb_lock(tdb, lists[i], F_WRLCK);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	if (ret == 0 && tdb->rehash_base != 0) {
+		/*
+		 * Some chains might have been split while we waited,
+		 * see tdb_lock_hash_list()
+		 */
+		check = tdb_chain_lists(tdb, keys, num_keys, &num_check);
+		if (check == NULL) {
+			ret = -1;
+		} else if ((num_check != num_lists) ||
+			   (memcmp(check, lists,
+				   num_lists * sizeof(uint32_t)) != 0)) {
+			while (i > 0) {
+				i -= 1;
+				tdb_unlock(tdb, lists[i], F_WRLCK);
+			}
+			free(lists);
+			lists = check;
+			num_lists = num_check;
+			goto again;
+		} else {
+			free(check);
+		}
+	}
+
+	if (ret != 0) {
+		while (i > 0) {
+			i -= 1;
+			tdb_unlock(tdb, lists[i], F_WRLCK);
+		}
+	}
+
+	for (i=0; i<num_keys; i++) {
+		tdb_trace_1rec(tdb, "tdb_chainlock_multi", keys[i]);
+	}
+
+	free(lists);
+	return ret;
+}
+
+_PUBLIC_ int tdb_chainunlock_multi(struct tdb_context *tdb,
+				   const TDB_DATA *keys, size_t num_keys)
+{
+	uint32_t *lists;
+	size_t i, num_lists;
+	int ret = 0;
+
+	for (i=0; i<num_keys; i++) {
+		tdb_trace_1rec(tdb, "tdb_chainunlock_multi", keys[i]);
+	}
+
+	lists = tdb_chain_lists(tdb, keys, num_keys, &num_lists);
+	if (lists == NULL) {
+		return -1;
+	}
+
+	for (i=num_lists; i>0; i--) {
+		if (tdb_unlock(tdb, lists[i-1], F_WRLCK) != 0) {
+			ret = -1;
+		}
+	}
+
+	free(lists);
+	tdb_rehash_maybe(tdb);
+	return ret;
 }
 
 _PUBLIC_ int tdb_chainlock_read(struct tdb_context *tdb, TDB_DATA key)
 {
 	int ret;
-	ret = tdb_lock(tdb, BUCKET(tdb->hash_fn(&key)), F_RDLCK);
+	ret = tdb_lock_hash(tdb, tdb->hash_fn(&key), F_RDLCK);
 	tdb_trace_1rec(tdb, "tdb_chainlock_read", key);
 	return ret;
 }
@@ -905,7 +1274,7 @@ _PUBLIC_ int tdb_chainunlock_read(struct tdb_context *tdb, TDB_DATA key)
 
 _PUBLIC_ int tdb_chainlock_read_nonblock(struct tdb_context *tdb, TDB_DATA key)
 {
-	int ret = tdb_lock_nonblock(tdb, BUCKET(tdb->hash_fn(&key)), F_RDLCK);
+	int ret = tdb_lock_hash_nonblock(tdb, tdb->hash_fn(&key), F_RDLCK);
 	tdb_trace_1rec_ret(tdb, "tdb_chainlock_read_nonblock", key, ret);
 	return ret;
 }
@@ -987,6 +1356,11 @@ bool tdb_have_extra_locks(struct tdb_context *tdb)
 		extra--;
 	}
 
+	/* A tdb_firstkey/nextkey walk might never be finished */
+	if (tdb->rehash_walk) {
+		extra--;
+	}
+
 	return extra;
 }
 
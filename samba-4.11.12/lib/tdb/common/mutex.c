@@ -91,9 +91,80 @@ size_t tdb_mutex_size(struct tdb_context *tdb)
 	mutex_size = sizeof(struct tdb_mutexes);
 	mutex_size += tdb->hash_size * sizeof(pthread_mutex_t);
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_STATS) {
+		mutex_size = TDB_ALIGN(mutex_size, sizeof(uint64_t));
+		mutex_size += (tdb->hash_size + 1) *
+			sizeof(struct tdb_mutex_chain_stats);
+	}
+
 	return TDB_ALIGN(mutex_size, tdb->page_size);
 }
 
+/*
+ * Offset of the tdb_mutex_chain_stats array in the mutex area
+ */
+static size_t tdb_mutex_stats_ofs(struct tdb_context *tdb)
+{
+	size_t ofs;
+
+	ofs = sizeof(struct tdb_mutexes);
+	ofs += tdb->hash_size * sizeof(pthread_mutex_t);
+
+	return TDB_ALIGN(ofs, sizeof(uint64_t));
+}
+
+/*
+ * Get the statistics for mutex idx, NULL if the tdb does not have
+ * them
+ */
+static struct tdb_mutex_chain_stats *tdb_mutex_stats(
+	struct tdb_context *tdb, unsigned idx)
+{
+	struct tdb_mutex_chain_stats *stats;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_STATS)) {
+		return NULL;
+	}
+	if (tdb->mutexes == NULL) {
+		return NULL;
+	}
+
+	stats = (struct tdb_mutex_chain_stats *)
+		((char *)tdb->mutexes + tdb_mutex_stats_ofs(tdb));
+
+	return &stats[idx];
+}
+
+bool tdb_mutex_chain_stats(struct tdb_context *tdb, unsigned idx,
+			   struct tdb_mutex_chain_stats *stats)
+{
+	struct tdb_mutex_chain_stats *s;
+	off_t ofs;
+	ssize_t nread;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_STATS)) {
+		return false;
+	}
+	if (idx > tdb->hash_size) {
+		return false;
+	}
+
+	s = tdb_mutex_stats(tdb, idx);
+	if (s != NULL) {
+		*stats = *s;
+		return true;
+	}
+
+	/*
+	 * With TDB_NOLOCK the mutex area is not mapped, as
+	 * tdbtool does it
+	 */
+	ofs = tdb_mutex_stats_ofs(tdb) + idx * sizeof(*stats);
+	nread = pread(tdb->fd, stats, sizeof(*stats), ofs);
+
+	return (nread == sizeof(*stats));
+}
+
 /*
  * Get the index for a chain mutex
  */
@@ -174,23 +245,142 @@ static bool tdb_have_mutex_chainlocks(struct tdb_context *tdb)
 	return false;
 }
 
-static int chain_mutex_lock(pthread_mutex_t *m, bool waitflag)
+/*
+ * TDB_MUTEX_ADAPTIVE: A contended chain mutex is polled with
+ * pthread_mutex_trylock(), pausing for an exponentially growing
+ * number of cpu relax cycles in between. How long we poll adapts per
+ * chain to how long it took to get the mutex recently, similar to
+ * glibc's PTHREAD_MUTEX_ADAPTIVE_NP. If that does not get us the
+ * mutex we sleep in pthread_mutex_lock().
+ *
+ * The estimates are per process, they don't change the file format.
+ */
+#define TDB_MUTEX_SPIN_MAX 1000
+#define TDB_MUTEX_SPIN_BACKOFF_MAX 64
+
+static bool tdb_mutex_spin_ok(struct tdb_context *tdb)
 {
-	int ret;
+	static long num_cpus = 0;
+
+	if (!(tdb->flags & TDB_MUTEX_ADAPTIVE)) {
+		return false;
+	}
+
+	if (num_cpus == 0) {
+		num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	/*
+	 * Spinning is pointless if the mutex holder can't run
+	 * while we spin.
+	 */
+	return (num_cpus > 1);
+}
+
+static int32_t *tdb_mutex_spin_estimate(struct tdb_context *tdb,
+					unsigned idx)
+{
+	if (tdb->spin_estimates == NULL) {
+		tdb->spin_estimates = calloc(tdb->hash_size + 1,
+					     sizeof(int32_t));
+		if (tdb->spin_estimates == NULL) {
+			return NULL;
+		}
+	}
+	return &tdb->spin_estimates[idx];
+}
+
+static int chain_mutex_spin(pthread_mutex_t *m,
+			    const int32_t *estimate,
+			    int *pspins)
+{
+	int max_spins = TDB_MUTEX_SPIN_MAX;
+	int spins = 0;
+	int backoff = 1;
+	int ret = EBUSY;
+
+	if (estimate != NULL) {
+		max_spins = MIN(*estimate * 2 + 10, TDB_MUTEX_SPIN_MAX);
+	}
+
+	while (spins < max_spins) {
+		int i;
+
+		for (i=0; i<backoff; i++) {
+			tdb_cpu_relax();
+		}
+		spins += backoff;
 
-	if (waitflag) {
-		ret = pthread_mutex_lock(m);
-	} else {
 		ret = pthread_mutex_trylock(m);
+		if (ret != EBUSY) {
+			break;
+		}
+
+		backoff = MIN(backoff * 2, TDB_MUTEX_SPIN_BACKOFF_MAX);
 	}
-	if (ret != EOWNERDEAD) {
+
+	*pspins = spins;
+	return ret;
+}
+
+static int chain_mutex_lock(struct tdb_context *tdb, unsigned idx,
+			    bool waitflag)
+{
+	pthread_mutex_t *m = &tdb->mutexes->hashchains[idx];
+	struct tdb_mutex_chain_stats *stats = tdb_mutex_stats(tdb, idx);
+	int32_t *estimate = NULL;
+	bool contended = false;
+	bool slept = false;
+	int spins = 0;
+	int ret;
+
+	ret = pthread_mutex_trylock(m);
+
+	if (waitflag && (ret == EBUSY)) {
+		contended = true;
+
+		if (tdb_mutex_spin_ok(tdb)) {
+			estimate = tdb_mutex_spin_estimate(tdb, idx);
+			ret = chain_mutex_spin(m, estimate, &spins);
+		}
+		if (ret == EBUSY) {
+			slept = true;
+			ret = pthread_mutex_lock(m);
+		}
+	}
+
+	if (ret == EOWNERDEAD) {
+		/*
+		 * For chainlocks, we don't do any cleanup (yet?)
+		 */
+		ret = pthread_mutex_consistent(m);
+	}
+	if (ret != 0) {
 		return ret;
 	}
 
+	if ((estimate != NULL) && (spins != 0)) {
+		*estimate += (spins - *estimate) / 8;
+	}
+
 	/*
-	 * For chainlocks, we don't do any cleanup (yet?)
+	 * The counters dirty another cache line on every lock, only
+	 * pay for that if asked to.
 	 */
-	return pthread_mutex_consistent(m);
+	if ((stats != NULL) && (tdb->flags & TDB_MUTEX_STATS)) {
+		stats->locks += 1;
+		if (contended) {
+			stats->contended += 1;
+		}
+		if (contended && !slept) {
+			stats->spun += 1;
+		}
+		if (slept) {
+			stats->slept += 1;
+		}
+	}
+
+	return ret;
 }
 
 static int allrecord_mutex_lock(struct tdb_mutexes *m, bool waitflag)
@@ -231,7 +421,7 @@ bool tdb_mutex_lock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 	chain = &m->hashchains[idx];
 
 again:
-	ret = chain_mutex_lock(chain, waitflag);
+	ret = chain_mutex_lock(tdb, idx, waitflag);
 	if (ret == EBUSY) {
 		ret = EAGAIN;
 	}
@@ -354,6 +544,52 @@ bool tdb_mutex_unlock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 	return true;
 }
 
+/*
+ * Wait until the mutex of hash chain "list" is free, for
+ * tdb_chainlock_wait(). This runs in a thread different from the
+ * one using tdb, so unlike tdb_mutex_lock() we can't look at
+ * tdb->lockrecs: Only touch the shared mutex area. Returns 0 or an
+ * errno.
+ */
+int tdb_mutex_chain_wait(struct tdb_context *tdb, uint32_t list)
+{
+	struct tdb_mutexes *m = tdb->mutexes;
+	unsigned idx = list + 1;
+	bool allrecord_locked;
+	int ret;
+
+	while (true) {
+		ret = chain_mutex_lock(tdb, idx, true);
+		if (ret != 0) {
+			return ret;
+		}
+
+		allrecord_locked = (m->allrecord_lock != F_UNLCK);
+
+		ret = pthread_mutex_unlock(&m->hashchains[idx]);
+		if (ret != 0) {
+			return ret;
+		}
+
+		if (!allrecord_locked) {
+			return 0;
+		}
+
+		/*
+		 * Queue behind the allrecord lock holder like
+		 * tdb_mutex_lock() does and try again
+		 */
+		ret = allrecord_mutex_lock(m, true);
+		if (ret != 0) {
+			return ret;
+		}
+		ret = pthread_mutex_unlock(&m->allrecord_mutex);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+}
+
 int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 			     enum tdb_lock_flags flags)
 {
@@ -399,7 +635,7 @@ int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 		/* ignore hashchains[0], the freelist */
 		pthread_mutex_t *chain = &m->hashchains[i+1];
 
-		ret = chain_mutex_lock(chain, waitflag);
+		ret = chain_mutex_lock(tdb, i+1, waitflag);
 		if (!waitflag && (ret == EBUSY)) {
 			errno = EAGAIN;
 			goto fail_unroll_allrecord_lock;
@@ -473,7 +709,7 @@ int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb)
 		/* ignore hashchains[0], the freelist */
 		pthread_mutex_t *chain = &m->hashchains[i+1];
 
-		ret = chain_mutex_lock(chain, true);
+		ret = chain_mutex_lock(tdb, i+1, true);
 		if (ret != 0) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "pthread_mutex_lock"
 				 "(chainlock) failed: %s\n", strerror(ret)));
@@ -593,6 +829,15 @@ int tdb_mutex_init(struct tdb_context *tdb)
 		}
 	}
 
+	for (i=0; i<tdb->hash_size+1; i++) {
+		struct tdb_mutex_chain_stats *stats = tdb_mutex_stats(tdb, i);
+
+		if (stats == NULL) {
+			break;
+		}
+		*stats = (struct tdb_mutex_chain_stats) { .locks = 0 };
+	}
+
 	m->allrecord_lock = F_UNLCK;
 
 	ret = pthread_mutex_init(&m->allrecord_mutex, &ma);
@@ -643,6 +888,8 @@ int tdb_mutex_munmap(struct tdb_context *tdb)
 	size_t len;
 	int ret;
 
+	SAFE_FREE(tdb->spin_estimates);
+
 	len = tdb_mutex_size(tdb);
 	if (len == 0) {
 		return 0;
@@ -1028,6 +1275,17 @@ bool tdb_have_mutexes(struct tdb_context *tdb)
 	return false;
 }
 
+bool tdb_mutex_chain_stats(struct tdb_context *tdb, unsigned idx,
+			   struct tdb_mutex_chain_stats *stats)
+{
+	return false;
+}
+
+int tdb_mutex_chain_wait(struct tdb_context *tdb, uint32_t list)
+{
+	return ENOSYS;
+}
+
 int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 			     enum tdb_lock_flags flags)
 {
@@ -56,10 +56,40 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 {
 	struct tdb_header *newdb;
 	size_t size;
+	uint32_t rehash_base = 0;
+	tdb_off_t seqlock_area = 0;
 	int ret = -1;
 
+	/*
+	 * With TDB_REHASH we reserve room for the hash table to grow,
+	 * but only use hash_size chains to start with.
+	 */
+	if ((tdb->flags & TDB_REHASH) && !(tdb->flags & TDB_INTERNAL) &&
+	    ((uint32_t)hash_size <= UINT32_MAX/4/TDB_REHASH_GROWTH)) {
+		rehash_base = hash_size;
+		hash_size *= TDB_REHASH_GROWTH;
+	}
+
 	/* We make it up in memory, then write it out if not internal */
 	size = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off_t);
+
+#ifdef USE_TDB_SEQLOCK
+	/*
+	 * The readers and writers of the seqlock counters need a
+	 * shared mmap of them.
+	 */
+	if ((tdb->flags & TDB_LOCKFREE_READS) &&
+	    !(tdb->flags & (TDB_INTERNAL|TDB_NOMMAP|TDB_NOLOCK|TDB_CONVERT))) {
+		tdb_off_t seqlock_rec = size;
+		size_t area_size = TDB_SEQLOCK_AREA_SIZE(hash_size);
+
+		seqlock_area = TDB_ALIGN(seqlock_rec + sizeof(struct tdb_record),
+					 tdb->page_size);
+		size = TDB_ALIGN(seqlock_area + area_size, tdb->page_size);
+		size += sizeof(tdb_off_t);
+	}
+#endif
+
 	if (!(newdb = (struct tdb_header *)calloc(size, 1))) {
 		tdb->ecode = TDB_ERR_OOM;
 		return -1;
@@ -85,6 +115,47 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX;
 	}
 
+	/*
+	 * The lock statistics live in a per chain area behind the
+	 * mutexes.
+	 */
+	if ((tdb->flags & TDB_MUTEX_LOCKING) &&
+	    (tdb->flags & TDB_MUTEX_STATS)) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_MUTEX_STATS;
+	}
+
+	/*
+	 * The magic hashes alone would let older tdb versions try
+	 * their hashes and fail with a confusing error, the feature
+	 * flag makes them refuse the database.
+	 */
+	if (tdb->hash_fn == tdb_crc32c_hash) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_CRC32C_HASH;
+	}
+
+	if (rehash_base != 0) {
+		newdb->feature_flags |= TDB_FEATURE_FLAG_REHASH;
+		newdb->rehash_base = rehash_base;
+		newdb->rehash_buckets = rehash_base;
+	}
+
+	if (seqlock_area != 0) {
+		tdb_off_t seqlock_rec = TDB_DATA_START(hash_size);
+		struct tdb_record *rec = (struct tdb_record *)
+			((char *)newdb + seqlock_rec);
+		tdb_off_t totalsize = size - seqlock_rec;
+
+		*rec = (struct tdb_record) {
+			.magic = TDB_SEQLOCK_MAGIC,
+			.rec_len = totalsize - sizeof(struct tdb_record),
+		};
+		memcpy((char *)newdb + size - sizeof(tdb_off_t),
+		       &totalsize, sizeof(tdb_off_t));
+
+		newdb->feature_flags |= TDB_FEATURE_FLAG_SEQLOCK;
+		newdb->seqlock_area = seqlock_area;
+	}
+
 	/*
 	 * If we have any features we add the FEATURE_FLAG_MAGIC, overwriting the
 	 * TDB_HASH_RWLOCK_MAGIC above.
@@ -101,6 +172,7 @@ static int tdb_new_database(struct tdb_context *tdb, struct tdb_header *header,
 	 */
 	tdb->feature_flags = newdb->feature_flags;
 	tdb->hash_size = newdb->hash_size;
+	tdb->seqlock_area = newdb->seqlock_area;
 
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->map_size = size;
@@ -338,7 +410,9 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		hash_alg = "the user defined";
 	} else {
 		/* This controls what we use when creating a tdb. */
-		if (tdb->flags & TDB_INCOMPATIBLE_HASH) {
+		if (tdb->flags & TDB_CRC32C_HASH) {
+			tdb->hash_fn = tdb_crc32c_hash;
+		} else if (tdb->flags & TDB_INCOMPATIBLE_HASH) {
 			tdb->hash_fn = tdb_jenkins_hash;
 		} else {
 			tdb->hash_fn = tdb_old_hash;
@@ -580,6 +654,40 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		goto fail;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_REHASH) {
+		if ((header.rehash_base == 0) ||
+		    (header.rehash_base > header.hash_size)) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+				 "invalid rehash base %"PRIu32" for hash "
+				 "size %"PRIu32" in %s\n", header.rehash_base,
+				 header.hash_size, name));
+			errno = EINVAL;
+			goto fail;
+		}
+		tdb->rehash_base = header.rehash_base;
+	}
+
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		if (header.seqlock_area < TDB_DATA_START(header.hash_size) +
+		    sizeof(struct tdb_record)) {
+			TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+				 "invalid seqlock area offset %"PRIu32
+				 " in %s\n", header.seqlock_area, name));
+			errno = EINVAL;
+			goto fail;
+		}
+		tdb->seqlock_area = header.seqlock_area;
+	}
+
+	if ((tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) &&
+	    !tdb->read_only && (tdb->flags & TDB_NOMMAP)) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_open_ex: "
+			 "%s uses lock-free reads, can't write to it "
+			 "with TDB_NOMMAP\n", name));
+		errno = EINVAL;
+		goto fail;
+	}
+
 	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX) {
 		if (!tdb_mutex_open_ok(tdb, &header)) {
 			errno = EINVAL;
@@ -619,10 +727,25 @@ _PUBLIC_ struct tdb_context *tdb_open_ex(const char *name, int hash_size, int td
 		}
 	}
 
+	if (!hash_fn) {
+		/*
+		 * The header tells us about CRC32C, check_header_hash()
+		 * only toggles between the old and the jenkins hash.
+		 */
+		if (tdb->feature_flags & TDB_FEATURE_FLAG_CRC32C_HASH) {
+			tdb->hash_fn = tdb_crc32c_hash;
+			hash_alg = "the crc32c";
+		} else if (tdb->hash_fn == tdb_crc32c_hash) {
+			tdb->hash_fn = tdb_jenkins_hash;
+		}
+	}
+
 	if ((header.magic1_hash == 0) && (header.magic2_hash == 0)) {
 		/* older TDB without magic hash references */
 		tdb->hash_fn = tdb_old_hash;
-	} else if (!check_header_hash(tdb, &header, !hash_fn,
+	} else if (!check_header_hash(tdb, &header,
+				      (hash_fn == NULL) &&
+				      (tdb->hash_fn != tdb_crc32c_hash),
 				      &magic1, &magic2)) {
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_open_ex: "
 			 "%s was not created with %s hash function we are using\n"
@@ -849,6 +972,9 @@ static int tdb_reopen_internal(struct tdb_context *tdb, bool active_lock)
 		return 0; /* Nothing to do. */
 	}
 
+	/* Closing the fd drops the fcntl lock anyway */
+	tdb_rehash_walk_unlock(tdb);
+
 	if (tdb_have_extra_locks(tdb)) {
 		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_reopen: reopen not allowed with locks held\n"));
 		goto fail;
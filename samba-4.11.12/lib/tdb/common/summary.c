@@ -22,6 +22,7 @@
 	"Header offset/logical size: %zu/%zu\n" \
 	"Number of records: %zu\n" \
 	"Incompatible hash: %s\n" \
+	"Hash function: %s\n" \
 	"Active/supported feature flags: 0x%08x/0x%08x\n" \
 	"Robust mutexes locking: %s\n" \
 	"Smallest/average/largest keys: %zu/%zu/%zu\n" \
@@ -35,8 +36,20 @@
 	"Smallest/average/largest hash chains: %zu/%zu/%zu\n" \
 	"Number of uncoalesced records: %zu\n" \
 	"Smallest/average/largest uncoalesced runs: %zu/%zu/%zu\n" \
+	"Free space fragmentation: %.0f%%\n" \
 	"Percentage keys/data/padding/free/dead/rechdrs&tailers/hashes: %.0f/%.0f/%.0f/%.0f/%.0f/%.0f/%.0f\n"
 
+#define MUTEX_STATS_FORMAT \
+	"Chain mutex locks: %llu\n" \
+	"Contended/spun/slept chain mutex locks: %llu/%llu/%llu\n" \
+	"Most contended chain mutex: %s %u (%llu of %llu contended)\n"
+
+#define REHASH_FORMAT \
+	"Hash chains in use/reserved: %u/%u\n"
+
+#define SEQLOCK_FORMAT \
+	"Lock-free read fallbacks: %u\n"
+
 /* We don't use tally module, to keep upstream happy. */
 struct tally {
 	size_t min, max, total;
@@ -75,7 +88,7 @@ static size_t get_hash_length(struct tdb_context *tdb, unsigned int i)
 	struct tdb_chainwalk_ctx chainwalk;
 	size_t count = 0;
 
-	if (tdb_ofs_read(tdb, TDB_HASH_TOP(i), &rec_ptr) == -1)
+	if (tdb_ofs_read(tdb, TDB_CHAIN_TOP(i), &rec_ptr) == -1)
 		return 0;
 
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
@@ -96,6 +109,78 @@ static size_t get_hash_length(struct tdb_context *tdb, unsigned int i)
 	return count;
 }
 
+/*
+ * Returns an empty string if there is nothing to show
+ */
+static char *tdb_mutex_summary(struct tdb_context *tdb)
+{
+	struct tdb_mutex_chain_stats total = { .locks = 0 };
+	struct tdb_mutex_chain_stats hottest = { .locks = 0 };
+	unsigned i, hottest_idx = 0;
+	char *ret = NULL;
+	int len;
+
+	for (i = 0; i < tdb->hash_size + 1; i++) {
+		struct tdb_mutex_chain_stats stats;
+
+		if (!tdb_mutex_chain_stats(tdb, i, &stats)) {
+			return strdup("");
+		}
+
+		total.locks += stats.locks;
+		total.contended += stats.contended;
+		total.spun += stats.spun;
+		total.slept += stats.slept;
+
+		if (stats.contended > hottest.contended) {
+			hottest = stats;
+			hottest_idx = i;
+		}
+	}
+
+	if (total.locks == 0) {
+		/*
+		 * Nobody used TDB_MUTEX_STATS
+		 */
+		return strdup("");
+	}
+
+	/* index 0 is the freelist, then the hash chains */
+	len = asprintf(&ret, MUTEX_STATS_FORMAT,
+		       (unsigned long long)total.locks,
+		       (unsigned long long)total.contended,
+		       (unsigned long long)total.spun,
+		       (unsigned long long)total.slept,
+		       (hottest_idx == 0) ? "freelist" : "hash chain",
+		       (hottest_idx == 0) ? 0 : hottest_idx - 1,
+		       (unsigned long long)hottest.contended,
+		       (unsigned long long)hottest.locks);
+	if (len == -1) {
+		return NULL;
+	}
+	return ret;
+}
+
+/* append extra to *summary, freeing extra */
+static bool tdb_summary_append(char **summary, char *extra)
+{
+	char *tmp;
+
+	if (extra == NULL) {
+		return false;
+	}
+
+	tmp = realloc(*summary, strlen(*summary) + strlen(extra) + 1);
+	if (tmp == NULL) {
+		free(extra);
+		return false;
+	}
+	*summary = tmp;
+	strcat(*summary, extra);
+	free(extra);
+	return true;
+}
+
 _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 {
 	off_t file_size;
@@ -105,6 +190,8 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	char *ret = NULL;
 	bool locked;
 	size_t unc = 0;
+	double free_frag = 0.0;
+	const char *hash_name = "custom";
 	int len;
 	struct tdb_record recovery;
 
@@ -146,6 +233,12 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 				tally_add(&uncoal, unc - 1);
 			unc = 0;
 			break;
+		case TDB_SEQLOCK_MAGIC:
+			/* The lock-free read counters, not a free region */
+			if (unc > 1)
+				tally_add(&uncoal, unc - 1);
+			unc = 0;
+			break;
 		case TDB_FREE_MAGIC:
 			tally_add(&freet, rec.rec_len);
 			unc++;
@@ -174,16 +267,35 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 	if (unc > 1)
 		tally_add(&uncoal, unc - 1);
 
-	for (off = 0; off < tdb->hash_size; off++)
+	/* Only the chains in use, see TDB_FEATURE_FLAG_REHASH */
+	for (off = 0; off < tdb_rehash_buckets(tdb); off++)
 		tally_add(&hashval, get_hash_length(tdb, off));
 
 	file_size = tdb->hdr_ofs + tdb->map_size;
 
+	/*
+	 * How much of the free space can not be handed out as one
+	 * allocation: 0% means it is all in a single record.
+	 */
+	if (freet.total != 0) {
+		free_frag = 100.0 - freet.max * 100.0 / freet.total;
+	}
+
+	if (tdb->hash_fn == tdb_old_hash) {
+		hash_name = "old";
+	} else if (tdb->hash_fn == tdb_jenkins_hash) {
+		hash_name = "jenkins";
+	} else if (tdb->hash_fn == tdb_crc32c_hash) {
+		hash_name = "crc32c";
+	}
+
 	len = asprintf(&ret, SUMMARY_FORMAT,
 		 (unsigned long long)file_size, keys.total+data.total,
 		 (size_t)tdb->hdr_ofs, (size_t)tdb->map_size,
 		 keys.num,
-		 (tdb->hash_fn == tdb_jenkins_hash)?"yes":"no",
+		 ((tdb->hash_fn == tdb_jenkins_hash) ||
+		  (tdb->hash_fn == tdb_crc32c_hash))?"yes":"no",
+		 hash_name,
 		 (unsigned)tdb->feature_flags, TDB_SUPPORTED_FEATURE_FLAGS,
 		 (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX)?"yes":"no",
 		 keys.min, tally_mean(&keys), keys.max,
@@ -197,6 +309,7 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		 hashval.min, tally_mean(&hashval), hashval.max,
 		 uncoal.total,
 		 uncoal.min, tally_mean(&uncoal), uncoal.max,
+		 free_frag,
 		 keys.total * 100.0 / file_size,
 		 data.total * 100.0 / file_size,
 		 extra.total * 100.0 / file_size,
@@ -211,6 +324,49 @@ _PUBLIC_ char *tdb_summary(struct tdb_context *tdb)
 		goto unlock;
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_STATS) {
+		/*
+		 * The statistics are not available if this tdb
+		 * library can't do mutexes or nobody counted
+		 */
+		if (!tdb_summary_append(&ret, tdb_mutex_summary(tdb))) {
+			SAFE_FREE(ret);
+			goto unlock;
+		}
+	}
+
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_REHASH) {
+		char *rehash_summary = NULL;
+
+		len = asprintf(&rehash_summary, REHASH_FORMAT,
+			       (unsigned)tdb_rehash_buckets(tdb),
+			       (unsigned)tdb->hash_size);
+		if (len == -1) {
+			rehash_summary = NULL;
+		}
+		if (!tdb_summary_append(&ret, rehash_summary)) {
+			SAFE_FREE(ret);
+			goto unlock;
+		}
+	}
+
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		struct tdb_seqlock_area *area = tdb_seqlock_area(tdb);
+		char *seqlock_summary = NULL;
+
+		if (area != NULL) {
+			len = asprintf(&seqlock_summary, SEQLOCK_FORMAT,
+				       (unsigned)area->fallbacks);
+			if (len == -1) {
+				seqlock_summary = NULL;
+			}
+			if (!tdb_summary_append(&ret, seqlock_summary)) {
+				SAFE_FREE(ret);
+				goto unlock;
+			}
+		}
+	}
+
 unlock:
 	if (locked) {
 		tdb_unlockall_read(tdb);
@@ -115,6 +115,7 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 {
 	tdb_off_t rec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
+	uint32_t chain_len = 0;
 
 	/* read in the hash top */
 	if (tdb_ofs_read(tdb, TDB_HASH_TOP(hash), &rec_ptr) == -1)
@@ -129,6 +130,10 @@ static tdb_off_t tdb_find(struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
 		if (tdb_rec_read(tdb, rec_ptr, r) == -1)
 			return 0;
 
+		if (++chain_len > TDB_REHASH_CHAIN_LIMIT) {
+			tdb->rehash_wanted = (tdb->rehash_base != 0);
+		}
+
 		if (!TDB_DEAD(r) && hash==r->full_hash
 		    && key.dsize==r->key_len
 		    && tdb_parse_data(tdb, key, rec_ptr + sizeof(*r),
@@ -153,7 +158,7 @@ tdb_off_t tdb_find_lock_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t has
 {
 	uint32_t rec_ptr;
 
-	if (tdb_lock(tdb, BUCKET(hash), locktype) == -1)
+	if (tdb_lock_hash(tdb, hash, locktype) == -1)
 		return 0;
 	if (!(rec_ptr = tdb_find(tdb, key, hash, rec)))
 		tdb_unlock(tdb, BUCKET(hash), locktype);
@@ -286,6 +291,211 @@ _PUBLIC_ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
 	return ret;
 }
 
+#ifdef USE_TDB_SEQLOCK
+
+#define TDB_SEQLOCK_TRIES 3
+/* cpu relax cycles to wait for a writer before the first retry */
+#define TDB_SEQLOCK_SPIN 64
+
+static uint32_t tdb_seqlock_load(const uint32_t *p)
+{
+	return *(const volatile uint32_t *)p;
+}
+
+static bool tdb_seqlock_idle(const struct tdb_seqlock_chain *chain)
+{
+	uint32_t finished, started;
+
+	finished = tdb_seqlock_load(&chain->finished);
+	atomic_thread_fence(memory_order_acquire);
+	started = tdb_seqlock_load(&chain->started);
+
+	return (started == finished);
+}
+
+/*
+ * Give the writer that disturbed our last try some time to finish,
+ * twice as long for every try. Retrying right away would most likely
+ * find it still busy.
+ */
+static void tdb_seqlock_backoff(const struct tdb_seqlock_area *area,
+				const struct tdb_seqlock_chain *chain,
+				int tries)
+{
+	unsigned spins = TDB_SEQLOCK_SPIN << tries;
+	unsigned i;
+
+	for (i = 0; i < spins; i++) {
+		if (tdb_seqlock_idle(chain) && tdb_seqlock_idle(&area->all)) {
+			return;
+		}
+		tdb_cpu_relax();
+	}
+}
+
+/*
+ * Walk the hash chain without holding its lock. Everything we read
+ * might be modified under our feet, so we bounds-check every offset
+ * against the current mmap and never trust a length. The result is
+ * only valid if tdb_seqlock_parse_record() finds the "started"
+ * counters unchanged afterwards.
+ *
+ * Returns 1 with a malloc'ed copy of the data, 0 if the key was not
+ * found and -1 if the chain looked inconsistent.
+ */
+static int tdb_seqlock_find(struct tdb_context *tdb, TDB_DATA key,
+			    uint32_t hash, uint32_t list, TDB_DATA *data)
+{
+	const char *map = (const char *)tdb->map_ptr;
+	tdb_len_t map_size = tdb->map_size;
+	tdb_off_t data_start = TDB_DATA_START(tdb->hash_size);
+	tdb_off_t max_records;
+	tdb_off_t rec_ptr;
+	tdb_off_t count = 0;
+
+	if (map_size < data_start + sizeof(struct tdb_record)) {
+		return -1;
+	}
+	/* A chain longer than this must be a loop */
+	max_records = (map_size - data_start) / sizeof(struct tdb_record);
+
+	memcpy(&rec_ptr, map + TDB_CHAIN_TOP(list), sizeof(rec_ptr));
+
+	while (rec_ptr != 0) {
+		struct tdb_record rec;
+		tdb_off_t key_ofs;
+
+		if ((rec_ptr < data_start) ||
+		    (rec_ptr > map_size - sizeof(rec)) ||
+		    (count++ > max_records)) {
+			return -1;
+		}
+		memcpy(&rec, map + rec_ptr, sizeof(rec));
+
+		if (rec.magic == TDB_DEAD_MAGIC) {
+			rec_ptr = rec.next;
+			continue;
+		}
+		if (rec.magic != TDB_MAGIC) {
+			return -1;
+		}
+
+		key_ofs = rec_ptr + sizeof(rec);
+
+		if ((rec.full_hash != hash) || (rec.key_len != key.dsize)) {
+			rec_ptr = rec.next;
+			continue;
+		}
+		if ((rec.key_len > map_size - key_ofs) ||
+		    (rec.data_len > map_size - key_ofs - rec.key_len)) {
+			return -1;
+		}
+		if (memcmp(map + key_ofs, key.dptr, key.dsize) != 0) {
+			rec_ptr = rec.next;
+			continue;
+		}
+
+		data->dsize = rec.data_len;
+		data->dptr = (unsigned char *)malloc(
+			rec.data_len == 0 ? 1 : rec.data_len);
+		if (data->dptr == NULL) {
+			return -1;
+		}
+		memcpy(data->dptr, map + key_ofs + rec.key_len, rec.data_len);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Try tdb_parse_record() without the chain lock. Returns false if
+ * the caller has to fall back to the locked path, either because the
+ * tdb does not support it or because writers kept interfering.
+ */
+static bool tdb_seqlock_parse_record(
+	struct tdb_context *tdb, TDB_DATA key, uint32_t hash,
+	int (*parser)(TDB_DATA key, TDB_DATA data, void *private_data),
+	void *private_data, int *pret)
+{
+	struct tdb_seqlock_area *area;
+	int tries;
+
+	if (!(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) ||
+	    (tdb->flags & TDB_CONVERT) ||
+	    (tdb->transaction != NULL) ||
+	    (tdb->allrecord_lock.count != 0)) {
+		return false;
+	}
+	area = tdb_seqlock_area(tdb);
+	if (area == NULL) {
+		return false;
+	}
+
+	for (tries = 0; tries < TDB_SEQLOCK_TRIES; tries++) {
+		TDB_DATA data = { .dptr = NULL };
+		uint32_t list = BUCKET(hash);
+		struct tdb_seqlock_chain *chain = &area->chains[list];
+		uint32_t finished, started, all_finished, all_started;
+		int found;
+
+		if (tries > 0) {
+			tdb_seqlock_backoff(area, chain, tries - 1);
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		finished = tdb_seqlock_load(&chain->finished);
+		all_finished = tdb_seqlock_load(&area->all.finished);
+		atomic_thread_fence(memory_order_acquire);
+		started = tdb_seqlock_load(&chain->started);
+		all_started = tdb_seqlock_load(&area->all.started);
+		if ((started != finished) || (all_started != all_finished)) {
+			/* A writer holds our chain or all of them */
+			continue;
+		}
+		atomic_thread_fence(memory_order_acquire);
+
+		found = tdb_seqlock_find(tdb, key, hash, list, &data);
+
+		atomic_thread_fence(memory_order_acquire);
+		if ((tdb_seqlock_load(&chain->started) != started) ||
+		    (tdb_seqlock_load(&area->all.started) != all_started)) {
+			SAFE_FREE(data.dptr);
+			continue;
+		}
+		if (BUCKET(hash) != list) {
+			/* The chain was split under our feet */
+			SAFE_FREE(data.dptr);
+			continue;
+		}
+
+		if (found == -1) {
+			break;
+		}
+		if (found == 0) {
+			tdb->ecode = TDB_ERR_NOEXIST;
+			*pret = -1;
+			return true;
+		}
+
+		*pret = parser(key, data, private_data);
+		SAFE_FREE(data.dptr);
+		return true;
+	}
+
+	/*
+	 * Shows up in tdb_summary(). Read-only openers can't write to
+	 * the mapping, their fallbacks are not counted.
+	 */
+	if (!tdb->read_only) {
+		__sync_fetch_and_add(&area->fallbacks, 1);
+	}
+
+	return false;
+}
+
+#endif /* USE_TDB_SEQLOCK */
+
 /*
  * Find an entry in the database and hand the record's data to a parsing
  * function. The parsing function is executed under the chain read lock, so it
@@ -298,6 +508,9 @@ _PUBLIC_ TDB_DATA tdb_fetch(struct tdb_context *tdb, TDB_DATA key)
  * case. If a transaction is open or no mmap is available, it has to do
  * malloc/read/parse/free.
  *
+ * For tdb's created with TDB_LOCKFREE_READS the record is copied out of the
+ * mmap area without taking the chain lock and the parser runs on the copy.
+ *
  * This is interesting for all readers of potentially large data structures in
  * the tdb records, ldb indexes being one example.
  *
@@ -317,6 +530,14 @@ _PUBLIC_ int tdb_parse_record(struct tdb_context *tdb, TDB_DATA key,
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
 
+#ifdef USE_TDB_SEQLOCK
+	if (tdb_seqlock_parse_record(tdb, key, hash, parser, private_data,
+				     &ret)) {
+		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, ret);
+		return ret;
+	}
+#endif
+
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec))) {
 		/* record not found */
 		tdb_trace_1rec_ret(tdb, "tdb_parse_record", key, -1);
@@ -395,7 +616,7 @@ static int tdb_del_dead(struct tdb_context *tdb,
  * Walk the hash chain and leave tdb->max_dead_records around. Move
  * the rest of dead records to the freelist.
  */
-int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash)
+int tdb_trim_dead(struct tdb_context *tdb, uint32_t list)
 {
 	struct tdb_chainwalk_ctx chainwalk;
 	struct tdb_record rec;
@@ -404,7 +625,7 @@ int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash)
 	int num_dead = 0;
 	int ret;
 
-	last_ptr = TDB_HASH_TOP(hash);
+	last_ptr = TDB_CHAIN_TOP(list);
 
 	/*
 	 * Init chainwalk with the pointer to the hash top. It might
@@ -522,7 +743,7 @@ static int tdb_delete_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t hash)
 
 	tdb_increment_seqnum(tdb);
 
-	ret = tdb_trim_dead(tdb, hash);
+	ret = tdb_trim_dead(tdb, BUCKET(hash));
 done:
 	if (tdb_unlock(tdb, BUCKET(hash), F_WRLCK) != 0)
 		TDB_LOG((tdb, TDB_DEBUG_WARNING, "tdb_delete: WARNING tdb_unlock failed!\n"));
@@ -542,7 +763,7 @@ _PUBLIC_ int tdb_delete(struct tdb_context *tdb, TDB_DATA key)
 /*
  * See if we have a dead record around with enough space
  */
-tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
+tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t list,
 			struct tdb_record *r, tdb_len_t length,
 			tdb_off_t *p_last_ptr)
 {
@@ -554,7 +775,7 @@ tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
 
 	length += sizeof(tdb_off_t); /* tailer */
 
-	last_ptr = TDB_HASH_TOP(hash);
+	last_ptr = TDB_CHAIN_TOP(list);
 
 	/* read in the hash top */
 	if (tdb_ofs_read(tdb, last_ptr, &rec_ptr) == -1)
@@ -737,12 +958,13 @@ _PUBLIC_ int tdb_store(struct tdb_context *tdb, TDB_DATA key, TDB_DATA dbuf, int
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
-	if (tdb_lock(tdb, BUCKET(hash), F_WRLCK) == -1)
+	if (tdb_lock_hash(tdb, hash, F_WRLCK) == -1)
 		return -1;
 
 	ret = _tdb_store(tdb, key, dbuf, flag, hash);
 	tdb_trace_2rec_flag_ret(tdb, "tdb_store", key, dbuf, flag, ret);
 	tdb_unlock(tdb, BUCKET(hash), F_WRLCK);
+	tdb_rehash_maybe(tdb);
 	return ret;
 }
 
@@ -761,13 +983,14 @@ _PUBLIC_ int tdb_storev(struct tdb_context *tdb, TDB_DATA key,
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
-	if (tdb_lock(tdb, BUCKET(hash), F_WRLCK) == -1)
+	if (tdb_lock_hash(tdb, hash, F_WRLCK) == -1)
 		return -1;
 
 	ret = _tdb_storev(tdb, key, dbufs, num_dbufs, flag, hash);
 	tdb_trace_1plusn_rec_flag_ret(tdb, "tdb_storev", key,
 				      dbufs, num_dbufs, flag, -1);
 	tdb_unlock(tdb, BUCKET(hash), F_WRLCK);
+	tdb_rehash_maybe(tdb);
 	return ret;
 }
 
@@ -780,7 +1003,7 @@ _PUBLIC_ int tdb_append(struct tdb_context *tdb, TDB_DATA key, TDB_DATA new_dbuf
 
 	/* find which hash bucket it is in */
 	hash = tdb->hash_fn(&key);
-	if (tdb_lock(tdb, BUCKET(hash), F_WRLCK) == -1)
+	if (tdb_lock_hash(tdb, hash, F_WRLCK) == -1)
 		return -1;
 
 	dbufs[0] = _tdb_fetch(tdb, key);
@@ -791,6 +1014,7 @@ _PUBLIC_ int tdb_append(struct tdb_context *tdb, TDB_DATA key, TDB_DATA new_dbuf
 
 	tdb_unlock(tdb, BUCKET(hash), F_WRLCK);
 	SAFE_FREE(dbufs[0].dptr);
+	tdb_rehash_maybe(tdb);
 	return ret;
 }
 
@@ -847,6 +1071,11 @@ _PUBLIC_ int tdb_hash_size(struct tdb_context *tdb)
 	return tdb->hash_size;
 }
 
+_PUBLIC_ unsigned int tdb_hash_chain(struct tdb_context *tdb, TDB_DATA key)
+{
+	return BUCKET(tdb->hash_fn(&key));
+}
+
 _PUBLIC_ size_t tdb_map_size(struct tdb_context *tdb)
 {
 	return tdb->map_size;
@@ -945,13 +1174,15 @@ static int tdb_free_region(struct tdb_context *tdb, tdb_off_t offset, ssize_t le
   very fast by using a allrecord lock. The entire data portion of the
   file becomes a single entry in the freelist.
 
-  This code carefully steps around the recovery area, leaving it alone
+  This code carefully steps around the recovery area, leaving it alone.
+  The same goes for the seqlock counters at the start of the data area.
  */
 _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 {
 	uint32_t i;
 	tdb_off_t offset = 0;
 	ssize_t data_len;
+	tdb_off_t data_start = TDB_DATA_START(tdb->hash_size);
 	tdb_off_t recovery_head;
 	tdb_len_t recovery_size = 0;
 
@@ -979,9 +1210,23 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 		recovery_size = rec.rec_len + sizeof(rec);
 	}
 
+	if (tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK) {
+		struct tdb_record rec;
+		if (tdb->methods->tdb_read(tdb, data_start, &rec, sizeof(rec), DOCONV()) == -1) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wipe_all: failed to read seqlock record\n"));
+			goto failed;
+		}
+		if (rec.magic != TDB_SEQLOCK_MAGIC) {
+			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_wipe_all: bad seqlock record magic 0x%x\n", rec.magic));
+			tdb->ecode = TDB_ERR_CORRUPT;
+			goto failed;
+		}
+		data_start += rec.rec_len + sizeof(rec);
+	}
+
 	/* wipe the hashes */
 	for (i=0;i<tdb->hash_size;i++) {
-		if (tdb_ofs_write(tdb, TDB_HASH_TOP(i), &offset) == -1) {
+		if (tdb_ofs_write(tdb, TDB_CHAIN_TOP(i), &offset) == -1) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL,"tdb_wipe_all: failed to write hash %d\n", i));
 			goto failed;
 		}
@@ -997,8 +1242,8 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 	   for the recovery area */
 	if (recovery_size == 0) {
 		/* the simple case - the whole file can be used as a freelist */
-		data_len = (tdb->map_size - TDB_DATA_START(tdb->hash_size));
-		if (tdb_free_region(tdb, TDB_DATA_START(tdb->hash_size), data_len) != 0) {
+		data_len = (tdb->map_size - data_start);
+		if (tdb_free_region(tdb, data_start, data_len) != 0) {
 			goto failed;
 		}
 	} else {
@@ -1010,8 +1255,8 @@ _PUBLIC_ int tdb_wipe_all(struct tdb_context *tdb)
 		   move the recovery area or we risk subtle data
 		   corruption
 		*/
-		data_len = (recovery_head - TDB_DATA_START(tdb->hash_size));
-		if (tdb_free_region(tdb, TDB_DATA_START(tdb->hash_size), data_len) != 0) {
+		data_len = (recovery_head - data_start);
+		if (tdb_free_region(tdb, data_start, data_len) != 0) {
 			goto failed;
 		}
 		/* and the 2nd free list entry after the recovery area - if any */
@@ -1126,6 +1371,232 @@ _PUBLIC_ int tdb_repack(struct tdb_context *tdb)
 	return 0;
 }
 
+/*
+ * Number of hash chains in use. With TDB_FEATURE_FLAG_REHASH this
+ * grows from rehash_base up to hash_size, as chains are split.
+ */
+uint32_t tdb_rehash_buckets(struct tdb_context *tdb)
+{
+	tdb_off_t buckets;
+	int ret;
+
+	if (tdb->rehash_base == 0) {
+		return tdb->hash_size;
+	}
+
+	if (tdb->map_ptr != NULL) {
+		const struct tdb_header *hdr = tdb->map_ptr;
+
+		/* Other processes update this under our feet */
+		buckets = *(const volatile uint32_t *)&hdr->rehash_buckets;
+		if (DOCONV()) {
+			tdb_convert(&buckets, sizeof(buckets));
+		}
+	} else {
+		ret = tdb_ofs_read(
+			tdb, offsetof(struct tdb_header, rehash_buckets),
+			&buckets);
+		if (ret == -1) {
+			return tdb->rehash_base;
+		}
+	}
+
+	if ((buckets < tdb->rehash_base) || (buckets > tdb->hash_size)) {
+		/* tdb_check() will complain about the chains */
+		return tdb->rehash_base;
+	}
+
+	return buckets;
+}
+
+/*
+ * Linear hashing: With "level" being the largest power of two
+ * multiple of rehash_base not above the number of chains in use,
+ * chains below "buckets - level" have already been split into
+ * "hash % (2*level)", the others still use "hash % level".
+ */
+uint32_t tdb_rehash_bucket(struct tdb_context *tdb, uint32_t hash)
+{
+	uint32_t buckets = tdb_rehash_buckets(tdb);
+	uint32_t level = tdb->rehash_base;
+	uint32_t list;
+
+	while (level <= buckets / 2) {
+		level *= 2;
+	}
+
+	list = hash % (2 * level);
+	if (list >= buckets) {
+		list = hash % level;
+	}
+	return list;
+}
+
+/*
+ * Split the next hash chain in line, moving the records that belong
+ * to the new chain over to it. Only done if all the locks are
+ * available right away, returns 0 if we did not do anything.
+ */
+static int tdb_rehash_split(struct tdb_context *tdb)
+{
+	struct tdb_chainwalk_ctx chainwalk;
+	struct tdb_record rec;
+	tdb_off_t last_ptr, rec_ptr, new_top = 0;
+	uint32_t buckets, level, old_list, new_list;
+	int ret;
+
+	buckets = tdb_rehash_buckets(tdb);
+	if (buckets >= tdb->hash_size) {
+		return 0;
+	}
+
+	level = tdb->rehash_base;
+	while (level <= buckets / 2) {
+		level *= 2;
+	}
+	old_list = buckets - level;
+	new_list = buckets;
+
+	/* Traversals hold REHASH_LOCK, never move records under them */
+	ret = tdb_nest_lock(tdb, REHASH_LOCK, F_WRLCK,
+			    TDB_LOCK_NOWAIT|TDB_LOCK_PROBE);
+	if (ret != 0) {
+		return 0;
+	}
+	ret = tdb_lock_nonblock(tdb, old_list, F_WRLCK);
+	if (ret != 0) {
+		ret = 0;
+		goto unlock_rehash;
+	}
+	ret = tdb_lock_nonblock(tdb, new_list, F_WRLCK);
+	if (ret != 0) {
+		ret = 0;
+		goto unlock_old;
+	}
+
+	if (tdb_rehash_buckets(tdb) != buckets) {
+		/* Someone else split it while we got the locks */
+		ret = 0;
+		goto unlock_new;
+	}
+
+	/*
+	 * tdb_firstkey()/tdb_nextkey() users in other processes might
+	 * sit on a record, check that before modifying anything.
+	 */
+	ret = tdb_ofs_read(tdb, TDB_CHAIN_TOP(old_list), &rec_ptr);
+	if (ret == -1) {
+		goto unlock_new;
+	}
+	tdb_chainwalk_init(&chainwalk, rec_ptr);
+
+	while (rec_ptr != 0) {
+		ret = tdb_rec_read(tdb, rec_ptr, &rec);
+		if (ret == -1) {
+			goto unlock_new;
+		}
+		if ((rec.full_hash % (2 * level)) == new_list) {
+			if (tdb_write_lock_record(tdb, rec_ptr) != 0) {
+				ret = 0;
+				goto unlock_new;
+			}
+			tdb_write_unlock_record(tdb, rec_ptr);
+		}
+		rec_ptr = rec.next;
+
+		if (!tdb_chainwalk_check(tdb, &chainwalk, rec_ptr)) {
+			ret = -1;
+			goto unlock_new;
+		}
+	}
+
+	last_ptr = TDB_CHAIN_TOP(old_list);
+	ret = tdb_ofs_read(tdb, last_ptr, &rec_ptr);
+	if (ret == -1) {
+		goto unlock_new;
+	}
+
+	while (rec_ptr != 0) {
+		tdb_off_t next;
+
+		ret = tdb_rec_read(tdb, rec_ptr, &rec);
+		if (ret == -1) {
+			goto unlock_new;
+		}
+		next = rec.next;
+
+		if ((rec.full_hash % (2 * level)) == new_list) {
+			/* Unlink from the old chain, push onto the new one */
+			ret = tdb_ofs_write(tdb, last_ptr, &next);
+			if (ret == -1) {
+				goto unlock_new;
+			}
+			rec.next = new_top;
+			ret = tdb_rec_write(tdb, rec_ptr, &rec);
+			if (ret == -1) {
+				goto unlock_new;
+			}
+			new_top = rec_ptr;
+			ret = tdb_ofs_write(tdb, TDB_CHAIN_TOP(new_list),
+					   &new_top);
+			if (ret == -1) {
+				goto unlock_new;
+			}
+		} else {
+			last_ptr = rec_ptr;
+		}
+		rec_ptr = next;
+	}
+
+	buckets += 1;
+	ret = tdb_ofs_write(tdb, offsetof(struct tdb_header, rehash_buckets),
+			    &buckets);
+	if (ret == -1) {
+		goto unlock_new;
+	}
+	ret = 1;
+
+unlock_new:
+	tdb_unlock(tdb, new_list, F_WRLCK);
+unlock_old:
+	tdb_unlock(tdb, old_list, F_WRLCK);
+unlock_rehash:
+	tdb_nest_unlock(tdb, REHASH_LOCK, F_WRLCK, false);
+	return ret;
+}
+
+/*
+ * Called after dropping chain locks: If we have seen a long hash
+ * chain, split one. This needs all our locks to be released, so we
+ * can't deadlock with others.
+ */
+void tdb_rehash_maybe(struct tdb_context *tdb)
+{
+	enum TDB_ERROR ecode;
+	int ret;
+
+	if (!tdb->rehash_wanted) {
+		return;
+	}
+	if (tdb->read_only || tdb->traverse_read ||
+	    (tdb->transaction != NULL) ||
+	    (tdb->travlocks.next != NULL) || (tdb->travlocks.off != 0) ||
+	    tdb->rehash_walk || tdb_have_extra_locks(tdb)) {
+		return;
+	}
+
+	tdb->rehash_wanted = false;
+
+	/* Our caller's error code is more interesting than ours */
+	ecode = tdb->ecode;
+	ret = tdb_rehash_split(tdb);
+	if (ret == -1) {
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_rehash_maybe: "
+			 "failed to split a hash chain\n"));
+	}
+	tdb->ecode = ecode;
+}
+
 /* Even on files, we can get partial writes due to signals. */
 bool tdb_write_all(int fd, const void *buf, size_t count)
 {
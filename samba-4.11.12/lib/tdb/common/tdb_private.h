@@ -52,6 +52,7 @@ typedef uint32_t tdb_off_t;
 #define TDB_DEAD_MAGIC (0xFEE1DEAD)
 #define TDB_RECOVERY_MAGIC (0xf53bc0e7U)
 #define TDB_RECOVERY_INVALID_MAGIC (0x0)
+#define TDB_SEQLOCK_MAGIC (0x5e91c0c7U)
 #define TDB_HASH_RWLOCK_MAGIC (0xbad1a51U)
 #define TDB_FEATURE_FLAG_MAGIC (0xbad1a52U)
 #define TDB_ALIGNMENT 4
@@ -61,20 +62,89 @@ typedef uint32_t tdb_off_t;
 #define TDB_BYTEREV(x) (((((x)&0xff)<<24)|((x)&0xFF00)<<8)|(((x)>>8)&0xFF00)|((x)>>24))
 #define TDB_DEAD(r) ((r)->magic == TDB_DEAD_MAGIC)
 #define TDB_BAD_MAGIC(r) ((r)->magic != TDB_MAGIC && !TDB_DEAD(r))
-#define TDB_HASH_TOP(hash) (FREELIST_TOP + (BUCKET(hash)+1)*sizeof(tdb_off_t))
+#define TDB_CHAIN_TOP(list) (FREELIST_TOP + ((list)+1)*sizeof(tdb_off_t))
+#define TDB_HASH_TOP(hash) TDB_CHAIN_TOP(BUCKET(hash))
 #define TDB_HASHTABLE_SIZE(tdb) ((tdb->hash_size+1)*sizeof(tdb_off_t))
-#define TDB_DATA_START(hash_size) (TDB_HASH_TOP(hash_size-1) + sizeof(tdb_off_t))
+#define TDB_DATA_START(hash_size) (TDB_CHAIN_TOP((hash_size)-1) + sizeof(tdb_off_t))
 #define TDB_RECOVERY_HEAD offsetof(struct tdb_header, recovery_start)
 #define TDB_SEQNUM_OFS    offsetof(struct tdb_header, sequence_number)
 #define TDB_PAD_BYTE 0x42
 #define TDB_PAD_U32  0x42424242
 
 #define TDB_FEATURE_FLAG_MUTEX 0x00000001
+#define TDB_FEATURE_FLAG_SEQLOCK 0x00000002
+#define TDB_FEATURE_FLAG_MUTEX_STATS 0x00000004
+#define TDB_FEATURE_FLAG_REHASH 0x00000008
+#define TDB_FEATURE_FLAG_CRC32C_HASH 0x00000010
+
+#if defined(HAVE___SYNC_FETCH_AND_ADD) && \
+	defined(HAVE_ATOMIC_THREAD_FENCE_SUPPORT)
+#define USE_TDB_SEQLOCK 1
+#include "system/threads.h"
+#define TDB_SUPPORTED_FEATURE_FLAG_SEQLOCK TDB_FEATURE_FLAG_SEQLOCK
+#else
+#define TDB_SUPPORTED_FEATURE_FLAG_SEQLOCK 0
+#endif
 
 #define TDB_SUPPORTED_FEATURE_FLAGS ( \
 	TDB_FEATURE_FLAG_MUTEX | \
+	TDB_FEATURE_FLAG_MUTEX_STATS | \
+	TDB_FEATURE_FLAG_REHASH | \
+	TDB_FEATURE_FLAG_CRC32C_HASH | \
+	TDB_SUPPORTED_FEATURE_FLAG_SEQLOCK | \
 	0)
 
+/*
+ * With TDB_FEATURE_FLAG_SEQLOCK every write locker of a hash chain
+ * increments the chain's "started" counter after getting the lock
+ * and its "finished" counter before dropping it, the allrecord lock
+ * counts in "all". Readers can copy a record without locking the
+ * chain if both counters of the chain and of "all" are equal before
+ * and the "started" ones are unchanged after the copy.
+ *
+ * The counters live in a record with TDB_SEQLOCK_MAGIC at the start
+ * of the data area, header.seqlock_area points behind its header.
+ * They start on a page boundary and fill whole pages, so that a
+ * transaction commit never writes back a stale copy of them.
+ */
+struct tdb_seqlock_chain {
+	uint32_t started;
+	uint32_t finished;
+};
+
+struct tdb_seqlock_area {
+	uint32_t fallbacks; /* reads that had to take the chain lock */
+	uint32_t reserved;
+	struct tdb_seqlock_chain all;
+	struct tdb_seqlock_chain chains[];
+};
+
+#define TDB_SEQLOCK_AREA_SIZE(hash_size) \
+	(sizeof(struct tdb_seqlock_area) + \
+	 (size_t)(hash_size) * sizeof(struct tdb_seqlock_chain))
+
+/*
+ * With TDB_FEATURE_FLAG_REHASH the hash table is created
+ * TDB_REHASH_GROWTH times as large as asked for, and only
+ * rehash_buckets of the chains are in use. A chain is split by linear
+ * hashing once lookups find chains longer than TDB_REHASH_CHAIN_LIMIT.
+ * Splits need REHASH_LOCK, which all traversals hold as a read lock.
+ */
+#define TDB_REHASH_GROWTH 8
+#define TDB_REHASH_CHAIN_LIMIT 6
+
+/*
+ * With TDB_FEATURE_FLAG_MUTEX_STATS the mutex area has one of these
+ * per mutex behind the hash chain mutexes. A chain's statistics are
+ * only modified while holding its mutex.
+ */
+struct tdb_mutex_chain_stats {
+	uint64_t locks;		/* all successful locks */
+	uint64_t contended;	/* locks that found the mutex taken */
+	uint64_t spun;		/* contended locks acquired by spinning */
+	uint64_t slept;		/* contended locks that had to sleep */
+};
+
 /* NB assumes there is a local variable called "tdb" that is the
  * current context, also takes doubly-parenthesized print-style
  * argument. */
@@ -120,6 +190,7 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
 #define OPEN_LOCK        0
 #define ACTIVE_LOCK      4
 #define TRANSACTION_LOCK 8
+#define REHASH_LOCK      12
 
 /* free memory if the pointer is valid and zero the pointer */
 #ifndef SAFE_FREE
@@ -142,7 +213,7 @@ void tdb_trace_2rec_retrec(struct tdb_context *tdb, const char *op,
  * consistent. We can not change this without an incompatible on-disk format
  * change, otherwise different tdb versions would use incompatible locking.
  */
-#define BUCKET(hash) ((hash) % tdb->hash_size)
+#define BUCKET(hash) tdb_hash_bucket(tdb, (hash))
 
 #define DOCONV() (tdb->flags & TDB_CONVERT)
 #define CONVERT(x) (DOCONV() ? tdb_convert(&x, sizeof(x)) : &x)
@@ -182,7 +253,12 @@ struct tdb_header {
 	uint32_t magic2_hash; /* hash of TDB_MAGIC. */
 	uint32_t feature_flags;
 	tdb_len_t mutex_size; /* set if TDB_FEATURE_FLAG_MUTEX is set */
-	tdb_off_t reserved[25];
+	/* set if TDB_FEATURE_FLAG_SEQLOCK is set */
+	tdb_off_t seqlock_area; /* struct tdb_seqlock_area */
+	/* used if TDB_FEATURE_FLAG_REHASH is set */
+	uint32_t rehash_base; /* hash chains in use at creation */
+	uint32_t rehash_buckets; /* hash chains in use now */
+	tdb_off_t reserved[22];
 };
 
 struct tdb_lock_type {
@@ -243,6 +319,7 @@ struct tdb_context {
 
 	tdb_off_t hdr_ofs; /* this is 0 or header.mutex_size */
 	struct tdb_mutexes *mutexes; /* mmap of the mutex area */
+	int32_t *spin_estimates; /* TDB_MUTEX_ADAPTIVE, per chain mutex */
 
 	enum TDB_ERROR ecode; /* error code for last tdb error */
 	uint32_t hash_size;
@@ -259,6 +336,14 @@ struct tdb_context {
 	struct tdb_transaction *transaction;
 	int page_size;
 	int max_dead_records;
+	struct {
+		uint32_t chain; /* next hash chain to purge */
+		tdb_off_t free_cur; /* freelist entry to continue after */
+	} compact; /* cursor for tdb_compact_step() */
+	uint32_t rehash_base; /* from the header with TDB_FEATURE_FLAG_REHASH */
+	bool rehash_wanted; /* we have seen a long hash chain */
+	bool rehash_walk; /* tdb_firstkey/nextkey hold REHASH_LOCK */
+	tdb_off_t seqlock_area; /* from the header with TDB_FEATURE_FLAG_SEQLOCK */
 #ifdef TDB_TRACE
 	int tracefd;
 #endif
@@ -273,6 +358,8 @@ int tdb_munmap(struct tdb_context *tdb);
 int tdb_mmap(struct tdb_context *tdb);
 int tdb_lock(struct tdb_context *tdb, int list, int ltype);
 int tdb_lock_nonblock(struct tdb_context *tdb, int list, int ltype);
+int tdb_lock_hash(struct tdb_context *tdb, uint32_t hash, int ltype);
+int tdb_lock_hash_nonblock(struct tdb_context *tdb, uint32_t hash, int ltype);
 int tdb_nest_lock(struct tdb_context *tdb, uint32_t offset, int ltype,
 		  enum tdb_lock_flags flags);
 int tdb_nest_unlock(struct tdb_context *tdb, uint32_t offset, int ltype,
@@ -316,6 +403,37 @@ static inline int tdb_oob(
 	return _tdb_oob(tdb, off, len, probe);
 }
 
+/* Tell the cpu we are busy polling */
+static inline void tdb_cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+uint32_t tdb_rehash_buckets(struct tdb_context *tdb);
+uint32_t tdb_rehash_bucket(struct tdb_context *tdb, uint32_t hash);
+void tdb_rehash_maybe(struct tdb_context *tdb);
+void tdb_rehash_walk_unlock(struct tdb_context *tdb);
+struct tdb_seqlock_area *tdb_seqlock_area(struct tdb_context *tdb);
+
+/*
+ * The hash chain a hash value lives in. Only the chains of tdbs with
+ * TDB_FEATURE_FLAG_REHASH can change, see tdb_rehash_bucket().
+ */
+static inline uint32_t tdb_hash_bucket(
+	struct tdb_context *tdb, uint32_t hash)
+{
+	if (likely(tdb->rehash_base == 0)) {
+		return hash % tdb->hash_size;
+	}
+	return tdb_rehash_bucket(tdb, hash);
+}
+
 
 int tdb_ofs_read(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
 int tdb_ofs_write(struct tdb_context *tdb, tdb_off_t offset, tdb_off_t *d);
@@ -332,10 +450,10 @@ int tdb_parse_data(struct tdb_context *tdb, TDB_DATA key,
 		   void *private_data);
 tdb_off_t tdb_find_lock_hash(struct tdb_context *tdb, TDB_DATA key, uint32_t hash, int locktype,
 			   struct tdb_record *rec);
-tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t hash,
+tdb_off_t tdb_find_dead(struct tdb_context *tdb, uint32_t list,
 			struct tdb_record *r, tdb_len_t length,
 			tdb_off_t *p_last_ptr);
-int tdb_trim_dead(struct tdb_context *tdb, uint32_t hash);
+int tdb_trim_dead(struct tdb_context *tdb, uint32_t list);
 void tdb_io_init(struct tdb_context *tdb);
 int tdb_expand(struct tdb_context *tdb, tdb_off_t size);
 tdb_off_t tdb_expand_adjust(tdb_off_t map_size, tdb_off_t size, int page_size);
@@ -361,10 +479,13 @@ bool tdb_mutex_lock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 		    bool waitflag, int *pret);
 bool tdb_mutex_unlock(struct tdb_context *tdb, int rw, off_t off, off_t len,
 		      int *pret);
+int tdb_mutex_chain_wait(struct tdb_context *tdb, uint32_t list);
 int tdb_mutex_allrecord_lock(struct tdb_context *tdb, int ltype,
 			     enum tdb_lock_flags flags);
 int tdb_mutex_allrecord_unlock(struct tdb_context *tdb);
 int tdb_mutex_allrecord_upgrade(struct tdb_context *tdb);
 void tdb_mutex_allrecord_downgrade(struct tdb_context *tdb);
+bool tdb_mutex_chain_stats(struct tdb_context *tdb, unsigned idx,
+			   struct tdb_mutex_chain_stats *stats);
 
 #endif /* TDB_PRIVATE_H */
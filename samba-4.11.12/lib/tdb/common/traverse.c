@@ -78,7 +78,7 @@ static tdb_off_t tdb_next_lock(struct tdb_context *tdb, struct tdb_traverse_lock
 
 		/* No previous record?  Start at top of chain. */
 		if (!tlock->off) {
-			if (tdb_ofs_read(tdb, TDB_HASH_TOP(tlock->list),
+			if (tdb_ofs_read(tdb, TDB_CHAIN_TOP(tlock->list),
 				     &tlock->off) == -1)
 				goto fail;
 		} else {
@@ -150,6 +150,16 @@ static int tdb_traverse_internal(struct tdb_context *tdb,
 		return -1;
 	}
 
+	if (tdb->rehash_base != 0) {
+		/* Don't let tdb_rehash_split() move records under us */
+		ret = tdb_nest_lock(tdb, REHASH_LOCK, F_RDLCK,
+				    TDB_LOCK_WAIT);
+		if (ret != 0) {
+			SAFE_FREE(key.dptr);
+			return -1;
+		}
+	}
+
 	/* This was in the initialization, above, but the IRIX compiler
 	 * did not like it.  crh
 	 */
@@ -233,6 +243,9 @@ static int tdb_traverse_internal(struct tdb_context *tdb,
 out:
 	SAFE_FREE(key.dptr);
 	tdb->travlocks.next = tl->next;
+	if (tdb->rehash_base != 0) {
+		tdb_nest_unlock(tdb, REHASH_LOCK, F_RDLCK, false);
+	}
 	if (ret < 0)
 		return -1;
 	else
@@ -301,6 +314,36 @@ _PUBLIC_ int tdb_traverse(struct tdb_context *tdb,
 }
 
 
+/*
+ * Unlike tdb_traverse(), a tdb_firstkey()/tdb_nextkey() walk spans
+ * several calls. It holds REHASH_LOCK from the first key until it
+ * runs off the end, so tdb_rehash_split() can't move records into
+ * chains the walk has already passed.
+ */
+static int tdb_rehash_walk_lock(struct tdb_context *tdb)
+{
+	int ret;
+
+	if ((tdb->rehash_base == 0) || tdb->rehash_walk) {
+		return 0;
+	}
+	ret = tdb_nest_lock(tdb, REHASH_LOCK, F_RDLCK, TDB_LOCK_WAIT);
+	if (ret != 0) {
+		return -1;
+	}
+	tdb->rehash_walk = true;
+	return 0;
+}
+
+void tdb_rehash_walk_unlock(struct tdb_context *tdb)
+{
+	if (!tdb->rehash_walk) {
+		return;
+	}
+	tdb_nest_unlock(tdb, REHASH_LOCK, F_RDLCK, false);
+	tdb->rehash_walk = false;
+}
+
 /* find the first entry in the database and return its key */
 _PUBLIC_ TDB_DATA tdb_firstkey(struct tdb_context *tdb)
 {
@@ -314,9 +357,14 @@ _PUBLIC_ TDB_DATA tdb_firstkey(struct tdb_context *tdb)
 	tdb->travlocks.off = tdb->travlocks.list = 0;
 	tdb->travlocks.lock_rw = F_RDLCK;
 
+	if (tdb_rehash_walk_lock(tdb) != 0) {
+		return tdb_null;
+	}
+
 	/* Grab first record: locks chain and returned record. */
 	off = tdb_next_lock(tdb, &tdb->travlocks, &rec);
 	if (off == 0 || off == TDB_NEXT_LOCK_ERR) {
+		tdb_rehash_walk_unlock(tdb);
 		tdb_trace_retrec(tdb, "tdb_firstkey", tdb_null);
 		return tdb_null;
 	}
@@ -341,10 +389,14 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 	unsigned char *k = NULL;
 	tdb_off_t off;
 
+	if (tdb_rehash_walk_lock(tdb) != 0) {
+		return tdb_null;
+	}
+
 	/* Is locked key the old key?  If so, traverse will be reliable. */
 	if (tdb->travlocks.off) {
 		if (tdb_lock(tdb,tdb->travlocks.list,tdb->travlocks.lock_rw))
-			return tdb_null;
+			goto fail;
 		if (tdb_rec_read(tdb, tdb->travlocks.off, &rec) == -1
 		    || !(k = tdb_alloc_read(tdb,tdb->travlocks.off+sizeof(rec),
 					    rec.key_len))
@@ -354,11 +406,11 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 				tdb_trace_1rec_retrec(tdb, "tdb_nextkey",
 						      oldkey, tdb_null);
 				SAFE_FREE(k);
-				return tdb_null;
+				goto fail;
 			}
 			if (tdb_unlock(tdb, tdb->travlocks.list, tdb->travlocks.lock_rw) != 0) {
 				SAFE_FREE(k);
-				return tdb_null;
+				goto fail;
 			}
 			tdb->travlocks.off = 0;
 		}
@@ -371,12 +423,12 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 		tdb->travlocks.off = tdb_find_lock_hash(tdb, oldkey, tdb->hash_fn(&oldkey), tdb->travlocks.lock_rw, &rec);
 		if (!tdb->travlocks.off) {
 			tdb_trace_1rec_retrec(tdb, "tdb_nextkey", oldkey, tdb_null);
-			return tdb_null;
+			goto fail;
 		}
 		tdb->travlocks.list = BUCKET(rec.full_hash);
 		if (tdb_lock_record(tdb, tdb->travlocks.off) != 0) {
 			TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_nextkey: lock_record failed (%s)!\n", strerror(errno)));
-			return tdb_null;
+			goto fail;
 		}
 	}
 	oldlist = tdb->travlocks.list;
@@ -395,42 +447,38 @@ _PUBLIC_ TDB_DATA tdb_nextkey(struct tdb_context *tdb, TDB_DATA oldkey)
 	/* Unlock the chain of old record */
 	if (tdb_unlock(tdb, oldlist, tdb->travlocks.lock_rw) != 0)
 		TDB_LOG((tdb, TDB_DEBUG_FATAL, "tdb_nextkey: WARNING tdb_unlock failed!\n"));
+	if (key.dptr == NULL) {
+		/* End of the walk */
+		tdb_rehash_walk_unlock(tdb);
+	}
 	tdb_trace_1rec_retrec(tdb, "tdb_nextkey", oldkey, key);
 	return key;
+
+fail:
+	tdb_rehash_walk_unlock(tdb);
+	return tdb_null;
 }
 
-_PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
-				unsigned chain,
-				tdb_traverse_func fn,
-				void *private_data)
+/*
+ * Walk one hash chain without locking. The caller has to make sure
+ * nobody modifies the chain. Sets *stop if fn asks to terminate.
+ */
+static int tdb_walk_chain(struct tdb_context *tdb,
+			  unsigned chain,
+			  tdb_traverse_func fn,
+			  void *private_data,
+			  bool *stop)
 {
 	tdb_off_t rec_ptr;
 	struct tdb_chainwalk_ctx chainwalk;
 	int count = 0;
 	int ret;
 
-	if (chain >= tdb->hash_size) {
-		tdb->ecode = TDB_ERR_EINVAL;
-		return -1;
-	}
-
-	if (tdb->traverse_read != 0) {
-		tdb->ecode = TDB_ERR_LOCK;
-		return -1;
-	}
-
-	ret = tdb_lock(tdb, chain, F_RDLCK);
+	ret = tdb_ofs_read(tdb, TDB_CHAIN_TOP(chain), &rec_ptr);
 	if (ret == -1) {
 		return -1;
 	}
 
-	tdb->traverse_read += 1;
-
-	ret = tdb_ofs_read(tdb, TDB_HASH_TOP(chain), &rec_ptr);
-	if (ret == -1) {
-		goto fail;
-	}
-
 	tdb_chainwalk_init(&chainwalk, rec_ptr);
 
 	while (rec_ptr != 0) {
@@ -439,7 +487,7 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 
 		ret = tdb_rec_read(tdb, rec_ptr, &rec);
 		if (ret == -1) {
-			goto fail;
+			return -1;
 		}
 
 		if (!TDB_DEAD(&rec)) {
@@ -455,13 +503,13 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 			    (tdb->map_ptr != NULL)) {
 				ret = tdb_oob(tdb, key_ofs, full_len, 0);
 				if (ret == -1) {
-					goto fail;
+					return -1;
 				}
 				key.dptr = (uint8_t *)tdb->map_ptr + key_ofs;
 			} else {
 				buf = tdb_alloc_read(tdb, key_ofs, full_len);
 				if (buf == NULL) {
-					goto fail;
+					return -1;
 				}
 				key.dptr = buf;
 			}
@@ -473,6 +521,7 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 			count += 1;
 
 			if (ret != 0) {
+				*stop = true;
 				break;
 			}
 		}
@@ -481,17 +530,42 @@ _PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
 
 		ok = tdb_chainwalk_check(tdb, &chainwalk, rec_ptr);
 		if (!ok) {
-			goto fail;
+			return -1;
 		}
 	}
-	tdb->traverse_read -= 1;
-	tdb_unlock(tdb, chain, F_RDLCK);
+
 	return count;
+}
 
-fail:
+_PUBLIC_ int tdb_traverse_chain(struct tdb_context *tdb,
+				unsigned chain,
+				tdb_traverse_func fn,
+				void *private_data)
+{
+	bool stop = false;
+	int ret;
+
+	if (chain >= tdb->hash_size) {
+		tdb->ecode = TDB_ERR_EINVAL;
+		return -1;
+	}
+
+	if (tdb->traverse_read != 0) {
+		tdb->ecode = TDB_ERR_LOCK;
+		return -1;
+	}
+
+	ret = tdb_lock(tdb, chain, F_RDLCK);
+	if (ret == -1) {
+		return -1;
+	}
+
+	tdb->traverse_read += 1;
+	ret = tdb_walk_chain(tdb, chain, fn, private_data, &stop);
 	tdb->traverse_read -= 1;
+
 	tdb_unlock(tdb, chain, F_RDLCK);
-	return -1;
+	return ret;
 }
 
 _PUBLIC_ int tdb_traverse_key_chain(struct tdb_context *tdb,
@@ -503,8 +577,298 @@ _PUBLIC_ int tdb_traverse_key_chain(struct tdb_context *tdb,
 	int ret;
 
 	hash = tdb->hash_fn(&key);
+
+	if (tdb->rehash_base != 0) {
+		/* Keep the key's chain from being split */
+		ret = tdb_nest_lock(tdb, REHASH_LOCK, F_RDLCK,
+				    TDB_LOCK_WAIT);
+		if (ret != 0) {
+			return -1;
+		}
+	}
+
 	chain = BUCKET(hash);
 	ret = tdb_traverse_chain(tdb, chain, fn, private_data);
 
+	if (tdb->rehash_base != 0) {
+		tdb_nest_unlock(tdb, REHASH_LOCK, F_RDLCK, false);
+	}
+
 	return ret;
 }
+
+/*
+ * The database as the parallel traverse parts see it: The mapping
+ * taken under the allrecord lock. The parts only read through this,
+ * never through the shared tdb_context, which would remap the file
+ * and set tdb->ecode behind the other threads' backs.
+ */
+struct tdb_snapshot {
+	const uint8_t *map;
+	tdb_off_t map_size;
+	bool convert;
+};
+
+static bool tdb_snapshot_inside(const struct tdb_snapshot *snap,
+				tdb_off_t off, tdb_len_t len)
+{
+	return ((uint64_t)off + len <= snap->map_size);
+}
+
+static bool tdb_snapshot_ofs(const struct tdb_snapshot *snap,
+			     tdb_off_t off, tdb_off_t *d)
+{
+	if (!tdb_snapshot_inside(snap, off, sizeof(*d))) {
+		return false;
+	}
+	memcpy(d, snap->map + off, sizeof(*d));
+	if (snap->convert) {
+		tdb_convert(d, sizeof(*d));
+	}
+	return true;
+}
+
+static bool tdb_snapshot_rec(const struct tdb_snapshot *snap,
+			     tdb_off_t off, struct tdb_record *rec)
+{
+	if (!tdb_snapshot_inside(snap, off, sizeof(*rec))) {
+		return false;
+	}
+	memcpy(rec, snap->map + off, sizeof(*rec));
+	if (snap->convert) {
+		tdb_convert(rec, sizeof(*rec));
+	}
+	if (TDB_BAD_MAGIC(rec)) {
+		return false;
+	}
+	if ((uint64_t)rec->key_len + rec->data_len > rec->rec_len) {
+		return false;
+	}
+	return tdb_snapshot_inside(snap, off + sizeof(*rec), rec->rec_len);
+}
+
+/*
+ * tdb_walk_chain() on a snapshot. Returns the number of records
+ * walked, -1 with *ecode set if the chain is corrupt.
+ */
+static int tdb_snapshot_walk_chain(const struct tdb_snapshot *snap,
+				   struct tdb_context *tdb,
+				   unsigned chain,
+				   tdb_traverse_func fn,
+				   void *private_data,
+				   bool *stop,
+				   enum TDB_ERROR *ecode)
+{
+	tdb_off_t rec_ptr, slow_ptr;
+	bool slow_chase = false;
+	int count = 0;
+
+	if (!tdb_snapshot_ofs(snap, TDB_CHAIN_TOP(chain), &rec_ptr)) {
+		*ecode = TDB_ERR_IO;
+		return -1;
+	}
+	slow_ptr = rec_ptr;
+
+	while (rec_ptr != 0) {
+		struct tdb_record rec;
+
+		if (!tdb_snapshot_rec(snap, rec_ptr, &rec)) {
+			*ecode = TDB_ERR_CORRUPT;
+			return -1;
+		}
+
+		if (!TDB_DEAD(&rec)) {
+			TDB_DATA key, data;
+			int ret;
+
+			key = (TDB_DATA) {
+				.dptr = discard_const_p(
+					uint8_t, snap->map + rec_ptr + sizeof(rec)),
+				.dsize = rec.key_len,
+			};
+			data = (TDB_DATA) {
+				.dptr = key.dptr + key.dsize,
+				.dsize = rec.data_len,
+			};
+
+			ret = fn(tdb, key, data, private_data);
+			count += 1;
+
+			if (ret != 0) {
+				*stop = true;
+				break;
+			}
+		}
+
+		rec_ptr = rec.next;
+
+		/* Same as tdb_chainwalk_check() */
+		if (slow_chase &&
+		    !tdb_snapshot_ofs(snap, slow_ptr, &slow_ptr)) {
+			*ecode = TDB_ERR_IO;
+			return -1;
+		}
+		slow_chase = !slow_chase;
+
+		if (rec_ptr == slow_ptr) {
+			*ecode = TDB_ERR_CORRUPT;
+			return -1;
+		}
+	}
+
+	return count;
+}
+
+struct tdb_traverse_parallel_state {
+	struct tdb_context *tdb;
+	struct tdb_snapshot snap;
+	uint32_t num_chains;
+	unsigned num_parts;
+	tdb_traverse_func fn;
+	void *private_data;
+	int *counts;
+	enum TDB_ERROR *ecodes;	/* per part, the parts can't set tdb->ecode */
+	bool stop;		/* shared by the parts, use __atomic */
+};
+
+/*
+ * Called from the caller's helper threads: Only reads from the
+ * snapshot, which the allrecord lock keeps stable.
+ */
+static void tdb_traverse_read_part(unsigned part, void *private_data)
+{
+	struct tdb_traverse_parallel_state *state = private_data;
+	uint32_t chain, end;
+	int count = 0;
+
+	chain = (uint64_t)state->num_chains * part / state->num_parts;
+	end = (uint64_t)state->num_chains * (part + 1) / state->num_parts;
+
+	for (; chain < end; chain++) {
+		bool stop = false;
+		int ret;
+
+		if (__atomic_load_n(&state->stop, __ATOMIC_RELAXED)) {
+			break;
+		}
+
+		ret = tdb_snapshot_walk_chain(
+			&state->snap, state->tdb, chain, state->fn,
+			state->private_data, &stop, &state->ecodes[part]);
+		if (ret == -1) {
+			__atomic_store_n(&state->stop, true, __ATOMIC_RELAXED);
+			count = -1;
+			break;
+		}
+		count += ret;
+
+		if (stop) {
+			__atomic_store_n(&state->stop, true, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	state->counts[part] = count;
+}
+
+_PUBLIC_ int tdb_traverse_read_parallel(
+	struct tdb_context *tdb,
+	unsigned num_parts,
+	int (*run_parts)(unsigned num_parts,
+			 void (*part_fn)(unsigned part, void *part_state),
+			 void *part_state,
+			 void *private_data),
+	void *run_private_data,
+	tdb_traverse_func fn,
+	void *private_data)
+{
+	struct tdb_traverse_parallel_state state = {
+		.tdb = tdb, .fn = fn, .private_data = private_data,
+	};
+	enum TDB_ERROR ecode;
+	unsigned i;
+	int ret, count;
+
+	/*
+	 * Transactions read through the transaction's block cache,
+	 * which is not thread safe.
+	 */
+	if ((num_parts < 2) || (tdb->transaction != NULL)) {
+		return tdb_traverse_read(tdb, fn, private_data);
+	}
+
+	if (tdb->traverse_read != 0) {
+		tdb->ecode = TDB_ERR_LOCK;
+		return -1;
+	}
+
+	if (tdb_lockall_read(tdb) == -1) {
+		return -1;
+	}
+
+	/*
+	 * Pick up growth by other processes now, the parts only see
+	 * the mapping we have from here on.
+	 */
+	tdb_oob(tdb, tdb->map_size, 1, 1);
+
+	if (tdb->map_ptr == NULL) {
+		/* Without mmap all reads go through tdb->fd */
+		tdb_unlockall_read(tdb);
+		return tdb_traverse_read(tdb, fn, private_data);
+	}
+
+	state.snap = (struct tdb_snapshot) {
+		.map = tdb->map_ptr,
+		.map_size = tdb->map_size,
+		.convert = DOCONV(),
+	};
+
+	/* Splits need a write lock, the allrecord lock keeps them away */
+	state.num_chains = tdb_rehash_buckets(tdb);
+	state.num_parts = MIN(num_parts, state.num_chains);
+
+	state.counts = calloc(state.num_parts, sizeof(int));
+	state.ecodes = calloc(state.num_parts, sizeof(enum TDB_ERROR));
+	if ((state.counts == NULL) || (state.ecodes == NULL)) {
+		free(state.counts);
+		free(state.ecodes);
+		tdb_unlockall_read(tdb);
+		tdb->ecode = TDB_ERR_OOM;
+		return -1;
+	}
+
+	tdb->traverse_read += 1;
+	tdb_trace(tdb, "tdb_traverse_read_parallel_start");
+
+	ret = run_parts(state.num_parts, tdb_traverse_read_part, &state,
+			run_private_data);
+
+	tdb_trace(tdb, "tdb_traverse_end");
+	tdb->traverse_read -= 1;
+
+	tdb_unlockall_read(tdb);
+
+	count = 0;
+	ecode = (ret != 0) ? TDB_ERR_IO : TDB_SUCCESS;
+	for (i=0; i<state.num_parts; i++) {
+		if (state.counts[i] == -1) {
+			if (ecode == TDB_SUCCESS) {
+				ecode = state.ecodes[i];
+			}
+			continue;
+		}
+		count += state.counts[i];
+	}
+	free(state.counts);
+	free(state.ecodes);
+
+	if (ecode != TDB_SUCCESS) {
+		tdb->ecode = ecode;
+		TDB_LOG((tdb, TDB_DEBUG_ERROR, "tdb_traverse_read_parallel: "
+			 "%s\n", tdb_errorstr(tdb)));
+		return -1;
+	}
+
+	return count;
+}
@@ -84,6 +84,18 @@ extern "C" {
 #define TDB_MUTEX_LOCKING 4096 /** optimized locking using robust mutexes if supported,
                                    only with tdb >= 1.3.0 and TDB_CLEAR_IF_FIRST
                                    after checking tdb_runtime_check_for_robust_mutexes() */
+#define TDB_LOCKFREE_READS 8192 /** tdb_parse_record() copies records without taking
+                                    the chain lock if possible. Only used when
+                                    creating a new database, ignored without mmap */
+#define TDB_MUTEX_ADAPTIVE 16384 /** with TDB_MUTEX_LOCKING: spin on a contended chain
+                                    mutex for a while before going to sleep */
+#define TDB_REHASH 32768 /** grow the hash table by splitting long chains while the
+                            database is in use. Only used when creating a new
+                            database */
+#define TDB_CRC32C_HASH 65536 /** Faster hashing with CRC32C, using SSE4.2 if available:
+                                 can't be opened by tdb < 1.4.3 */
+#define TDB_MUTEX_STATS 131072 /** with TDB_MUTEX_LOCKING: count locks and contention
+                                 per chain mutex, shown by tdb_summary() */
 
 /** The tdb error codes */
 enum TDB_ERROR {TDB_SUCCESS=0, TDB_ERR_CORRUPT, TDB_ERR_IO, TDB_ERR_LOCK, 
@@ -152,6 +164,25 @@ struct tdb_logging_context {
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_LOCKFREE_READS - Let tdb_parse_record() read without
+ *                                              taking the chain lock, can't be opened
+ *                                              by tdb < 1.4.3.\n
+ *                         TDB_MUTEX_ADAPTIVE - Spin with exponential backoff on
+ *                                              contended chain mutexes before
+ *                                              blocking. Only used with
+ *                                              TDB_MUTEX_LOCKING.\n
+ *                         TDB_REHASH - Start with hash_size chains and split
+ *                                      them as the database grows, up to
+ *                                      8 times as many. Can't be opened
+ *                                      by tdb < 1.4.3.\n
+ *                         TDB_CRC32C_HASH - Hash keys with CRC32C when creating
+ *                                           the database. Can't be opened by
+ *                                           tdb < 1.4.3.\n
+ *                         TDB_MUTEX_STATS - Count locks and contention per
+ *                                           chain mutex. Only used with
+ *                                           TDB_MUTEX_LOCKING, and only if
+ *                                           the database was created with
+ *                                           TDB_MUTEX_STATS.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -193,6 +224,25 @@ struct tdb_context *tdb_open(const char *name, int hash_size, int tdb_flags,
  *                                             can't be opened by tdb < 1.3.0.
  *                                             Only valid in combination with TDB_CLEAR_IF_FIRST
  *                                             after checking tdb_runtime_check_for_robust_mutexes()\n
+ *                         TDB_LOCKFREE_READS - Let tdb_parse_record() read without
+ *                                              taking the chain lock, can't be opened
+ *                                              by tdb < 1.4.3.\n
+ *                         TDB_MUTEX_ADAPTIVE - Spin with exponential backoff on
+ *                                              contended chain mutexes before
+ *                                              blocking. Only used with
+ *                                              TDB_MUTEX_LOCKING.\n
+ *                         TDB_REHASH - Start with hash_size chains and split
+ *                                      them as the database grows, up to
+ *                                      8 times as many. Can't be opened
+ *                                      by tdb < 1.4.3.\n
+ *                         TDB_CRC32C_HASH - Hash keys with CRC32C when creating
+ *                                           the database. Can't be opened by
+ *                                           tdb < 1.4.3.\n
+ *                         TDB_MUTEX_STATS - Count locks and contention per
+ *                                           chain mutex. Only used with
+ *                                           TDB_MUTEX_LOCKING, and only if
+ *                                           the database was created with
+ *                                           TDB_MUTEX_STATS.\n
  *
  * @param[in]  open_flags Flags for the open(2) function.
  *
@@ -547,6 +597,50 @@ int tdb_traverse_key_chain(struct tdb_context *tdb,
 			   TDB_DATA key,
 			   tdb_traverse_func fn,
 			   void *private_data);
+
+/**
+ * @brief Traverse the entire database with several threads.
+ *
+ * This is like tdb_traverse_read(), but splits the hash chains into
+ * num_parts parts that can be walked in parallel. tdb itself does not
+ * create threads: run_parts has to call part_fn(part, part_state)
+ * once for every 0<=part<num_parts, possibly concurrently, and return
+ * 0 once all of them have returned.
+ *
+ * The whole database is read locked during the traversal, so other
+ * processes can't write to it. fn is called from the threads
+ * run_parts uses and must be thread safe. It must not call any tdb
+ * functions on the database. If fn returns non-zero, the other parts
+ * stop after their current hash chain.
+ *
+ * Inside a transaction, on databases that are not mmapped or with
+ * num_parts < 2 this is tdb_traverse_read().
+ *
+ * @param[in]  tdb      The database to traverse.
+ *
+ * @param[in]  num_parts The number of parts to split the hash chains into.
+ *
+ * @param[in]  run_parts The function running the parts.
+ *
+ * @param[in]  run_private_data Passed to run_parts.
+ *
+ * @param[in]  fn       The function to call on each entry.
+ *
+ * @param[in]  private_data The private data which should be passed to the
+ *                          traversing function.
+ *
+ * @return              The record count traversed, -1 on error.
+ */
+int tdb_traverse_read_parallel(
+	struct tdb_context *tdb,
+	unsigned num_parts,
+	int (*run_parts)(unsigned num_parts,
+			 void (*part_fn)(unsigned part, void *part_state),
+			 void *part_state,
+			 void *private_data),
+	void *run_private_data,
+	tdb_traverse_func fn,
+	void *private_data);
 /**
  * @brief Check if an entry in the database exists.
  *
@@ -856,6 +950,20 @@ int tdb_get_seqnum(struct tdb_context *tdb);
  */
 int tdb_hash_size(struct tdb_context *tdb);
 
+/**
+ * @brief Get the hash chain a key lives in.
+ *
+ * This uses the hash function the database was opened with and takes
+ * chains split by TDB_REHASH into account.
+ *
+ * @param[in]  tdb      The database to look at.
+ *
+ * @param[in]  key      The key to get the hash chain for.
+ *
+ * @return              The hash chain, 0 <= chain < tdb_hash_size(tdb).
+ */
+unsigned int tdb_hash_chain(struct tdb_context *tdb, TDB_DATA key);
+
 /**
  * @brief Get the map size.
  *
@@ -923,6 +1031,18 @@ void tdb_increment_seqnum_nonblock(struct tdb_context *tdb);
  */
 unsigned int tdb_jenkins_hash(TDB_DATA *key);
 
+/**
+ * @brief Create a CRC32C hash of the key.
+ *
+ * This is the hash used for databases created with TDB_CRC32C_HASH. It
+ * uses the SSE4.2 crc32 instruction if the cpu supports it.
+ *
+ * @param[in]  key      The key to hash
+ *
+ * @return              The hash.
+ */
+unsigned int tdb_crc32c_hash(TDB_DATA *key);
+
 /**
  * @brief Check the consistency of the database.
  *
@@ -997,18 +1117,56 @@ bool tdb_runtime_check_for_robust_mutexes(void);
 int tdb_chainlock(struct tdb_context *tdb, TDB_DATA key);
 int tdb_chainlock_nonblock(struct tdb_context *tdb, TDB_DATA key);
 int tdb_chainunlock(struct tdb_context *tdb, TDB_DATA key);
+int tdb_chainlock_multi(struct tdb_context *tdb,
+			const TDB_DATA *keys, size_t num_keys);
+int tdb_chainunlock_multi(struct tdb_context *tdb,
+			  const TDB_DATA *keys, size_t num_keys);
 int tdb_chainlock_read(struct tdb_context *tdb, TDB_DATA key);
 int tdb_chainlock_read_nonblock(struct tdb_context *tdb, TDB_DATA key);
 int tdb_chainunlock_read(struct tdb_context *tdb, TDB_DATA key);
 int tdb_chainlock_mark(struct tdb_context *tdb, TDB_DATA key);
 int tdb_chainlock_unmark(struct tdb_context *tdb, TDB_DATA key);
 
+/**
+ * @brief Wait for a chain lock from a helper thread.
+ *
+ * Block until the hash chain lock protecting key is free, and return
+ * without holding it. Unlike all other tdb calls this may be called
+ * from any thread, concurrently with the thread using tdb: It only
+ * looks at the parts of tdb that don't change after tdb_open(). The
+ * caller has to keep tdb open until it returns.
+ *
+ * This waits for locks held by other processes as well as by the
+ * calling process itself. Someone else might take the lock before the
+ * caller gets to it, so the caller should retry with
+ * tdb_chainlock_nonblock() and wait again if that fails.
+ *
+ * Databases opened with TDB_REHASH are not supported. Without
+ * TDB_MUTEX_LOCKING this needs open file description locks
+ * (F_OFD_SETLKW).
+ *
+ * @param[in]  tdb      The database to wait for.
+ *
+ * @param[in]  key      The key whose chain lock to wait for.
+ *
+ * @return              0 once the lock was free, -1 on error with errno
+ *                      set (ENOSYS if the platform can't wait this way).
+ *                      The tdb error code is not touched.
+ *
+ * @see tdb_chainlock_nonblock()
+ */
+int tdb_chainlock_wait(struct tdb_context *tdb, TDB_DATA key);
+
 void tdb_setalarm_sigptr(struct tdb_context *tdb, volatile sig_atomic_t *sigptr);
 
 /* wipe and repack */
 int tdb_wipe_all(struct tdb_context *tdb);
 int tdb_repack(struct tdb_context *tdb);
 
+/* incremental compaction, doing at most max_work steps per call */
+#define TDB_COMPACT_BUSY 2 /** tdb_compact_step() skipped work on busy locks */
+int tdb_compact_step(struct tdb_context *tdb, unsigned int max_work);
+
 /* Debug functions. Not used in production. */
 void tdb_dump_all(struct tdb_context *tdb);
 int tdb_printfreelist(struct tdb_context *tdb);
@@ -0,0 +1,177 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include "logging.h"
+
+#define TESTS_PER_FLAGS 8
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+
+struct waiter {
+	pthread_t id;
+	struct tdb_context *tdb;
+	TDB_DATA key;
+	int ret;
+	int err;
+	int done[2];
+};
+
+static void *waiter_fn(void *private_data)
+{
+	struct waiter *w = private_data;
+	char c = 0;
+
+	w->ret = tdb_chainlock_wait(w->tdb, w->key);
+	w->err = errno;
+	write(w->done[1], &c, sizeof(c));
+	return NULL;
+}
+
+static bool waiter_start(struct waiter *w, struct tdb_context *tdb,
+			 TDB_DATA key)
+{
+	*w = (struct waiter) { .tdb = tdb, .key = key, .ret = -1 };
+
+	if (pipe(w->done) == -1) {
+		return false;
+	}
+	return (pthread_create(&w->id, NULL, waiter_fn, w) == 0);
+}
+
+/* Has the waiter returned within timeout milliseconds? */
+static bool waiter_done(struct waiter *w, int timeout)
+{
+	struct pollfd pfd = { .fd = w->done[0], .events = POLLIN };
+	return (poll(&pfd, 1, timeout) == 1);
+}
+
+static void waiter_finish(struct waiter *w)
+{
+	pthread_join(w->id, NULL);
+	close(w->done[0]);
+	close(w->done[1]);
+}
+
+static void test_wait(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	struct waiter w1, w2;
+	uint32_t val1 = 1, val2;
+	TDB_DATA key1, key2;
+	int to_child[2], from_child[2];
+	pid_t child;
+	char c = 0;
+
+	key1 = (TDB_DATA) { .dptr = (uint8_t *)&val1, .dsize = sizeof(val1) };
+
+	tdb = tdb_open_ex("run-chainlock-wait.tdb", 17, tdb_flags,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	/* A key living in another chain */
+	for (val2 = 2; val2 < 1000; val2++) {
+		key2 = (TDB_DATA) { .dptr = (uint8_t *)&val2,
+				    .dsize = sizeof(val2) };
+		if ((tdb->hash_fn(&key1) % tdb->hash_size) !=
+		    (tdb->hash_fn(&key2) % tdb->hash_size)) {
+			break;
+		}
+	}
+
+	/* Our own process' lock blocks the waiter */
+	ok1(tdb_chainlock(tdb, key1) == 0);
+	waiter_start(&w1, tdb, key1);
+	ok1(!waiter_done(&w1, 100));
+
+	/* Other chains are not affected */
+	waiter_start(&w2, tdb, key2);
+	ok1(waiter_done(&w2, 5000) && (w2.ret == 0));
+	waiter_finish(&w2);
+
+	tdb_chainunlock(tdb, key1);
+	ok1(waiter_done(&w1, 5000) && (w1.ret == 0));
+	waiter_finish(&w1);
+
+	/* Another process' allrecord lock blocks the waiter */
+	pipe(to_child);
+	pipe(from_child);
+
+	child = fork();
+	if (child == 0) {
+		if ((tdb_reopen(tdb) != 0) || (tdb_lockall(tdb) != 0)) {
+			_exit(1);
+		}
+		write(from_child[1], &c, sizeof(c));
+		read(to_child[0], &c, sizeof(c));
+		tdb_unlockall(tdb);
+		_exit(0);
+	}
+	read(from_child[0], &c, sizeof(c));
+
+	waiter_start(&w1, tdb, key1);
+	ok1(!waiter_done(&w1, 100));
+
+	write(to_child[1], &c, sizeof(c));
+	ok1(waiter_done(&w1, 5000) && (w1.ret == 0));
+	waiter_finish(&w1);
+	waitpid(child, NULL, 0);
+
+	close(to_child[0]);
+	close(to_child[1]);
+	close(from_child[0]);
+	close(from_child[1]);
+
+	/* The waiter left nothing locked behind */
+	ok1(tdb_chainlock_nonblock(tdb, key1) == 0);
+	tdb_chainunlock(tdb, key1);
+
+	tdb_close(tdb);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	uint32_t val = 1;
+	TDB_DATA key = { .dptr = (uint8_t *)&val, .dsize = sizeof(val) };
+	int ret;
+
+	plan_tests(2 * TESTS_PER_FLAGS + 2);
+
+#ifdef HAVE_PTHREAD
+	test_wait(TDB_DEFAULT);
+
+	if (tdb_runtime_check_for_robust_mutexes()) {
+		test_wait(TDB_MUTEX_LOCKING|TDB_INCOMPATIBLE_HASH);
+	} else {
+		skip(TESTS_PER_FLAGS, "No robust mutex support");
+	}
+#else
+	skip(2 * TESTS_PER_FLAGS, "No pthread support");
+#endif
+
+	/* With TDB_REHASH chains move, which the waiter can't follow */
+	tdb = tdb_open_ex("run-chainlock-wait.tdb", 17, TDB_REHASH,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ret = tdb_chainlock_wait(tdb, key);
+	ok1((ret == -1) && (errno == EINVAL));
+	tdb_close(tdb);
+
+	return exit_status();
+}
@@ -0,0 +1,180 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/summary.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define NUM_RECORDS 1000
+
+static int count_dead(struct tdb_context *tdb)
+{
+	tdb_off_t off;
+	struct tdb_record rec;
+	int count = 0;
+
+	for (off = TDB_DATA_START(tdb->hash_size);
+	     off < tdb->map_size - 1;
+	     off += sizeof(rec) + rec.rec_len) {
+		if (tdb->methods->tdb_read(tdb, off, &rec, sizeof(rec),
+					   DOCONV()) == -1) {
+			return -1;
+		}
+		if (rec.magic == TDB_DEAD_MAGIC) {
+			count++;
+		}
+	}
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	unsigned int j, steps;
+	tdb_off_t cur;
+	int ret;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA data;
+	bool all_there;
+	char *summary;
+	int to_child[2], from_child[2];
+	pid_t child;
+	int status;
+	char c = 0;
+
+	plan_tests(26);
+
+	tdb = tdb_open_ex("run-compact.tdb", 131, TDB_VOLATILE,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	for (j = 0; j < NUM_RECORDS; j++) {
+		data.dsize = sizeof(j) + (j % 23);
+		data.dptr = calloc(1, data.dsize);
+		if (tdb_store(tdb, key, data, TDB_INSERT) != 0) {
+			fail("Storing in tdb");
+		}
+		free(data.dptr);
+	}
+
+	/*
+	 * Delete every other record first, so that the freed space
+	 * ends up in lots of adjacent free records and some dead
+	 * ones.
+	 */
+	for (j = 0; j < NUM_RECORDS; j += 2) {
+		tdb_delete(tdb, key);
+	}
+	for (j = 1; j < NUM_RECORDS; j += 4) {
+		tdb_delete(tdb, key);
+	}
+
+	summary = tdb_summary(tdb);
+	ok1(strstr(summary, "Number of uncoalesced records: 0\n") == NULL);
+	free(summary);
+	ok1(count_dead(tdb) > 0);
+
+	/* Bounded work: one chain per step, nothing finishes early */
+	ok1(tdb_compact_step(tdb, 1) == 0);
+	ok1(tdb->compact.chain == 1);
+	ok1(tdb_compact_step(tdb, 0) == 0);
+
+	/*
+	 * Someone else holds the freelist: we must not wait for it,
+	 * nor move the cursor past the chain we could not purge.
+	 */
+	ok1(pipe(to_child) == 0);
+	ok1(pipe(from_child) == 0);
+	child = fork();
+	if (child == 0) {
+		/* fcntl locks are per process, the handle can be shared */
+		if (tdb_lock(tdb, -1, F_WRLCK) != 0) {
+			exit(1);
+		}
+		write(from_child[1], &c, 1);
+		read(to_child[0], &c, 1);
+		exit(0);
+	}
+	close(from_child[1]);
+	ok1(read(from_child[0], &c, 1) == 1);
+	ok1(tdb_compact_step(tdb, 10) == TDB_COMPACT_BUSY);
+	ok1(tdb->compact.chain == 1);
+	write(to_child[1], &c, 1);
+	ok1(waitpid(child, &status, 0) == child);
+	ok1(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	steps = 1;
+	do {
+		ret = tdb_compact_step(tdb, 10);
+		steps++;
+	} while (ret == 0 && tdb->compact.chain < 131 && steps < 10000);
+	ok1(ret == 0);
+
+	/* The freelist cursor is an offset, it does not count entries */
+	ret = tdb_compact_step(tdb, 10);
+	steps++;
+	cur = tdb->compact.free_cur;
+	ok1(ret == 0);
+	ok1(cur >= TDB_DATA_START(tdb->hash_size));
+	ok1(tdb_compact_cursor_valid(tdb, cur));
+
+	/*
+	 * Reuse free space until the cursor record is gone, the next
+	 * step has to notice and start over.
+	 */
+	for (j = NUM_RECORDS; j < 2 * NUM_RECORDS; j++) {
+		data.dsize = sizeof(j) + (j % 23);
+		data.dptr = calloc(1, data.dsize);
+		if (tdb_store(tdb, key, data, TDB_INSERT) != 0) {
+			fail("Storing in tdb");
+		}
+		free(data.dptr);
+		if (!tdb_compact_cursor_valid(tdb, cur)) {
+			break;
+		}
+	}
+	ok1(!tdb_compact_cursor_valid(tdb, cur));
+
+	do {
+		ret = tdb_compact_step(tdb, 10);
+		steps++;
+	} while (ret == 0 && steps < 10000);
+
+	ok1(ret == 1);
+	ok1(steps > 131 / 10);
+	ok1(count_dead(tdb) == 0);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	all_there = true;
+	for (j = 3; j < NUM_RECORDS; j += 4) {
+		data = tdb_fetch(tdb, key);
+		if (data.dsize != sizeof(j) + (j % 23)) {
+			all_there = false;
+		}
+		free(data.dptr);
+	}
+	ok1(all_there);
+
+	summary = tdb_summary(tdb);
+	diag("%s", summary);
+	ok1(strstr(summary, "Number of dead records: 0\n"));
+	ok1(strstr(summary, "Number of uncoalesced records: 0\n"));
+	ok1(strstr(summary, "Free space fragmentation: "));
+	free(summary);
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
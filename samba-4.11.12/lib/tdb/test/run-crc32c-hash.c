@@ -0,0 +1,148 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/summary.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#define BENCH_HASHES 2000000
+
+static double timeval_elapsed2(const struct timeval *tv1, const struct timeval *tv2)
+{
+	return (tv2->tv_sec - tv1->tv_sec) +
+	       (tv2->tv_usec - tv1->tv_usec)*1.0e-6;
+}
+
+static double timeval_elapsed(const struct timeval *tv)
+{
+	struct timeval tv2;
+	gettimeofday(&tv2, NULL);
+	return timeval_elapsed2(tv, &tv2);
+}
+
+/*
+ * Hash keys of the size of a file_id (24 bytes) and a server_id
+ * based key (16 bytes), the hot keys in smbd's databases.
+ */
+static void bench(tdb_hash_func fn, const char *desc, size_t keylen)
+{
+	uint8_t buf[64];
+	TDB_DATA key = { .dptr = buf, .dsize = keylen };
+	struct timeval start;
+	unsigned int sum = 0;
+	uint32_t i;
+
+	memset(buf, 0x5a, sizeof(buf));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_HASHES; i++) {
+		memcpy(buf, &i, sizeof(i));
+		sum += fn(&key);
+	}
+	diag("%s: %d hashes of %zu byte keys in %f seconds (%x)",
+	     desc, BENCH_HASHES, keylen, timeval_elapsed(&start), sum);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	uint8_t buf[67];
+	TDB_DATA key, data;
+	bool same;
+	char *summary;
+	size_t i, len;
+
+	plan_tests(18);
+
+	/* The standard CRC32C check value */
+	key.dptr = discard_const_p(uint8_t, "123456789");
+	key.dsize = 9;
+	ok1(tdb_crc32c_hash(&key) == 0xe3069283);
+
+	/* Whatever implementation we use must match the table */
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = i * 7 + 3;
+	}
+	same = true;
+	for (len = 0; len < sizeof(buf) - 3; len++) {
+		for (i = 0; i < 4; i++) {
+			key.dptr = buf + i;
+			key.dsize = len;
+			if (tdb_crc32c_hash(&key) !=
+			    ~crc32c_sw(~0U, key.dptr, key.dsize)) {
+				same = false;
+			}
+		}
+	}
+	ok1(same);
+
+	bench(tdb_old_hash, "old", 24);
+	bench(tdb_jenkins_hash, "jenkins", 24);
+	bench(tdb_crc32c_hash, "crc32c", 24);
+	bench(tdb_old_hash, "old", 16);
+	bench(tdb_jenkins_hash, "jenkins", 16);
+	bench(tdb_crc32c_hash, "crc32c", 16);
+
+	key.dptr = discard_const_p(uint8_t, "hi");
+	key.dsize = 2;
+	data.dptr = discard_const_p(uint8_t, "world");
+	data.dsize = 5;
+
+	tdb = tdb_open_ex("run-crc32c-hash.tdb", 0, TDB_CRC32C_HASH,
+			  O_CREAT|O_RDWR|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb->hash_fn == tdb_crc32c_hash);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_CRC32C_HASH);
+	ok1(tdb_store(tdb, key, data, TDB_INSERT) == 0);
+	summary = tdb_summary(tdb);
+	ok1(summary && strstr(summary, "Hash function: crc32c\n"));
+	free(summary);
+	tdb_close(tdb);
+
+	/* The header tells us to use crc32c */
+	tdb = tdb_open_ex("run-crc32c-hash.tdb", 0, 0, O_RDWR, 0,
+			  &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb->hash_fn == tdb_crc32c_hash);
+	ok1(tdb_exists(tdb, key));
+	tdb_close(tdb);
+
+	tdb = tdb_open_ex("run-crc32c-hash.tdb", 0, TDB_INCOMPATIBLE_HASH,
+			  O_RDWR, 0, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb_exists(tdb, key));
+	tdb_close(tdb);
+
+	/* An explicit hash function must match */
+	suppress_logging = true;
+	tdb = tdb_open_ex("run-crc32c-hash.tdb", 0, 0, O_RDWR, 0,
+			  &taplogctx, tdb_jenkins_hash);
+	suppress_logging = false;
+	ok1(!tdb);
+
+	/* Asking for crc32c doesn't change existing databases */
+	tdb = tdb_open_ex("run-crc32c-hash.tdb", 0, TDB_INCOMPATIBLE_HASH,
+			  O_CREAT|O_RDWR|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb_store(tdb, key, data, TDB_INSERT) == 0);
+	tdb_close(tdb);
+
+	tdb = tdb_open_ex("run-crc32c-hash.tdb", 0, TDB_CRC32C_HASH,
+			  O_RDWR, 0, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb->hash_fn == tdb_jenkins_hash);
+	ok1(tdb_exists(tdb, key));
+	tdb_close(tdb);
+
+	return exit_status();
+}
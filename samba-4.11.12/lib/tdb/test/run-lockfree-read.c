@@ -0,0 +1,220 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/summary.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define NUM_WRITES 20000
+#define NUM_READS 20000
+
+static TDB_DATA key;
+
+struct check_state {
+	size_t len;
+	bool consistent;
+};
+
+/*
+ * The writer stores records consisting of a single repeated byte,
+ * a torn read shows up as a mix of bytes.
+ */
+static int check_parser(TDB_DATA k, TDB_DATA data, void *private_data)
+{
+	struct check_state *state = private_data;
+	size_t i;
+
+	state->len = data.dsize;
+	state->consistent = true;
+
+	for (i = 1; i < data.dsize; i++) {
+		if (data.dptr[i] != data.dptr[0]) {
+			state->consistent = false;
+		}
+	}
+	if ((data.dsize != 0) && (data.dsize != (size_t)data.dptr[0] * 4)) {
+		state->consistent = false;
+	}
+	return 0;
+}
+
+/* No writer may be left half way through on any chain */
+static bool seqlock_balanced(struct tdb_context *tdb)
+{
+	struct tdb_seqlock_area *area = tdb_seqlock_area(tdb);
+	uint32_t i;
+
+	if (area == NULL) {
+		return false;
+	}
+	if (area->all.started != area->all.finished) {
+		return false;
+	}
+	for (i = 0; i < tdb->hash_size; i++) {
+		if (area->chains[i].started != area->chains[i].finished) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int do_writer(struct tdb_context *tdb, int to)
+{
+	uint8_t buf[1024];
+	char c = 0;
+	int i;
+
+	if (tdb_reopen(tdb) != 0) {
+		return 1;
+	}
+
+	write(to, &c, sizeof(c));
+
+	for (i = 0; i < NUM_WRITES; i++) {
+		uint8_t b = (i % 250) + 1;
+		TDB_DATA data = { .dptr = buf, .dsize = b * 4 };
+
+		if ((i % 7) == 0) {
+			tdb_delete(tdb, key);
+			continue;
+		}
+
+		memset(buf, b, data.dsize);
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return 1;
+		}
+	}
+
+	tdb_close(tdb);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb, *tdb2;
+	struct check_state state;
+	TDB_DATA data, other;
+	uint32_t fallbacks;
+	char *summary;
+	int tdb_flags, ret, status, i;
+	int fromchild[2];
+	bool all_consistent;
+	pid_t child;
+	char c;
+
+	plan_tests(25);
+
+	key.dsize = strlen("hi");
+	key.dptr = discard_const_p(uint8_t, "hi");
+	data.dsize = 8;
+	data.dptr = discard_const_p(uint8_t, "\002\002\002\002\002\002\002\002");
+
+	tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_CLEAR_IF_FIRST|
+		TDB_VOLATILE|TDB_LOCKFREE_READS;
+
+	tdb = tdb_open_ex("run-lockfree-read.tdb", 0, tdb_flags,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+#ifndef USE_TDB_SEQLOCK
+	skip(24, "No lock-free read support");
+	return exit_status();
+#endif
+
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_SEQLOCK);
+	ok1(tdb_seqlock_area(tdb) != NULL);
+
+	ok1(tdb_store(tdb, key, data, TDB_INSERT) == 0);
+	ok1(seqlock_balanced(tdb));
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	state = (struct check_state) { .len = 0 };
+	ret = tdb_parse_record(tdb, key, check_parser, &state);
+	ok1((ret == 0) && state.consistent && (state.len == 8));
+
+	/* A writer on another chain does not disturb us */
+	other.dsize = sizeof(i);
+	other.dptr = (uint8_t *)&i;
+	for (i = 0; i < 1000; i++) {
+		if (BUCKET(tdb->hash_fn(&other)) !=
+		    BUCKET(tdb->hash_fn(&key))) {
+			break;
+		}
+	}
+	fallbacks = tdb_seqlock_area(tdb)->fallbacks;
+	ok1(tdb_chainlock(tdb, other) == 0);
+	state = (struct check_state) { .len = 0 };
+	ret = tdb_parse_record(tdb, key, check_parser, &state);
+	ok1((ret == 0) && state.consistent && (state.len == 8));
+	ok1(tdb_chainunlock(tdb, other) == 0);
+	ok1(tdb_seqlock_area(tdb)->fallbacks == fallbacks);
+
+	/* Our own chain lock makes us fall back to the locked path */
+	ok1(tdb_chainlock(tdb, key) == 0);
+	state = (struct check_state) { .len = 0 };
+	ret = tdb_parse_record(tdb, key, check_parser, &state);
+	ok1((ret == 0) && state.consistent && (state.len == 8));
+	ok1(tdb_chainunlock(tdb, key) == 0);
+	ok1(tdb_seqlock_area(tdb)->fallbacks == fallbacks + 1);
+
+	summary = tdb_summary(tdb);
+	ok1(summary && strstr(summary, "Lock-free read fallbacks: 1\n"));
+	free(summary);
+
+	/* Writers need the mmap to maintain the counters */
+	tdb2 = tdb_open_ex("run-lockfree-read.tdb", 0, TDB_NOMMAP,
+			   O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb2 == NULL);
+
+	/* A lost mapping is restored before the next write lock */
+	tdb_munmap(tdb);
+	ok1(tdb_store(tdb, key, data, TDB_MODIFY) == 0);
+	ok1(seqlock_balanced(tdb));
+
+	/* If that is impossible, the write lock is refused */
+	tdb_munmap(tdb);
+	tdb->flags |= TDB_NOMMAP;
+	ok1(tdb_chainlock(tdb, key) == -1);
+	tdb->flags &= ~TDB_NOMMAP;
+	ok1(tdb_chainlock(tdb, key) == 0);
+	ok1(tdb_chainunlock(tdb, key) == 0);
+
+	pipe(fromchild);
+
+	child = fork();
+	if (child == 0) {
+		close(fromchild[0]);
+		exit(do_writer(tdb, fromchild[1]));
+	}
+	close(fromchild[1]);
+	read(fromchild[0], &c, sizeof(c));
+
+	all_consistent = true;
+	for (i = 0; i < NUM_READS; i++) {
+		state = (struct check_state) { .len = 0 };
+		ret = tdb_parse_record(tdb, key, check_parser, &state);
+		if ((ret == 0) && !state.consistent) {
+			all_consistent = false;
+		}
+	}
+	ok1(all_consistent);
+
+	ok1(waitpid(child, &status, 0) == child);
+	ok1(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
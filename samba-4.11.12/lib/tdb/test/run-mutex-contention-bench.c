@@ -0,0 +1,212 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "../common/summary.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdarg.h>
+
+#define NUM_CHILDREN 4
+#define NUM_OPS 20000
+
+static TDB_DATA key;
+
+static void log_fn(struct tdb_context *tdb, enum tdb_debug_level level,
+		   const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static struct tdb_logging_context log_ctx = { log_fn, NULL };
+
+static double timeval_elapsed2(const struct timeval *tv1, const struct timeval *tv2)
+{
+	return (tv2->tv_sec - tv1->tv_sec) +
+	       (tv2->tv_usec - tv1->tv_usec)*1.0e-6;
+}
+
+static double timeval_elapsed(const struct timeval *tv)
+{
+	struct timeval tv2;
+	gettimeofday(&tv2, NULL);
+	return timeval_elapsed2(tv, &tv2);
+}
+
+/*
+ * All children increment the same record, so they all fight for
+ * the same chain mutex.
+ */
+static int do_child(int tdb_flags, int ready_fd, int go_fd)
+{
+	struct tdb_context *tdb;
+	char c = 0;
+	int i;
+
+	tdb = tdb_open_ex("mutex-contention-bench.tdb", 0, tdb_flags,
+			  O_RDWR|O_CREAT, 0755, &log_ctx, NULL);
+	if (tdb == NULL) {
+		return 1;
+	}
+
+	write(ready_fd, &c, sizeof(c));
+	read(go_fd, &c, sizeof(c));
+
+	for (i = 0; i < NUM_OPS; i++) {
+		TDB_DATA data;
+		uint32_t val = 0;
+
+		if (tdb_chainlock(tdb, key) != 0) {
+			return 1;
+		}
+
+		data = tdb_fetch(tdb, key);
+		if (data.dsize == sizeof(val)) {
+			memcpy(&val, data.dptr, sizeof(val));
+		}
+		free(data.dptr);
+
+		val += 1;
+		data = (TDB_DATA) { .dptr = (uint8_t *)&val,
+				    .dsize = sizeof(val) };
+
+		if (tdb_store(tdb, key, data, TDB_REPLACE) != 0) {
+			return 1;
+		}
+		if (tdb_chainunlock(tdb, key) != 0) {
+			return 1;
+		}
+	}
+
+	tdb_close(tdb);
+	return 0;
+}
+
+static void run_bench(int tdb_flags, const char *desc)
+{
+	struct tdb_context *tdb;
+	struct tdb_mutex_chain_stats stats;
+	struct timeval start;
+	TDB_DATA data;
+	uint32_t val = 0;
+	int ready[2], go[2];
+	int i, status;
+	bool ok;
+	char c;
+	char *summary;
+
+	ok1(pipe(ready) == 0);
+	ok1(pipe(go) == 0);
+
+	for (i = 0; i < NUM_CHILDREN; i++) {
+		pid_t child = fork();
+		ok1(child != -1);
+
+		if (child == 0) {
+			close(ready[0]);
+			close(go[1]);
+			exit(do_child(tdb_flags, ready[1], go[0]));
+		}
+	}
+	close(ready[1]);
+	close(go[0]);
+
+	for (i = 0; i < NUM_CHILDREN; i++) {
+		ok1(read(ready[0], &c, sizeof(c)) == sizeof(c));
+	}
+
+	/* Keep the tdb open so that it survives the children */
+	tdb = tdb_open_ex("mutex-contention-bench.tdb", 0, tdb_flags,
+			  O_RDWR, 0755, &log_ctx, NULL);
+	ok(tdb, "tdb_open_ex should succeed");
+
+	gettimeofday(&start, NULL);
+	close(go[1]);
+
+	for (i = 0; i < NUM_CHILDREN; i++) {
+		ok1(wait(&status) != -1);
+		ok1(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+	}
+
+	diag("%s: %d processes did %d locked increments each "
+	     "in %f seconds", desc, NUM_CHILDREN, NUM_OPS,
+	     timeval_elapsed(&start));
+
+	data = tdb_fetch(tdb, key);
+	ok1(data.dsize == sizeof(val));
+	memcpy(&val, data.dptr, sizeof(val));
+	free(data.dptr);
+	ok(val == NUM_CHILDREN * NUM_OPS, "all increments should be there");
+
+	ok = tdb_mutex_chain_stats(tdb, BUCKET(tdb->hash_fn(&key)) + 1,
+				   &stats);
+	if (tdb_flags & TDB_MUTEX_STATS) {
+		ok(ok, "tdb_mutex_chain_stats should succeed");
+		ok1(stats.locks >= NUM_CHILDREN * NUM_OPS);
+		ok1(stats.contended <= stats.locks);
+		ok1(stats.spun + stats.slept == stats.contended);
+		if (!(tdb_flags & TDB_MUTEX_ADAPTIVE)) {
+			ok1(stats.spun == 0);
+		}
+		diag("%s: %llu locks, %llu contended, %llu spun, "
+		     "%llu slept", desc,
+		     (unsigned long long)stats.locks,
+		     (unsigned long long)stats.contended,
+		     (unsigned long long)stats.spun,
+		     (unsigned long long)stats.slept);
+	} else {
+		ok(!ok, "no statistics area without TDB_MUTEX_STATS");
+		ok1(!(tdb->feature_flags & TDB_FEATURE_FLAG_MUTEX_STATS));
+	}
+
+	summary = tdb_summary(tdb);
+	ok1(summary != NULL);
+	if (tdb_flags & TDB_MUTEX_STATS) {
+		ok1(strstr(summary, "Chain mutex locks: ") != NULL);
+	} else {
+		ok1(strstr(summary, "Chain mutex locks: ") == NULL);
+	}
+	free(summary);
+
+	tdb_close(tdb);
+	unlink("mutex-contention-bench.tdb");
+}
+
+int main(int argc, char *argv[])
+{
+	bool runtime_support;
+	int tdb_flags;
+
+	runtime_support = tdb_runtime_check_for_robust_mutexes();
+
+	if (!runtime_support) {
+		skip(1, "No robust mutex support");
+		return exit_status();
+	}
+
+	key.dsize = strlen("hi");
+	key.dptr = discard_const_p(uint8_t, "hi");
+
+	tdb_flags = TDB_INCOMPATIBLE_HASH|
+		TDB_MUTEX_LOCKING|
+		TDB_CLEAR_IF_FIRST;
+
+	run_bench(tdb_flags|TDB_MUTEX_STATS, "blocking");
+	run_bench(tdb_flags|TDB_MUTEX_STATS|TDB_MUTEX_ADAPTIVE, "adaptive");
+	run_bench(tdb_flags|TDB_MUTEX_ADAPTIVE, "adaptive without statistics");
+
+	return exit_status();
+}
@@ -0,0 +1,168 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/summary.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define NUM_RECORDS 200
+#define NUM_EXTRA 2000
+#define HASH_SIZE 7
+
+/* Add records once the parent is in the middle of a walk */
+static int do_child(struct tdb_context *tdb, int fd)
+{
+	unsigned j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	char c;
+
+	if (tdb_reopen(tdb) != 0) {
+		return 1;
+	}
+	if (read(fd, &c, 1) != 1) {
+		return 4;
+	}
+
+	for (j = NUM_RECORDS; j < NUM_RECORDS + NUM_EXTRA; j++) {
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			return 2;
+		}
+	}
+
+	tdb_close(tdb);
+	return 0;
+}
+
+static void test_rehash_walk(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	unsigned j, buckets, walked;
+	unsigned seen[NUM_RECORDS + NUM_EXTRA];
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	TDB_DATA k, next;
+	bool once, split;
+	int pipefd[2];
+	pid_t child;
+	int status;
+	char c = 0;
+
+	tdb = tdb_open_ex("run-rehash-walk.tdb", HASH_SIZE, tdb_flags,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	for (j = 0; j < NUM_RECORDS; j++) {
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			fail("Storing in tdb");
+		}
+	}
+	buckets = tdb_rehash_buckets(tdb);
+	ok1(buckets < tdb->hash_size);
+
+	memset(seen, 0, sizeof(seen));
+
+	/* Fork before the walk, our walk state is not the child's */
+	ok1(pipe(pipefd) == 0);
+	child = fork();
+	ok1(child != -1);
+	if (child == 0) {
+		close(pipefd[1]);
+		exit(do_child(tdb, pipefd[0]));
+	}
+	close(pipefd[0]);
+
+	/* Walk part of the database */
+	k = tdb_firstkey(tdb);
+	ok1(k.dptr != NULL);
+	ok1(tdb->rehash_walk);
+	for (walked = 0; (walked < NUM_RECORDS / 4) && (k.dptr != NULL);
+	     walked++) {
+		memcpy(&j, k.dptr, sizeof(j));
+		seen[j] += 1;
+		next = tdb_nextkey(tdb, k);
+		free(k.dptr);
+		k = next;
+	}
+	ok1(k.dptr != NULL);
+
+	/* Another process wants to split chains under the walk */
+	ok1(write(pipefd[1], &c, 1) == 1);
+	close(pipefd[1]);
+	ok1(waitpid(child, &status, 0) == child);
+	ok1(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+	/* The walk held off all splits */
+	ok1(tdb_rehash_buckets(tdb) == buckets);
+
+	/* Finish the walk */
+	while (k.dptr != NULL) {
+		memcpy(&j, k.dptr, sizeof(j));
+		seen[j] += 1;
+		next = tdb_nextkey(tdb, k);
+		free(k.dptr);
+		k = next;
+	}
+	ok1(!tdb->rehash_walk);
+
+	/* No record moved into a chain we had already walked */
+	once = true;
+	for (j = 0; j < NUM_RECORDS; j++) {
+		if (seen[j] != 1) {
+			diag("record %u seen %u times", j, seen[j]);
+			once = false;
+		}
+	}
+	for (j = NUM_RECORDS; j < NUM_RECORDS + NUM_EXTRA; j++) {
+		if (seen[j] > 1) {
+			diag("record %u seen %u times", j, seen[j]);
+			once = false;
+		}
+	}
+	ok1(once);
+
+	/* With the walk done, long chains get split again */
+	split = false;
+	for (j = 0; j < NUM_RECORDS + NUM_EXTRA; j++) {
+		if (tdb_store(tdb, key, key, TDB_MODIFY) != 0) {
+			fail("Lost a record");
+		}
+		if (tdb_rehash_buckets(tdb) > buckets) {
+			split = true;
+			break;
+		}
+	}
+	ok1(split);
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	tdb_close(tdb);
+	unlink("run-rehash-walk.tdb");
+}
+
+int main(int argc, char *argv[])
+{
+	int tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_REHASH;
+
+	plan_tests(2 * 15);
+
+	test_rehash_walk(tdb_flags);
+
+	if (!tdb_runtime_check_for_robust_mutexes()) {
+		skip(15, "No robust mutex support");
+		return exit_status();
+	}
+
+	test_rehash_walk(tdb_flags|TDB_MUTEX_LOCKING|TDB_CLEAR_IF_FIRST);
+
+	return exit_status();
+}
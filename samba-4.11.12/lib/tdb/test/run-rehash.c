@@ -0,0 +1,143 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/summary.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "logging.h"
+
+#define NUM_RECORDS 2000
+#define HASH_SIZE 7
+
+static int count_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		    void *private_data)
+{
+	unsigned *count = private_data;
+	(*count) += 1;
+	return 0;
+}
+
+static int parse_fn(TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	return 0;
+}
+
+/* Store our half of the records, the parent stores the other half */
+static int do_child(struct tdb_context *tdb)
+{
+	unsigned j;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+
+	if (tdb_reopen(tdb) != 0) {
+		return 1;
+	}
+
+	for (j = 1; j < NUM_RECORDS; j += 2) {
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			return 2;
+		}
+	}
+
+	tdb_close(tdb);
+	return 0;
+}
+
+static void test_rehash(int tdb_flags)
+{
+	struct tdb_context *tdb;
+	unsigned j, count;
+	TDB_DATA key = { (unsigned char *)&j, sizeof(j) };
+	bool all_there;
+	char *summary;
+	pid_t child;
+	int status;
+
+	tdb = tdb_open_ex("run-rehash.tdb", HASH_SIZE, tdb_flags,
+			  O_RDWR|O_CREAT|O_TRUNC, 0600, &taplogctx, NULL);
+	ok1(tdb);
+	ok1(tdb->feature_flags & TDB_FEATURE_FLAG_REHASH);
+	ok1(tdb->hash_size == HASH_SIZE * TDB_REHASH_GROWTH);
+	ok1(tdb_rehash_buckets(tdb) == HASH_SIZE);
+
+	child = fork();
+	ok1(child != -1);
+	if (child == 0) {
+		exit(do_child(tdb));
+	}
+
+	for (j = 0; j < NUM_RECORDS; j += 2) {
+		if (tdb_store(tdb, key, key, TDB_INSERT) != 0) {
+			fail("Storing in tdb");
+		}
+	}
+
+	ok1(waitpid(child, &status, 0) == child);
+	ok1(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+	/* Chains were split, up to the reserved size */
+	ok1(tdb_rehash_buckets(tdb) > HASH_SIZE);
+	ok1(tdb_rehash_buckets(tdb) <= tdb->hash_size);
+	diag("%u chains in use", (unsigned)tdb_rehash_buckets(tdb));
+
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	all_there = true;
+	for (j = 0; j < NUM_RECORDS; j++) {
+		if (tdb_parse_record(tdb, key, parse_fn, NULL) != 0) {
+			all_there = false;
+		}
+		if (!tdb_exists(tdb, key)) {
+			all_there = false;
+		}
+	}
+	ok1(all_there);
+
+	count = 0;
+	ok1(tdb_traverse_read(tdb, count_fn, &count) == NUM_RECORDS);
+	ok1(count == NUM_RECORDS);
+
+	summary = tdb_summary(tdb);
+	ok1(summary != NULL);
+	ok1(strstr(summary, "Hash chains in use/reserved: "));
+	free(summary);
+
+	/* Deleting everything leaves the chains split */
+	for (j = 0; j < NUM_RECORDS; j++) {
+		tdb_delete(tdb, key);
+	}
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+	count = 0;
+	ok1(tdb_traverse_read(tdb, count_fn, &count) == 0);
+
+	tdb_close(tdb);
+	unlink("run-rehash.tdb");
+}
+
+int main(int argc, char *argv[])
+{
+	int tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_REHASH;
+
+	plan_tests(2 * 18);
+
+	test_rehash(tdb_flags);
+
+	if (!tdb_runtime_check_for_robust_mutexes()) {
+		skip(18, "No robust mutex support");
+		return exit_status();
+	}
+
+	test_rehash(tdb_flags|TDB_MUTEX_LOCKING|TDB_CLEAR_IF_FIRST);
+
+	return exit_status();
+}
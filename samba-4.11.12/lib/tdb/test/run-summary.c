@@ -25,7 +25,7 @@ int main(int argc, char *argv[])
 	TDB_DATA data = { (unsigned char *)&j, sizeof(j) };
 	char *summary;
 
-	plan_tests(sizeof(flags) / sizeof(flags[0]) * 14);
+	plan_tests(sizeof(flags) / sizeof(flags[0]) * 15);
 	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
 		tdb = tdb_open("run-summary.tdb", 131, flags[i],
 			       O_RDWR|O_CREAT|O_TRUNC, 0600);
@@ -55,6 +55,7 @@ int main(int argc, char *argv[])
 		ok1(strstr(summary, "Smallest/average/largest hash chains: "));
 		ok1(strstr(summary, "Number of uncoalesced records: 0\n"));
 		ok1(strstr(summary, "Smallest/average/largest uncoalesced runs: 0/0/0\n"));
+		ok1(strstr(summary, "Free space fragmentation: 0%\n"));
 		ok1(strstr(summary, "Percentage keys/data/padding/free/dead/rechdrs&tailers/hashes: "));
 
 		free(summary);
@@ -0,0 +1,218 @@
+#include "../common/tdb_private.h"
+#include "../common/io.c"
+#include "../common/tdb.c"
+#include "../common/lock.c"
+#include "../common/freelist.c"
+#include "../common/traverse.c"
+#include "../common/transaction.c"
+#include "../common/error.c"
+#include "../common/open.c"
+#include "../common/check.c"
+#include "../common/hash.c"
+#include "../common/mutex.c"
+#include "tap-interface.h"
+#include <stdlib.h>
+#include "logging.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define NUM_RECORDS 1000
+#define NUM_PARTS 4
+
+struct sum_state {
+	uint64_t sum;
+	unsigned count;
+	unsigned stop_after;
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t sum_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int sum_fn(struct tdb_context *tdb, TDB_DATA key, TDB_DATA data,
+		  void *private_data)
+{
+	struct sum_state *state = private_data;
+	uint32_t val;
+	int ret = 0;
+
+	if (data.dsize != sizeof(val)) {
+		return -1;
+	}
+	memcpy(&val, data.dptr, sizeof(val));
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&sum_mutex);
+#endif
+	state->sum += val;
+	state->count += 1;
+	if ((state->stop_after != 0) &&
+	    (state->count >= state->stop_after)) {
+		ret = 1;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&sum_mutex);
+#endif
+	return ret;
+}
+
+/* Run the parts backwards to see they are independent */
+static int run_parts_serial(unsigned num_parts,
+			    void (*part_fn)(unsigned part, void *part_state),
+			    void *part_state,
+			    void *private_data)
+{
+	unsigned *num_calls = private_data;
+	unsigned i;
+
+	for (i = num_parts; i > 0; i--) {
+		part_fn(i-1, part_state);
+		*num_calls += 1;
+	}
+	return 0;
+}
+
+#ifdef HAVE_PTHREAD
+struct part_thread {
+	pthread_t id;
+	unsigned part;
+	void (*part_fn)(unsigned part, void *part_state);
+	void *part_state;
+};
+
+static void *part_thread_fn(void *private_data)
+{
+	struct part_thread *t = private_data;
+	t->part_fn(t->part, t->part_state);
+	return NULL;
+}
+
+static int run_parts_threads(unsigned num_parts,
+			     void (*part_fn)(unsigned part, void *part_state),
+			     void *part_state,
+			     void *private_data)
+{
+	struct part_thread threads[NUM_PARTS];
+	unsigned i;
+	int ret = 0;
+
+	if (num_parts > NUM_PARTS) {
+		return -1;
+	}
+
+	for (i = 0; i < num_parts; i++) {
+		threads[i] = (struct part_thread) {
+			.part = i, .part_fn = part_fn,
+			.part_state = part_state,
+		};
+		ret = pthread_create(&threads[i].id, NULL, part_thread_fn,
+				     &threads[i]);
+		if (ret != 0) {
+			num_parts = i;
+			ret = -1;
+			break;
+		}
+	}
+	for (i = 0; i < num_parts; i++) {
+		pthread_join(threads[i].id, NULL);
+	}
+	return ret;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	struct tdb_context *tdb;
+	struct sum_state state;
+	uint64_t expected = 0;
+	unsigned num_calls;
+	uint32_t i, last;
+	TDB_DATA key, data;
+	tdb_off_t top, bad;
+	tdb_len_t map_size;
+	bool all_ok;
+	int ret;
+
+	plan_tests(19);
+
+	tdb = tdb_open_ex("run-traverse-parallel.tdb", 0,
+			  TDB_CLEAR_IF_FIRST|TDB_REHASH,
+			  O_CREAT|O_TRUNC|O_RDWR, 0600, &taplogctx, NULL);
+	ok1(tdb);
+
+	all_ok = true;
+	for (i = 0; i < NUM_RECORDS; i++) {
+		data = (TDB_DATA) { .dptr = (uint8_t *)&i, .dsize = sizeof(i) };
+		if (tdb_store(tdb, data, data, TDB_INSERT) != 0) {
+			all_ok = false;
+		}
+		expected += i;
+	}
+	ok1(all_ok);
+
+	last = NUM_RECORDS - 1;
+	key = (TDB_DATA) { .dptr = (uint8_t *)&last, .dsize = sizeof(last) };
+	ok1(tdb_delete(tdb, key) == 0);
+	expected -= last;
+
+	num_calls = 0;
+	state = (struct sum_state) { .sum = 0 };
+	ret = tdb_traverse_read_parallel(tdb, NUM_PARTS, run_parts_serial,
+					 &num_calls, sum_fn, &state);
+	ok1(ret == NUM_RECORDS - 1);
+	ok1(num_calls == NUM_PARTS);
+	ok1((state.count == NUM_RECORDS - 1) && (state.sum == expected));
+
+	/* The allrecord lock is gone again */
+	ok1(tdb_store(tdb, key, key, TDB_INSERT) == 0);
+	expected += last;
+
+#ifdef HAVE_PTHREAD
+	state = (struct sum_state) { .sum = 0 };
+	ret = tdb_traverse_read_parallel(tdb, NUM_PARTS, run_parts_threads,
+					 NULL, sum_fn, &state);
+	ok1(ret == NUM_RECORDS);
+	ok1((state.count == NUM_RECORDS) && (state.sum == expected));
+#else
+	skip(2, "No pthread support");
+#endif
+
+	/* fn can stop the traverse */
+	num_calls = 0;
+	state = (struct sum_state) { .stop_after = 10 };
+	ret = tdb_traverse_read_parallel(tdb, NUM_PARTS, run_parts_serial,
+					 &num_calls, sum_fn, &state);
+	ok1((ret > 0) && (ret < NUM_RECORDS) && (state.count == 10));
+
+	/* Transactions fall back to tdb_traverse_read */
+	ok1(tdb_transaction_start(tdb) == 0);
+	num_calls = 0;
+	state = (struct sum_state) { .sum = 0 };
+	ret = tdb_traverse_read_parallel(tdb, NUM_PARTS, run_parts_serial,
+					 &num_calls, sum_fn, &state);
+	ok1((ret == NUM_RECORDS) && (num_calls == 0));
+	ok1(tdb_transaction_commit(tdb) == 0);
+
+	/* A corrupt chain fails the parts without remapping the file */
+	ok1(tdb_ofs_read(tdb, TDB_CHAIN_TOP(0), &top) == 0);
+	bad = tdb->map_size + 4096;
+	ok1(tdb_ofs_write(tdb, TDB_CHAIN_TOP(0), &bad) == 0);
+	map_size = tdb->map_size;
+	num_calls = 0;
+	state = (struct sum_state) { .sum = 0 };
+	suppress_logging = true;
+	ret = tdb_traverse_read_parallel(tdb, NUM_PARTS, run_parts_serial,
+					 &num_calls, sum_fn, &state);
+	suppress_logging = false;
+	ok1((ret == -1) && (tdb_error(tdb) == TDB_ERR_CORRUPT));
+	ok1(tdb->map_size == map_size);
+	ok1(tdb_ofs_write(tdb, TDB_CHAIN_TOP(0), &top) == 0);
+
+	ok1(tdb_check(tdb, NULL, NULL) == 0);
+
+	tdb_close(tdb);
+
+	return exit_status();
+}
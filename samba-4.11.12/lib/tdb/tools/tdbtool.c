@@ -65,6 +65,7 @@ enum commands {
 	CMD_SYSTEM,
 	CMD_CHECK,
 	CMD_REPACK,
+	CMD_CONVERT,
 	CMD_QUIT,
 	CMD_HELP
 };
@@ -105,6 +106,7 @@ COMMAND_TABLE cmd_table[] = {
 	{"q",		CMD_QUIT},
 	{"!",		CMD_SYSTEM},
 	{"repack",	CMD_REPACK},
+	{"convert",	CMD_CONVERT},
 	{NULL,		CMD_HELP}
 };
 
@@ -240,6 +242,8 @@ static void help(void)
 "  freelist_size        : print the number of records in the freelist\n"
 "  check                : check the integrity of an opened database\n"
 "  repack               : repack the database\n"
+"  convert   file [hash]: copy the database to a new file using hash\n"
+"                         crc32c (default), jenkins or old\n"
 "  speed                : perform speed tests on the database\n"
 "  ! command            : execute system command\n"
 "  1 | first            : print the first record\n"
@@ -559,6 +563,66 @@ static void info_tdb(void)
 	}
 }
 
+static int convert_fn(TDB_CONTEXT *the_tdb, TDB_DATA key, TDB_DATA dbuf,
+		      void *state)
+{
+	TDB_CONTEXT *dst_tdb = (TDB_CONTEXT *)state;
+
+	return tdb_store(dst_tdb, key, dbuf, TDB_INSERT);
+}
+
+static void convert_tdb(const char *tdbname, const char *hashname)
+{
+	struct tdb_logging_context log_ctx = { NULL, NULL };
+	TDB_CONTEXT *dst_tdb;
+	int tdb_flags;
+	int count;
+
+	log_ctx.log_fn = tdb_log;
+
+	if (tdbname == NULL) {
+		terror("need destination tdb name");
+		return;
+	}
+
+	if ((hashname == NULL) || (hashname[0] == '\0') ||
+	    (strcmp(hashname, "crc32c") == 0)) {
+		tdb_flags = TDB_CRC32C_HASH;
+	} else if (strcmp(hashname, "jenkins") == 0) {
+		tdb_flags = TDB_INCOMPATIBLE_HASH;
+	} else if (strcmp(hashname, "old") == 0) {
+		tdb_flags = 0;
+	} else {
+		terror("unknown hash function");
+		return;
+	}
+
+	dst_tdb = tdb_open_ex(tdbname, tdb_hash_size(tdb), tdb_flags,
+			      O_RDWR | O_CREAT | O_EXCL, 0600, &log_ctx, NULL);
+	if (dst_tdb == NULL) {
+		printf("Could not create %s: %s\n", tdbname, strerror(errno));
+		return;
+	}
+
+	if (tdb_transaction_start(dst_tdb) != 0) {
+		terror("failed to start transaction");
+		tdb_close(dst_tdb);
+		return;
+	}
+
+	count = tdb_traverse_read(tdb, convert_fn, dst_tdb);
+	if (count < 0) {
+		printf("Error converting: %s\n", tdb_errorstr(dst_tdb));
+		tdb_transaction_cancel(dst_tdb);
+	} else if (tdb_transaction_commit(dst_tdb) != 0) {
+		printf("Error converting: %s\n", tdb_errorstr(dst_tdb));
+	} else {
+		printf("converted %d records\n", count);
+	}
+
+	tdb_close(dst_tdb);
+}
+
 static void speed_tdb(const char *tlimit)
 {
 	const char *str = "store test", *str2 = "transaction test";
@@ -748,6 +812,10 @@ static int do_command(void)
 			bIterate = 0;
 			tdb_repack(tdb);
 			return 0;
+		case CMD_CONVERT:
+			bIterate = 0;
+			convert_tdb(arg1, arg2);
+			return 0;
 		case CMD_TRANSACTION_CANCEL:
 			bIterate = 0;
 			tdb_transaction_cancel(tdb);
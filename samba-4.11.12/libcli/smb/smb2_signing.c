@@ -28,6 +28,11 @@
 #include <gnutls/gnutls.h>
 #include <gnutls/crypto.h>
 
+#if defined(HAVE_LINUX_IF_ALG_H) && defined(HAVE_LINUX_SPLICE)
+#include "system/network.h"
+#include <linux/if_alg.h>
+#endif
+
 int smb2_signing_key_destructor(struct smb2_signing_key *key)
 {
 	if (key->hmac_hnd != NULL) {
@@ -139,6 +144,399 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 	return NT_STATUS_OK;
 }
 
+#define SMB2_SIGNING_FD_CHUNK 65536
+
+#if defined(HAVE_LINUX_IF_ALG_H) && defined(HAVE_LINUX_SPLICE)
+/*
+ * Feed the file data to the kernel crypto API via splice(), so it
+ * goes from the page cache into the MAC without being copied to
+ * userspace.
+ */
+static NTSTATUS smb2_signing_calc_fd_alg(const char *alg_name,
+					 const uint8_t *key,
+					 size_t key_len,
+					 const struct iovec *vector,
+					 int count,
+					 int fd,
+					 off_t offset,
+					 size_t length,
+					 uint8_t *digest,
+					 size_t digest_len)
+{
+	struct sockaddr_alg sa = {
+		.salg_family = AF_ALG,
+		.salg_type = "hash",
+	};
+	static const uint8_t zeros[256];
+	loff_t ofs = offset;
+	int tfm_fd = -1;
+	int op_fd = -1;
+	int pipefd[2] = { -1, -1 };
+	NTSTATUS status = NT_STATUS_NOT_SUPPORTED;
+	ssize_t nwritten;
+	ssize_t nread;
+	int ret;
+	int i;
+
+	strlcpy((char *)sa.salg_name, alg_name, sizeof(sa.salg_name));
+
+	tfm_fd = socket(AF_ALG, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+	if (tfm_fd == -1) {
+		goto done;
+	}
+	ret = bind(tfm_fd, (struct sockaddr *)&sa, sizeof(sa));
+	if (ret == -1) {
+		goto done;
+	}
+	ret = setsockopt(tfm_fd, SOL_ALG, ALG_SET_KEY, key, key_len);
+	if (ret == -1) {
+		goto done;
+	}
+	op_fd = accept(tfm_fd, NULL, 0);
+	if (op_fd == -1) {
+		goto done;
+	}
+	ret = pipe2(pipefd, O_CLOEXEC);
+	if (ret == -1) {
+		goto done;
+	}
+
+	status = NT_STATUS_INTERNAL_ERROR;
+
+	for (i = 0; i < count; i++) {
+		if (vector[i].iov_len == 0) {
+			continue;
+		}
+		nwritten = send(op_fd, vector[i].iov_base, vector[i].iov_len,
+				MSG_MORE);
+		if (nwritten != vector[i].iov_len) {
+			goto done;
+		}
+	}
+
+	while (length > 0) {
+		size_t chunk = MIN(length, SMB2_SIGNING_FD_CHUNK);
+
+		nread = splice(fd, &ofs, pipefd[1], NULL, chunk,
+			       SPLICE_F_MOVE);
+		if (nread == -1 && errno == EINTR) {
+			continue;
+		}
+		if (nread == -1) {
+			goto done;
+		}
+		if (nread == 0) {
+			/* EOF, the rest is sent as zeros, see below */
+			break;
+		}
+		length -= nread;
+
+		while (nread > 0) {
+			nwritten = splice(pipefd[0], NULL, op_fd, NULL, nread,
+					  SPLICE_F_MOVE|SPLICE_F_MORE);
+			if (nwritten == -1 && errno == EINTR) {
+				continue;
+			}
+			if (nwritten <= 0) {
+				goto done;
+			}
+			nread -= nwritten;
+		}
+	}
+
+	while (length > 0) {
+		size_t chunk = MIN(length, sizeof(zeros));
+
+		nwritten = send(op_fd, zeros, chunk, MSG_MORE);
+		if (nwritten != chunk) {
+			goto done;
+		}
+		length -= chunk;
+	}
+
+	/*
+	 * Reading finalizes the hash, even after MSG_MORE.
+	 */
+	nread = read(op_fd, digest, digest_len);
+	if (nread != digest_len) {
+		goto done;
+	}
+
+	status = NT_STATUS_OK;
+done:
+	if (pipefd[0] != -1) {
+		close(pipefd[0]);
+	}
+	if (pipefd[1] != -1) {
+		close(pipefd[1]);
+	}
+	if (op_fd != -1) {
+		close(op_fd);
+	}
+	if (tfm_fd != -1) {
+		close(tfm_fd);
+	}
+	return status;
+}
+#endif
+
+/*
+ * Read the next chunk of file data for the MAC. Data beyond EOF is
+ * treated as zeros, that's what sendfile_short_send() puts on the
+ * wire for a file that was truncated under us.
+ */
+static NTSTATUS smb2_signing_read_chunk(int fd,
+					uint8_t *buf,
+					size_t n,
+					off_t offset,
+					bool *eof)
+{
+	size_t done = 0;
+
+	if (*eof) {
+		memset(buf, 0, n);
+		return NT_STATUS_OK;
+	}
+
+	while (done < n) {
+		ssize_t nread;
+
+		nread = pread(fd, buf + done, n - done, offset + done);
+		if (nread == -1 && errno == EINTR) {
+			continue;
+		}
+		if (nread == -1) {
+			return map_nt_error_from_unix_common(errno);
+		}
+		if (nread == 0) {
+			memset(buf + done, 0, n - done);
+			*eof = true;
+			break;
+		}
+		done += nread;
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * This is also used from worker threads, see
+ * smb2_signing_sign_pdu_fd_nolog(). It must not log, must not use
+ * talloc and must not touch shared state like a cached hmac handle.
+ */
+static NTSTATUS smb2_signing_calc_fd(DATA_BLOB signing_key,
+				     enum protocol_types protocol,
+				     const struct iovec *vector,
+				     int count,
+				     int fd,
+				     off_t offset,
+				     size_t length,
+				     uint8_t res[16])
+{
+	uint8_t key[AES_BLOCK_SIZE] = {0};
+	uint8_t *buf = NULL;
+	bool eof = false;
+	NTSTATUS status;
+	int i;
+
+	memcpy(key,
+	       signing_key.data,
+	       MIN(signing_key.length, 16));
+
+#if defined(HAVE_LINUX_IF_ALG_H) && defined(HAVE_LINUX_SPLICE)
+	if (protocol >= PROTOCOL_SMB2_24) {
+		status = smb2_signing_calc_fd_alg("cmac(aes)",
+						  key, sizeof(key),
+						  vector, count,
+						  fd, offset, length,
+						  res, 16);
+	} else {
+		uint8_t digest[gnutls_hmac_get_len(GNUTLS_MAC_SHA256)];
+
+		status = smb2_signing_calc_fd_alg("hmac(sha256)",
+						  signing_key.data,
+						  MIN(signing_key.length, 16),
+						  vector, count,
+						  fd, offset, length,
+						  digest, sizeof(digest));
+		memcpy(res, digest, 16);
+		ZERO_ARRAY(digest);
+	}
+	if (NT_STATUS_IS_OK(status)) {
+		ZERO_ARRAY(key);
+		return NT_STATUS_OK;
+	}
+	/* AF_ALG not usable, use the buffered path */
+#endif
+
+	buf = malloc(MIN(length, SMB2_SIGNING_FD_CHUNK));
+	if (length > 0 && buf == NULL) {
+		ZERO_ARRAY(key);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	if (protocol >= PROTOCOL_SMB2_24) {
+		struct aes_cmac_128_context ctx;
+
+		aes_cmac_128_init(&ctx, key);
+		for (i=0; i < count; i++) {
+			aes_cmac_128_update(&ctx,
+					(const uint8_t *)vector[i].iov_base,
+					vector[i].iov_len);
+		}
+		while (length > 0) {
+			size_t n = MIN(length, SMB2_SIGNING_FD_CHUNK);
+
+			status = smb2_signing_read_chunk(fd, buf, n, offset,
+							 &eof);
+			if (!NT_STATUS_IS_OK(status)) {
+				goto fail;
+			}
+			aes_cmac_128_update(&ctx, buf, n);
+			offset += n;
+			length -= n;
+		}
+		aes_cmac_128_final(&ctx, res);
+	} else {
+		gnutls_hmac_hd_t hmac_hnd = NULL;
+		uint8_t digest[gnutls_hmac_get_len(GNUTLS_MAC_SHA256)];
+		int rc;
+
+		rc = gnutls_hmac_init(&hmac_hnd,
+				      GNUTLS_MAC_SHA256,
+				      signing_key.data,
+				      MIN(signing_key.length, 16));
+		if (rc < 0) {
+			status = gnutls_error_to_ntstatus(rc, NT_STATUS_HMAC_NOT_SUPPORTED);
+			goto fail;
+		}
+
+		for (i = 0; i < count; i++) {
+			rc = gnutls_hmac(hmac_hnd,
+					 vector[i].iov_base,
+					 vector[i].iov_len);
+			if (rc < 0) {
+				gnutls_hmac_deinit(hmac_hnd, NULL);
+				status = gnutls_error_to_ntstatus(rc, NT_STATUS_HMAC_NOT_SUPPORTED);
+				goto fail;
+			}
+		}
+		while (length > 0) {
+			size_t n = MIN(length, SMB2_SIGNING_FD_CHUNK);
+
+			status = smb2_signing_read_chunk(fd, buf, n, offset,
+							 &eof);
+			if (!NT_STATUS_IS_OK(status)) {
+				gnutls_hmac_deinit(hmac_hnd, NULL);
+				goto fail;
+			}
+			rc = gnutls_hmac(hmac_hnd, buf, n);
+			if (rc < 0) {
+				gnutls_hmac_deinit(hmac_hnd, NULL);
+				status = gnutls_error_to_ntstatus(rc, NT_STATUS_HMAC_NOT_SUPPORTED);
+				goto fail;
+			}
+			offset += n;
+			length -= n;
+		}
+		gnutls_hmac_deinit(hmac_hnd, digest);
+		memcpy(res, digest, 16);
+		ZERO_ARRAY(digest);
+	}
+
+	status = NT_STATUS_OK;
+fail:
+	SAFE_FREE(buf);
+	ZERO_ARRAY(key);
+	return status;
+}
+
+NTSTATUS smb2_signing_sign_pdu_fd_nolog(DATA_BLOB signing_key,
+					enum protocol_types protocol,
+					struct iovec *vector,
+					int count,
+					int fd,
+					off_t offset,
+					size_t length)
+{
+	uint8_t *hdr;
+	uint64_t session_id;
+	uint8_t res[16];
+	NTSTATUS status;
+
+	if (count < 1) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (vector[0].iov_len != SMB2_HDR_BODY) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	hdr = (uint8_t *)vector[0].iov_base;
+
+	session_id = BVAL(hdr, SMB2_HDR_SESSION_ID);
+	if (session_id == 0) {
+		/*
+		 * do not sign messages with a zero session_id.
+		 * See MS-SMB2 3.2.4.1.1
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (signing_key.length == 0) {
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	memset(hdr + SMB2_HDR_SIGNATURE, 0, 16);
+
+	SIVAL(hdr, SMB2_HDR_FLAGS, IVAL(hdr, SMB2_HDR_FLAGS) | SMB2_HDR_FLAG_SIGNED);
+
+	status = smb2_signing_calc_fd(signing_key, protocol,
+				      vector, count,
+				      fd, offset, length,
+				      res);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	memcpy(hdr + SMB2_HDR_SIGNATURE, res, 16);
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_signing_sign_pdu_fd(struct smb2_signing_key *signing_key,
+				  enum protocol_types protocol,
+				  struct iovec *vector,
+				  int count,
+				  int fd,
+				  off_t offset,
+				  size_t length)
+{
+	DATA_BLOB key = data_blob_null;
+	NTSTATUS status;
+
+	if (smb2_signing_key_valid(signing_key)) {
+		key = signing_key->blob;
+	}
+
+	status = smb2_signing_sign_pdu_fd_nolog(key,
+						protocol,
+						vector,
+						count,
+						fd,
+						offset,
+						length);
+	if (!NT_STATUS_IS_OK(status)) {
+		if (key.length == 0) {
+			DBG_WARNING("No valid session key for SMB2 signing\n");
+		}
+		return status;
+	}
+	DEBUG(5,("signed SMB2 message (payload from fd)\n"));
+
+	return NT_STATUS_OK;
+}
+
 NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 				enum protocol_types protocol,
 				const struct iovec *vector,
@@ -242,6 +640,77 @@ NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 	return NT_STATUS_OK;
 }
 
+NTSTATUS smb2_signing_check_pdu_fd(struct smb2_signing_key *signing_key,
+				   enum protocol_types protocol,
+				   const struct iovec *vector,
+				   int count,
+				   int fd,
+				   off_t offset,
+				   size_t length)
+{
+	const uint8_t *hdr;
+	uint8_t zero_hdr[SMB2_HDR_BODY];
+	struct iovec *tmp = NULL;
+	uint64_t session_id;
+	uint8_t res[16];
+	NTSTATUS status;
+
+	if (count < 1) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (vector[0].iov_len != SMB2_HDR_BODY) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	hdr = (const uint8_t *)vector[0].iov_base;
+
+	session_id = BVAL(hdr, SMB2_HDR_SESSION_ID);
+	if (session_id == 0) {
+		/*
+		 * do not sign messages with a zero session_id.
+		 * See MS-SMB2 3.2.4.1.1
+		 */
+		return NT_STATUS_OK;
+	}
+
+	if (!smb2_signing_key_valid(signing_key)) {
+		/* we don't have the session key yet */
+		return NT_STATUS_OK;
+	}
+
+	/*
+	 * The signature is calculated with a zeroed
+	 * signature field, so use a copy of the header.
+	 */
+	memcpy(zero_hdr, hdr, SMB2_HDR_BODY);
+	memset(zero_hdr + SMB2_HDR_SIGNATURE, 0, 16);
+
+	tmp = talloc_memdup(NULL, vector, sizeof(struct iovec) * count);
+	if (tmp == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	tmp[0].iov_base = zero_hdr;
+
+	status = smb2_signing_calc_fd(signing_key->blob, protocol,
+				      tmp, count,
+				      fd, offset, length,
+				      res);
+	TALLOC_FREE(tmp);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	if (memcmp_const_time(res, hdr + SMB2_HDR_SIGNATURE, 16) != 0) {
+		DEBUG(0,("Bad SMB2 signature for message (payload from fd)\n"));
+		dump_data(0, hdr + SMB2_HDR_SIGNATURE, 16);
+		dump_data(0, res, 16);
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	return NT_STATUS_OK;
+}
+
 NTSTATUS smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 			     const uint8_t *Label, size_t Label_len,
 			     const uint8_t *Context, size_t Context_len,
@@ -310,10 +779,10 @@ NTSTATUS smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 	return NT_STATUS_OK;
 }
 
-NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
-				  uint16_t cipher_id,
-				  struct iovec *vector,
-				  int count)
+NTSTATUS smb2_signing_encrypt_pdu_nolog(DATA_BLOB encryption_key,
+					uint16_t cipher_id,
+					struct iovec *vector,
+					int count)
 {
 	uint8_t *tf;
 	uint8_t sig[16];
@@ -337,8 +806,6 @@ NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (encryption_key.length == 0) {
-		DEBUG(2,("Wrong encryption key length %u for SMB2 signing\n",
-			 (unsigned)encryption_key.length));
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
@@ -399,15 +866,39 @@ NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
 
 	memcpy(tf + SMB2_TF_SIGNATURE, sig, 16);
 
-	DEBUG(5,("encrypt SMB2 message\n"));
-
 	return NT_STATUS_OK;
 }
 
-NTSTATUS smb2_signing_decrypt_pdu(DATA_BLOB decryption_key,
+NTSTATUS smb2_signing_encrypt_pdu(DATA_BLOB encryption_key,
 				  uint16_t cipher_id,
 				  struct iovec *vector,
 				  int count)
+{
+	NTSTATUS status;
+
+	if (encryption_key.length == 0) {
+		DEBUG(2,("Wrong encryption key length %u for SMB2 signing\n",
+			 (unsigned)encryption_key.length));
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	status = smb2_signing_encrypt_pdu_nolog(encryption_key,
+						cipher_id,
+						vector,
+						count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	DEBUG(5,("encrypt SMB2 message\n"));
+
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_signing_decrypt_pdu_nolog(DATA_BLOB decryption_key,
+					uint16_t cipher_id,
+					struct iovec *vector,
+					int count)
 {
 	uint8_t *tf;
 	uint16_t flags;
@@ -434,8 +925,6 @@ NTSTATUS smb2_signing_decrypt_pdu(DATA_BLOB decryption_key,
 	tf = (uint8_t *)vector[0].iov_base;
 
 	if (decryption_key.length == 0) {
-		DEBUG(2,("Wrong decryption key length %u for SMB2 signing\n",
-			 (unsigned)decryption_key.length));
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
@@ -503,6 +992,30 @@ NTSTATUS smb2_signing_decrypt_pdu(DATA_BLOB decryption_key,
 		return NT_STATUS_ACCESS_DENIED;
 	}
 
+	return NT_STATUS_OK;
+}
+
+NTSTATUS smb2_signing_decrypt_pdu(DATA_BLOB decryption_key,
+				  uint16_t cipher_id,
+				  struct iovec *vector,
+				  int count)
+{
+	NTSTATUS status;
+
+	if (decryption_key.length == 0) {
+		DEBUG(2,("Wrong decryption key length %u for SMB2 signing\n",
+			 (unsigned)decryption_key.length));
+		return NT_STATUS_ACCESS_DENIED;
+	}
+
+	status = smb2_signing_decrypt_pdu_nolog(decryption_key,
+						cipher_id,
+						vector,
+						count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
 	DEBUG(5,("decrypt SMB2 message\n"));
 
 	return NT_STATUS_OK;
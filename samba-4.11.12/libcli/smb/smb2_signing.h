@@ -40,11 +40,49 @@ NTSTATUS smb2_signing_sign_pdu(struct smb2_signing_key *signing_key,
 			       struct iovec *vector,
 			       int count);
 
+/*
+ * Like smb2_signing_sign_pdu(), but the payload following the
+ * vector is 'length' bytes at 'offset' of 'fd', e.g. a READ
+ * response sent with sendfile().
+ */
+NTSTATUS smb2_signing_sign_pdu_fd(struct smb2_signing_key *signing_key,
+				  enum protocol_types protocol,
+				  struct iovec *vector,
+				  int count,
+				  int fd,
+				  off_t offset,
+				  size_t length);
+
+/*
+ * The same without any logging, for callers in worker threads.
+ * An empty key gives NT_STATUS_ACCESS_DENIED.
+ */
+NTSTATUS smb2_signing_sign_pdu_fd_nolog(DATA_BLOB signing_key,
+					enum protocol_types protocol,
+					struct iovec *vector,
+					int count,
+					int fd,
+					off_t offset,
+					size_t length);
+
 NTSTATUS smb2_signing_check_pdu(struct smb2_signing_key *signing_key,
 				enum protocol_types protocol,
 				const struct iovec *vector,
 				int count);
 
+/*
+ * Like smb2_signing_check_pdu(), but the payload following the
+ * vector is 'length' bytes at 'offset' of 'fd', e.g. a WRITE
+ * request received with recvfile().
+ */
+NTSTATUS smb2_signing_check_pdu_fd(struct smb2_signing_key *signing_key,
+				   enum protocol_types protocol,
+				   const struct iovec *vector,
+				   int count,
+				   int fd,
+				   off_t offset,
+				   size_t length);
+
 NTSTATUS smb2_key_derivation(const uint8_t *KI, size_t KI_len,
 			     const uint8_t *Label, size_t Label_len,
 			     const uint8_t *Context, size_t Context_len,
@@ -59,4 +97,17 @@ NTSTATUS smb2_signing_decrypt_pdu(DATA_BLOB decryption_key,
 				  struct iovec *vector,
 				  int count);
 
+/*
+ * The same without any logging, for callers in worker threads.
+ * The caller has to check and log the key length itself.
+ */
+NTSTATUS smb2_signing_encrypt_pdu_nolog(DATA_BLOB encryption_key,
+					uint16_t cipher_id,
+					struct iovec *vector,
+					int count);
+NTSTATUS smb2_signing_decrypt_pdu_nolog(DATA_BLOB decryption_key,
+					uint16_t cipher_id,
+					struct iovec *vector,
+					int count);
+
 #endif /* _LIBCLI_SMB_SMB2_SIGNING_H_ */
@@ -166,6 +166,7 @@ struct smb2cli_session {
 	uint16_t channel_sequence;
 	bool replay_active;
 	bool require_signed_response;
+	bool torture_corrupt_signature;
 };
 
 struct smbXcli_session {
@@ -3339,6 +3340,12 @@ skip_credits:
 			if (!NT_STATUS_IS_OK(status)) {
 				return status;
 			}
+
+			if (state->session->smb2->torture_corrupt_signature) {
+				state->smb2.hdr[SMB2_HDR_SIGNATURE] ^= 0xff;
+				state->session->smb2->torture_corrupt_signature =
+					false;
+			}
 		}
 
 		nbt_len += reqlen;
@@ -5955,6 +5962,15 @@ void smb2cli_session_require_signed_response(struct smbXcli_session *session,
 	session->smb2->require_signed_response = require_signed_response;
 }
 
+/*
+ * Only for tests: send the next signed request
+ * of the session with a bad signature.
+ */
+void smb2cli_session_torture_corrupt_signature(struct smbXcli_session *session)
+{
+	session->smb2->torture_corrupt_signature = true;
+}
+
 NTSTATUS smb2cli_session_update_preauth(struct smbXcli_session *session,
 					const struct iovec *iov)
 {
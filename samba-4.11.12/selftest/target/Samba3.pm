@@ -305,6 +305,13 @@ sub setup_nt4_member
 	security = domain
 	dbwrap_tdb_mutexes:* = yes
 	${require_mutexes}
+	directory listing cache size = 10000
+	smbd search batch size = 16
+	smbd encryption offload size = 4096
+	min receivefile size = 16384
+	smbd signed recvfile = yes
+	shared stat cache size = 1024
+	smbd profiling level = count
 ";
 	my $ret = $self->provision($prefix, $nt4_dc_vars->{DOMAIN},
 				   "LOCALNT4MEMBER3",
@@ -818,6 +825,7 @@ sub setup_simpleserver
 	vfs objects = xattr_tdb streams_depot
 	change notify = no
 	smb encrypt = off
+	negative stat cache timeout = 3600
 
 [vfs_aio_pthread]
 	path = $prefix_abs/share
@@ -874,6 +882,11 @@ sub setup_simpleserver
         read only = no
         vfs_aio_fork:erratic_testing_mode=yes
 
+[vfs_io_uring]
+	path = $prefix_abs/share
+	read only = no
+	vfs objects = io_uring
+
 [dosmode]
 	path = $prefix_abs/share
 	vfs objects =
@@ -964,6 +977,12 @@ sub setup_fileserver
 
 	my $fileserver_options = "
 	kernel change notify = yes
+	directory listing cache size = 10000
+	case insensitive index size = 10000
+	locking database shards = 4
+	locking database lockfree reads = yes
+	locking database rehash = yes
+	locking database crc32c hash = yes
 
 	usershare path = $usershare_dir
 	usershare max shares = 10
@@ -1843,6 +1862,11 @@ sub provision($$$$$$$$$)
 	comment = encrypt smb username is [%U]
 	smb encrypt = required
 	vfs objects = dirsort
+[sendfile]
+	path = $shrdir
+	use sendfile = yes
+	smbd signed sendfile = yes
+	aio read size = 0
 [tmpguest]
 	path = $shrdir
         guest ok = yes
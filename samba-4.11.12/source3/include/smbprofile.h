@@ -108,6 +108,16 @@ struct tevent_context;
 	SMBPROFILE_STATS_COUNT(statcache_lookups) \
 	SMBPROFILE_STATS_COUNT(statcache_misses) \
 	SMBPROFILE_STATS_COUNT(statcache_hits) \
+	SMBPROFILE_STATS_COUNT(statcache_shared_hits) \
+	SMBPROFILE_STATS_COUNT(statcache_shared_misses) \
+	SMBPROFILE_STATS_COUNT(statcache_shared_adds) \
+	SMBPROFILE_STATS_COUNT(statcache_shared_evictions) \
+	SMBPROFILE_STATS_COUNT(statcache_shared_collisions) \
+	SMBPROFILE_STATS_SECTION_END \
+	\
+	SMBPROFILE_STATS_SECTION_START(brlock, "Byte Range Locks") \
+	SMBPROFILE_STATS_COUNT(brlock_readonly_cached) \
+	SMBPROFILE_STATS_COUNT(brlock_readonly_fetched) \
 	SMBPROFILE_STATS_SECTION_END \
 	\
 	SMBPROFILE_STATS_SECTION_START(writecache, "Write Cache") \
@@ -1205,12 +1205,7 @@ again:
 
 	if ((migrate_attempts > ctx->warn_migrate_attempts) ||
 	    (duration_msecs > ctx->warn_migrate_msecs)) {
-		int chain = 0;
-
-		if (tdb_get_flags(ctx->wtdb->tdb) & TDB_INCOMPATIBLE_HASH) {
-			chain = tdb_jenkins_hash(&key) %
-				tdb_hash_size(ctx->wtdb->tdb);
-		}
+		int chain = tdb_hash_chain(ctx->wtdb->tdb, key);
 
 		DEBUG(0, ("db_ctdb_fetch_locked for %s key %s, chain %d "
 			  "needed %d attempts, %d milliseconds, "
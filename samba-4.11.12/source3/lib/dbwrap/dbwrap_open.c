@@ -126,6 +126,32 @@ struct db_context *db_open(TALLOC_CTX *mem_ctx,
 		}
 	}
 
+	if (tdb_flags & TDB_MUTEX_LOCKING) {
+		bool adaptive_mutex = false;
+
+		adaptive_mutex = lp_parm_bool(-1, "dbwrap_tdb_adaptive_mutexes",
+					      "*", adaptive_mutex);
+		adaptive_mutex = lp_parm_bool(-1, "dbwrap_tdb_adaptive_mutexes",
+					      base, adaptive_mutex);
+
+		if (adaptive_mutex) {
+			tdb_flags |= TDB_MUTEX_ADAPTIVE;
+		}
+	}
+
+	if (tdb_flags & TDB_MUTEX_LOCKING) {
+		bool mutex_stats = false;
+
+		mutex_stats = lp_parm_bool(-1, "dbwrap_tdb_mutex_stats",
+					   "*", mutex_stats);
+		mutex_stats = lp_parm_bool(-1, "dbwrap_tdb_mutex_stats",
+					   base, mutex_stats);
+
+		if (mutex_stats) {
+			tdb_flags |= TDB_MUTEX_STATS;
+		}
+	}
+
 	if (lp_clustering()) {
 		const char *sockname;
 
@@ -347,6 +347,94 @@ static NTSTATUS dbwrap_watched_do_locked(struct db_context *db, TDB_DATA key,
 	return state.status;
 }
 
+struct dbwrap_watched_do_locked_multi_state {
+	struct db_context *db;
+	void (*fn)(struct db_record **recs, size_t num_recs,
+		   void *private_data);
+	void *private_data;
+
+	struct dbwrap_watched_do_locked_state *states;
+	struct db_record *recs;
+	struct db_record **precs;
+};
+
+static void dbwrap_watched_do_locked_multi_fn(struct db_record **subrecs,
+					      size_t num_subrecs,
+					      void *private_data)
+{
+	struct dbwrap_watched_do_locked_multi_state *state =
+		(struct dbwrap_watched_do_locked_multi_state *)private_data;
+	size_t i;
+
+	for (i=0; i<num_subrecs; i++) {
+		struct dbwrap_watched_do_locked_state *rec_state =
+			&state->states[i];
+		struct db_record *subrec = subrecs[i];
+		TDB_DATA subrec_value = dbwrap_record_get_value(subrec);
+		bool ok;
+
+		*rec_state = (struct dbwrap_watched_do_locked_state) {
+			.db = state->db,
+			.subrec = (struct db_watched_subrec) {
+				.subrec = subrec
+			}
+		};
+
+		state->recs[i] = (struct db_record) {
+			.db = state->db, .key = dbwrap_record_get_key(subrec),
+			.storev = dbwrap_watched_do_locked_storev,
+			.delete_rec = dbwrap_watched_do_locked_delete,
+			.private_data = rec_state
+		};
+
+		ok = dbwrap_watch_rec_parse(subrec_value,
+					    &rec_state->subrec.wrec);
+		if (ok) {
+			state->recs[i].value = rec_state->subrec.wrec.data;
+		}
+
+		state->precs[i] = &state->recs[i];
+	}
+
+	state->fn(state->precs, num_subrecs, state->private_data);
+}
+
+static NTSTATUS dbwrap_watched_do_locked_multi(
+	struct db_context *db, const TDB_DATA *keys, size_t num_keys,
+	void (*fn)(struct db_record **recs, size_t num_recs,
+		   void *private_data),
+	void *private_data)
+{
+	struct db_watched_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_watched_ctx);
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct dbwrap_watched_do_locked_multi_state state = {
+		.db = db, .fn = fn, .private_data = private_data
+	};
+	NTSTATUS status;
+
+	state.states = talloc_array(
+		frame, struct dbwrap_watched_do_locked_state, num_keys);
+	state.recs = talloc_array(frame, struct db_record, num_keys);
+	state.precs = talloc_array(frame, struct db_record *, num_keys);
+	if ((state.states == NULL) || (state.recs == NULL) ||
+	    (state.precs == NULL)) {
+		TALLOC_FREE(frame);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	status = dbwrap_do_locked_multi(
+		ctx->backend, keys, num_keys,
+		dbwrap_watched_do_locked_multi_fn, &state);
+	TALLOC_FREE(frame);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_do_locked_multi returned %s\n",
+			  nt_errstr(status));
+	}
+
+	return status;
+}
+
 static void dbwrap_watched_subrec_wakeup(
 	struct db_record *rec, struct db_watched_subrec *subrec)
 {
@@ -565,6 +653,32 @@ static int dbwrap_watched_traverse_read(struct db_context *db,
 	return ret;
 }
 
+/*
+ * dbwrap_watched_traverse_fn() only parses the record, so it can
+ * run in the backend's helper threads.
+ */
+static int dbwrap_watched_traverse_read_parallel(
+	struct db_context *db,
+	int (*fn)(struct db_record *rec, void *private_data),
+	void *private_data,
+	unsigned num_threads)
+{
+	struct db_watched_ctx *ctx = talloc_get_type_abort(
+		db->private_data, struct db_watched_ctx);
+	struct dbwrap_watched_traverse_state state = {
+		.fn = fn, .private_data = private_data };
+	NTSTATUS status;
+	int ret;
+
+	status = dbwrap_traverse_read_parallel(
+		ctx->backend, dbwrap_watched_traverse_fn, &state,
+		num_threads, &ret);
+	if (!NT_STATUS_IS_OK(status)) {
+		return -1;
+	}
+	return ret;
+}
+
 static int dbwrap_watched_get_seqnum(struct db_context *db)
 {
 	struct db_watched_ctx *ctx = talloc_get_type_abort(
@@ -781,8 +895,10 @@ struct db_context *db_open_watched(TALLOC_CTX *mem_ctx,
 
 	db->fetch_locked = dbwrap_watched_fetch_locked;
 	db->do_locked = dbwrap_watched_do_locked;
+	db->do_locked_multi = dbwrap_watched_do_locked_multi;
 	db->traverse = dbwrap_watched_traverse;
 	db->traverse_read = dbwrap_watched_traverse_read;
+	db->traverse_read_parallel = dbwrap_watched_traverse_read_parallel;
 	db->get_seqnum = dbwrap_watched_get_seqnum;
 	db->transaction_start = dbwrap_watched_transaction_start;
 	db->transaction_commit = dbwrap_watched_transaction_commit;
@@ -34,6 +34,7 @@
 #include "serverid.h"
 #include "messages.h"
 #include "util_tdb.h"
+#include "smbprofile.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_LOCKING
@@ -44,6 +45,39 @@
 
 static struct db_context *brlock_db;
 
+/*
+ * Change counters for brlock.tdb records, indexed by a hash of the
+ * file_id. They live in shared memory set up by the parent smbd and are
+ * bumped whenever a record is stored or deleted. That allows
+ * brl_get_locks_readonly() to reuse fsp->brlock_rec without touching
+ * brlock.tdb as long as the file's record did not change. Without them
+ * we fall back to the database sequence number, which changes with
+ * every lock on any file.
+ *
+ * Not used with clustering, other nodes don't bump our counters.
+ */
+
+#define BRL_NUM_GENERATIONS 65536
+
+static uint32_t *brl_generations;
+
+/*
+ * A brlock.tdb record is a brl_record_header followed by num_locks
+ * lock_structs sorted by start. Records written by older versions are
+ * just the unsorted lock_structs, they are told apart by their size as
+ * sizeof(struct brl_record_header) is smaller than a lock_struct.
+ * Those are sorted when read and written back in the current format.
+ */
+
+#define BRL_RECORD_MAGIC 0x4b4c5242 /* "BRLK" */
+#define BRL_RECORD_VERSION 1
+
+struct brl_record_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_locks;
+};
+
 struct byte_range_lock {
 	struct files_struct *fsp;
 	TALLOC_CTX *req_mem_ctx;
@@ -52,6 +86,14 @@ struct byte_range_lock {
 	bool modified;
 	struct lock_struct *lock_data;
 	struct db_record *record;
+
+	/*
+	 * max_last[i] is the highest last byte of lock_data[0..i]. As
+	 * lock_data is sorted by start, the locks overlapping a range
+	 * are found with two binary searches, see brl_overlap_window().
+	 * Built on demand, NULL when lock_data changed.
+	 */
+	uint64_t *max_last;
 };
 
 /****************************************************************************
@@ -203,6 +245,150 @@ bool byte_range_overlap(uint64_t ofs1,
 	return true;
 }
 
+/****************************************************************************
+ The last byte of a range as byte_range_overlap() sees it. The {0, 0}
+ range never overlaps, anything returned for it is fine.
+****************************************************************************/
+
+static uint64_t byte_range_last(uint64_t ofs, uint64_t len)
+{
+	if (ofs == 0 && len == 0) {
+		return 0;
+	}
+	if (!byte_range_valid(ofs, len)) {
+		return UINT64_MAX;
+	}
+	return ofs + len - 1;
+}
+
+/****************************************************************************
+ Find the locks that might overlap ofs/len: all others start after the
+ last byte of the range or end before it starts. Conflicts always need
+ an overlap, so the conflict checks only have to look at
+ lock_data[*pfirst] .. lock_data[*pend-1].
+****************************************************************************/
+
+static void brl_overlap_window(struct byte_range_lock *br_lck,
+			       uint64_t ofs,
+			       uint64_t len,
+			       unsigned int *pfirst,
+			       unsigned int *pend)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+	uint64_t last = byte_range_last(ofs, len);
+	unsigned int lo, hi, i;
+	uint64_t max_last;
+
+	*pfirst = 0;
+	*pend = br_lck->num_locks;
+
+	if (br_lck->num_locks == 0) {
+		return;
+	}
+	if (ofs == 0 && len == 0) {
+		*pend = 0;
+		return;
+	}
+
+	if (br_lck->max_last == NULL) {
+		br_lck->max_last = talloc_array(br_lck, uint64_t,
+						br_lck->num_locks);
+		if (br_lck->max_last == NULL) {
+			/* Look at all of them */
+			return;
+		}
+		max_last = 0;
+		for (i=0; i<br_lck->num_locks; i++) {
+			max_last = MAX(max_last,
+				       byte_range_last(locks[i].start,
+						       locks[i].size));
+			br_lck->max_last[i] = max_last;
+		}
+	}
+
+	/* First lock starting after our last byte */
+	lo = 0;
+	hi = br_lck->num_locks;
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (locks[i].start > last) {
+			hi = i;
+		} else {
+			lo = i + 1;
+		}
+	}
+	*pend = lo;
+
+	/* First lock where any lock up to it ends at or after ofs */
+	lo = 0;
+	hi = *pend;
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (br_lck->max_last[i] < ofs) {
+			lo = i + 1;
+		} else {
+			hi = i;
+		}
+	}
+	*pfirst = lo;
+}
+
+/****************************************************************************
+ Keep lock_data sorted by start. Locks with the same start keep their
+ order, brl_unlock_windows_default() removes the oldest matching lock.
+****************************************************************************/
+
+static unsigned int brl_start_pos(const struct byte_range_lock *br_lck,
+				  uint64_t start,
+				  bool after)
+{
+	unsigned int lo = 0;
+	unsigned int hi = br_lck->num_locks;
+
+	/* First lock starting after start, or at start if !after */
+	while (lo < hi) {
+		unsigned int i = lo + (hi - lo) / 2;
+		uint64_t s = br_lck->lock_data[i].start;
+
+		if ((s > start) || (!after && (s == start))) {
+			hi = i;
+		} else {
+			lo = i + 1;
+		}
+	}
+	return lo;
+}
+
+static void brl_sort_locks(struct lock_struct *locks, unsigned int num_locks)
+{
+	unsigned int i;
+
+	/*
+	 * Stable insertion sort, the callers pass arrays that are
+	 * sorted already or nearly so.
+	 */
+	for (i=1; i<num_locks; i++) {
+		struct lock_struct tmp;
+		unsigned int j = i;
+
+		if (locks[i-1].start <= locks[i].start) {
+			continue;
+		}
+		tmp = locks[i];
+		while ((j > 0) && (locks[j-1].start > tmp.start)) {
+			locks[j] = locks[j-1];
+			j -= 1;
+		}
+		locks[j] = tmp;
+	}
+}
+
+static void brl_locks_changed(struct byte_range_lock *br_lck)
+{
+	br_lck->modified = true;
+	TALLOC_FREE(br_lck->max_last);
+}
+
 /****************************************************************************
  See if lck1 and lck2 overlap.
 ****************************************************************************/
@@ -393,6 +579,17 @@ void brl_init(bool read_only)
 		return;
 	}
 	TALLOC_FREE(db_path);
+
+	if (read_only || lp_clustering() || (brl_generations != NULL)) {
+		return;
+	}
+
+	brl_generations = (uint32_t *)anonymous_shared_allocate(
+		sizeof(uint32_t) * BRL_NUM_GENERATIONS);
+	if (brl_generations == NULL) {
+		DBG_WARNING("anonymous_shared_allocate failed: %s\n",
+			    strerror(errno));
+	}
 }
 
 /****************************************************************************
@@ -404,6 +601,21 @@ void brl_shutdown(void)
 	TALLOC_FREE(brlock_db);
 }
 
+static uint32_t *brl_generation(const struct file_id *id)
+{
+	uint32_t hash = tdb_jenkins_hash(&(TDB_DATA) {
+		.dptr = discard_const_p(uint8_t, id), .dsize = sizeof(*id) });
+	return &brl_generations[hash % BRL_NUM_GENERATIONS];
+}
+
+static void brl_bump_generation(const struct file_id *id)
+{
+	if (brl_generations == NULL) {
+		return;
+	}
+	__atomic_fetch_add(brl_generation(id), 1, __ATOMIC_RELEASE);
+}
+
 #if ZERO_ZERO
 /****************************************************************************
  Compare two locks for sorting.
@@ -429,7 +641,7 @@ static int lock_compare(const struct lock_struct *lck1,
 NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 				  struct lock_struct *plock)
 {
-	unsigned int i;
+	unsigned int i, first, end;
 	files_struct *fsp = br_lck->fsp;
 	struct lock_struct *locks = br_lck->lock_data;
 	NTSTATUS status;
@@ -442,7 +654,9 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	brl_overlap_window(br_lck, plock->start, plock->size, &first, &end);
+
+	for (i=first; i < end; i++) {
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -499,11 +713,14 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		status = NT_STATUS_NO_MEMORY;
 		goto fail;
 	}
+	br_lck->lock_data = locks;
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
+	i = brl_start_pos(br_lck, plock->start, true);
+	memmove(&locks[i+1], &locks[i],
+		(br_lck->num_locks - i) * sizeof(struct lock_struct));
+	memcpy(&locks[i], plock, sizeof(struct lock_struct));
 	br_lck->num_locks += 1;
-	br_lck->lock_data = locks;
-	br_lck->modified = True;
+	brl_locks_changed(br_lck);
 
 	return NT_STATUS_OK;
  fail:
@@ -894,21 +1111,13 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
-
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
-
-	if (i < count) {
-		memmove(&tp[i+1], &tp[i],
-			(count - i)*sizeof(struct lock_struct));
-	}
-	memcpy(&tp[i], plock, sizeof(struct lock_struct));
+	/*
+	 * Add the lock and restore the order, splitting existing
+	 * locks can move their tail behind later locks.
+	 */
+	memcpy(&tp[count], plock, sizeof(struct lock_struct));
 	count++;
+	brl_sort_locks(tp, count);
 
 	/* We can get the POSIX lock, now see if it needs to
 	   be mapped into a lower level POSIX one, and if so can
@@ -957,7 +1166,7 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 	TALLOC_FREE(br_lck->lock_data);
 	br_lck->lock_data = tp;
 	locks = tp;
-	br_lck->modified = True;
+	brl_locks_changed(br_lck);
 
 	/* A successful downgrade from write to read lock can trigger a lock
 	   re-evalutation where waiting readers can now proceed. */
@@ -1085,9 +1294,17 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 	}
 #endif
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	/* The locks are sorted by start, only look at the ones at ours. */
+	for (i = brl_start_pos(br_lck, plock->start, false);
+	     i < br_lck->num_locks;
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
+		if (lock->start != plock->start) {
+			i = br_lck->num_locks;
+			break;
+		}
+
 		/* Only remove our own locks that match in start, size, and flavour. */
 		if (brl_same_context(&lock->context, &plock->context) &&
 					lock->fnum == plock->fnum &&
@@ -1110,7 +1327,7 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 
 	brl_delete_lock_struct(locks, br_lck->num_locks, i);
 	br_lck->num_locks -= 1;
-	br_lck->modified = True;
+	brl_locks_changed(br_lck);
 
 	/* Unlock the underlying POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
@@ -1226,6 +1443,8 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 		return True;
 	}
 
+	brl_sort_locks(tp, count);
+
 	/* Unlock any POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
 		release_posix_lock_posix_flavour(br_lck->fsp,
@@ -1256,7 +1475,7 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 	TALLOC_FREE(br_lck->lock_data);
 	locks = tp;
 	br_lck->lock_data = tp;
-	br_lck->modified = True;
+	brl_locks_changed(br_lck);
 
 	return True;
 }
@@ -1308,12 +1527,15 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 		  const struct lock_struct *rw_probe)
 {
 	bool ret = True;
-	unsigned int i;
+	unsigned int i, first, end;
 	struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
 
+	brl_overlap_window(br_lck, rw_probe->start, rw_probe->size,
+			   &first, &end);
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i=first; i < end; i++) {
 		/*
 		 * Our own locks don't conflict.
 		 */
@@ -1376,7 +1598,7 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 		enum brl_type *plock_type,
 		enum brl_flavour lock_flav)
 {
-	unsigned int i;
+	unsigned int i, first, end;
 	struct lock_struct lock;
 	const struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
@@ -1390,8 +1612,10 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_type = *plock_type;
 	lock.lock_flav = lock_flav;
 
+	brl_overlap_window(br_lck, lock.start, lock.size, &first, &end);
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (i=first; i < end; i++) {
 		const struct lock_struct *exlock = &locks[i];
 		bool conflict = False;
 
@@ -1619,6 +1843,63 @@ bool brl_reconnect_disconnected(struct files_struct *fsp)
 	return true;
 }
 
+/****************************************************************************
+ Find the lock_structs in a brlock.tdb record. *plegacy tells whether it
+ is a headerless, unsorted record from an older version.
+****************************************************************************/
+
+static bool brl_parse_record(TDB_DATA data,
+			     struct lock_struct **plocks,
+			     unsigned int *pnum_locks,
+			     bool *plegacy)
+{
+	struct brl_record_header hdr;
+	size_t num_locks;
+
+	*plocks = NULL;
+	*pnum_locks = 0;
+	*plegacy = false;
+
+	if (data.dsize == 0) {
+		return true;
+	}
+
+	if (data.dsize % sizeof(struct lock_struct) == 0) {
+		*plocks = (struct lock_struct *)data.dptr;
+		*pnum_locks = data.dsize / sizeof(struct lock_struct);
+		*plegacy = true;
+		return true;
+	}
+
+	if (data.dsize < sizeof(hdr)) {
+		DBG_WARNING("Invalid data size: %zu\n", data.dsize);
+		return false;
+	}
+	memcpy(&hdr, data.dptr, sizeof(hdr));
+
+	if (hdr.magic != BRL_RECORD_MAGIC) {
+		DBG_WARNING("Invalid magic: %"PRIx32"\n", hdr.magic);
+		return false;
+	}
+	if (hdr.version != BRL_RECORD_VERSION) {
+		DBG_WARNING("Unknown version: %"PRIu32"\n", hdr.version);
+		return false;
+	}
+
+	num_locks = (data.dsize - sizeof(hdr)) / sizeof(struct lock_struct);
+	if ((hdr.num_locks != num_locks) ||
+	    (sizeof(hdr) + num_locks * sizeof(struct lock_struct) !=
+	     data.dsize)) {
+		DBG_WARNING("Invalid data size: %zu for %"PRIu64" locks\n",
+			    data.dsize, hdr.num_locks);
+		return false;
+	}
+
+	*plocks = (struct lock_struct *)(data.dptr + sizeof(hdr));
+	*pnum_locks = num_locks;
+	return true;
+}
+
 struct brl_forall_cb {
 	void (*fn)(struct file_id id, struct server_id pid,
 		   enum brl_type lock_type,
@@ -1642,21 +1923,25 @@ static int brl_traverse_fn(struct db_record *rec, void *state)
 	unsigned int num_locks = 0;
 	TDB_DATA dbkey;
 	TDB_DATA value;
+	bool legacy;
 
 	dbkey = dbwrap_record_get_key(rec);
 	value = dbwrap_record_get_value(rec);
 
+	if (!brl_parse_record(value, &locks, &num_locks, &legacy)) {
+		return 0;
+	}
+
 	/* In a traverse function we must make a copy of
 	   dbuf before modifying it. */
 
 	locks = (struct lock_struct *)talloc_memdup(
-		talloc_tos(), value.dptr, value.dsize);
-	if (!locks) {
+		talloc_tos(), locks, num_locks * sizeof(*locks));
+	if ((locks == NULL) && (num_locks != 0)) {
 		return -1; /* Terminate traversal. */
 	}
 
 	key = (struct file_id *)dbkey.dptr;
-	num_locks = value.dsize/sizeof(*locks);
 
 	if (cb->fn) {
 		for ( i=0; i<num_locks; i++) {
@@ -1712,6 +1997,7 @@ int brl_forall(void (*fn)(struct file_id id, struct server_id pid,
 static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 {
 	unsigned i;
+	unsigned num_locks = 0;
 	struct lock_struct *locks = br_lck->lock_data;
 
 	if (!br_lck->modified) {
@@ -1719,19 +2005,22 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		goto done;
 	}
 
-	i = 0;
-
-	while (i < br_lck->num_locks) {
+	for (i = 0; i < br_lck->num_locks; i++) {
 		if (locks[i].context.pid.pid == 0) {
 			/*
 			 * Autocleanup, the process conflicted and does not
 			 * exist anymore.
 			 */
-			locks[i] = locks[br_lck->num_locks-1];
-			br_lck->num_locks -= 1;
-		} else {
-			i += 1;
+			continue;
+		}
+		if (num_locks != i) {
+			locks[num_locks] = locks[i];
 		}
+		num_locks += 1;
+	}
+	if (num_locks != br_lck->num_locks) {
+		br_lck->num_locks = num_locks;
+		TALLOC_FREE(br_lck->max_last);
 	}
 
 	if (br_lck->num_locks == 0) {
@@ -1743,19 +2032,29 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 			smb_panic("Could not delete byte range lock entry");
 		}
 	} else {
-		TDB_DATA data = {
-			.dsize = br_lck->num_locks * sizeof(struct lock_struct),
-			.dptr = (uint8_t *)br_lck->lock_data,
+		struct brl_record_header hdr = {
+			.magic = BRL_RECORD_MAGIC,
+			.version = BRL_RECORD_VERSION,
+			.num_locks = br_lck->num_locks,
+		};
+		TDB_DATA data[] = {
+			{ .dsize = sizeof(hdr), .dptr = (uint8_t *)&hdr, },
+			{ .dsize = br_lck->num_locks *
+				   sizeof(struct lock_struct),
+			  .dptr = (uint8_t *)br_lck->lock_data, },
 		};
 		NTSTATUS status;
 
-		status = dbwrap_record_store(br_lck->record, data, TDB_REPLACE);
+		status = dbwrap_record_storev(br_lck->record, data,
+					      ARRAY_SIZE(data), TDB_REPLACE);
 		if (!NT_STATUS_IS_OK(status)) {
 			DEBUG(0, ("store returned %s\n", nt_errstr(status)));
 			smb_panic("Could not store byte range mode entry");
 		}
 	}
 
+	brl_bump_generation(&br_lck->fsp->file_id);
+
 	DEBUG(10, ("seqnum=%d\n", dbwrap_get_seqnum(brlock_db)));
 
  done:
@@ -1771,24 +2070,33 @@ static int byte_range_lock_destructor(struct byte_range_lock *br_lck)
 
 static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 {
-	size_t data_len;
+	struct lock_struct *locks = NULL;
+	unsigned int num_locks;
+	bool legacy;
 
-	if (data.dsize == 0) {
-		return true;
-	}
-	if (data.dsize % sizeof(struct lock_struct) != 0) {
-		DEBUG(1, ("Invalid data size: %u\n", (unsigned)data.dsize));
+	if (!brl_parse_record(data, &locks, &num_locks, &legacy)) {
 		return false;
 	}
+	if (num_locks == 0) {
+		return true;
+	}
 
-	br_lck->num_locks = data.dsize / sizeof(struct lock_struct);
-	data_len = br_lck->num_locks * sizeof(struct lock_struct);
-
-	br_lck->lock_data = talloc_memdup(br_lck, data.dptr, data_len);
+	br_lck->lock_data = talloc_memdup(
+		br_lck, locks, num_locks * sizeof(struct lock_struct));
 	if (br_lck->lock_data == NULL) {
 		DEBUG(1, ("talloc_memdup failed\n"));
 		return false;
 	}
+	br_lck->num_locks = num_locks;
+
+	if (legacy) {
+		/*
+		 * Written by an older version, sort it. If we have the
+		 * record locked, store it back in the current format.
+		 */
+		brl_sort_locks(br_lck->lock_data, br_lck->num_locks);
+		br_lck->modified = true;
+	}
 	return true;
 }
 
@@ -1875,8 +2183,11 @@ static void brl_get_locks_readonly_parser(TDB_DATA key, TDB_DATA data,
 		(struct brl_get_locks_readonly_state *)private_data;
 	struct byte_range_lock *br_lck;
 
+	/* lock_data and max_last */
 	br_lck = talloc_pooled_object(
-		state->mem_ctx, struct byte_range_lock, 1, data.dsize);
+		state->mem_ctx, struct byte_range_lock, 2,
+		data.dsize + data.dsize / sizeof(struct lock_struct) *
+		sizeof(uint64_t));
 	if (br_lck == NULL) {
 		*state->br_lock = NULL;
 		return;
@@ -1893,20 +2204,34 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 {
 	struct byte_range_lock *br_lock = NULL;
 	struct brl_get_locks_readonly_state state;
+	int seqnum;
 	NTSTATUS status;
 
+	if (brl_generations != NULL) {
+		/*
+		 * Read this before the record, a change after this
+		 * makes us parse it again next time.
+		 */
+		seqnum = (int)__atomic_load_n(brl_generation(&fsp->file_id),
+					      __ATOMIC_ACQUIRE);
+	} else {
+		seqnum = dbwrap_get_seqnum(brlock_db);
+	}
+
 	DEBUG(10, ("seqnum=%d, fsp->brlock_seqnum=%d\n",
-		   dbwrap_get_seqnum(brlock_db), fsp->brlock_seqnum));
+		   seqnum, fsp->brlock_seqnum));
 
-	if ((fsp->brlock_rec != NULL)
-	    && (dbwrap_get_seqnum(brlock_db) == fsp->brlock_seqnum)) {
+	if ((fsp->brlock_rec != NULL) && (seqnum == fsp->brlock_seqnum)) {
 		/*
-		 * We have cached the brlock_rec and the database did not
-		 * change.
+		 * We have cached the brlock_rec and the record (or the
+		 * whole database) did not change.
 		 */
+		DO_PROFILE_INC(brlock_readonly_cached);
 		return fsp->brlock_rec;
 	}
 
+	DO_PROFILE_INC(brlock_readonly_fetched);
+
 	/*
 	 * Parse the record fresh from the database
 	 */
@@ -1943,12 +2268,12 @@ struct byte_range_lock *brl_get_locks_readonly(files_struct *fsp)
 	br_lock->record = NULL;
 
 	/*
-	 * Cache the brlock struct, invalidated when the dbwrap_seqnum
+	 * Cache the brlock struct, invalidated when the seqnum
 	 * changes. See beginning of this routine.
 	 */
 	TALLOC_FREE(fsp->brlock_rec);
 	fsp->brlock_rec = br_lock;
-	fsp->brlock_seqnum = dbwrap_get_seqnum(brlock_db);
+	fsp->brlock_seqnum = seqnum;
 
 	return br_lock;
 }
@@ -1961,6 +2286,7 @@ bool brl_cleanup_disconnected(struct file_id fid, uint64_t open_persistent_id)
 	struct db_record *rec;
 	struct lock_struct *lock;
 	unsigned n, num;
+	bool legacy;
 	NTSTATUS status;
 
 	key = make_tdb_data((void*)&fid, sizeof(fid));
@@ -1973,8 +2299,9 @@ bool brl_cleanup_disconnected(struct file_id fid, uint64_t open_persistent_id)
 	}
 
 	val = dbwrap_record_get_value(rec);
-	lock = (struct lock_struct*)val.dptr;
-	num = val.dsize / sizeof(struct lock_struct);
+	if (!brl_parse_record(val, &lock, &num, &legacy)) {
+		goto done;
+	}
 	if (lock == NULL) {
 		DEBUG(10, ("brl_cleanup_disconnected: no byte range locks for "
 			   "file %s\n", file_id_string(frame, &fid)));
@@ -2014,6 +2341,7 @@ bool brl_cleanup_disconnected(struct file_id fid, uint64_t open_persistent_id)
 			  nt_errstr(status)));
 		goto done;
 	}
+	brl_bump_generation(&fid);
 
 	DEBUG(10, ("brl_cleanup_disconnected: "
 		   "file %s cleaned up %u entries from open %llu\n",
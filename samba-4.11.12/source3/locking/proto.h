@@ -150,6 +150,10 @@ NTSTATUS share_mode_wakeup_waiters(struct file_id id);
 
 struct share_mode_lock *fetch_share_mode_unlocked(TALLOC_CTX *mem_ctx,
 						  struct file_id id);
+bool share_mode_exists_unlocked(struct file_id id);
+void fetch_share_mode_write_times(const struct file_id *ids,
+				  size_t num_ids,
+				  struct timespec *write_times);
 struct tevent_req *fetch_share_mode_send(TALLOC_CTX *mem_ctx,
 					 struct tevent_context *ev,
 					 struct file_id id,
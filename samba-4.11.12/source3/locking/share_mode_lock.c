@@ -57,48 +57,112 @@
 
 #define NO_LOCKING_COUNT (-1)
 
-/* the locking database handle */
-static struct db_context *lock_db;
+/*
+ * The locking database handles. With "locking database shards" > 1
+ * the share mode records are spread over several independent
+ * databases to reduce contention on the tdb locks.
+ */
+static struct db_context **lock_dbs;
+static unsigned num_lock_dbs;
 
-static bool locking_init_internal(bool read_only)
+static struct db_context *lock_db_open(unsigned shard, bool read_only)
 {
-	struct db_context *backend;
-	char *db_path;
-
-	brl_init(read_only);
-
-	if (lock_db)
-		return True;
+	struct db_context *backend = NULL;
+	struct db_context *db = NULL;
+	char *db_name = NULL;
+	char *db_path = NULL;
+	int tdb_flags = TDB_DEFAULT|
+			TDB_VOLATILE|
+			TDB_CLEAR_IF_FIRST|
+			TDB_INCOMPATIBLE_HASH|
+			TDB_SEQNUM;
+
+	if (shard == 0) {
+		db_name = talloc_strdup(talloc_tos(), "locking.tdb");
+	} else {
+		db_name = talloc_asprintf(talloc_tos(), "locking.%u.tdb", shard);
+	}
+	if (db_name == NULL) {
+		return NULL;
+	}
 
-	db_path = lock_path(talloc_tos(), "locking.tdb");
+	db_path = lock_path(talloc_tos(), db_name);
+	TALLOC_FREE(db_name);
 	if (db_path == NULL) {
-		return false;
+		return NULL;
+	}
+
+	/*
+	 * TDB_LOCKFREE_READS lets fetch_share_mode_unlocked() and
+	 * friends read records without taking the chain lock.
+	 * TDB_REHASH keeps the hash chains short when a busy server
+	 * has far more open files than the hash size was made for.
+	 * TDB_CRC32C_HASH makes hashing the short file_id keys cheap.
+	 * All of them change the on-disk format, so they are opt-in.
+	 */
+	if (lp_locking_database_lockfree_reads()) {
+		tdb_flags |= TDB_LOCKFREE_READS;
+	}
+	if (lp_locking_database_rehash()) {
+		tdb_flags |= TDB_REHASH;
+	}
+	if (lp_locking_database_crc32c_hash()) {
+		tdb_flags |= TDB_CRC32C_HASH;
 	}
 
 	backend = db_open(NULL, db_path,
 			  SMB_OPEN_DATABASE_TDB_HASH_SIZE,
-			  TDB_DEFAULT|
-			  TDB_VOLATILE|
-			  TDB_CLEAR_IF_FIRST|
-			  TDB_INCOMPATIBLE_HASH|
-			  TDB_SEQNUM,
+			  tdb_flags,
 			  read_only?O_RDONLY:O_RDWR|O_CREAT, 0644,
 			  DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
-	TALLOC_FREE(db_path);
-	if (!backend) {
-		DEBUG(0,("ERROR: Failed to initialise locking database\n"));
-		return False;
+	if (backend == NULL) {
+		DBG_ERR("Failed to open %s\n", db_path);
+		TALLOC_FREE(db_path);
+		return NULL;
 	}
+	TALLOC_FREE(db_path);
 
-	lock_db = db_open_watched(NULL, &backend, global_messaging_context());
-	if (lock_db == NULL) {
+	db = db_open_watched(lock_dbs, &backend, global_messaging_context());
+	if (db == NULL) {
 		DBG_ERR("db_open_watched failed\n");
 		TALLOC_FREE(backend);
+		return NULL;
+	}
+
+	return db;
+}
+
+static bool locking_init_internal(bool read_only)
+{
+	unsigned num_shards;
+	unsigned i;
+
+	brl_init(read_only);
+
+	if (lock_dbs)
+		return True;
+
+	num_shards = MAX(lp_locking_database_shards(), 1);
+
+	lock_dbs = talloc_zero_array(NULL, struct db_context *, num_shards);
+	if (lock_dbs == NULL) {
 		return false;
 	}
 
+	for (i=0; i<num_shards; i++) {
+		lock_dbs[i] = lock_db_open(i, read_only);
+		if (lock_dbs[i] == NULL) {
+			DEBUG(0,("ERROR: Failed to initialise locking "
+				 "database\n"));
+			TALLOC_FREE(lock_dbs);
+			return False;
+		}
+	}
+	num_lock_dbs = num_shards;
+
 	if (!posix_locking_init(read_only)) {
-		TALLOC_FREE(lock_db);
+		TALLOC_FREE(lock_dbs);
+		num_lock_dbs = 0;
 		return False;
 	}
 
@@ -122,10 +186,30 @@ bool locking_init_readonly(void)
 bool locking_end(void)
 {
 	brl_shutdown();
-	TALLOC_FREE(lock_db);
+	TALLOC_FREE(lock_dbs);
+	num_lock_dbs = 0;
 	return true;
 }
 
+/*******************************************************************
+ Find the locking database holding the record for a dev/inode pair.
+ Don't use tdb_jenkins_hash() here: within a shard the records
+ should still spread over all hash chains.
+******************************************************************/
+
+static struct db_context *lock_db_for(const struct file_id *id)
+{
+	uint64_t hash;
+
+	if (num_lock_dbs == 1) {
+		return lock_dbs[0];
+	}
+
+	hash = (id->devid ^ id->inode ^ id->extid) * 0x9e3779b97f4a7c15ULL;
+
+	return lock_dbs[(hash >> 32) % num_lock_dbs];
+}
+
 /*******************************************************************
  Form a static locking key for a dev/inode pair.
 ******************************************************************/
@@ -215,7 +299,7 @@ static void fsp_update_share_mode_flags_fn(
 static NTSTATUS fsp_update_share_mode_flags(struct files_struct *fsp)
 {
 	struct fsp_update_share_mode_flags_state state = {0};
-	int seqnum = dbwrap_get_seqnum(lock_db);
+	int seqnum = dbwrap_get_seqnum(lock_db_for(&fsp->file_id));
 	NTSTATUS status;
 
 	if (seqnum == fsp->share_mode_flags_seqnum) {
@@ -516,6 +600,7 @@ static NTSTATUS get_static_share_mode_data(
 	const struct smb_filename *smb_fname,
 	const struct timespec *old_write_time)
 {
+	struct db_context *lock_db = dbwrap_record_get_db(rec);
 	struct share_mode_data *d;
 	TDB_DATA value = dbwrap_record_get_value(rec);
 
@@ -556,6 +641,7 @@ struct share_mode_lock *get_share_mode_lock(
 	const struct smb_filename *smb_fname,
 	const struct timespec *old_write_time)
 {
+	struct db_context *lock_db = lock_db_for(&id);
 	TDB_DATA key = locking_key(&id);
 	struct share_mode_lock *lck = NULL;
 	NTSTATUS status;
@@ -758,7 +844,10 @@ NTSTATUS share_mode_do_locked(
 		NTSTATUS status;
 
 		status = dbwrap_do_locked(
-			lock_db, key, share_mode_do_locked_fn, &state);
+			lock_db_for(&id),
+			key,
+			share_mode_do_locked_fn,
+			&state);
 		if (!NT_STATUS_IS_OK(status)) {
 			DBG_WARNING("dbwrap_do_locked failed: %s\n",
 				    nt_errstr(status));
@@ -820,13 +909,106 @@ struct share_mode_lock *fetch_share_mode_unlocked(TALLOC_CTX *mem_ctx,
 	NTSTATUS status;
 
 	status = dbwrap_parse_record(
-		lock_db, key, fetch_share_mode_unlocked_parser, &state);
+		lock_db_for(&id),
+		key,
+		fetch_share_mode_unlocked_parser,
+		&state);
 	if (!NT_STATUS_IS_OK(status)) {
 		return NULL;
 	}
 	return state.lck;
 }
 
+static void share_mode_exists_unlocked_parser(
+	TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	bool *exists = private_data;
+
+	/* An empty record is likely a ctdb tombstone */
+	*exists = (data.dsize != 0);
+}
+
+/*******************************************************************
+ Check whether a file has a share mode record, i.e. whether it is
+ open somewhere, without locking the database.
+********************************************************************/
+
+bool share_mode_exists_unlocked(struct file_id id)
+{
+	TDB_DATA key = locking_key(&id);
+	bool exists = false;
+
+	(void)dbwrap_parse_record(lock_db_for(&id),
+				  key,
+				  share_mode_exists_unlocked_parser,
+				  &exists);
+	return exists;
+}
+
+struct fetch_share_mode_write_times_state {
+	TALLOC_CTX *mem_ctx;
+	struct timespec write_time;
+};
+
+static void fetch_share_mode_write_times_parser(
+	TDB_DATA key, TDB_DATA data, void *private_data)
+{
+	struct fetch_share_mode_write_times_state *state = private_data;
+	struct share_mode_data *d = NULL;
+
+	if (data.dsize == 0) {
+		/* Likely a ctdb tombstone record, ignore it */
+		return;
+	}
+
+	d = parse_share_modes(state->mem_ctx, key, data);
+	if (d == NULL) {
+		return;
+	}
+
+	if (!null_timespec(d->changed_write_time)) {
+		state->write_time = d->changed_write_time;
+	} else {
+		state->write_time = d->old_write_time;
+	}
+	TALLOC_FREE(d);
+}
+
+/*******************************************************************
+ Get the pending write times of a batch of files without creating a
+ share_mode_lock per file. Used for directory listings, files without
+ a record get a null timespec.
+
+ Each record is read with dbwrap_parse_record(), which goes through
+ the lock-free read path of fetch_share_mode_unlocked(): directory
+ listings must not take chain locks that serialise against opens.
+********************************************************************/
+
+void fetch_share_mode_write_times(const struct file_id *ids,
+				  size_t num_ids,
+				  struct timespec *write_times)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct fetch_share_mode_write_times_state state = {
+		.mem_ctx = frame,
+	};
+	size_t i;
+
+	for (i = 0; i < num_ids; i++) {
+		TDB_DATA key = locking_key(&ids[i]);
+
+		ZERO_STRUCT(state.write_time);
+
+		(void)dbwrap_parse_record(lock_db_for(&ids[i]),
+					  key,
+					  fetch_share_mode_write_times_parser,
+					  &state);
+		write_times[i] = state.write_time;
+	}
+
+	TALLOC_FREE(frame);
+}
+
 static void fetch_share_mode_done(struct tevent_req *subreq);
 
 struct fetch_share_mode_state {
@@ -884,7 +1066,7 @@ struct tevent_req *fetch_share_mode_send(TALLOC_CTX *mem_ctx,
 
 	subreq = dbwrap_parse_record_send(state,
 					  ev,
-					  lock_db,
+					  lock_db_for(&state->id),
 					  state->key,
 					  fetch_share_mode_unlocked_parser,
 					  &state->parser_state,
@@ -952,6 +1134,7 @@ struct share_mode_forall_state {
 	int (*fn)(struct file_id fid, const struct share_mode_data *data,
 		  void *private_data);
 	void *private_data;
+	bool stopped;
 };
 
 static int share_mode_traverse_fn(struct db_record *rec, void *_state)
@@ -996,6 +1179,7 @@ static int share_mode_traverse_fn(struct db_record *rec, void *_state)
 	}
 
 	ret = state->fn(fid, d, state->private_data);
+	state->stopped = (ret != 0);
 
 	TALLOC_FREE(d);
 	return ret;
@@ -1011,19 +1195,27 @@ int share_mode_forall(int (*fn)(struct file_id fid,
 		.private_data = private_data
 	};
 	NTSTATUS status;
-	int count;
+	int total = 0;
+	unsigned i;
 
-	if (lock_db == NULL) {
-		return 0;
-	}
+	for (i=0; i<num_lock_dbs; i++) {
+		int count;
 
-	status = dbwrap_traverse_read(lock_db, share_mode_traverse_fn,
-				      &state, &count);
-	if (!NT_STATUS_IS_OK(status)) {
-		return -1;
+		status = dbwrap_traverse_read(lock_dbs[i],
+					      share_mode_traverse_fn,
+					      &state,
+					      &count);
+		if (!NT_STATUS_IS_OK(status)) {
+			return -1;
+		}
+		total += count;
+
+		if (state.stopped) {
+			break;
+		}
 	}
 
-	return count;
+	return total;
 }
 
 struct share_entry_forall_state {
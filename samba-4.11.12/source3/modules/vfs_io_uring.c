@@ -0,0 +1,916 @@
+/*
+ * Use the io_uring of Linux (>= 5.1) for async pread, pwrite and fsync
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "system/filesys.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "lib/util/tevent_unix.h"
+#include "smbprofile.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * The module talks to the kernel directly via io_uring_setup(2) and
+ * io_uring_enter(2), there's no dependency on liburing.
+ *
+ * Requests are not submitted to the kernel from within the _send()
+ * functions. They are queued and a tevent immediate flushes all
+ * requests queued during one event loop iteration with a single
+ * io_uring_enter() call. Completions are reaped from a fd event on
+ * the ring fd, which is readable as soon as the completion ring is
+ * not empty.
+ *
+ * If the ring can't be created (old kernel, seccomp, ...) all requests
+ * are passed to the next module, so the pthreadpool of vfs_default
+ * is used as before.
+ */
+
+struct vfs_io_uring_request;
+
+struct vfs_io_uring_config {
+	struct tevent_context *ev;
+	int fd;
+
+	void *sq_ptr;
+	size_t sq_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ptr;
+	size_t cq_size;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned cq_entries;
+
+	struct tevent_fd *fde;
+	struct tevent_immediate *im;
+	bool im_scheduled;
+
+	/*
+	 * Retries a submission the kernel refused while nothing was
+	 * in flight, so no completion will trigger it.
+	 */
+	struct tevent_timer *retry_te;
+
+	/*
+	 * Requests waiting for the next flush and requests owned by
+	 * the kernel.
+	 */
+	struct vfs_io_uring_request *queue;
+	struct vfs_io_uring_request *pending;
+	unsigned num_pending;
+
+	/*
+	 * A completion callback can disconnect the tree and free us
+	 * while we're still walking the rings, see
+	 * vfs_io_uring_config_destructor().
+	 */
+	bool busy;
+	bool destroyed;
+};
+
+struct vfs_io_uring_request {
+	struct vfs_io_uring_request *prev, *next;
+	struct vfs_io_uring_request **list_head;
+	struct vfs_io_uring_config *config;
+	struct tevent_req *req;
+	bool in_kernel;
+	struct io_uring_sqe sqe;
+	struct iovec iov;
+	struct timespec start_time;
+	SMBPROFILE_BYTES_ASYNC_STATE(profile_bytes);
+};
+
+/*
+ * Shared by pread, pwrite and fsync
+ */
+struct vfs_io_uring_state {
+	struct vfs_io_uring_request ur;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static int vfs_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int vfs_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static void vfs_io_uring_ring_free(struct vfs_io_uring_config *config)
+{
+	if (config->sqes != NULL) {
+		munmap(config->sqes, config->sqes_size);
+		config->sqes = NULL;
+	}
+	if (config->cq_ptr != NULL) {
+		munmap(config->cq_ptr, config->cq_size);
+		config->cq_ptr = NULL;
+	}
+	if (config->sq_ptr != NULL) {
+		munmap(config->sq_ptr, config->sq_size);
+		config->sq_ptr = NULL;
+	}
+	if (config->fd != -1) {
+		close(config->fd);
+		config->fd = -1;
+	}
+}
+
+static int vfs_io_uring_ring_init(struct vfs_io_uring_config *config,
+				  unsigned num_entries)
+{
+	struct io_uring_params p = { .flags = 0, };
+	uint8_t *sq_ptr = NULL;
+	uint8_t *cq_ptr = NULL;
+	void *ptr = NULL;
+	int fd;
+
+	fd = vfs_io_uring_setup(num_entries, &p);
+	if (fd == -1) {
+		return errno;
+	}
+	config->fd = fd;
+
+	config->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ptr = mmap(NULL, config->sq_size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED) {
+		return errno;
+	}
+	config->sq_ptr = sq_ptr = ptr;
+
+	config->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, config->sqes_size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED) {
+		return errno;
+	}
+	config->sqes = ptr;
+
+	config->cq_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, config->cq_size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED) {
+		return errno;
+	}
+	config->cq_ptr = cq_ptr = ptr;
+
+	config->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+	config->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+	config->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+	config->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+	config->sq_entries = p.sq_entries;
+
+	config->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+	config->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+	config->cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+	config->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+	config->cq_entries = p.cq_entries;
+
+	return 0;
+}
+
+static int vfs_io_uring_config_destructor(struct vfs_io_uring_config *config)
+{
+	struct vfs_io_uring_request *cur = NULL, *next = NULL;
+
+	if (config->busy) {
+		/*
+		 * talloc moves us away from the parent,
+		 * vfs_io_uring_config_unbusy() frees us.
+		 */
+		config->destroyed = true;
+		return -1;
+	}
+
+	TALLOC_FREE(config->fde);
+	TALLOC_FREE(config->im);
+	TALLOC_FREE(config->retry_te);
+
+	for (cur = config->queue; cur != NULL; cur = next) {
+		next = cur->next;
+		DLIST_REMOVE(config->queue, cur);
+		cur->list_head = NULL;
+		cur->config = NULL;
+		tevent_req_error(cur->req, EIO);
+	}
+
+	/*
+	 * The kernel might still write into the buffers of submitted
+	 * requests, so their states are never freed (see
+	 * vfs_io_uring_state_deny_destructor()).
+	 */
+	for (cur = config->pending; cur != NULL; cur = next) {
+		next = cur->next;
+		DLIST_REMOVE(config->pending, cur);
+		cur->list_head = NULL;
+		cur->config = NULL;
+		if (cur->req != NULL) {
+			tevent_req_error(cur->req, EIO);
+		}
+	}
+
+	vfs_io_uring_ring_free(config);
+
+	return 0;
+}
+
+static void vfs_io_uring_fd_handler(struct tevent_context *ev,
+				    struct tevent_fd *fde,
+				    uint16_t flags,
+				    void *private_data);
+
+static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
+			    const char *user)
+{
+	int ret;
+	struct vfs_io_uring_config *config;
+	unsigned num_entries;
+
+	ret = SMB_VFS_NEXT_CONNECT(handle, service, user);
+	if (ret < 0) {
+		return ret;
+	}
+
+	config = talloc_zero(handle->conn, struct vfs_io_uring_config);
+	if (config == NULL) {
+		DBG_ERR("talloc_zero() failed\n");
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = ENOMEM;
+		return -1;
+	}
+	config->fd = -1;
+	config->ev = handle->conn->sconn->ev_ctx;
+	talloc_set_destructor(config, vfs_io_uring_config_destructor);
+
+	SMB_VFS_HANDLE_SET_DATA(handle, config, NULL,
+				struct vfs_io_uring_config,
+				return -1);
+
+	num_entries = lp_parm_ulong(SNUM(handle->conn),
+				    "io_uring",
+				    "num_entries",
+				    128);
+	num_entries = MAX(num_entries, 1);
+
+	ret = vfs_io_uring_ring_init(config, num_entries);
+	if (ret != 0) {
+		DBG_WARNING("io_uring setup failed: %s, "
+			    "using the next module for async I/O\n",
+			    strerror(ret));
+		vfs_io_uring_ring_free(config);
+		return 0;
+	}
+
+	config->im = tevent_create_immediate(config);
+	if (config->im == NULL) {
+		DBG_ERR("tevent_create_immediate() failed\n");
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	config->fde = tevent_add_fd(config->ev,
+				    config,
+				    config->fd,
+				    TEVENT_FD_READ,
+				    vfs_io_uring_fd_handler,
+				    config);
+	if (config->fde == NULL) {
+		DBG_ERR("tevent_add_fd() failed\n");
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void vfs_io_uring_queue_run(struct vfs_io_uring_config *config);
+
+/*
+ * Called before running callbacks, which might free config.
+ */
+static void vfs_io_uring_config_busy(struct vfs_io_uring_config *config)
+{
+	config->busy = true;
+}
+
+/*
+ * Returns false if config is gone.
+ */
+static bool vfs_io_uring_config_unbusy(struct vfs_io_uring_config *config)
+{
+	config->busy = false;
+
+	if (config->destroyed) {
+		TALLOC_FREE(config);
+		return false;
+	}
+	return true;
+}
+
+static void vfs_io_uring_retry_handler(struct tevent_context *ev,
+				       struct tevent_timer *te,
+				       struct timeval current_time,
+				       void *private_data)
+{
+	struct vfs_io_uring_config *config = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_config);
+
+	TALLOC_FREE(config->retry_te);
+
+	vfs_io_uring_config_busy(config);
+	vfs_io_uring_queue_run(config);
+	vfs_io_uring_config_unbusy(config);
+}
+
+/*
+ * Take back the entries the kernel did not consume from the
+ * submission ring. Without SQPOLL the kernel only reads the ring
+ * within io_uring_enter(), so we can rewind the tail. The requests
+ * go back to the front of the queue, they were the last ones added
+ * to the pending list.
+ */
+static void vfs_io_uring_unsubmit(struct vfs_io_uring_config *config,
+				  unsigned head,
+				  unsigned tail)
+{
+	__atomic_store_n(config->sq_tail, head, __ATOMIC_RELEASE);
+
+	while (tail != head) {
+		struct vfs_io_uring_request *cur = DLIST_TAIL(config->pending);
+
+		DLIST_REMOVE(config->pending, cur);
+		DLIST_ADD(config->queue, cur);
+		cur->list_head = &config->queue;
+		cur->in_kernel = false;
+		config->num_pending -= 1;
+
+		SMBPROFILE_BYTES_ASYNC_SET_IDLE(cur->profile_bytes);
+
+		tail -= 1;
+	}
+}
+
+static void vfs_io_uring_queue_fail(struct vfs_io_uring_config *config,
+				    int err)
+{
+	struct vfs_io_uring_request *queue = config->queue;
+	struct vfs_io_uring_request *cur = NULL;
+
+	/*
+	 * Callbacks might queue new requests or free the ones we
+	 * still have to fail, keep them on our own list.
+	 */
+	config->queue = NULL;
+	for (cur = queue; cur != NULL; cur = cur->next) {
+		cur->list_head = &queue;
+	}
+
+	while ((cur = queue) != NULL) {
+		DLIST_REMOVE(queue, cur);
+		cur->list_head = NULL;
+		SMBPROFILE_BYTES_ASYNC_END(cur->profile_bytes);
+		tevent_req_error(cur->req, err);
+	}
+}
+
+static void vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
+{
+	unsigned head, tail, to_submit;
+	int ret, err;
+
+	head = __atomic_load_n(config->sq_head, __ATOMIC_ACQUIRE);
+	tail = *config->sq_tail;
+
+	/*
+	 * Move as many queued requests into the submission ring as
+	 * fit. We never have more requests in the kernel than the
+	 * completion ring can hold, so completions can't overflow.
+	 */
+	while ((config->queue != NULL) &&
+	       (tail - head < config->sq_entries) &&
+	       (config->num_pending < config->cq_entries))
+	{
+		struct vfs_io_uring_request *cur = config->queue;
+		unsigned idx = tail & *config->sq_mask;
+
+		config->sqes[idx] = cur->sqe;
+		config->sq_array[idx] = idx;
+		tail += 1;
+
+		DLIST_REMOVE(config->queue, cur);
+		DLIST_ADD_END(config->pending, cur);
+		cur->list_head = &config->pending;
+		cur->in_kernel = true;
+		config->num_pending += 1;
+
+		SMBPROFILE_BYTES_ASYNC_SET_BUSY(cur->profile_bytes);
+		PROFILE_TIMESTAMP(&cur->start_time);
+	}
+
+	__atomic_store_n(config->sq_tail, tail, __ATOMIC_RELEASE);
+
+	to_submit = tail - head;
+	if (to_submit == 0) {
+		return;
+	}
+
+	do {
+		ret = vfs_io_uring_enter(config->fd, to_submit, 0, 0);
+	} while ((ret == -1) && (errno == EINTR));
+	err = (ret == -1) ? errno : 0;
+
+	head = __atomic_load_n(config->sq_head, __ATOMIC_ACQUIRE);
+	if (head == tail) {
+		return;
+	}
+
+	/*
+	 * The kernel took only part of the batch or none at all.
+	 */
+	vfs_io_uring_unsubmit(config, head, tail);
+
+	if ((err != 0) && (err != EAGAIN) && (err != EBUSY)) {
+		DBG_WARNING("io_uring_enter failed: %s\n", strerror(err));
+		vfs_io_uring_queue_fail(config, err);
+		return;
+	}
+
+	DBG_DEBUG("io_uring_enter submitted %d of %u: %s\n",
+		  ret, to_submit, (err != 0) ? strerror(err) : "short");
+
+	/*
+	 * EAGAIN or EBUSY, the kernel is short of resources. The next
+	 * completion runs the queue again, if nothing is in flight we
+	 * have to try again ourselves.
+	 */
+	if ((config->num_pending == 0) && (config->retry_te == NULL)) {
+		config->retry_te = tevent_add_timer(
+			config->ev,
+			config,
+			timeval_current_ofs_msec(10),
+			vfs_io_uring_retry_handler,
+			config);
+		if (config->retry_te == NULL) {
+			vfs_io_uring_queue_fail(config, ENOMEM);
+		}
+	}
+}
+
+static void vfs_io_uring_queue_handler(struct tevent_context *ev,
+				       struct tevent_immediate *im,
+				       void *private_data)
+{
+	struct vfs_io_uring_config *config = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_config);
+
+	config->im_scheduled = false;
+
+	vfs_io_uring_config_busy(config);
+	vfs_io_uring_queue_run(config);
+	vfs_io_uring_config_unbusy(config);
+}
+
+static void vfs_io_uring_finish_req(struct vfs_io_uring_request *cur, int res)
+{
+	struct vfs_io_uring_state *state = talloc_get_type_abort(
+		cur, struct vfs_io_uring_state);
+	struct timespec end_time;
+
+	/*
+	 * The kernel is done with the buffers.
+	 */
+	cur->in_kernel = false;
+	talloc_set_destructor(state, NULL);
+
+	if (cur->list_head != NULL) {
+		DLIST_REMOVE((*cur->list_head), cur);
+		cur->list_head = NULL;
+	}
+	if (cur->config != NULL) {
+		cur->config->num_pending -= 1;
+	}
+
+	SMBPROFILE_BYTES_ASYNC_END(cur->profile_bytes);
+
+	if (cur->req == NULL) {
+		/*
+		 * The caller has given up on the request while the
+		 * kernel owned it, we're the last user.
+		 */
+		TALLOC_FREE(state);
+		return;
+	}
+
+	PROFILE_TIMESTAMP(&end_time);
+	state->vfs_aio_state.duration = nsec_time_diff(&end_time,
+						       &cur->start_time);
+
+	if (res < 0) {
+		state->ret = -1;
+		state->vfs_aio_state.error = -res;
+	} else {
+		state->ret = res;
+	}
+
+	tevent_req_done(cur->req);
+}
+
+static void vfs_io_uring_fd_handler(struct tevent_context *ev,
+				    struct tevent_fd *fde,
+				    uint16_t flags,
+				    void *private_data)
+{
+	struct vfs_io_uring_config *config = talloc_get_type_abort(
+		private_data, struct vfs_io_uring_config);
+	unsigned head = *config->cq_head;
+	unsigned tail;
+
+	vfs_io_uring_config_busy(config);
+
+	tail = __atomic_load_n(config->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = NULL;
+		struct vfs_io_uring_request *cur = NULL;
+		int res;
+
+		cqe = &config->cqes[head & *config->cq_mask];
+		cur = (struct vfs_io_uring_request *)(uintptr_t)cqe->user_data;
+		res = cqe->res;
+		head += 1;
+
+		/*
+		 * Release the slot before running the completion,
+		 * the callback might queue new requests.
+		 */
+		__atomic_store_n(config->cq_head, head, __ATOMIC_RELEASE);
+
+		vfs_io_uring_finish_req(cur, res);
+
+		if (config->destroyed) {
+			/*
+			 * The tree is gone, the destructor fails
+			 * whatever is still pending.
+			 */
+			vfs_io_uring_config_unbusy(config);
+			return;
+		}
+
+		tail = __atomic_load_n(config->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	/*
+	 * Completions free up room for queued requests.
+	 */
+	vfs_io_uring_queue_run(config);
+	vfs_io_uring_config_unbusy(config);
+}
+
+static int vfs_io_uring_state_deny_destructor(struct vfs_io_uring_state *state)
+{
+	/*
+	 * The kernel owns the buffers, see
+	 * vfs_io_uring_state_cleanup().
+	 */
+	return -1;
+}
+
+static void vfs_io_uring_state_cleanup(struct tevent_req *req,
+				       enum tevent_req_state req_state)
+{
+	struct vfs_io_uring_state *state = tevent_req_data(
+		req, struct vfs_io_uring_state);
+	struct vfs_io_uring_request *cur = &state->ur;
+
+	if (req_state != TEVENT_REQ_RECEIVED) {
+		return;
+	}
+
+	if (cur->in_kernel) {
+		/*
+		 * The state survives the talloc_free() of req,
+		 * vfs_io_uring_finish_req() frees it once the kernel
+		 * is done.
+		 */
+		cur->req = NULL;
+		return;
+	}
+
+	if (cur->list_head != NULL) {
+		DLIST_REMOVE((*cur->list_head), cur);
+		cur->list_head = NULL;
+	}
+	talloc_set_destructor(state, NULL);
+}
+
+static struct tevent_req *vfs_io_uring_state_create(
+	TALLOC_CTX *mem_ctx,
+	struct vfs_io_uring_config *config,
+	struct vfs_io_uring_state **pstate)
+{
+	struct tevent_req *req = NULL;
+	struct vfs_io_uring_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state, struct vfs_io_uring_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->ret = -1;
+	state->ur.config = config;
+	state->ur.req = req;
+
+	talloc_set_destructor(state, vfs_io_uring_state_deny_destructor);
+	tevent_req_set_cleanup_fn(req, vfs_io_uring_state_cleanup);
+
+	*pstate = state;
+	return req;
+}
+
+static void vfs_io_uring_request_submit(struct vfs_io_uring_request *cur)
+{
+	struct vfs_io_uring_config *config = cur->config;
+
+	cur->sqe.user_data = (uint64_t)(uintptr_t)cur;
+
+	DLIST_ADD_END(config->queue, cur);
+	cur->list_head = &config->queue;
+
+	if (!config->im_scheduled) {
+		tevent_schedule_immediate(config->im,
+					  config->ev,
+					  vfs_io_uring_queue_handler,
+					  config);
+		config->im_scheduled = true;
+	}
+}
+
+static bool vfs_io_uring_usable(struct vfs_io_uring_config *config,
+				struct tevent_context *ev)
+{
+	/*
+	 * Completions are only seen from the main event context.
+	 */
+	return (config->fd != -1) && (ev == config->ev);
+}
+
+static void vfs_io_uring_pread_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_pread_send(struct vfs_handle_struct *handle,
+					     TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct files_struct *fsp,
+					     void *data,
+					     size_t n, off_t offset)
+{
+	struct tevent_req *req = NULL, *subreq = NULL;
+	struct vfs_io_uring_config *config = NULL;
+	struct vfs_io_uring_state *state = NULL;
+	struct io_uring_sqe *sqe = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	req = vfs_io_uring_state_create(mem_ctx, config, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!vfs_io_uring_usable(config, ev)) {
+		talloc_set_destructor(state, NULL);
+		subreq = SMB_VFS_NEXT_PREAD_SEND(state, ev, handle, fsp,
+						 data, n, offset);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, vfs_io_uring_pread_next_done,
+					req);
+		return req;
+	}
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_pread, profile_p,
+				     state->ur.profile_bytes, n);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	state->ur.iov = (struct iovec) {
+		.iov_base = data,
+		.iov_len = n,
+	};
+	sqe = &state->ur.sqe;
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fsp->fh->fd;
+	sqe->off = offset;
+	sqe->addr = (uint64_t)(uintptr_t)&state->ur.iov;
+	sqe->len = 1;
+
+	vfs_io_uring_request_submit(&state->ur);
+
+	return req;
+}
+
+static void vfs_io_uring_pread_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_state *state = tevent_req_data(
+		req, struct vfs_io_uring_state);
+
+	state->ret = SMB_VFS_PREAD_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static ssize_t vfs_io_uring_rw_recv(struct tevent_req *req,
+				    struct vfs_aio_state *vfs_aio_state)
+{
+	struct vfs_io_uring_state *state = tevent_req_data(
+		req, struct vfs_io_uring_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+static void vfs_io_uring_pwrite_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_pwrite_send(struct vfs_handle_struct *handle,
+					      TALLOC_CTX *mem_ctx,
+					      struct tevent_context *ev,
+					      struct files_struct *fsp,
+					      const void *data,
+					      size_t n, off_t offset)
+{
+	struct tevent_req *req = NULL, *subreq = NULL;
+	struct vfs_io_uring_config *config = NULL;
+	struct vfs_io_uring_state *state = NULL;
+	struct io_uring_sqe *sqe = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	req = vfs_io_uring_state_create(mem_ctx, config, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!vfs_io_uring_usable(config, ev)) {
+		talloc_set_destructor(state, NULL);
+		subreq = SMB_VFS_NEXT_PWRITE_SEND(state, ev, handle, fsp,
+						  data, n, offset);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, vfs_io_uring_pwrite_next_done,
+					req);
+		return req;
+	}
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_pwrite, profile_p,
+				     state->ur.profile_bytes, n);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	state->ur.iov = (struct iovec) {
+		.iov_base = discard_const(data),
+		.iov_len = n,
+	};
+	sqe = &state->ur.sqe;
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fsp->fh->fd;
+	sqe->off = offset;
+	sqe->addr = (uint64_t)(uintptr_t)&state->ur.iov;
+	sqe->len = 1;
+
+	vfs_io_uring_request_submit(&state->ur);
+
+	return req;
+}
+
+static void vfs_io_uring_pwrite_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_state *state = tevent_req_data(
+		req, struct vfs_io_uring_state);
+
+	state->ret = SMB_VFS_PWRITE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static void vfs_io_uring_fsync_next_done(struct tevent_req *subreq);
+
+static struct tevent_req *vfs_io_uring_fsync_send(struct vfs_handle_struct *handle,
+					     TALLOC_CTX *mem_ctx,
+					     struct tevent_context *ev,
+					     struct files_struct *fsp)
+{
+	struct tevent_req *req = NULL, *subreq = NULL;
+	struct vfs_io_uring_config *config = NULL;
+	struct vfs_io_uring_state *state = NULL;
+	struct io_uring_sqe *sqe = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct vfs_io_uring_config,
+				smb_panic(__location__));
+
+	req = vfs_io_uring_state_create(mem_ctx, config, &state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	if (!vfs_io_uring_usable(config, ev)) {
+		talloc_set_destructor(state, NULL);
+		subreq = SMB_VFS_NEXT_FSYNC_SEND(state, ev, handle, fsp);
+		if (tevent_req_nomem(subreq, req)) {
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, vfs_io_uring_fsync_next_done,
+					req);
+		return req;
+	}
+
+	SMBPROFILE_BYTES_ASYNC_START(syscall_asys_fsync, profile_p,
+				     state->ur.profile_bytes, 0);
+	SMBPROFILE_BYTES_ASYNC_SET_IDLE(state->ur.profile_bytes);
+
+	sqe = &state->ur.sqe;
+	sqe->opcode = IORING_OP_FSYNC;
+	sqe->fd = fsp->fh->fd;
+
+	vfs_io_uring_request_submit(&state->ur);
+
+	return req;
+}
+
+static void vfs_io_uring_fsync_next_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct vfs_io_uring_state *state = tevent_req_data(
+		req, struct vfs_io_uring_state);
+
+	state->ret = SMB_VFS_FSYNC_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+	tevent_req_done(req);
+}
+
+static int vfs_io_uring_fsync_recv(struct tevent_req *req,
+				   struct vfs_aio_state *vfs_aio_state)
+{
+	return vfs_io_uring_rw_recv(req, vfs_aio_state);
+}
+
+static struct vfs_fn_pointers vfs_io_uring_fns = {
+	.connect_fn = vfs_io_uring_connect,
+	.pread_send_fn = vfs_io_uring_pread_send,
+	.pread_recv_fn = vfs_io_uring_rw_recv,
+	.pwrite_send_fn = vfs_io_uring_pwrite_send,
+	.pwrite_recv_fn = vfs_io_uring_rw_recv,
+	.fsync_send_fn = vfs_io_uring_fsync_send,
+	.fsync_recv_fn = vfs_io_uring_fsync_recv,
+};
+
+static_decl_vfs;
+NTSTATUS vfs_io_uring_init(TALLOC_CTX *ctx)
+{
+	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION,
+				"io_uring", &vfs_io_uring_fns);
+}
@@ -0,0 +1,108 @@
+#!/bin/sh
+#
+# Blackbox test for the shared stat cache: A directory deleted on close
+# must not be found anymore. Deletes don't touch the shared cache, the
+# stat() on the next hit drops the stale entry. This needs
+# "shared stat cache size" and "smbd profiling level = count" on the
+# server.
+#
+
+if [ $# -lt 8 ]; then
+cat <<EOF
+Usage: test_shared_stat_cache.sh SERVER SERVER_IP USERNAME PASSWORD LOCAL_PATH SMBCLIENT SMBSTATUS CONFIGURATION
+EOF
+exit 1;
+fi
+
+SERVER=${1}
+SERVER_IP=${2}
+USERNAME=${3}
+PASSWORD=${4}
+LOCAL_PATH=${5}
+SMBCLIENT=${6}
+SMBSTATUS=${7}
+CONFIGURATION=${8}
+
+incdir=`dirname $0`/../../../testprogs/blackbox
+. $incdir/subunit.sh
+
+failed=0
+
+shared_hits()
+{
+	UID_WRAPPER_INITIAL_RUID=0 UID_WRAPPER_INITIAL_EUID=0 \
+		$SMBSTATUS $CONFIGURATION --profile 2>/dev/null |
+		sed -n 's/^statcache_shared_hits_count: *//p'
+}
+
+smbclient_cmd()
+{
+	CLI_FORCE_INTERACTIVE=yes $SMBCLIENT -mSMB3 -U$USERNAME%$PASSWORD \
+		//$SERVER/tmp -I $SERVER_IP -c "$1" 2>&1
+}
+
+test_delete_on_close()
+{
+	dir=$LOCAL_PATH/StatCacheDir
+
+	rm -rf $dir
+	mkdir $dir || return 1
+
+	# Store STATCACHEDIR -> StatCacheDir, then find it from a new process
+	smbclient_cmd 'ls STATCACHEDIR\*' > /dev/null || return 1
+	hits1=`shared_hits`
+	smbclient_cmd 'ls STATCACHEDIR\*' > /dev/null || return 1
+	hits2=`shared_hits`
+
+	if [ "$hits2" -le "$hits1" ]; then
+		echo "no shared stat cache hit: $hits1 -> $hits2"
+		return 1
+	fi
+
+	# rmdir deletes on close
+	out=`smbclient_cmd 'rmdir StatCacheDir'`
+	if [ $? -ne 0 ]; then
+		echo "$out"
+		echo "rmdir failed"
+		return 1
+	fi
+
+	out=`smbclient_cmd 'ls STATCACHEDIR\*'`
+	if [ $? -eq 0 ]; then
+		echo "$out"
+		echo "deleted directory still listed"
+		return 1
+	fi
+
+	# The stale hit above dropped the entry
+	hits3=`shared_hits`
+	out=`smbclient_cmd 'ls STATCACHEDIR\*'`
+	if [ $? -eq 0 ]; then
+		echo "$out"
+		echo "deleted directory still listed"
+		return 1
+	fi
+	hits4=`shared_hits`
+
+	if [ "$hits4" -ne "$hits3" ]; then
+		echo "deleted directory still in shared stat cache: " \
+		     "$hits3 -> $hits4"
+		return 1
+	fi
+
+	return 0
+}
+
+if [ -z "`shared_hits`" ]; then
+	subunit_start_test "shared stat cache"
+	subunit_skip_test "shared stat cache" <<EOF
+smbd was built without profiling data
+EOF
+	exit 0
+fi
+
+testit "directory deleted on close leaves the shared stat cache" \
+	test_delete_on_close || \
+	failed=`expr $failed + 1`
+
+exit $failed
@@ -69,6 +69,7 @@ have_linux_kernel_oplocks = ("HAVE_KERNEL_OPLOCKS_LINUX" in config_hash)
 have_inotify = ("HAVE_INOTIFY" in config_hash)
 have_ldwrap = ("HAVE_LDWRAP" in config_hash)
 with_pthreadpool = ("WITH_PTHREADPOOL" in config_hash)
+have_io_uring = ("HAVE_LINUX_IO_URING" in config_hash)
 
 
 plantestsuite("samba3.blackbox.success", "nt4_dc:local", [os.path.join(samba3srcdir, "script/tests/test_success.sh")])
@@ -91,7 +92,7 @@ tests = ["FDPASS", "LOCK1", "LOCK2", "LOCK3", "LOCK4", "LOCK5", "LOCK6", "LOCK7"
          "TCON2", "IOCTL", "CHKPATH", "FDSESS", "CHAIN1", "CHAIN2", "OWNER-RIGHTS",
          "CHAIN3", "PIDHIGH", "CLI_SPLICE",
          "UID-REGRESSION-TEST", "SHORTNAME-TEST",
-         "CASE-INSENSITIVE-CREATE", "SMB2-BASIC", "NTTRANS-FSCTL", "SMB2-NEGPROT",
+         "CASE-INSENSITIVE-CREATE", "CASE-INSENSITIVE-INDEX", "SMB2-BASIC", "NTTRANS-FSCTL", "SMB2-NEGPROT",
          "SMB2-SESSION-REAUTH", "SMB2-SESSION-RECONNECT", "SMB2-FTRUNCATE",
          "SMB2-ANONYMOUS", "SMB2-DIR-FSYNC",
          "CLEANUP1",
@@ -134,6 +135,14 @@ tests = ["RW1", "RW2", "RW3", "SMB2-BASIC"]
 for t in tests:
     plantestsuite("samba3.smbtorture_s3.vfs_aio_pthread(simpleserver).%s" % t, "simpleserver", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//$SERVER_IP/vfs_aio_pthread', '$USERNAME', '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
     plantestsuite("samba3.smbtorture_s3.vfs_aio_fork(simpleserver).%s" % t, "simpleserver", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//$SERVER_IP/vfs_aio_fork', '$USERNAME', '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
+    if have_io_uring:
+        plantestsuite("samba3.smbtorture_s3.vfs_io_uring(simpleserver).%s" % t, "simpleserver", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), t, '//$SERVER_IP/vfs_io_uring', '$USERNAME', '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
+
+if have_io_uring:
+    for t in ["smb2.read", "smb2.compound"]:
+        plansmbtorture4testsuite(t, "simpleserver", '//$SERVER_IP/vfs_io_uring -U$USERNAME%$PASSWORD', description="vfs_io_uring")
+
+plantestsuite("samba3.smbtorture_s3.plain.NEGATIVE-STAT-CACHE(simpleserver)", "simpleserver", [os.path.join(samba3srcdir, "script/tests/test_smbtorture_s3.sh"), 'NEGATIVE-STAT-CACHE', '//$SERVER_IP/tmp', '$USERNAME', '$PASSWORD', smbtorture3, "", "-l $LOCAL_PATH"])
 
 plantestsuite("samba3.smbtorture_s3.hidenewfiles(simpleserver)",
               "simpleserver",
@@ -203,6 +212,7 @@ local_tests = [
     "LOCAL-DBWRAP-WATCH1",
     "LOCAL-DBWRAP-WATCH2",
     "LOCAL-DBWRAP-DO-LOCKED1",
+    "LOCAL-DBWRAP-DO-LOCKED-MULTI",
     "LOCAL-G-LOCK1",
     "LOCAL-G-LOCK2",
     "LOCAL-G-LOCK3",
@@ -289,6 +299,11 @@ env = "nt4_member:local"
 plantestsuite("samba3.wbinfo_sids_to_xids", env,
               [os.path.join(srcdir(),
                             "nsswitch/tests/test_wbinfo_sids_to_xids.sh")])
+plantestsuite("samba3.blackbox.shared_stat_cache", env,
+              [os.path.join(samba3srcdir,
+                            "script/tests/test_shared_stat_cache.sh"),
+               '$SERVER', '$SERVER_IP', '$DC_USERNAME', '$DC_PASSWORD',
+               '$LOCAL_PATH', smbclient3, smbstatus, configuration])
 
 env = "ad_member"
 t = "WBCLIENT-MULTI-PING"
@@ -567,9 +582,16 @@ for t in tests:
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmpenc -U$USERNAME%$PASSWORD', 'enc')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -k no -U$USERNAME%$PASSWORD', 'ntlm')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -k yes -U$USERNAME%$PASSWORD', 'krb5')
+    elif t == "smb2.read":
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+        plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
+        plansmbtorture4testsuite(t, "nt4_member", '//$SERVER_IP/tmpenc -U$DC_USERNAME%$DC_PASSWORD', 'enc')
+        plansmbtorture4testsuite(t, "nt4_member", '//$SERVER_IP/sendfile --signing=required -U$DC_USERNAME%$DC_PASSWORD', 'signed sendfile')
     elif t == "smb2.session":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD', 'plain')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmpenc -U$USERNAME%$PASSWORD', 'enc')
+        plansmbtorture4testsuite(t, "nt4_member", '//$SERVER_IP/tmpenc -U$DC_USERNAME%$DC_PASSWORD', 'enc')
+        plansmbtorture4testsuite("smb2.session.signing-bad-write", "nt4_member", '//$SERVER_IP/tmp -U$DC_USERNAME%$DC_PASSWORD', 'signed recvfile')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -k no -U$USERNAME%$PASSWORD', 'ntlm')
         plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -k yes -U$USERNAME%$PASSWORD', 'krb5')
         # Certain tests fail when run against ad_member with MIT kerberos because the private krb5.conf overrides the provisioned lib/krb5.conf,
@@ -673,6 +695,11 @@ for t in tests:
             plansmbtorture4testsuite(t, "fileserver", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
     elif t == "vfs.acl_xattr":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+    elif t == "smb2.dir":
+        plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
+        plansmbtorture4testsuite(t, "ad_dc", '//$SERVER/tmp -U$USERNAME%$PASSWORD')
+        plansmbtorture4testsuite(t, "fileserver", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD', 'listing cache')
+        plansmbtorture4testsuite(t, "nt4_member", '//$SERVER_IP/tmp -U$DC_USERNAME%$DC_PASSWORD', 'listing cache and search batches without kernel change notify')
     elif t == "smb2.compound_find":
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER/compound_find -U$USERNAME%$PASSWORD')
         plansmbtorture4testsuite(t, "nt4_dc", '//$SERVER_IP/tmp -U$USERNAME%$PASSWORD')
@@ -0,0 +1,862 @@
+/*
+   Unix SMB/CIFS implementation.
+   Case-insensitive name index for directories
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * get_real_filename_full_scan() reads the whole directory for every
+ * name that is not found by stat(2), which makes creating files in
+ * large directories O(n). With "case insensitive index size" > 0 we
+ * keep a hash of the upper-cased names of the directories we had to
+ * scan, so positive and negative lookups are answered without reading
+ * the directory again.
+ *
+ * An index is registered with notifyd, changes made by other smbd
+ * processes are applied to it when the notify message arrives. Our
+ * own changes are applied directly from notify_fname(). Changes
+ * behind our back that don't generate notifies are caught by
+ * comparing the directory's mtime and ctime with the values seen
+ * when the index was built.
+ *
+ * After a change we applied the timestamps differ as well. If we
+ * made the change ourselves in the same request that checked the
+ * timestamps, the directory's new timestamps are taken right away.
+ * Otherwise we can't tell whether somebody else changed the directory
+ * too, so the next lookup reads the directory again and compares it
+ * with the index before trusting the new timestamps.
+ */
+
+#include "includes.h"
+#include "smbd/smbd.h"
+#include "smbd/globals.h"
+#include "librpc/gen_ndr/notify.h"
+#include <tdb.h>
+
+#define CASE_INDEX_NOTIFY_FILTER \
+	(FILE_NOTIFY_CHANGE_FILE_NAME|FILE_NOTIFY_CHANGE_DIR_NAME)
+
+#define CASE_INDEX_MIN_BUCKETS 64
+
+struct case_index_entry {
+	struct case_index_entry *next;
+	unsigned int hash;
+	char *name;
+	char *upper;
+};
+
+struct case_index {
+	struct case_index *prev, *next;
+	struct smbd_server_connection *sconn;
+	connection_struct *conn;
+
+	/* As passed to get_real_filename(), relative to the share */
+	char *path;
+	/* For notifyd */
+	char *fullpath;
+
+	struct file_id id;
+	struct timespec mtime;
+	struct timespec ctime;
+
+	/*
+	 * We applied a change to the index that mtime and ctime
+	 * don't reflect yet.
+	 */
+	bool changed;
+
+	/* sconn->num_requests when mtime and ctime last matched */
+	uint64_t checked_request;
+
+	struct case_index_entry **buckets;
+	size_t num_buckets;
+	size_t num_entries;
+};
+
+static unsigned int case_index_hash(const char *upper)
+{
+	TDB_DATA key = { .dptr = discard_const_p(uint8_t, upper) };
+	return fast_string_hash(&key);
+}
+
+static struct case_index_entry *case_index_find(struct case_index *idx,
+						const char *upper,
+						unsigned int hash)
+{
+	struct case_index_entry *e = NULL;
+
+	for (e = idx->buckets[hash % idx->num_buckets];
+	     e != NULL;
+	     e = e->next) {
+		if ((e->hash == hash) && (strcmp(e->upper, upper) == 0)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static struct case_index_entry *case_index_find_name(struct case_index *idx,
+						     const char *name,
+						     const char *upper)
+{
+	unsigned int hash = case_index_hash(upper);
+	struct case_index_entry *e = NULL;
+
+	for (e = idx->buckets[hash % idx->num_buckets];
+	     e != NULL;
+	     e = e->next) {
+		if ((e->hash == hash) && (strcmp(e->name, name) == 0)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static bool case_index_grow(struct case_index *idx)
+{
+	struct case_index_entry **buckets = NULL;
+	size_t i, num_buckets;
+
+	num_buckets = MAX(idx->num_buckets * 2, CASE_INDEX_MIN_BUCKETS);
+
+	buckets = talloc_zero_array(idx, struct case_index_entry *,
+				    num_buckets);
+	if (buckets == NULL) {
+		return false;
+	}
+
+	for (i=0; i<idx->num_buckets; i++) {
+		struct case_index_entry *e = NULL, *next = NULL;
+
+		for (e = idx->buckets[i]; e != NULL; e = next) {
+			struct case_index_entry **pe = NULL;
+
+			next = e->next;
+
+			/*
+			 * Keep the order within the chain, the
+			 * first name found must stay the first
+			 */
+			pe = &buckets[e->hash % num_buckets];
+			while (*pe != NULL) {
+				pe = &(*pe)->next;
+			}
+			e->next = NULL;
+			*pe = e;
+		}
+	}
+
+	TALLOC_FREE(idx->buckets);
+	idx->buckets = buckets;
+	idx->num_buckets = num_buckets;
+	return true;
+}
+
+/*
+ * Add name to the index. Names that differ only in case can exist
+ * on case sensitive file systems, the full scan returns the first
+ * one it finds, so new names are appended to their chain.
+ */
+static bool case_index_insert(struct case_index *idx,
+			      const char *name,
+			      const char *upper)
+{
+	struct case_index_entry *e = NULL, **pe = NULL;
+	unsigned int hash;
+
+	if (idx->num_entries >= idx->num_buckets * 2) {
+		if (!case_index_grow(idx)) {
+			return false;
+		}
+	}
+
+	hash = case_index_hash(upper);
+
+	for (pe = &idx->buckets[hash % idx->num_buckets];
+	     *pe != NULL;
+	     pe = &(*pe)->next) {
+		e = *pe;
+		if ((e->hash == hash) && (strcmp(e->name, name) == 0)) {
+			return true;
+		}
+	}
+
+	e = talloc(idx, struct case_index_entry);
+	if (e == NULL) {
+		return false;
+	}
+	*e = (struct case_index_entry) { .hash = hash };
+
+	e->name = talloc_strdup(e, name);
+	e->upper = talloc_strdup(e, upper);
+	if ((e->name == NULL) || (e->upper == NULL)) {
+		TALLOC_FREE(e);
+		return false;
+	}
+
+	*pe = e;
+	idx->num_entries += 1;
+	idx->sconn->num_case_index_entries += 1;
+	return true;
+}
+
+static void case_index_remove(struct case_index *idx,
+			      const char *name,
+			      const char *upper)
+{
+	unsigned int hash = case_index_hash(upper);
+	struct case_index_entry **pe = NULL;
+
+	for (pe = &idx->buckets[hash % idx->num_buckets];
+	     *pe != NULL;
+	     pe = &(*pe)->next) {
+		struct case_index_entry *e = *pe;
+
+		if ((e->hash == hash) && (strcmp(e->name, name) == 0)) {
+			*pe = e->next;
+			TALLOC_FREE(e);
+			idx->num_entries -= 1;
+			idx->sconn->num_case_index_entries -= 1;
+			return;
+		}
+	}
+}
+
+static void case_index_drop(struct case_index *idx)
+{
+	struct smbd_server_connection *sconn = idx->sconn;
+
+	DBG_DEBUG("dropping index of %s\n", idx->fullpath);
+
+	DLIST_REMOVE(sconn->case_indexes, idx);
+	sconn->num_case_index_entries -= idx->num_entries;
+
+	(void)notify_remove(sconn->notify_ctx, idx, idx->fullpath);
+	TALLOC_FREE(idx);
+}
+
+/*
+ * Apply a change we know about to the index. Returns false if the
+ * index could not be updated and was dropped.
+ */
+static bool case_index_apply(struct case_index *idx,
+			     uint32_t action,
+			     const char *name)
+{
+	char *upper = NULL;
+	bool ok = true;
+
+	switch (action) {
+	case NOTIFY_ACTION_ADDED:
+	case NOTIFY_ACTION_REMOVED:
+	case NOTIFY_ACTION_OLD_NAME:
+	case NOTIFY_ACTION_NEW_NAME:
+		break;
+	default:
+		return true;
+	}
+
+	upper = talloc_strdup_upper(talloc_tos(), name);
+	if (upper == NULL) {
+		case_index_drop(idx);
+		return false;
+	}
+
+	if ((action == NOTIFY_ACTION_ADDED) ||
+	    (action == NOTIFY_ACTION_NEW_NAME)) {
+		ok = case_index_insert(idx, name, upper);
+	} else {
+		case_index_remove(idx, name, upper);
+	}
+	TALLOC_FREE(upper);
+
+	if (!ok) {
+		case_index_drop(idx);
+		return false;
+	}
+
+	idx->changed = true;
+	return true;
+}
+
+static struct case_index *case_index_create(connection_struct *conn,
+					    const char *path,
+					    const SMB_STRUCT_STAT *st)
+{
+	struct smbd_server_connection *sconn = conn->sconn;
+	struct case_index *idx = NULL;
+	NTSTATUS status;
+
+	idx = talloc_zero(sconn, struct case_index);
+	if (idx == NULL) {
+		return NULL;
+	}
+	idx->sconn = sconn;
+	idx->conn = conn;
+	idx->id = vfs_file_id_from_sbuf(conn, st);
+	idx->mtime = st->st_ex_mtime;
+	idx->ctime = st->st_ex_ctime;
+
+	idx->path = talloc_strdup(idx, path);
+	if (ISDOT(path)) {
+		idx->fullpath = talloc_strdup(idx, conn->connectpath);
+	} else {
+		idx->fullpath = talloc_asprintf(idx, "%s/%s",
+						conn->connectpath, path);
+	}
+	if ((idx->path == NULL) || (idx->fullpath == NULL)) {
+		TALLOC_FREE(idx);
+		return NULL;
+	}
+
+	if (!case_index_grow(idx)) {
+		TALLOC_FREE(idx);
+		return NULL;
+	}
+
+	/*
+	 * Register before we read the directory, so we
+	 * see changes that happen while we build it.
+	 */
+	status = notify_add(sconn->notify_ctx, idx->fullpath,
+			    CASE_INDEX_NOTIFY_FILTER, 0, idx);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("notify_add failed: %s\n", nt_errstr(status));
+		TALLOC_FREE(idx);
+		return NULL;
+	}
+
+	DLIST_ADD(sconn->case_indexes, idx);
+	return idx;
+}
+
+/*
+ * Read the whole directory into a new index. As this is the full
+ * scan, we look for the name on the way. Returns the index if it
+ * could be kept.
+ */
+static struct case_index *case_index_build(connection_struct *conn,
+					   const char *path,
+					   const SMB_STRUCT_STAT *st,
+					   const char *upper,
+					   TALLOC_CTX *mem_ctx,
+					   char **found_name,
+					   int *pret)
+{
+	struct smbd_server_connection *sconn = conn->sconn;
+	size_t max_entries = lp_case_insensitive_index_size();
+	struct case_index *idx = NULL;
+	struct smb_filename *smb_fname = NULL;
+	struct smb_Dir *cur_dir = NULL;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	long curpos = 0;
+	SMB_STRUCT_STAT st2;
+	int ret;
+
+	*pret = -1;
+	*found_name = NULL;
+
+	smb_fname = synthetic_smb_fname(talloc_tos(), path, NULL, NULL, 0);
+	if (smb_fname == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	idx = case_index_create(conn, path, st);
+
+	cur_dir = OpenDir(talloc_tos(), conn, smb_fname, NULL, 0);
+	if (cur_dir == NULL) {
+		DBG_NOTICE("scan dir didn't open dir [%s]\n", path);
+		TALLOC_FREE(smb_fname);
+		goto fail;
+	}
+
+	while ((dname = ReadDirName(cur_dir, &curpos, NULL, &talloced))) {
+		char *dupper = NULL;
+
+		if (ISDOT(dname) || ISDOTDOT(dname)) {
+			TALLOC_FREE(talloced);
+			continue;
+		}
+
+		dupper = talloc_strdup_upper(talloc_tos(), dname);
+		if (dupper == NULL) {
+			TALLOC_FREE(talloced);
+			TALLOC_FREE(cur_dir);
+			TALLOC_FREE(smb_fname);
+			errno = ENOMEM;
+			goto fail;
+		}
+
+		if ((*found_name == NULL) && (strcmp(dupper, upper) == 0)) {
+			*found_name = talloc_strdup(mem_ctx, dname);
+			if (*found_name == NULL) {
+				TALLOC_FREE(dupper);
+				TALLOC_FREE(talloced);
+				TALLOC_FREE(cur_dir);
+				TALLOC_FREE(smb_fname);
+				errno = ENOMEM;
+				goto fail;
+			}
+		}
+
+		if ((idx != NULL) &&
+		    ((idx->num_entries >= max_entries) ||
+		     !case_index_insert(idx, dname, dupper))) {
+			/*
+			 * Continue as a plain full scan
+			 */
+			case_index_drop(idx);
+			idx = NULL;
+		}
+
+		TALLOC_FREE(dupper);
+		TALLOC_FREE(talloced);
+	}
+
+	TALLOC_FREE(cur_dir);
+
+	if (*found_name != NULL) {
+		*pret = 0;
+	} else {
+		errno = ENOENT;
+	}
+
+	if (idx == NULL) {
+		TALLOC_FREE(smb_fname);
+		return NULL;
+	}
+
+	/*
+	 * Only keep the index if nothing changed while we read.
+	 */
+	ret = SMB_VFS_STAT(conn, smb_fname);
+	st2 = smb_fname->st;
+	TALLOC_FREE(smb_fname);
+
+	if ((ret == -1) ||
+	    (timespec_compare(&idx->mtime, &st2.st_ex_mtime) != 0) ||
+	    (timespec_compare(&idx->ctime, &st2.st_ex_ctime) != 0)) {
+		case_index_drop(idx);
+		if (*pret == -1) {
+			errno = ENOENT;
+		}
+		return NULL;
+	}
+
+	idx->checked_request = sconn->num_requests;
+
+	DBG_DEBUG("built index of %s with %zu entries\n",
+		  idx->fullpath, idx->num_entries);
+
+	/*
+	 * Make room, least recently used last
+	 */
+	while (sconn->num_case_index_entries > max_entries) {
+		struct case_index *tail = DLIST_TAIL(sconn->case_indexes);
+
+		if (tail == idx) {
+			break;
+		}
+		case_index_drop(tail);
+	}
+
+	if (*pret == -1) {
+		errno = ENOENT;
+	}
+	return idx;
+
+fail:
+	if (idx != NULL) {
+		int saved_errno = errno;
+		case_index_drop(idx);
+		errno = saved_errno;
+	}
+	TALLOC_FREE(*found_name);
+	return NULL;
+}
+
+/*
+ * Read the directory again and check that the index has exactly its
+ * names, st is the directory's stat from before reading it.
+ */
+static bool case_index_recheck(struct case_index *idx,
+			       const SMB_STRUCT_STAT *st)
+{
+	struct smb_filename *smb_fname = NULL;
+	struct smb_Dir *cur_dir = NULL;
+	const char *dname = NULL;
+	char *talloced = NULL;
+	long curpos = 0;
+	size_t num_entries = 0;
+	bool ok = true;
+	int ret;
+
+	smb_fname = synthetic_smb_fname(talloc_tos(), idx->path,
+					NULL, NULL, 0);
+	if (smb_fname == NULL) {
+		return false;
+	}
+
+	cur_dir = OpenDir(talloc_tos(), idx->conn, smb_fname, NULL, 0);
+	if (cur_dir == NULL) {
+		TALLOC_FREE(smb_fname);
+		return false;
+	}
+
+	while (ok &&
+	       (dname = ReadDirName(cur_dir, &curpos, NULL, &talloced))) {
+		char *dupper = NULL;
+
+		if (ISDOT(dname) || ISDOTDOT(dname)) {
+			TALLOC_FREE(talloced);
+			continue;
+		}
+
+		dupper = talloc_strdup_upper(talloc_tos(), dname);
+		if ((dupper == NULL) ||
+		    (case_index_find_name(idx, dname, dupper) == NULL)) {
+			ok = false;
+		}
+		num_entries += 1;
+
+		TALLOC_FREE(dupper);
+		TALLOC_FREE(talloced);
+	}
+
+	TALLOC_FREE(cur_dir);
+
+	if (!ok || (num_entries != idx->num_entries)) {
+		TALLOC_FREE(smb_fname);
+		return false;
+	}
+
+	/*
+	 * Nothing may have changed while we read
+	 */
+	ret = SMB_VFS_STAT(idx->conn, smb_fname);
+	if ((ret == -1) ||
+	    (timespec_compare(&st->st_ex_mtime,
+			      &smb_fname->st.st_ex_mtime) != 0) ||
+	    (timespec_compare(&st->st_ex_ctime,
+			      &smb_fname->st.st_ex_ctime) != 0)) {
+		ok = false;
+	}
+	TALLOC_FREE(smb_fname);
+	return ok;
+}
+
+/****************************************************************************
+ Look up name in path without case sensitivity using the directory's index,
+ building it if needed. Returns -1 with errno EOPNOTSUPP if no index can be
+ used, the caller has to fall back to get_real_filename_full_scan() then.
+****************************************************************************/
+
+int case_index_lookup(connection_struct *conn,
+		      const char *path,
+		      const char *name,
+		      TALLOC_CTX *mem_ctx,
+		      char **found_name)
+{
+	struct smbd_server_connection *sconn = conn->sconn;
+	struct case_index *idx = NULL;
+	struct case_index_entry *e = NULL;
+	struct smb_filename *smb_fname = NULL;
+	SMB_STRUCT_STAT st;
+	struct file_id id;
+	char *upper = NULL;
+	int ret;
+
+	if ((lp_case_insensitive_index_size() <= 0) ||
+	    (sconn == NULL) ||
+	    (sconn->notify_ctx == NULL) ||
+	    conn->case_sensitive ||
+	    !(conn->fs_capabilities & FILE_CASE_SENSITIVE_SEARCH)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	/* handle null paths */
+	if ((path == NULL) || (*path == 0)) {
+		path = ".";
+	}
+
+	smb_fname = synthetic_smb_fname(talloc_tos(), path, NULL, NULL, 0);
+	if (smb_fname == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	ret = SMB_VFS_STAT(conn, smb_fname);
+	st = smb_fname->st;
+	TALLOC_FREE(smb_fname);
+	if (ret == -1) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	id = vfs_file_id_from_sbuf(conn, &st);
+
+	for (idx = sconn->case_indexes; idx != NULL; idx = idx->next) {
+		if ((idx->conn == conn) && (strcmp(idx->path, path) == 0)) {
+			break;
+		}
+	}
+
+	if ((idx != NULL) && !file_id_equal(&idx->id, &id)) {
+		case_index_drop(idx);
+		idx = NULL;
+	}
+
+	if ((idx != NULL) &&
+	    ((timespec_compare(&idx->mtime, &st.st_ex_mtime) != 0) ||
+	     (timespec_compare(&idx->ctime, &st.st_ex_ctime) != 0))) {
+		/*
+		 * Even if we applied changes, someone else might have
+		 * changed the directory as well.
+		 */
+		if (idx->changed && case_index_recheck(idx, &st)) {
+			DBG_DEBUG("index of %s still matches\n",
+				  idx->fullpath);
+		} else {
+			case_index_drop(idx);
+			idx = NULL;
+		}
+	}
+
+	if (idx != NULL) {
+		idx->mtime = st.st_ex_mtime;
+		idx->ctime = st.st_ex_ctime;
+		idx->changed = false;
+		idx->checked_request = sconn->num_requests;
+	}
+
+	upper = talloc_strdup_upper(talloc_tos(), name);
+	if (upper == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (idx == NULL) {
+		idx = case_index_build(conn, path, &st, upper,
+				       mem_ctx, found_name, &ret);
+		TALLOC_FREE(upper);
+		return ret;
+	}
+
+	DLIST_PROMOTE(sconn->case_indexes, idx);
+
+	e = case_index_find(idx, upper, case_index_hash(upper));
+	TALLOC_FREE(upper);
+
+	if (e == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	*found_name = talloc_strdup(mem_ctx, e->name);
+	if (*found_name == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called from the notify callback, private_data might be an index.
+ */
+bool case_index_notify(struct smbd_server_connection *sconn,
+		       void *private_data,
+		       const struct notify_event *e)
+{
+	struct case_index *idx = NULL;
+	struct smb_filename *smb_fname = NULL;
+	char *fullname = NULL;
+	uint32_t action;
+	int ret;
+
+	for (idx = sconn->case_indexes; idx != NULL; idx = idx->next) {
+		if (idx == private_data) {
+			break;
+		}
+	}
+	if (idx == NULL) {
+		return false;
+	}
+
+	if ((e->path == NULL) || (strchr(e->path, '/') != NULL)) {
+		case_index_drop(idx);
+		return true;
+	}
+
+	switch (e->action) {
+	case NOTIFY_ACTION_ADDED:
+	case NOTIFY_ACTION_REMOVED:
+	case NOTIFY_ACTION_OLD_NAME:
+	case NOTIFY_ACTION_NEW_NAME:
+		break;
+	default:
+		return true;
+	}
+
+	/*
+	 * The message might be an echo of our own change or
+	 * overtaken by later changes, look at what's there now.
+	 */
+	fullname = talloc_asprintf(talloc_tos(), "%s/%s",
+				   idx->fullpath, e->path);
+	if (fullname == NULL) {
+		case_index_drop(idx);
+		return true;
+	}
+	smb_fname = synthetic_smb_fname(talloc_tos(), fullname,
+					NULL, NULL, 0);
+	TALLOC_FREE(fullname);
+	if (smb_fname == NULL) {
+		case_index_drop(idx);
+		return true;
+	}
+
+	ret = SMB_VFS_LSTAT(idx->conn, smb_fname);
+	if (ret == 0) {
+		action = NOTIFY_ACTION_ADDED;
+	} else if (errno == ENOENT) {
+		action = NOTIFY_ACTION_REMOVED;
+	} else {
+		TALLOC_FREE(smb_fname);
+		case_index_drop(idx);
+		return true;
+	}
+	TALLOC_FREE(smb_fname);
+
+	(void)case_index_apply(idx, action, e->path);
+	return true;
+}
+
+/*
+ * Apply our own change. If the index was checked against the
+ * directory in this request, nobody else had a chance to change it
+ * unnoticed, so the new timestamps are the reference again. This
+ * leaves the window between our own stat and our change, the full
+ * scan has the same between reading the directory and the create.
+ */
+static void case_index_update_own(struct case_index *idx,
+				  uint32_t action,
+				  const char *name)
+{
+	struct smbd_server_connection *sconn = idx->sconn;
+	struct smb_filename *smb_fname = NULL;
+	bool checked;
+	int ret;
+
+	checked = (!idx->changed &&
+		   (idx->checked_request == sconn->num_requests));
+
+	if (!case_index_apply(idx, action, name)) {
+		return;
+	}
+	if (!checked) {
+		return;
+	}
+
+	smb_fname = synthetic_smb_fname(talloc_tos(), idx->fullpath,
+					NULL, NULL, 0);
+	if (smb_fname == NULL) {
+		return;
+	}
+	ret = SMB_VFS_STAT(idx->conn, smb_fname);
+	if (ret == 0) {
+		idx->mtime = smb_fname->st.st_ex_mtime;
+		idx->ctime = smb_fname->st.st_ex_ctime;
+		idx->changed = false;
+	}
+	TALLOC_FREE(smb_fname);
+}
+
+/*
+ * We changed path ourselves, update the index of its directory.
+ */
+void case_index_update(connection_struct *conn,
+		       uint32_t action,
+		       const char *path)
+{
+	struct smbd_server_connection *sconn = conn->sconn;
+	struct case_index *idx = NULL, *next = NULL;
+	size_t connectpath_len;
+	const char *name = path;
+	size_t parent_len = 0;
+	const char *p = NULL;
+
+	if ((sconn == NULL) || (sconn->case_indexes == NULL)) {
+		return;
+	}
+
+	connectpath_len = strlen(conn->connectpath);
+
+	p = strrchr(path, '/');
+	if (p != NULL) {
+		parent_len = PTR_DIFF(p, path);
+		name = p + 1;
+	}
+
+	for (idx = sconn->case_indexes; idx != NULL; idx = next) {
+		const char *dir = idx->fullpath;
+
+		next = idx->next;
+
+		if (strncmp(dir, conn->connectpath, connectpath_len) != 0) {
+			continue;
+		}
+		dir += connectpath_len;
+
+		if (parent_len == 0) {
+			if (dir[0] != '\0') {
+				continue;
+			}
+		} else if ((dir[0] != '/') ||
+			   (strncmp(dir + 1, path, parent_len) != 0) ||
+			   (dir[parent_len + 1] != '\0')) {
+			continue;
+		}
+
+		case_index_update_own(idx, action, name);
+	}
+}
+
+void case_index_closecnum(connection_struct *conn)
+{
+	struct smbd_server_connection *sconn = conn->sconn;
+	struct case_index *idx = NULL, *next = NULL;
+
+	if (sconn == NULL) {
+		return;
+	}
+
+	for (idx = sconn->case_indexes; idx != NULL; idx = next) {
+		next = idx->next;
+		if (idx->conn == conn) {
+			case_index_drop(idx);
+		}
+	}
+}
+
+/*
+ * The notify context goes away, we can't watch our indexes anymore.
+ */
+void case_index_drop_all(struct smbd_server_connection *sconn)
+{
+	while (sconn->case_indexes != NULL) {
+		case_index_drop(sconn->case_indexes);
+	}
+}
@@ -807,6 +807,16 @@ static NTSTATUS close_normal_file(struct smb_request *req, files_struct *fsp,
 
 	status = ntstatus_keeperror(status, tmp);
 
+	if (fsp->modified) {
+		/*
+		 * A sticky write time means no notify above,
+		 * don't let our cached listings keep the old size.
+		 */
+		dir_listing_invalidate_path(conn,
+					    NOTIFY_ACTION_MODIFIED,
+					    fsp->fsp_name->base_name);
+	}
+
 	DEBUG(2,("%s closed file %s (numopen=%d) %s\n",
 		conn->session_info->unix_info->unix_name, fsp_str_dbg(fsp),
 		conn->num_files_open - 1,
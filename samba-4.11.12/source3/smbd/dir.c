@@ -26,6 +26,7 @@
 #include "lib/util/bitmap.h"
 #include "../lib/util/memcache.h"
 #include "../librpc/gen_ndr/open_files.h"
+#include "librpc/gen_ndr/notify.h"
 
 /*
    This module implements directory related functions for Samba.
@@ -59,8 +60,68 @@ struct smb_Dir {
 	unsigned int file_number;
 	files_struct *fsp; /* Back pointer to containing fsp, only
 			      set from OpenDir_fsp(). */
+	/*
+	 * The cached listing we are filling or, if
+	 * listing_replay is set, returning entries from.
+	 */
+	struct dir_listing *listing;
+	bool listing_replay;
+	size_t listing_pos;
+	long listing_fill_offset;
+	size_t listing_last;
+};
+
+/*
+ * Cached SMB2 directory listings, see "directory listing cache size".
+ *
+ * A listing is filled while a handle reads the directory from the
+ * start to the end. It is dropped when a name in the directory is
+ * created, removed or renamed, as reported by notify, or when the
+ * mtime or ctime of the directory has changed.
+ *
+ * The stat information and DOS attributes of an entry are cached as
+ * well. They are dropped per entry when notify reports a modification
+ * of the file. Writes don't trigger a notify before the write time is
+ * updated, so the cached data is not used while the file has a share
+ * mode record, i.e. while it is open anywhere.
+ */
+
+struct dir_listing_entry {
+	char *name;
+	SMB_STRUCT_STAT st;
+	struct file_id id;
+	uint32_t mode;
+	bool have_stat;
+	bool have_mode;
+};
+
+struct dir_listing {
+	struct dir_listing *prev, *next;
+	struct smbd_server_connection *sconn;
+	connection_struct *conn;
+	struct file_id id;
+	struct timespec mtime;
+	struct timespec ctime;
+	char *fullpath;
+	struct dir_listing_entry *entries;
+	size_t num_entries;
+	/* Number of smb_Dir handles using us */
+	unsigned int num_users;
+	/* In sconn->searches.listings and registered with notifyd */
+	bool linked;
+	/* Read to the end, can be used by other handles */
+	bool complete;
 };
 
+#define DIR_LISTING_NOTIFY_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | \
+				   FILE_NOTIFY_CHANGE_DIR_NAME | \
+				   FILE_NOTIFY_CHANGE_ATTRIBUTES | \
+				   FILE_NOTIFY_CHANGE_SIZE | \
+				   FILE_NOTIFY_CHANGE_LAST_WRITE | \
+				   FILE_NOTIFY_CHANGE_CREATION | \
+				   FILE_NOTIFY_CHANGE_EA | \
+				   FILE_NOTIFY_CHANGE_SECURITY)
+
 struct dptr_struct {
 	struct dptr_struct *next, *prev;
 	int dnum;
@@ -85,6 +146,11 @@ static struct smb_Dir *OpenDir_fsp(TALLOC_CTX *mem_ctx, connection_struct *conn,
 
 static void DirCacheAdd(struct smb_Dir *dirp, const char *name, long offset);
 
+static void dir_listing_drop(struct dir_listing *l);
+static void dir_listing_release(struct smb_Dir *dirp);
+static struct dir_listing_entry *dir_listing_last(struct smb_Dir *dirp,
+						  const char *name);
+
 #define INVALID_DPTR_KEY (-3)
 
 /****************************************************************************
@@ -306,6 +372,7 @@ void dptr_closecnum(connection_struct *conn)
 {
 	struct dptr_struct *dptr, *next;
 	struct smbd_server_connection *sconn = conn->sconn;
+	struct dir_listing *l = NULL, *lnext = NULL;
 
 	if (sconn == NULL) {
 		return;
@@ -317,6 +384,13 @@ void dptr_closecnum(connection_struct *conn)
 			dptr_close_internal(dptr);
 		}
 	}
+
+	for (l = sconn->searches.listings; l != NULL; l = lnext) {
+		lnext = l->next;
+		if (l->conn == conn) {
+			dir_listing_drop(l);
+		}
+	}
 }
 
 /****************************************************************************
@@ -1125,6 +1199,7 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 		char *fname = NULL;
 		char *pathreal = NULL;
 		struct smb_filename smb_fname;
+		struct dir_listing_entry *cached = NULL;
 		uint32_t mode = 0;
 		bool ok;
 
@@ -1191,7 +1266,25 @@ bool smbd_dirptr_get_entry(TALLOC_CTX *ctx,
 			.base_name = pathreal, .st = sbuf
 		};
 
-		ok = mode_fn(ctx, private_data, &smb_fname, get_dosmode, &mode);
+		cached = dir_listing_last(dirptr->dir_hnd, dname);
+
+		if ((cached != NULL) && cached->have_mode && get_dosmode &&
+		    VALID_STAT(smb_fname.st)) {
+			mode = cached->mode;
+			ok = true;
+		} else {
+			ok = mode_fn(ctx, private_data, &smb_fname,
+				     get_dosmode, &mode);
+			if (ok && (cached != NULL) &&
+			    VALID_STAT(smb_fname.st)) {
+				cached->st = smb_fname.st;
+				cached->id = vfs_file_id_from_sbuf(
+					conn, &smb_fname.st);
+				cached->mode = mode;
+				cached->have_stat = true;
+				cached->have_mode = get_dosmode;
+			}
+		}
 		if (!ok) {
 			TALLOC_FREE(dname);
 			TALLOC_FREE(fname);
@@ -1630,6 +1723,8 @@ bool is_visible_file(connection_struct *conn, const char *dir_path,
 
 static int smb_Dir_destructor(struct smb_Dir *dirp)
 {
+	dir_listing_release(dirp);
+
 	if (dirp->dir != NULL) {
 		SMB_VFS_CLOSEDIR(dirp->conn,dirp->dir);
 		if (dirp->fsp != NULL) {
@@ -1783,6 +1878,434 @@ struct smb_Dir *OpenDir(TALLOC_CTX *mem_ctx, connection_struct *conn,
 				attr);
 }
 
+/*******************************************************************
+ Directory listing cache.
+********************************************************************/
+
+static void dir_listing_drop(struct dir_listing *l)
+{
+	struct smbd_server_connection *sconn = l->sconn;
+
+	if (!l->linked) {
+		return;
+	}
+
+	DBG_DEBUG("dropping listing of %s\n", l->fullpath);
+
+	DLIST_REMOVE(sconn->searches.listings, l);
+	if (l->complete) {
+		sconn->searches.num_listing_entries -= l->num_entries;
+	}
+	l->linked = false;
+
+	(void)notify_remove(sconn->notify_ctx, l, l->fullpath);
+
+	if (l->num_users == 0) {
+		TALLOC_FREE(l);
+	}
+}
+
+static void dir_listing_release(struct smb_Dir *dirp)
+{
+	struct dir_listing *l = dirp->listing;
+
+	if (l == NULL) {
+		return;
+	}
+
+	dirp->listing = NULL;
+	dirp->listing_replay = false;
+
+	SMB_ASSERT(l->num_users > 0);
+	l->num_users -= 1;
+
+	if (!l->complete && l->linked) {
+		/*
+		 * Nobody else can use a partial listing,
+		 * dir_listing_drop() frees it.
+		 */
+		dir_listing_drop(l);
+		return;
+	}
+
+	if (!l->linked && l->num_users == 0) {
+		TALLOC_FREE(l);
+	}
+}
+
+static bool dir_listing_current(const struct dir_listing *l,
+				const SMB_STRUCT_STAT *st)
+{
+	if (timespec_compare(&l->mtime, &st->st_ex_mtime) != 0) {
+		return false;
+	}
+	if (timespec_compare(&l->ctime, &st->st_ex_ctime) != 0) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Called when an SMB2 directory handle is opened: Either start to
+ * return entries from a cached listing or start to fill a new one.
+ */
+static void dir_listing_open(struct smb_Dir *dirp)
+{
+	connection_struct *conn = dirp->conn;
+	struct smbd_server_connection *sconn = conn->sconn;
+	int max_entries = lp_directory_listing_cache_size();
+	struct dir_listing *l = NULL, *next = NULL;
+	SMB_STRUCT_STAT st;
+	struct file_id id;
+	size_t len;
+	NTSTATUS status;
+	int ret;
+
+	if ((max_entries <= 0) ||
+	    (sconn == NULL) ||
+	    !sconn->using_smb2 ||
+	    (sconn->notify_ctx == NULL) ||
+	    (dirp->fsp == NULL)) {
+		return;
+	}
+
+	ret = SMB_VFS_FSTAT(dirp->fsp, &st);
+	if (ret == -1) {
+		return;
+	}
+	id = vfs_file_id_from_sbuf(conn, &st);
+
+	for (l = sconn->searches.listings; l != NULL; l = next) {
+		next = l->next;
+
+		if ((l->conn != conn) ||
+		    !l->complete ||
+		    !file_id_equal(&l->id, &id)) {
+			continue;
+		}
+
+		if (!dir_listing_current(l, &st)) {
+			dir_listing_drop(l);
+			break;
+		}
+
+		DBG_DEBUG("using cached listing of %s with %zu entries\n",
+			  l->fullpath, l->num_entries);
+
+		DLIST_PROMOTE(sconn->searches.listings, l);
+		l->num_users += 1;
+		dirp->listing = l;
+		dirp->listing_replay = true;
+		dirp->listing_pos = 0;
+		dirp->listing_last = SIZE_MAX;
+		return;
+	}
+
+	l = talloc_zero(sconn, struct dir_listing);
+	if (l == NULL) {
+		return;
+	}
+	l->sconn = sconn;
+	l->conn = conn;
+	l->id = id;
+	l->mtime = st.st_ex_mtime;
+	l->ctime = st.st_ex_ctime;
+
+	len = fsp_fullbasepath(dirp->fsp, NULL, 0);
+	l->fullpath = talloc_array(l, char, len + 1);
+	if (l->fullpath == NULL) {
+		TALLOC_FREE(l);
+		return;
+	}
+	fsp_fullbasepath(dirp->fsp, l->fullpath, len + 1);
+
+	/*
+	 * Avoid /. at the end of the path name. notify can't deal with it.
+	 */
+	if (len > 1 && l->fullpath[len-1] == '.' && l->fullpath[len-2] == '/') {
+		l->fullpath[len-2] = '\0';
+	}
+
+	/*
+	 * Register before we read anything, changes
+	 * while we fill the listing also drop it.
+	 */
+	status = notify_add(sconn->notify_ctx, l->fullpath,
+			    DIR_LISTING_NOTIFY_FILTER, 0, l);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("notify_add failed: %s\n", nt_errstr(status));
+		TALLOC_FREE(l);
+		return;
+	}
+
+	DLIST_ADD(sconn->searches.listings, l);
+	l->linked = true;
+	l->num_users = 1;
+
+	dirp->listing = l;
+	dirp->listing_replay = false;
+	dirp->listing_fill_offset = DOT_DOT_DIRECTORY_OFFSET;
+	dirp->listing_last = SIZE_MAX;
+}
+
+/*
+ * Record an entry read from the directory, prev_offset is the
+ * position it was read from.
+ */
+static void dir_listing_add(struct smb_Dir *dirp,
+			    long prev_offset,
+			    const char *name)
+{
+	struct dir_listing *l = dirp->listing;
+	size_t max_entries = lp_directory_listing_cache_size();
+	struct dir_listing_entry *e = NULL;
+	size_t num_alloced;
+
+	dirp->listing_last = SIZE_MAX;
+
+	if ((l == NULL) || dirp->listing_replay || l->complete) {
+		return;
+	}
+
+	if (!l->linked || (l->num_entries >= max_entries)) {
+		dir_listing_release(dirp);
+		return;
+	}
+
+	if (prev_offset != dirp->listing_fill_offset) {
+		/*
+		 * Read again after a seek back, we have this one
+		 */
+		return;
+	}
+
+	num_alloced = talloc_array_length(l->entries);
+	if (l->num_entries == num_alloced) {
+		struct dir_listing_entry *tmp = NULL;
+
+		num_alloced = MIN(MAX(num_alloced * 2, 64), max_entries);
+
+		tmp = talloc_realloc(l, l->entries, struct dir_listing_entry,
+				     num_alloced);
+		if (tmp == NULL) {
+			dir_listing_release(dirp);
+			return;
+		}
+		l->entries = tmp;
+	}
+
+	e = &l->entries[l->num_entries];
+	*e = (struct dir_listing_entry) {
+		.name = talloc_strdup(l, name),
+	};
+	if (e->name == NULL) {
+		dir_listing_release(dirp);
+		return;
+	}
+
+	dirp->listing_last = l->num_entries;
+	l->num_entries += 1;
+	dirp->listing_fill_offset = dirp->offset;
+}
+
+/*
+ * We hit the end of the directory, if we saw all entries
+ * the listing can be used by the next handle.
+ */
+static void dir_listing_complete(struct smb_Dir *dirp, long prev_offset)
+{
+	struct dir_listing *l = dirp->listing;
+	struct smbd_server_connection *sconn = NULL;
+	size_t max_entries = lp_directory_listing_cache_size();
+	SMB_STRUCT_STAT st;
+	int ret;
+
+	if ((l == NULL) || dirp->listing_replay || l->complete) {
+		return;
+	}
+
+	if (prev_offset != dirp->listing_fill_offset) {
+		return;
+	}
+
+	ret = SMB_VFS_FSTAT(dirp->fsp, &st);
+	if ((ret == -1) || !l->linked || !dir_listing_current(l, &st)) {
+		dir_listing_release(dirp);
+		return;
+	}
+
+	DBG_DEBUG("caching listing of %s with %zu entries\n",
+		  l->fullpath, l->num_entries);
+
+	sconn = l->sconn;
+	l->complete = true;
+	sconn->searches.num_listing_entries += l->num_entries;
+
+	while (sconn->searches.num_listing_entries > max_entries) {
+		struct dir_listing *tail = NULL;
+
+		for (tail = DLIST_TAIL(sconn->searches.listings);
+		     tail != NULL;
+		     tail = DLIST_PREV(tail)) {
+			if (tail->complete && (tail != l)) {
+				break;
+			}
+		}
+		if (tail == NULL) {
+			break;
+		}
+		dir_listing_drop(tail);
+	}
+}
+
+/*
+ * The directory entry last returned from ReadDirName()
+ * as part of a listing, if it is still valid.
+ */
+static struct dir_listing_entry *dir_listing_last(struct smb_Dir *dirp,
+						  const char *name)
+{
+	struct dir_listing *l = dirp->listing;
+	struct dir_listing_entry *e = NULL;
+
+	if ((l == NULL) ||
+	    !l->linked ||
+	    (dirp->listing_last >= l->num_entries)) {
+		return NULL;
+	}
+
+	e = &l->entries[dirp->listing_last];
+	if (strcmp(e->name, name) != 0) {
+		return NULL;
+	}
+	return e;
+}
+
+/*
+ * The cached stat information of an entry can be returned if
+ * nobody changed the file since, see the comment at the top.
+ */
+static bool dir_listing_entry_current(const struct dir_listing *l,
+				      const struct dir_listing_entry *e)
+{
+	if (!l->linked || !e->have_stat) {
+		return false;
+	}
+	if (share_mode_exists_unlocked(e->id)) {
+		return false;
+	}
+	return true;
+}
+
+/*
+ * A file in the directory of l was modified: Forget what we know
+ * about it. Anything else, or a name we don't know, drops l.
+ */
+static void dir_listing_changed(struct dir_listing *l,
+				uint32_t action,
+				const char *name)
+{
+	size_t i;
+
+	if ((action != NOTIFY_ACTION_MODIFIED) ||
+	    (name == NULL) ||
+	    (strchr(name, '/') != NULL)) {
+		dir_listing_drop(l);
+		return;
+	}
+
+	for (i = 0; i < l->num_entries; i++) {
+		struct dir_listing_entry *e = &l->entries[i];
+
+		if (strcmp(e->name, name) == 0) {
+			e->have_stat = false;
+			e->have_mode = false;
+			return;
+		}
+	}
+
+	dir_listing_drop(l);
+}
+
+/*
+ * Called from the notify callback, private_data might be a listing.
+ */
+bool dir_listing_notify(struct smbd_server_connection *sconn,
+			void *private_data,
+			const struct notify_event *e)
+{
+	struct dir_listing *l = NULL;
+
+	for (l = sconn->searches.listings; l != NULL; l = l->next) {
+		if (l == private_data) {
+			dir_listing_changed(l, e->action, e->path);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The notify context goes away, we can't watch our listings anymore.
+ */
+void dir_listing_drop_all(struct smbd_server_connection *sconn)
+{
+	while (sconn->searches.listings != NULL) {
+		dir_listing_drop(sconn->searches.listings);
+	}
+}
+
+/*
+ * We changed path ourselves, update the listing of its directory
+ * without waiting for the notify daemon.
+ */
+void dir_listing_invalidate_path(connection_struct *conn,
+				 uint32_t action,
+				 const char *path)
+{
+	struct smbd_server_connection *sconn = conn->sconn;
+	struct dir_listing *l = NULL, *next = NULL;
+	size_t connectpath_len;
+	const char *p = NULL;
+	const char *name = path;
+	size_t parent_len = 0;
+
+	if ((sconn == NULL) || (sconn->searches.listings == NULL)) {
+		return;
+	}
+
+	connectpath_len = strlen(conn->connectpath);
+
+	p = strrchr(path, '/');
+	if (p != NULL) {
+		parent_len = PTR_DIFF(p, path);
+		name = p + 1;
+	}
+
+	for (l = sconn->searches.listings; l != NULL; l = next) {
+		const char *dir = l->fullpath;
+
+		next = l->next;
+
+		if (strncmp(dir, conn->connectpath, connectpath_len) != 0) {
+			continue;
+		}
+		dir += connectpath_len;
+
+		if (parent_len == 0) {
+			if (dir[0] != '\0') {
+				continue;
+			}
+		} else if ((dir[0] != '/') ||
+			   (strncmp(dir + 1, path, parent_len) != 0) ||
+			   (dir[parent_len + 1] != '\0')) {
+			continue;
+		}
+
+		dir_listing_changed(l, action, name);
+	}
+}
+
 /*******************************************************************
  Open a directory from an fsp.
 ********************************************************************/
@@ -1855,6 +2378,8 @@ static struct smb_Dir *OpenDir_fsp(TALLOC_CTX *mem_ctx, connection_struct *conn,
 	}
 	talloc_set_destructor(dirp, smb_Dir_destructor);
 
+	dir_listing_open(dirp);
+
 	return dirp;
 
   fail:
@@ -1875,6 +2400,7 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 	const char *n;
 	char *talloced = NULL;
 	connection_struct *conn = dirp->conn;
+	long prev_offset;
 
 	/* Cheat to allow . and .. to be the first entries returned. */
 	if (((*poffset == START_OF_DIRECTORY_OFFSET) ||
@@ -1900,6 +2426,45 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 	/* A real offset, seek to it. */
 	SeekDir(dirp, *poffset);
 
+	prev_offset = dirp->offset;
+
+	if (dirp->listing_replay) {
+		struct dir_listing *l = dirp->listing;
+		struct dir_listing_entry *e = NULL;
+
+		if (dirp->listing_pos >= l->num_entries) {
+			*poffset = dirp->offset = END_OF_DIRECTORY_OFFSET;
+			*ptalloced = NULL;
+			return NULL;
+		}
+
+		e = &l->entries[dirp->listing_pos];
+
+		/*
+		 * Otherwise the callers stat and we cache
+		 * the result, see smbd_dirptr_get_entry().
+		 */
+		if (sbuf != NULL) {
+			if (dir_listing_entry_current(l, e)) {
+				*sbuf = e->st;
+			} else {
+				SET_STAT_INVALID(*sbuf);
+			}
+		}
+
+		dirp->listing_last = dirp->listing_pos;
+		dirp->listing_pos += 1;
+
+		/*
+		 * The offset is the index of the next entry
+		 * plus one, 0 is START_OF_DIRECTORY_OFFSET.
+		 */
+		*poffset = dirp->offset = dirp->listing_pos + 1;
+		*ptalloced = NULL;
+		dirp->file_number++;
+		return e->name;
+	}
+
 	while ((n = vfs_readdirname(conn, dirp->dir, sbuf, &talloced))) {
 		/* Ignore . and .. - we've already returned them. */
 		if (*n == '.') {
@@ -1911,10 +2476,12 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 		*poffset = dirp->offset = SMB_VFS_TELLDIR(conn, dirp->dir);
 		*ptalloced = talloced;
 		dirp->file_number++;
+		dir_listing_add(dirp, prev_offset, n);
 		return n;
 	}
 	*poffset = dirp->offset = END_OF_DIRECTORY_OFFSET;
 	*ptalloced = NULL;
+	dir_listing_complete(dirp, prev_offset);
 	return NULL;
 }
 
@@ -1924,6 +2491,18 @@ const char *ReadDirName(struct smb_Dir *dirp, long *poffset,
 
 void RewindDir(struct smb_Dir *dirp, long *poffset)
 {
+	if (dirp->listing_replay) {
+		if (dirp->listing->linked) {
+			dirp->listing_pos = 0;
+		} else {
+			/*
+			 * Dropped meanwhile, read the real
+			 * directory from now on.
+			 */
+			dir_listing_release(dirp);
+		}
+	}
+
 	SMB_VFS_REWINDDIR(dirp->conn, dirp->dir);
 	dirp->file_number = 0;
 	dirp->offset = START_OF_DIRECTORY_OFFSET;
@@ -1956,6 +2535,8 @@ void SeekDir(struct smb_Dir *dirp, long offset)
 			dirp->file_number = 2;
 		} else if (offset == END_OF_DIRECTORY_OFFSET) {
 			; /* Don't seek in this case. */
+		} else if (dirp->listing_replay) {
+			dirp->listing_pos = offset - 1;
 		} else {
 			SMB_VFS_SEEKDIR(dirp->conn, dirp->dir, offset);
 		}
@@ -455,6 +455,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 	    (ucf_flags & UCF_ALWAYS_ALLOW_WCARD_LCOMP);
 	bool save_last_component = ucf_flags & UCF_SAVE_LCOMP;
 	bool snapshot_path = (ucf_flags & UCF_GMT_PATHNAME);
+	char *negative_name = NULL;
 	NTSTATUS status;
 	int ret = -1;
 
@@ -634,6 +635,37 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 
 	start = smb_fname->base_name;
 
+	/*
+	 * Names that did not exist a short while ago most likely still
+	 * don't exist. Mangled and wildcard names are translated
+	 * depending on state we don't track here, so leave them alone.
+	 */
+
+	if (!posix_pathnames && !snapshot_path && (stream == NULL) &&
+	    (lp_negative_stat_cache_timeout() > 0) &&
+	    !ms_has_wild(smb_fname->base_name) &&
+	    !mangle_is_mangled(smb_fname->base_name, conn->params)) {
+		char *translated = NULL;
+
+		if (stat_cache_lookup_negative(conn, smb_fname,
+					       smb_fname->base_name,
+					       &translated)) {
+			TALLOC_FREE(smb_fname->base_name);
+			smb_fname->base_name = translated;
+			SET_STAT_INVALID(smb_fname->st);
+			DEBUG(5, ("conversion finished %s -> %s "
+				  "(negative cache)\n",
+				  orig_path, smb_fname->base_name));
+			goto done;
+		}
+
+		negative_name = talloc_strdup(ctx, smb_fname->base_name);
+		if (negative_name == NULL) {
+			status = NT_STATUS_NO_MEMORY;
+			goto err;
+		}
+	}
+
 	/*
 	 * If we're providing case insensitive semantics or
 	 * the underlying filesystem is case insensitive,
@@ -699,8 +731,8 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 				goto fail;
 			}
 			/* Add the path (not including the stream) to the cache. */
-			stat_cache_add(orig_path, smb_fname->base_name,
-				       conn->case_sensitive);
+			stat_cache_add(conn, orig_path,
+				       smb_fname->base_name);
 			DEBUG(5,("conversion of base_name finished %s -> %s\n",
 				 orig_path, smb_fname->base_name));
 			goto done;
@@ -784,6 +816,11 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 				 * Also deal with permission denied elsewhere.
 				 * Just drop out to done.
 				 */
+				if ((ret == 0) && (negative_name != NULL)) {
+					stat_cache_add_negative(
+						conn, negative_name,
+						smb_fname->base_name);
+				}
 				goto done;
 			}
 		}
@@ -984,6 +1021,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 					       talloc_tos(),
 					       &found_name) == -1)) {
 				char *unmangled;
+				bool last_component_enoent;
 
 				if (end) {
 					/*
@@ -1064,6 +1102,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 					}
 					goto fail;
 				}
+				last_component_enoent = (errno == ENOENT);
 
 				/*
 				 * Just the last part of the name doesn't exist.
@@ -1121,6 +1160,12 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 				}
 
 				DEBUG(5,("New file %s\n",start));
+				if (last_component_enoent &&
+				    (negative_name != NULL)) {
+					stat_cache_add_negative(
+						conn, negative_name,
+						smb_fname->base_name);
+				}
 				goto done;
 			}
 
@@ -1225,8 +1270,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 		 * or wildcard components as this can change the size.
 		 */
 		if(!component_was_mangled && !name_has_wildcard) {
-			stat_cache_add(orig_path, dirpath,
-					conn->case_sensitive);
+			stat_cache_add(conn, orig_path, dirpath);
 		}
 
 		/*
@@ -1243,8 +1287,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 	 */
 
 	if(!component_was_mangled && !name_has_wildcard) {
-		stat_cache_add(orig_path, smb_fname->base_name,
-			       conn->case_sensitive);
+		stat_cache_add(conn, orig_path, smb_fname->base_name);
 	}
 
 	/*
@@ -1266,6 +1309,7 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 		}
 	}
 	TALLOC_FREE(dirpath);
+	TALLOC_FREE(negative_name);
 	*smb_fname_out = smb_fname;
 	return NT_STATUS_OK;
  fail:
@@ -1284,8 +1328,10 @@ NTSTATUS unix_convert(TALLOC_CTX *ctx,
 
 	*smb_fname_out = smb_fname;
 	TALLOC_FREE(dirpath);
+	TALLOC_FREE(negative_name);
 	return status;
  err:
+	TALLOC_FREE(negative_name);
 	TALLOC_FREE(smb_fname);
 	return status;
 }
@@ -1602,6 +1648,15 @@ int get_real_filename(connection_struct *conn, const char *path,
 		return ret;
 	}
 
+	/*
+	 * Then the index of the directory, it does the full scan
+	 * itself when it's built.
+	 */
+	ret = case_index_lookup(conn, path, name, mem_ctx, found_name);
+	if (ret == 0 || (ret == -1 && errno != EOPNOTSUPP)) {
+		return ret;
+	}
+
 	return get_real_filename_full_scan(conn, path, name, mangled, mem_ctx,
 					   found_name);
 }
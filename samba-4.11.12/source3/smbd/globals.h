@@ -109,6 +109,7 @@ extern bool exit_firsttime;
 
 struct tstream_context;
 struct smbd_smb2_request;
+struct smbd_smb2_crypto_job;
 
 DATA_BLOB negprot_spnego(TALLOC_CTX *ctx, struct smbXsrv_connection *xconn);
 
@@ -230,6 +231,8 @@ void smbd_server_connection_terminate_ex(struct smbXsrv_connection *xconn,
 const char *smb2_opcode_name(uint16_t opcode);
 bool smbd_is_smb2_header(const uint8_t *inbuf, size_t size);
 bool smbd_smb2_is_compound(const struct smbd_smb2_request *req);
+struct smb2_signing_key *smbd_smb2_signing_key(struct smbXsrv_session *session,
+					       struct smbXsrv_connection *xconn);
 
 NTSTATUS smbd_add_connection(struct smbXsrv_client *client, int sock_fd,
 			     struct smbXsrv_connection **_xconn);
@@ -270,6 +273,15 @@ NTSTATUS smbd_smb2_send_lease_break(struct smbXsrv_connection *xconn,
 NTSTATUS smbd_smb2_request_pending_queue(struct smbd_smb2_request *req,
 					 struct tevent_req *subreq,
 					 uint32_t defer_time);
+NTSTATUS smbd_smb2_request_check_recvfile(struct smbd_smb2_request *req,
+					  int fd,
+					  off_t offset,
+					  size_t length);
+NTSTATUS smbd_smb2_request_read_recvfile(struct smbd_smb2_request *req,
+					 TALLOC_CTX *mem_ctx,
+					 DATA_BLOB *data);
+NTSTATUS smbd_smb2_request_stage_recvfile(struct smbd_smb2_request *req);
+void smbd_smb2_request_unstage_recvfile(struct smbd_smb2_request *req);
 
 struct smb_request *smbd_smb2_fake_smb_request(struct smbd_smb2_request *req);
 size_t smbd_smb2_unread_bytes(struct smbd_smb2_request *req);
@@ -445,6 +457,12 @@ struct smbXsrv_connection {
 		} request_read_state;
 		struct smbd_smb2_send_queue *send_queue;
 		size_t send_queue_len;
+		/*
+		 * Incoming requests being decrypted in the
+		 * thread pool and the ones that arrived
+		 * after them, in arrival order.
+		 */
+		struct smbd_smb2_crypto_job *decrypt_queue;
 
 		struct {
 			/*
@@ -663,9 +681,14 @@ struct smbd_smb2_send_queue {
 
 	DATA_BLOB *sendfile_header;
 	NTSTATUS *sendfile_status;
+	struct files_struct *sendfile_fsp;
+	off_t sendfile_offset;
 	struct iovec *vector;
 	int count;
 
+	/* Still being encrypted or signed in the thread pool */
+	bool encrypting;
+
 	TALLOC_CTX *mem_ctx;
 };
 
@@ -693,6 +716,24 @@ struct smbd_smb2_request {
 	bool do_encryption;
 	struct tevent_timer *async_te;
 	bool compound_related;
+	/*
+	 * Signed recvfile write, the signature
+	 * still needs to be checked.
+	 */
+	bool recvfile_check_signature;
+	/*
+	 * Staging file holding the checked payload
+	 * of a signed recvfile write, or -1.
+	 */
+	int recvfile_fd;
+	/*
+	 * Encryption or decryption running in
+	 * the thread pool, see "smbd encryption
+	 * offload size".
+	 */
+	struct smbd_smb2_crypto_job *crypto_job;
+	/* The transform was already decrypted */
+	bool in_decrypted;
 
 	/*
 	 * Give the implementation of an SMB2 req a way to tell the SMB2 request
@@ -882,8 +923,15 @@ struct smbd_server_connection {
 		struct bitmap *dptr_bmap;
 		struct dptr_struct *dirptrs;
 		int dirhandles_open;
+		/* cached SMB2 directory listings, most recently used first */
+		struct dir_listing *listings;
+		size_t num_listing_entries;
 	} searches;
 
+	/* case-insensitive name indexes, most recently used first */
+	struct case_index *case_indexes;
+	size_t num_case_index_entries;
+
 	uint64_t num_requests;
 
 	/* Current number of oplocks we have outstanding. */
@@ -277,6 +277,14 @@ void notify_callback(struct smbd_server_connection *sconn,
 	struct notify_fsp_state state = {
 		.notified_fsp = private_data, .when = when, .e = e
 	};
+
+	if (dir_listing_notify(sconn, private_data, e)) {
+		return;
+	}
+	if (case_index_notify(sconn, private_data, e)) {
+		return;
+	}
+
 	files_forall(sconn, notify_fsp_cb, &state);
 }
 
@@ -545,6 +553,8 @@ void smbd_notifyd_restarted(struct messaging_context *msg,
 	struct smbd_server_connection *sconn = talloc_get_type_abort(
 		private_data, struct smbd_server_connection);
 
+	dir_listing_drop_all(sconn);
+	case_index_drop_all(sconn);
 	TALLOC_FREE(sconn->notify_ctx);
 
 	sconn->notify_ctx = notify_init(sconn, sconn->msg_ctx,
@@ -586,6 +596,26 @@ void notify_fname(connection_struct *conn, uint32_t action, uint32_t filter,
 		path += 2;
 	}
 
+	dir_listing_invalidate_path(conn, action, path);
+	case_index_update(conn, action, path);
+
+	switch (action) {
+	case NOTIFY_ACTION_ADDED:
+	case NOTIFY_ACTION_NEW_NAME:
+		stat_cache_invalidate_negative(conn, path);
+		break;
+	case NOTIFY_ACTION_REMOVED:
+	case NOTIFY_ACTION_OLD_NAME:
+		if (filter & FILE_NOTIFY_CHANGE_DIR_NAME) {
+			/*
+			 * Names below the directory are now
+			 * ENOTDIR, not a new file.
+			 */
+			stat_cache_invalidate_negative(conn, NULL);
+		}
+		break;
+	}
+
 	notify_trigger(notify_ctx, action, filter, conn->connectpath, path);
 }
 
@@ -233,6 +233,13 @@ void RewindDir(struct smb_Dir *dirp, long *poffset);
 void SeekDir(struct smb_Dir *dirp, long offset);
 long TellDir(struct smb_Dir *dirp);
 bool SearchDir(struct smb_Dir *dirp, const char *name, long *poffset);
+bool dir_listing_notify(struct smbd_server_connection *sconn,
+			void *private_data,
+			const struct notify_event *e);
+void dir_listing_invalidate_path(connection_struct *conn,
+				 uint32_t action,
+				 const char *path);
+void dir_listing_drop_all(struct smbd_server_connection *sconn);
 NTSTATUS can_delete_directory(struct connection_struct *conn,
 				const char *dirname);
 bool have_file_open_below(connection_struct *conn,
@@ -1128,9 +1135,10 @@ ssize_t message_push_string(uint8_t **outbuf, const char *str, int flags);
 
 /* The following definitions come from smbd/statcache.c  */
 
-void stat_cache_add( const char *full_orig_name,
-		char *translated_path,
-		bool case_sensitive);
+bool stat_cache_shared_init(void);
+void stat_cache_add(connection_struct *conn,
+		    const char *full_orig_name,
+		    char *translated_path);
 bool stat_cache_lookup(connection_struct *conn,
 			bool posix_paths,
 			char **pp_name,
@@ -1142,10 +1150,35 @@ void smbd_send_stat_cache_delete_message(struct messaging_context *msg_ctx,
 void send_stat_cache_delete_message(struct messaging_context *msg_ctx,
 				    const char *name);
 void stat_cache_delete(const char *name);
+void stat_cache_add_negative(connection_struct *conn,
+			     const char *name,
+			     const char *translated_path);
+bool stat_cache_lookup_negative(connection_struct *conn,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				char **translated_path);
+void stat_cache_delete_negative(const char *fullpath);
+void stat_cache_invalidate_negative(connection_struct *conn, const char *name);
 struct TDB_DATA;
 unsigned int fast_string_hash(struct TDB_DATA *key);
 bool reset_stat_cache( void );
 
+/* The following definitions come from smbd/case_index.c  */
+
+int case_index_lookup(connection_struct *conn,
+		      const char *path,
+		      const char *name,
+		      TALLOC_CTX *mem_ctx,
+		      char **found_name);
+bool case_index_notify(struct smbd_server_connection *sconn,
+		       void *private_data,
+		       const struct notify_event *e);
+void case_index_update(connection_struct *conn,
+		       uint32_t action,
+		       const char *path);
+void case_index_closecnum(connection_struct *conn);
+void case_index_drop_all(struct smbd_server_connection *sconn);
+
 /* The following definitions come from smbd/statvfs.c  */
 
 int sys_statvfs(const char *path, vfs_statvfs_struct *statbuf);
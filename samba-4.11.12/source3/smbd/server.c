@@ -137,6 +137,24 @@ static void smb_stat_cache_delete(struct messaging_context *msg,
 	stat_cache_delete(name);
 }
 
+static void smb_negative_stat_cache_delete(struct messaging_context *msg,
+					   void *private_data,
+					   uint32_t msg_type,
+					   struct server_id server_id,
+					   DATA_BLOB *data)
+{
+	const char *fullpath = (const char *)data->data;
+	struct server_id_buf tmp;
+
+	if ((data->length == 0) || (fullpath[data->length-1] != '\0')) {
+		DBG_WARNING("Invalid message from %s\n",
+			    server_id_str_buf(server_id, &tmp));
+		return;
+	}
+	DBG_DEBUG("delete negative entries for %s\n", fullpath);
+	stat_cache_delete_negative(fullpath);
+}
+
 /****************************************************************************
   Send a SIGTERM to our process group.
 *****************************************************************************/
@@ -1249,6 +1267,8 @@ static bool open_sockets_smbd(struct smbd_parent_context *parent,
 			   smbd_parent_conf_updated);
 	messaging_register(msg_ctx, NULL, MSG_SMB_STAT_CACHE_DELETE,
 			   smb_stat_cache_delete);
+	messaging_register(msg_ctx, NULL, MSG_SMB_NEGATIVE_STAT_CACHE_DELETE,
+			   smb_negative_stat_cache_delete);
 	messaging_register(msg_ctx, NULL, MSG_DEBUG, smbd_msg_debug);
 	messaging_register(msg_ctx, NULL, MSG_SMB_FORCE_TDIS,
 			   smb_parent_send_to_children);
@@ -1946,6 +1966,10 @@ extern void build_options(bool screen);
 
 	memcache_set_global(smbd_memcache());
 
+	if (!stat_cache_shared_init()) {
+		DBG_WARNING("Running without a shared stat cache\n");
+	}
+
 	/* Initialise the password backed before the global_sam_sid
 	   to ensure that we fetch from ldap before we make a domain sid up */
 
@@ -1123,6 +1123,7 @@ void close_cnum(connection_struct *conn, uint64_t vuid)
 
 	if (!IS_IPC(conn)) {
 		dptr_closecnum(conn);
+		case_index_closecnum(conn);
 	}
 
 	change_to_root_user();
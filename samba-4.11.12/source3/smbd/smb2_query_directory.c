@@ -238,13 +238,21 @@ struct smbd_smb2_query_directory_state {
 	bool ask_sharemode;
 	bool async_dosmode;
 	bool async_ask_sharemode;
+	bool batch_ask_sharemode;
 	int last_entry_off;
 	size_t max_async_dosmode_active;
 	uint32_t async_dosmode_active;
+	uint32_t batch_size;
+	uint32_t batch_num;
+	struct file_id *batch_ids;
+	int *batch_entry_offs;
+	struct timespec *batch_write_times;
 	bool done;
 };
 
 static bool smb2_query_directory_next_entry(struct tevent_req *req);
+static void smb2_query_directory_flush_batch(
+	struct smbd_smb2_query_directory_state *state);
 static void smb2_query_directory_fetch_write_time_done(struct tevent_req *subreq);
 static void smb2_query_directory_dos_mode_done(struct tevent_req *subreq);
 static void smb2_query_directory_waited(struct tevent_req *subreq);
@@ -505,6 +513,8 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 		state->ask_sharemode = lp_smbd_search_ask_sharemode(SNUM(conn));
 
 		state->async_dosmode = lp_smbd_async_dosmode(SNUM(conn));
+
+		state->batch_size = lp_smbd_search_batch_size(SNUM(conn));
 	}
 
 	if (state->ask_sharemode && lp_clustering()) {
@@ -512,6 +522,36 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 		state->async_ask_sharemode = true;
 	}
 
+	if (state->ask_sharemode && (state->batch_size > 0)) {
+		/*
+		 * Collect the entries and fetch their write times
+		 * from locking.tdb in one go
+		 */
+		state->ask_sharemode = false;
+		state->batch_ask_sharemode = true;
+	}
+
+	if (state->batch_ask_sharemode) {
+		state->batch_ids = talloc_array(state,
+						struct file_id,
+						state->batch_size);
+		if (tevent_req_nomem(state->batch_ids, req)) {
+			return tevent_req_post(req, ev);
+		}
+		state->batch_entry_offs = talloc_array(state,
+						       int,
+						       state->batch_size);
+		if (tevent_req_nomem(state->batch_entry_offs, req)) {
+			return tevent_req_post(req, ev);
+		}
+		state->batch_write_times = talloc_array(state,
+							struct timespec,
+							state->batch_size);
+		if (tevent_req_nomem(state->batch_write_times, req)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
 	if (state->async_dosmode) {
 		size_t max_threads;
 
@@ -640,6 +680,17 @@ static bool smb2_query_directory_next_entry(struct tevent_req *req)
 		state->async_sharemode_count++;
 	}
 
+	if (state->batch_ask_sharemode) {
+		state->batch_ids[state->batch_num] = file_id;
+		state->batch_entry_offs[state->batch_num] =
+			state->last_entry_off;
+		state->batch_num += 1;
+
+		if (state->batch_num == state->batch_size) {
+			smb2_query_directory_flush_batch(state);
+		}
+	}
+
 	if (state->async_dosmode) {
 		struct tevent_req *subreq = NULL;
 		uint8_t *buf = NULL;
@@ -682,6 +733,8 @@ static bool smb2_query_directory_next_entry(struct tevent_req *req)
 last_entry_done:
 	SIVAL(state->out_output_buffer.data, state->last_entry_off, 0);
 
+	smb2_query_directory_flush_batch(state);
+
 	state->done = true;
 
 	if (state->async_sharemode_count > 0) {
@@ -721,6 +774,40 @@ last_entry_done:
 	return true;
 }
 
+static void smb2_query_directory_flush_batch(
+	struct smbd_smb2_query_directory_state *state)
+{
+	connection_struct *conn = state->fsp->conn;
+	uint32_t i;
+
+	if (state->batch_num == 0) {
+		return;
+	}
+
+	fetch_share_mode_write_times(state->batch_ids,
+				     state->batch_num,
+				     state->batch_write_times);
+
+	for (i = 0; i < state->batch_num; i++) {
+		char *buf = state->base_data + state->batch_entry_offs[i];
+
+		if (null_timespec(state->batch_write_times[i])) {
+			continue;
+		}
+
+		/*
+		 * LastWriteTime is at offset 24 in all info
+		 * levels we ask the share modes for, see
+		 * fetch_write_time_done().
+		 */
+		put_long_date_timespec(conn->ts_res,
+				       buf + 24,
+				       state->batch_write_times[i]);
+	}
+
+	state->batch_num = 0;
+}
+
 static void smb2_query_directory_check_next_entry(struct tevent_req *req);
 
 static void smb2_query_directory_fetch_write_time_done(struct tevent_req *subreq)
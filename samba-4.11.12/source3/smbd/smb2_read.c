@@ -191,6 +191,65 @@ static int smb2_smb2_read_state_deny_destructor(struct smbd_smb2_read_state *sta
 	return -1;
 }
 
+/*
+ * A signed sendfile response is signed in the thread pool from a
+ * separate read of the file, see smbd_smb2_request_sign_sendfile().
+ * Only do this if no other open can change the data between that
+ * read and sendfile(). An RW lease or a batch or exclusive oplock
+ * guarantees that without looking at the share mode entries, any
+ * other open with write access has to break it first.
+ */
+static bool smb2_sendfile_sign_allowed(files_struct *fsp)
+{
+	return fsp_lease_type_is_exclusive(fsp);
+}
+
+struct smb2_sendfile_fsp_link_state {
+	struct smbd_smb2_read_state *read_state;
+};
+
+/*
+ * Freed by close_file(SHUTDOWN_CLOSE) if the file goes away
+ * before the signed response went out.
+ */
+static void smb2_sendfile_fsp_link_cleanup(struct tevent_req *req,
+					   enum tevent_req_state req_state)
+{
+	struct smb2_sendfile_fsp_link_state *state = tevent_req_data(
+		req, struct smb2_sendfile_fsp_link_state);
+
+	if (state->read_state != NULL) {
+		state->read_state->fsp = NULL;
+		state->read_state = NULL;
+	}
+}
+
+/*
+ * Keep a normal close waiting for us while the signature is
+ * calculated from the file.
+ */
+static bool smb2_sendfile_fsp_link(struct smbd_smb2_read_state *state)
+{
+	struct smb2_sendfile_fsp_link_state *link_state = NULL;
+	struct tevent_req *link = NULL;
+
+	link = tevent_req_create(state, &link_state,
+				 struct smb2_sendfile_fsp_link_state);
+	if (link == NULL) {
+		return false;
+	}
+	link_state->read_state = state;
+	tevent_req_set_cleanup_fn(link, smb2_sendfile_fsp_link_cleanup);
+
+	if (!aio_add_req_to_fsp(state->fsp, link)) {
+		link_state->read_state = NULL;
+		TALLOC_FREE(link);
+		return false;
+	}
+
+	return true;
+}
+
 /* struct smbd_smb2_read_state destructor. Send the SMB2_READ data. */
 static int smb2_sendfile_send_data(struct smbd_smb2_read_state *state)
 {
@@ -205,6 +264,20 @@ static int smb2_sendfile_send_data(struct smbd_smb2_read_state *state)
 	ssize_t ret;
 	int saved_errno;
 
+	if (pstatus == NULL) {
+		/* Never flushed, the connection is gone */
+		return 0;
+	}
+
+	if (fsp == NULL) {
+		/*
+		 * Closed by smb2_sendfile_fsp_link_cleanup() while
+		 * the response was signed.
+		 */
+		*pstatus = NT_STATUS_FILE_CLOSED;
+		return 0;
+	}
+
 	nread = SMB_VFS_SENDFILE(xconn->transport.sock,
 				 fsp,
 				 hdr,
@@ -339,7 +412,9 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	/*
 	 * We cannot use sendfile if...
 	 * We were not configured to do so OR
-	 * Signing is active OR
+	 * Signing is active and not allowed with sendfile OR
+	 * Signing is active and we don't hold an exclusive lease OR
+	 * Encryption is active OR
 	 * This is a compound SMB2 operation OR
 	 * fsp is a STREAM file OR
 	 * We're using a write cache OR
@@ -351,7 +426,10 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 	*/
 
 	if (!lp__use_sendfile(SNUM(fsp->conn)) ||
-	    smb2req->do_signing ||
+	    (smb2req->do_signing &&
+	     (!lp_smbd_signed_sendfile(SNUM(fsp->conn)) ||
+	      (fsp->fh->fd == -1) ||
+	      !smb2_sendfile_sign_allowed(fsp))) ||
 	    smb2req->do_encryption ||
 	    smbd_smb2_is_compound(smb2req) ||
 	    (fsp->base_fsp != NULL) ||
@@ -363,6 +441,10 @@ static NTSTATUS schedule_smb2_sendfile_read(struct smbd_smb2_request *smb2req,
 		return NT_STATUS_RETRY;
 	}
 
+	if (smb2req->do_signing && !smb2_sendfile_fsp_link(state)) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
 	/* We've already checked there's this amount of data
 	   to read. */
 	state->out_data.length = state->in_length;
@@ -652,6 +734,8 @@ static NTSTATUS smbd_smb2_read_recv(struct tevent_req *req,
 		talloc_set_destructor(state, smb2_smb2_read_state_deny_destructor);
 		tevent_req_received(req);
 		state->smb2req->queue_entry.sendfile_header = &state->out_headers;
+		state->smb2req->queue_entry.sendfile_fsp = state->fsp;
+		state->smb2req->queue_entry.sendfile_offset = state->in_offset;
 		talloc_set_destructor(state, smb2_sendfile_send_data);
 	} else {
 		tevent_req_received(req);
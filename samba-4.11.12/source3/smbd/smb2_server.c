@@ -20,6 +20,7 @@
 */
 
 #include "includes.h"
+#include "system/filesys.h"
 #include "smbd/smbd.h"
 #include "smbd/globals.h"
 #include "../libcli/smb/smb_common.h"
@@ -31,6 +32,7 @@
 #include "lib/util/iov_buf.h"
 #include "auth.h"
 #include "libcli/smb/smbXcli_base.h"
+#include "lib/pthreadpool/pthreadpool_tevent.h"
 
 #include "lib/crypto/gnutls_helpers.h"
 #include <gnutls/gnutls.h>
@@ -44,6 +46,15 @@ static void smbd_smb2_connection_handler(struct tevent_context *ev,
 					 uint16_t flags,
 					 void *private_data);
 static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn);
+static bool smbd_smb2_crypto_offload(struct smbXsrv_connection *xconn,
+				     size_t len);
+static NTSTATUS smbd_smb2_request_sign_sendfile(struct smbd_smb2_request *req,
+						struct iovec *outhdr,
+						size_t length);
+static void smbd_smb2_crypto_job_orphan(struct smbd_smb2_crypto_job *job);
+static NTSTATUS smbd_smb2_request_encrypt_offload(struct smbd_smb2_request *req,
+						  struct iovec *vector,
+						  int count);
 
 static const struct smbd_smb2_dispatch_table {
 	uint16_t opcode;
@@ -276,12 +287,21 @@ static bool smb2_setup_nbt_length(struct iovec *vector, int count)
 
 static int smbd_smb2_request_destructor(struct smbd_smb2_request *req)
 {
+	if (req->crypto_job != NULL) {
+		/*
+		 * A thread is still working on our buffers,
+		 * smbd_smb2_crypto_done() frees us later.
+		 */
+		smbd_smb2_crypto_job_orphan(req->crypto_job);
+		return -1;
+	}
 	if (req->first_key.length > 0) {
 		data_blob_clear_free(&req->first_key);
 	}
 	if (req->last_key.length > 0) {
 		data_blob_clear_free(&req->last_key);
 	}
+	smbd_smb2_request_unstage_recvfile(req);
 	return 0;
 }
 
@@ -318,6 +338,7 @@ static struct smbd_smb2_request *smbd_smb2_request_allocate(TALLOC_CTX *mem_ctx)
 
 	req->last_session_id = UINT64_MAX;
 	req->last_tid = UINT32_MAX;
+	req->recvfile_fd = -1;
 
 	talloc_set_destructor(req, smbd_smb2_request_destructor);
 
@@ -432,9 +453,15 @@ static NTSTATUS smbd_smb2_inbuf_parse_compound(struct smbXsrv_connection *xconn,
 			tf_iov[1].iov_base = (void *)hdr;
 			tf_iov[1].iov_len = enc_len;
 
-			status = smb2_signing_decrypt_pdu(s->global->decryption_key_blob,
-							  xconn->smb2.server.cipher,
-							  tf_iov, 2);
+			if (req->in_decrypted) {
+				/* done by smbd_smb2_crypto_do() */
+				status = NT_STATUS_OK;
+			} else {
+				status = smb2_signing_decrypt_pdu(
+					s->global->decryption_key_blob,
+					xconn->smb2.server.cipher,
+					tf_iov, 2);
+			}
 			if (!NT_STATUS_IS_OK(status)) {
 				TALLOC_FREE(iov_alloc);
 				return status;
@@ -1528,7 +1555,6 @@ NTSTATUS smbd_smb2_request_pending_queue(struct smbd_smb2_request *req,
 	return NT_STATUS_OK;
 }
 
-static
 struct smb2_signing_key *smbd_smb2_signing_key(struct smbXsrv_session *session,
 					       struct smbXsrv_connection *xconn)
 {
@@ -2498,10 +2524,23 @@ NTSTATUS smbd_smb2_request_dispatch(struct smbd_smb2_request *req)
 			req->do_signing = true;
 		}
 
-		status = smb2_signing_check_pdu(signing_key,
+		if ((flags & SMB2_HDR_FLAG_SIGNED) &&
+		    smbd_smb2_unread_bytes(req) > 0)
+		{
+			/*
+			 * Signed recvfile write, the payload is
+			 * still in the socket. The signature is
+			 * checked by smbd_smb2_write_send() once
+			 * the payload is in the file.
+			 */
+			req->recvfile_check_signature = true;
+			status = NT_STATUS_OK;
+		} else {
+			status = smb2_signing_check_pdu(signing_key,
 						xconn->protocol,
 						SMBD_SMB2_IN_HDR_IOV(req),
 						SMBD_SMB2_NUM_IOV_PER_REQ - 1);
+		}
 		if (!NT_STATUS_IS_OK(status)) {
 			return smbd_smb2_request_error(req, status);
 		}
@@ -2991,7 +3030,19 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 	/*
 	 * now check if we need to sign the current response
 	 */
-	if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
+	if (firsttf->iov_len == SMB2_TF_HDR_SIZE &&
+	    req->preauth == NULL &&
+	    req->first_key.length > 0 &&
+	    smbd_smb2_crypto_offload(xconn,
+			iov_buflen(firsttf, req->out.vector_count - first_idx)))
+	{
+		status = smbd_smb2_request_encrypt_offload(req,
+					firsttf,
+					req->out.vector_count - first_idx);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	} else if (firsttf->iov_len == SMB2_TF_HDR_SIZE) {
 		status = smb2_signing_encrypt_pdu(req->first_key,
 					xconn->smb2.server.cipher,
 					firsttf,
@@ -2999,6 +3050,18 @@ static NTSTATUS smbd_smb2_request_reply(struct smbd_smb2_request *req)
 		if (!NT_STATUS_IS_OK(status)) {
 			return status;
 		}
+	} else if (req->do_signing &&
+		   outdyn->iov_base == NULL && outdyn->iov_len != 0) {
+		/*
+		 * The payload goes out via sendfile,
+		 * the signature covers the file data.
+		 */
+		status = smbd_smb2_request_sign_sendfile(req,
+							 outhdr,
+							 outdyn->iov_len);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
 	} else if (req->do_signing) {
 		struct smbXsrv_session *x = req->session;
 		struct smb2_signing_key *signing_key =
@@ -3255,6 +3318,31 @@ NTSTATUS smbd_smb2_request_error_ex(struct smbd_smb2_request *req,
 		   "at %s\n", req->current_idx, nt_errstr(status),
 		   info ? " +info" : "", location);
 
+	if (unread_bytes && req->recvfile_check_signature) {
+		NTSTATUS sig_status;
+		DATA_BLOB blob = data_blob_null;
+
+		/*
+		 * A signed recvfile write failed before its
+		 * signature was checked. Don't answer a request
+		 * we haven't verified, read the payload and check
+		 * the signature first.
+		 */
+		sig_status = smbd_smb2_request_read_recvfile(req, req, &blob);
+		if (NT_STATUS_EQUAL(sig_status, NT_STATUS_ACCESS_DENIED)) {
+			/* Bad signature */
+			status = sig_status;
+		} else if (!NT_STATUS_IS_OK(sig_status)) {
+			DBG_NOTICE("Failed to read %zu bytes from SMB2 "
+				   "socket: %s\n",
+				   unread_bytes,
+				   nt_errstr(sig_status));
+			return sig_status;
+		}
+		data_blob_free(&blob);
+		unread_bytes = 0;
+	}
+
 	if (unread_bytes) {
 		/* Recvfile error. Drain incoming socket. */
 		size_t ret;
@@ -3521,10 +3609,6 @@ static bool is_smb2_recvfile_write(struct smbd_smb2_request_read_state *state)
 		/* Chained. Cannot recvfile. */
 		return false;
 	}
-	if (flags & SMB2_HDR_FLAG_SIGNED) {
-		/* Signed. Cannot recvfile. */
-		return false;
-	}
 
 	body = &state->pktbuf[SMB2_HDR_BODY];
 
@@ -3558,12 +3642,734 @@ static bool is_smb2_recvfile_write(struct smbd_smb2_request_read_state *state)
 		return false;
 	}
 
+	if (flags & SMB2_HDR_FLAG_SIGNED) {
+		uint16_t data_offset = SVAL(body, 0x02);
+		uint32_t data_length = IVAL(body, 0x04);
+		uint64_t offset = BVAL(body, 0x08);
+
+		if (!lp_smbd_signed_recvfile(SNUM(fsp->conn))) {
+			/* Signed. Cannot recvfile. */
+			return false;
+		}
+		if (fsp->fh->fd == -1) {
+			return false;
+		}
+		/*
+		 * The signature can only be checked from the
+		 * file if the whole rest of the PDU is the
+		 * payload.
+		 */
+		if (data_offset != SMBD_SMB2_SHORT_RECEIVEFILE_WRITE_LEN) {
+			return false;
+		}
+		if (data_length != (state->pktfull - state->pktlen)) {
+			return false;
+		}
+		/*
+		 * A bad signature is rolled back by truncating
+		 * the file, so only take writes that extend it.
+		 * smbd_smb2_write_send() copes with a stale
+		 * size.
+		 */
+		if (offset < fsp->fsp_name->st.st_ex_size) {
+			return false;
+		}
+	}
+
 	DEBUG(10,("Doing recvfile write len = %u\n",
 		(unsigned int)(state->pktfull - state->pktlen)));
 
 	return true;
 }
 
+/*
+ * Check the signature of a signed recvfile write
+ * after the payload has been received into 'fd'.
+ */
+NTSTATUS smbd_smb2_request_check_recvfile(struct smbd_smb2_request *req,
+					  int fd,
+					  off_t offset,
+					  size_t length)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smb2_signing_key *signing_key = NULL;
+	NTSTATUS status;
+
+	if (!req->recvfile_check_signature) {
+		return NT_STATUS_OK;
+	}
+
+	signing_key = smbd_smb2_signing_key(req->session, xconn);
+
+	status = smb2_signing_check_pdu_fd(signing_key,
+					   xconn->protocol,
+					   SMBD_SMB2_IN_HDR_IOV(req),
+					   2,
+					   fd,
+					   offset,
+					   length);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	req->recvfile_check_signature = false;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Read the payload of a signed recvfile write into memory
+ * and check the signature, for the cases where a bad
+ * signature could not be rolled back from the file.
+ */
+NTSTATUS smbd_smb2_request_read_recvfile(struct smbd_smb2_request *req,
+					 TALLOC_CTX *mem_ctx,
+					 DATA_BLOB *data)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smb2_signing_key *signing_key = NULL;
+	int sockfd = xconn->transport.sock;
+	size_t unread_bytes = smbd_smb2_unread_bytes(req);
+	struct iovec iov[SMBD_SMB2_NUM_IOV_PER_REQ - 1];
+	DATA_BLOB blob;
+	int old_flags;
+	NTSTATUS status;
+
+	blob = data_blob_talloc(mem_ctx, NULL, unread_bytes);
+	if (blob.data == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/* Like vfs_pwrite_data() we read blocking. */
+	old_flags = fcntl(sockfd, F_GETFL, 0);
+	if (set_blocking(sockfd, true) == -1) {
+		data_blob_free(&blob);
+		return map_nt_error_from_unix_common(errno);
+	}
+	status = read_data_ntstatus(sockfd, (char *)blob.data, blob.length);
+	if (fcntl(sockfd, F_SETFL, old_flags) == -1) {
+		if (NT_STATUS_IS_OK(status)) {
+			status = map_nt_error_from_unix_common(errno);
+		}
+	}
+	req->smb1req->unread_bytes = 0;
+	if (!NT_STATUS_IS_OK(status)) {
+		data_blob_free(&blob);
+		return status;
+	}
+
+	iov[0] = *SMBD_SMB2_IN_HDR_IOV(req);
+	iov[1] = *SMBD_SMB2_IN_BODY_IOV(req);
+	iov[2].iov_base = blob.data;
+	iov[2].iov_len = blob.length;
+
+	signing_key = smbd_smb2_signing_key(req->session, xconn);
+
+	status = smb2_signing_check_pdu(signing_key,
+					xconn->protocol,
+					iov,
+					ARRAY_SIZE(iov));
+	if (!NT_STATUS_IS_OK(status)) {
+		data_blob_free(&blob);
+		return status;
+	}
+
+	req->recvfile_check_signature = false;
+	*data = blob;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Receive the payload of a signed recvfile write into an unlinked
+ * staging file and check the signature there. Only a payload with a
+ * good signature is then moved into the target file by
+ * vfs_pwrite_data(), see smbd_smb2_request_unstage_recvfile().
+ *
+ * Returns NT_STATUS_RETRY if no staging file can be created, the
+ * payload is still unread then.
+ */
+NTSTATUS smbd_smb2_request_stage_recvfile(struct smbd_smb2_request *req)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	int sockfd = xconn->transport.sock;
+	size_t unread_bytes = smbd_smb2_unread_bytes(req);
+	size_t total = 0;
+	char *path = NULL;
+	int old_flags;
+	int fd;
+	NTSTATUS status;
+
+	path = talloc_asprintf(talloc_tos(), "%s/smb2_recvfile.XXXXXX",
+			       tmpdir());
+	if (path == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	fd = mkstemp(path);
+	if (fd == -1) {
+		DBG_NOTICE("Failed to create %s: %s\n",
+			   path,
+			   strerror(errno));
+		TALLOC_FREE(path);
+		return NT_STATUS_RETRY;
+	}
+	unlink(path);
+	TALLOC_FREE(path);
+
+	/* Like vfs_pwrite_data() we read blocking. */
+	old_flags = fcntl(sockfd, F_GETFL, 0);
+	if (set_blocking(sockfd, true) == -1) {
+		status = map_nt_error_from_unix_common(errno);
+		close(fd);
+		return status;
+	}
+	status = NT_STATUS_OK;
+	while (total < unread_bytes) {
+		ssize_t ret;
+
+		ret = sys_recvfile(sockfd, fd, total, unread_bytes - total);
+		if (ret == -1) {
+			status = map_nt_error_from_unix_common(errno);
+			break;
+		}
+		if (ret == 0) {
+			status = NT_STATUS_END_OF_FILE;
+			break;
+		}
+		total += ret;
+	}
+	if (fcntl(sockfd, F_SETFL, old_flags) == -1) {
+		if (NT_STATUS_IS_OK(status)) {
+			status = map_nt_error_from_unix_common(errno);
+		}
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		req->smb1req->unread_bytes = 0;
+		close(fd);
+		return status;
+	}
+
+	status = smbd_smb2_request_check_recvfile(req, fd, 0, unread_bytes);
+	if (!NT_STATUS_IS_OK(status)) {
+		req->smb1req->unread_bytes = 0;
+		close(fd);
+		return status;
+	}
+
+	if (lseek(fd, 0, SEEK_SET) == -1) {
+		status = map_nt_error_from_unix_common(errno);
+		req->smb1req->unread_bytes = 0;
+		close(fd);
+		return status;
+	}
+
+	req->recvfile_fd = fd;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Called after write_file() took the payload out of the
+ * staging file. Whatever it left behind is discarded.
+ */
+void smbd_smb2_request_unstage_recvfile(struct smbd_smb2_request *req)
+{
+	if (req->recvfile_fd == -1) {
+		return;
+	}
+	close(req->recvfile_fd);
+	req->recvfile_fd = -1;
+	if (req->smb1req != NULL) {
+		req->smb1req->unread_bytes = 0;
+	}
+}
+
+/*
+ * Encryption and decryption of large PDUs can be moved into
+ * the thread pool, see "smbd encryption offload size". So is
+ * the signing of READ responses sent with sendfile(), see
+ * smbd_smb2_request_sign_sendfile().
+ *
+ * Encrypted responses stay in the send queue, which is only
+ * flushed up to the first one still being encrypted.
+ * Incoming requests stay in xconn->smb2.decrypt_queue
+ * and are dispatched in arrival order, requests arriving
+ * while others are being decrypted queue up behind them.
+ */
+struct smbd_smb2_crypto_job {
+	struct smbd_smb2_crypto_job *prev, *next;
+	struct smbXsrv_connection *xconn;
+	struct smbd_smb2_request *req;
+	bool encrypt;
+	bool sign;
+	bool queued;
+	bool in_flight;
+	bool orphaned;
+
+	DATA_BLOB key;
+	uint16_t cipher;
+	struct iovec *vector;
+	int count;
+	NTSTATUS status;
+
+	/* incoming PDU for decryption */
+	struct iovec tf_iov[2];
+	uint8_t *buf;
+	size_t buflen;
+
+	/* sendfile payload for signing */
+	enum protocol_types protocol;
+	int fd;
+	off_t offset;
+	size_t length;
+};
+
+static bool smbd_smb2_crypto_offload(struct smbXsrv_connection *xconn,
+				     size_t len)
+{
+	int min_size = lp_smbd_encryption_offload_size();
+
+	if (min_size <= 0) {
+		return false;
+	}
+	if (len < (size_t)min_size) {
+		return false;
+	}
+	if (pthreadpool_tevent_max_threads(xconn->client->sconn->pool) == 0) {
+		return false;
+	}
+
+	return true;
+}
+
+static int smbd_smb2_crypto_job_destructor(struct smbd_smb2_crypto_job *job)
+{
+	if (job->queued) {
+		DLIST_REMOVE(job->xconn->smb2.decrypt_queue, job);
+		job->queued = false;
+	}
+	if (job->key.length > 0) {
+		data_blob_clear_free(&job->key);
+	}
+	if (job->sign && job->fd != -1) {
+		close(job->fd);
+		job->fd = -1;
+	}
+	return 0;
+}
+
+static void smbd_smb2_crypto_job_orphan(struct smbd_smb2_crypto_job *job)
+{
+	struct smbXsrv_connection *xconn = job->xconn;
+
+	if (job->orphaned) {
+		return;
+	}
+
+	/*
+	 * The request is freed with the connection,
+	 * detach it while xconn is still valid.
+	 */
+	if (job->encrypt || job->sign) {
+		DLIST_REMOVE(xconn->smb2.send_queue, &job->req->queue_entry);
+		xconn->smb2.send_queue_len--;
+	}
+	if (job->queued) {
+		DLIST_REMOVE(xconn->smb2.decrypt_queue, job);
+		job->queued = false;
+	}
+	job->orphaned = true;
+}
+
+static void smbd_smb2_crypto_do(void *private_data)
+{
+	struct smbd_smb2_crypto_job *job = talloc_get_type_abort(
+		private_data, struct smbd_smb2_crypto_job);
+
+	/*
+	 * This runs in a worker thread, the debug subsystem is
+	 * not thread-safe. The key has been checked before the
+	 * job was queued, smbd_smb2_crypto_done() does the
+	 * logging.
+	 */
+	if (job->sign) {
+		job->status = smb2_signing_sign_pdu_fd_nolog(job->key,
+							     job->protocol,
+							     job->vector,
+							     job->count,
+							     job->fd,
+							     job->offset,
+							     job->length);
+		return;
+	}
+
+	if (job->encrypt) {
+		job->status = smb2_signing_encrypt_pdu_nolog(job->key,
+							     job->cipher,
+							     job->vector,
+							     job->count);
+		return;
+	}
+
+	job->status = smb2_signing_decrypt_pdu_nolog(job->key,
+						     job->cipher,
+						     job->vector,
+						     job->count);
+}
+
+static void smbd_smb2_crypto_done(struct tevent_req *subreq);
+
+static NTSTATUS smbd_smb2_crypto_job_start(struct smbd_smb2_crypto_job *job)
+{
+	struct smbXsrv_connection *xconn = job->xconn;
+	struct tevent_req *subreq = NULL;
+
+	subreq = pthreadpool_tevent_job_send(job,
+					     xconn->client->raw_ev_ctx,
+					     xconn->client->sconn->pool,
+					     smbd_smb2_crypto_do,
+					     job);
+	if (subreq == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	tevent_req_set_callback(subreq, smbd_smb2_crypto_done, job);
+
+	job->in_flight = true;
+	job->req->crypto_job = job;
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_request_encrypt_offload(struct smbd_smb2_request *req,
+						  struct iovec *vector,
+						  int count)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_smb2_crypto_job *job = NULL;
+	NTSTATUS status;
+
+	job = talloc_zero(req, struct smbd_smb2_crypto_job);
+	if (job == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	talloc_set_destructor(job, smbd_smb2_crypto_job_destructor);
+	job->xconn = xconn;
+	job->req = req;
+	job->encrypt = true;
+	job->cipher = xconn->smb2.server.cipher;
+	job->vector = vector;
+	job->count = count;
+
+	/* req->first_key is gone before we're done */
+	job->key = data_blob_dup_talloc(job, req->first_key);
+	if (job->key.data == NULL) {
+		TALLOC_FREE(job);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	status = smbd_smb2_crypto_job_start(job);
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(job);
+		return status;
+	}
+
+	req->queue_entry.encrypting = true;
+	return NT_STATUS_OK;
+}
+
+/*
+ * The signature of a READ response sent with sendfile() covers the
+ * file data, which has to be read for the MAC. Don't block the
+ * connection with that, read it in the thread pool through a
+ * duplicate of the fd, the file might be closed meanwhile. The
+ * response waits in the send queue like an encrypted one.
+ */
+static NTSTATUS smbd_smb2_request_sign_sendfile(struct smbd_smb2_request *req,
+						struct iovec *outhdr,
+						size_t length)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smb2_signing_key *signing_key =
+		smbd_smb2_signing_key(req->session, xconn);
+	struct files_struct *fsp = req->queue_entry.sendfile_fsp;
+	off_t offset = req->queue_entry.sendfile_offset;
+	struct smbd_smb2_crypto_job *job = NULL;
+	NTSTATUS status;
+
+	if (fsp == NULL || fsp->fh->fd == -1) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	/*
+	 * Only the header and the body are in memory,
+	 * the dynamic part is 'length' bytes of the file.
+	 */
+	if (!smb2_signing_key_valid(signing_key) ||
+	    pthreadpool_tevent_max_threads(xconn->client->sconn->pool) == 0)
+	{
+		return smb2_signing_sign_pdu_fd(signing_key,
+						xconn->protocol,
+						outhdr,
+						2,
+						fsp->fh->fd,
+						offset,
+						length);
+	}
+
+	job = talloc_zero(req, struct smbd_smb2_crypto_job);
+	if (job == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	job->fd = -1;
+	talloc_set_destructor(job, smbd_smb2_crypto_job_destructor);
+	job->xconn = xconn;
+	job->req = req;
+	job->sign = true;
+	job->protocol = xconn->protocol;
+	job->vector = outhdr;
+	job->count = 2;
+	job->offset = offset;
+	job->length = length;
+
+	job->key = data_blob_dup_talloc(job, signing_key->blob);
+	if (job->key.data == NULL) {
+		TALLOC_FREE(job);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	job->fd = dup(fsp->fh->fd);
+	if (job->fd == -1) {
+		status = map_nt_error_from_unix_common(errno);
+		TALLOC_FREE(job);
+		return status;
+	}
+
+	status = smbd_smb2_crypto_job_start(job);
+	if (!NT_STATUS_IS_OK(status)) {
+		TALLOC_FREE(job);
+		return status;
+	}
+
+	req->queue_entry.encrypting = true;
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_request_process_queued(struct smbd_smb2_request *req,
+						 uint8_t *buf,
+						 size_t buflen)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	NTTIME now = timeval_to_nttime(&req->request_time);
+	NTSTATUS status;
+
+	status = smbd_smb2_inbuf_parse_compound(xconn,
+						now,
+						buf,
+						buflen,
+						req,
+						&req->in.vector,
+						&req->in.vector_count);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	req->current_idx = 1;
+
+	DEBUG(10,("smbd_smb2_request idx[%d] of %d vectors\n",
+		 req->current_idx, req->in.vector_count));
+
+	status = smbd_smb2_request_validate(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	status = smbd_smb2_request_setup_out(req);
+	if (!NT_STATUS_IS_OK(status)) {
+		return status;
+	}
+
+	return smbd_smb2_request_dispatch(req);
+}
+
+static NTSTATUS smbd_smb2_decrypt_queue_flush(struct smbXsrv_connection *xconn)
+{
+	struct smbd_smb2_crypto_job *job = NULL;
+
+	while ((job = xconn->smb2.decrypt_queue) != NULL) {
+		struct smbd_smb2_request *req = job->req;
+		uint8_t *buf = job->buf;
+		size_t buflen = job->buflen;
+		NTSTATUS status = job->status;
+
+		if (job->in_flight) {
+			/* Keep the order of the requests */
+			break;
+		}
+
+		TALLOC_FREE(job);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+
+		status = smbd_smb2_request_process_queued(req, buf, buflen);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
+static NTSTATUS smbd_smb2_request_decrypt_offload(struct smbd_smb2_request *req,
+						  uint8_t *buf,
+						  size_t buflen)
+{
+	struct smbXsrv_connection *xconn = req->xconn;
+	struct smbd_smb2_crypto_job *job = NULL;
+	struct smbXsrv_session *s = NULL;
+	NTTIME now = timeval_to_nttime(&req->request_time);
+	size_t enc_len;
+
+	job = talloc_zero(req, struct smbd_smb2_crypto_job);
+	if (job == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	talloc_set_destructor(job, smbd_smb2_crypto_job_destructor);
+	job->xconn = xconn;
+	job->req = req;
+	job->buf = buf;
+	job->buflen = buflen;
+	job->status = NT_STATUS_OK;
+
+	DLIST_ADD_END(xconn->smb2.decrypt_queue, job);
+	job->queued = true;
+
+	/*
+	 * Only a single transform covering the whole
+	 * PDU goes to the thread pool, everything else
+	 * is left to smbd_smb2_inbuf_parse_compound().
+	 */
+	if (!smbd_smb2_crypto_offload(xconn, buflen)) {
+		goto done;
+	}
+	if (buflen < SMB2_TF_HDR_SIZE || IVAL(buf, 0) != SMB2_TF_MAGIC) {
+		goto done;
+	}
+	if (xconn->protocol < PROTOCOL_SMB2_24 ||
+	    xconn->smb2.server.cipher == 0) {
+		goto done;
+	}
+	enc_len = IVAL(buf, SMB2_TF_MSG_SIZE);
+	if (enc_len != buflen - SMB2_TF_HDR_SIZE) {
+		goto done;
+	}
+	/*
+	 * As in smbd_smb2_inbuf_parse_compound() only the
+	 * decryption key matters, an expired session is
+	 * still decrypted and handled by the dispatcher.
+	 */
+	(void)smb2srv_session_lookup_conn(xconn,
+					  BVAL(buf, SMB2_TF_SESSION_ID),
+					  now,
+					  &s);
+	if (s == NULL) {
+		goto done;
+	}
+
+	if (s->global->decryption_key_blob.length == 0) {
+		/* Let smb2_signing_decrypt_pdu() complain */
+		goto done;
+	}
+
+	job->key = data_blob_dup_talloc(job, s->global->decryption_key_blob);
+	if (job->key.data == NULL) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	job->cipher = xconn->smb2.server.cipher;
+	job->tf_iov[0].iov_base = (void *)buf;
+	job->tf_iov[0].iov_len = SMB2_TF_HDR_SIZE;
+	job->tf_iov[1].iov_base = (void *)(buf + SMB2_TF_HDR_SIZE);
+	job->tf_iov[1].iov_len = enc_len;
+	job->vector = job->tf_iov;
+	job->count = ARRAY_SIZE(job->tf_iov);
+
+	return smbd_smb2_crypto_job_start(job);
+
+done:
+	return smbd_smb2_decrypt_queue_flush(xconn);
+}
+
+static void smbd_smb2_crypto_done(struct tevent_req *subreq)
+{
+	struct smbd_smb2_crypto_job *job = tevent_req_callback_data(
+		subreq, struct smbd_smb2_crypto_job);
+	struct smbd_smb2_request *req = job->req;
+	struct smbXsrv_connection *xconn = job->xconn;
+	NTSTATUS status;
+	int ret;
+
+	ret = pthreadpool_tevent_job_recv(subreq);
+	TALLOC_FREE(subreq);
+
+	job->in_flight = false;
+	req->crypto_job = NULL;
+
+	if (job->orphaned) {
+		/* The connection is gone, see smbd_smb2_request_destructor() */
+		TALLOC_FREE(req);
+		return;
+	}
+
+	if (ret != 0) {
+		if (ret != EAGAIN) {
+			smbd_server_connection_terminate(xconn, strerror(ret));
+			return;
+		}
+		/*
+		 * If we get EAGAIN from pthreadpool_tevent_job_recv() this
+		 * means the lower level pthreadpool failed to create a new
+		 * thread. Fallback to sync processing in that case.
+		 */
+		smbd_smb2_crypto_do(job);
+	}
+
+	if (job->encrypt || job->sign) {
+		bool sign = job->sign;
+
+		req->queue_entry.encrypting = false;
+		status = job->status;
+		TALLOC_FREE(job);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbd_server_connection_terminate(xconn,
+							 nt_errstr(status));
+			return;
+		}
+
+		if (sign) {
+			DEBUG(5,("signed SMB2 message (payload from fd)\n"));
+		} else {
+			DEBUG(5,("encrypt SMB2 message\n"));
+		}
+
+		status = smbd_smb2_flush_send_queue(xconn);
+		if (!NT_STATUS_IS_OK(status)) {
+			smbd_server_connection_terminate(xconn,
+							 nt_errstr(status));
+			return;
+		}
+		return;
+	}
+
+	req->in_decrypted = true;
+
+	if (NT_STATUS_IS_OK(job->status)) {
+		DEBUG(5,("decrypt SMB2 message\n"));
+	}
+
+	status = smbd_smb2_decrypt_queue_flush(xconn);
+	if (!NT_STATUS_IS_OK(status)) {
+		smbd_server_connection_terminate(xconn, nt_errstr(status));
+		return;
+	}
+}
+
 static NTSTATUS smbd_smb2_request_next_incoming(struct smbXsrv_connection *xconn)
 {
 	struct smbd_server_connection *sconn = xconn->client->sconn;
@@ -3740,6 +4546,16 @@ static NTSTATUS smbd_smb2_flush_send_queue(struct smbXsrv_connection *xconn)
 		struct smbd_smb2_send_queue *e = xconn->smb2.send_queue;
 		bool ok;
 
+		if (e->encrypting) {
+			/*
+			 * Keep the order of the responses,
+			 * smbd_smb2_crypto_done() flushes
+			 * the queue again.
+			 */
+			TEVENT_FD_NOT_WRITEABLE(xconn->transport.fde);
+			return NT_STATUS_OK;
+		}
+
 		if (e->sendfile_header != NULL) {
 			size_t size = 0;
 			size_t i = 0;
@@ -3946,7 +4762,11 @@ again:
 		goto got_full;
 	}
 
-	if (state->min_recv_size != 0) {
+	if (state->min_recv_size != 0 && xconn->smb2.decrypt_queue == NULL) {
+		/*
+		 * No recvfile while earlier requests wait
+		 * for decryption, we need to read on.
+		 */
 		min_recvfile_size = SMBD_SMB2_SHORT_RECEIVEFILE_WRITE_LEN;
 		min_recvfile_size += state->min_recv_size;
 	}
@@ -3996,6 +4816,24 @@ got_full:
 	req->request_time = timeval_current();
 	now = timeval_to_nttime(&req->request_time);
 
+	if (xconn->smb2.decrypt_queue != NULL ||
+	    (!state->doing_receivefile &&
+	     smbd_smb2_crypto_offload(xconn, state->pktlen)))
+	{
+		uint8_t *pktbuf = state->pktbuf;
+		size_t pktlen = state->pktlen;
+
+		ZERO_STRUCTP(state);
+
+		status = smbd_smb2_request_decrypt_offload(req,
+							   pktbuf,
+							   pktlen);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		goto next;
+	}
+
 	status = smbd_smb2_inbuf_parse_compound(xconn,
 						now,
 						state->pktbuf,
@@ -4037,6 +4875,7 @@ got_full:
 		return status;
 	}
 
+next:
 	sconn->num_requests++;
 
 	/* The timeout_processing function isn't run nearly
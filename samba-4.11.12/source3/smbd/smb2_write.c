@@ -270,6 +270,7 @@ static struct tevent_req *smbd_smb2_write_send(TALLOC_CTX *mem_ctx,
 	struct smb_request *smbreq = NULL;
 	connection_struct *conn = smb2req->tcon->compat;
 	ssize_t nwritten;
+	int err;
 	struct lock_struct lock;
 
 	req = tevent_req_create(mem_ctx, &state,
@@ -363,6 +364,22 @@ static struct tevent_req *smbd_smb2_write_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	if (smb2req->recvfile_check_signature) {
+		/*
+		 * Nothing goes into the file before
+		 * the signature has been checked.
+		 */
+		status = smbd_smb2_request_stage_recvfile(smb2req);
+		if (NT_STATUS_EQUAL(status, NT_STATUS_RETRY)) {
+			status = smbd_smb2_request_read_recvfile(smb2req,
+								 state,
+								 &in_data);
+		}
+		if (tevent_req_nterror(req, status)) {
+			return tevent_req_post(req, ev);
+		}
+	}
+
 	/*
 	 * Note: in_data.data is NULL for the recvfile case.
 	 */
@@ -370,8 +387,11 @@ static struct tevent_req *smbd_smb2_write_send(TALLOC_CTX *mem_ctx,
 			      (const char *)in_data.data,
 			      in_offset,
 			      in_data.length);
+	err = errno;
+
+	smbd_smb2_request_unstage_recvfile(smb2req);
 
-	status = smb2_write_complete(req, nwritten, errno);
+	status = smb2_write_complete(req, nwritten, err);
 
 	DEBUG(10,("smb2: write on "
 		"file %s, offset %.0f, requested %u, written = %u\n",
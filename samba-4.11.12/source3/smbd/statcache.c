@@ -23,6 +23,7 @@
 #include "includes.h"
 #include "../lib/util/memcache.h"
 #include "smbd/smbd.h"
+#include "smbd/globals.h"
 #include "messages.h"
 #include "serverid.h"
 #include "smbprofile.h"
@@ -32,9 +33,268 @@
  Stat cache code used in unix_convert.
 *****************************************************************************/
 
+/****************************************************************************
+ Shared stat cache.
+
+ With "shared stat cache size" set, the parent smbd maps a table of fixed
+ size slots that all children inherit, so new connections start with a
+ warm cache. The table is set associative: a key hashes to a bucket of
+ STAT_CACHE_SHARED_WAYS slots.
+
+ Each slot is protected by a sequence number. Writers claim a slot by
+ making its sequence number odd with a compare-and-swap and simply give up
+ if another process got there first. Readers never write, they copy the
+ slot and retry with the next slot if the sequence number was odd or
+ changed while copying. A writer dying halfway leaves its slot unusable,
+ which only costs one slot.
+
+ Entries are validated with a stat() on every hit just like the memcache
+ entries, a hit for a name that is gone deletes its slot. Deletes and
+ renames leave the table alone: they only know the name, not the share
+ in the key, and flushing the table on every delete would empty it for
+ all processes. Entries that don't fit into a slot go to the per-process
+ memcache.
+*****************************************************************************/
+
+#define STAT_CACHE_SHARED_WAYS 4
+#define STAT_CACHE_SHARED_SLOT_SIZE 512
+
+struct stat_cache_shared_slot {
+	uint32_t seq;
+	uint32_t hash;
+	uint32_t generation;
+	uint16_t keylen;
+	uint16_t vallen;
+	time_t added;
+	uint8_t data[STAT_CACHE_SHARED_SLOT_SIZE - 24];
+};
+
+struct stat_cache_shared {
+	/*
+	 * Bumped by reset_stat_cache(), slots from older generations
+	 * are empty.
+	 */
+	uint32_t generation;
+	uint32_t num_buckets;
+	uint8_t pad[56];
+	struct stat_cache_shared_slot slots[];
+};
+
+static struct stat_cache_shared *stat_cache_shared;
+
+/**
+ * Allocate the shared stat cache, called in the parent smbd before forking
+ */
+
+bool stat_cache_shared_init(void)
+{
+	size_t size = (size_t)lp_shared_stat_cache_size() * 1024;
+	size_t num_buckets;
+	struct stat_cache_shared *shared = NULL;
+
+	if (!lp_stat_cache() || (stat_cache_shared != NULL)) {
+		return true;
+	}
+
+	num_buckets = size / (sizeof(struct stat_cache_shared_slot) *
+			      STAT_CACHE_SHARED_WAYS);
+	if (num_buckets == 0) {
+		return true;
+	}
+	num_buckets = MIN(num_buckets, UINT32_MAX);
+
+	shared = anonymous_shared_allocate(
+		offsetof(struct stat_cache_shared, slots) +
+		num_buckets * STAT_CACHE_SHARED_WAYS *
+		sizeof(struct stat_cache_shared_slot));
+	if (shared == NULL) {
+		DBG_WARNING("anonymous_shared_allocate failed: %s\n",
+			    strerror(errno));
+		return false;
+	}
+	shared->num_buckets = num_buckets;
+
+	DBG_INFO("%zu slots in shared stat cache\n",
+		 num_buckets * STAT_CACHE_SHARED_WAYS);
+
+	stat_cache_shared = shared;
+	return true;
+}
+
+/*
+ * Empty all slots by moving to the next generation
+ */
+
+static void stat_cache_shared_flush(void)
+{
+	if (stat_cache_shared == NULL) {
+		return;
+	}
+	__atomic_fetch_add(&stat_cache_shared->generation, 1,
+			   __ATOMIC_RELAXED);
+}
+
+static char *stat_cache_shared_key(TALLOC_CTX *mem_ctx,
+				   connection_struct *conn,
+				   const char *name)
+{
+	/*
+	 * The memcache entries are valid for the current share only,
+	 * these ones are seen by all shares in all processes.
+	 */
+	return talloc_asprintf(mem_ctx, "%c%s\n%s\n%s",
+			       conn->case_sensitive ? 'S' : 'I',
+			       lp_const_servicename(SNUM(conn)),
+			       conn->connectpath,
+			       name);
+}
+
+static struct stat_cache_shared_slot *stat_cache_shared_bucket(
+	uint32_t hash)
+{
+	uint32_t bucket = hash % stat_cache_shared->num_buckets;
+	return &stat_cache_shared->slots[bucket * STAT_CACHE_SHARED_WAYS];
+}
+
+static char *stat_cache_shared_fetch(TALLOC_CTX *mem_ctx, const char *key)
+{
+	size_t keylen = strlen(key);
+	uint32_t hash = tdb_jenkins_hash(&(TDB_DATA) {
+		.dptr = discard_const_p(uint8_t, key), .dsize = keylen });
+	uint32_t generation = __atomic_load_n(&stat_cache_shared->generation,
+					      __ATOMIC_RELAXED);
+	struct stat_cache_shared_slot *slots = stat_cache_shared_bucket(hash);
+	uint8_t buf[sizeof(slots->data)];
+	size_t i;
+
+	for (i=0; i<STAT_CACHE_SHARED_WAYS; i++) {
+		struct stat_cache_shared_slot *slot = &slots[i];
+		uint32_t seq1, seq2;
+		size_t vallen;
+
+		seq1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if ((seq1 & 1) != 0) {
+			continue;
+		}
+		if ((slot->hash != hash) ||
+		    (slot->generation != generation) ||
+		    (slot->keylen != keylen)) {
+			continue;
+		}
+		vallen = slot->vallen;
+		if ((vallen == 0) || (keylen + vallen > sizeof(buf))) {
+			continue;
+		}
+		memcpy(buf, slot->data, keylen + vallen);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+		if (seq1 != seq2) {
+			continue;
+		}
+
+		if ((memcmp(buf, key, keylen) != 0) ||
+		    (buf[keylen + vallen - 1] != '\0')) {
+			continue;
+		}
+
+		DO_PROFILE_INC(statcache_shared_hits);
+		return talloc_memdup(mem_ctx, buf + keylen, vallen);
+	}
+
+	DO_PROFILE_INC(statcache_shared_misses);
+	return NULL;
+}
+
+/*
+ * Store val under key, val == NULL deletes key. Returns false if the
+ * entry does not fit into a slot.
+ */
+
+static bool stat_cache_shared_store(const char *key, const char *val)
+{
+	size_t keylen = strlen(key);
+	size_t vallen = (val != NULL) ? strlen(val) + 1 : 0;
+	uint32_t hash = tdb_jenkins_hash(&(TDB_DATA) {
+		.dptr = discard_const_p(uint8_t, key), .dsize = keylen });
+	uint32_t generation = __atomic_load_n(&stat_cache_shared->generation,
+					      __ATOMIC_RELAXED);
+	struct stat_cache_shared_slot *slots = stat_cache_shared_bucket(hash);
+	struct stat_cache_shared_slot *slot = NULL;
+	struct stat_cache_shared_slot *victim = NULL;
+	bool victim_empty = false;
+	uint32_t seq;
+	size_t i;
+
+	if (keylen + vallen > sizeof(slots->data)) {
+		return false;
+	}
+
+	/*
+	 * Prefer the slot already holding key, then an empty one, then
+	 * the oldest one. The unlocked reads are just a hint.
+	 */
+	for (i=0; i<STAT_CACHE_SHARED_WAYS; i++) {
+		struct stat_cache_shared_slot *s = &slots[i];
+		bool empty = ((s->generation != generation) ||
+			      (s->vallen == 0));
+
+		if (!empty && (s->hash == hash) && (s->keylen == keylen) &&
+		    (memcmp(s->data, key, keylen) == 0)) {
+			slot = s;
+			break;
+		}
+		if (victim_empty) {
+			continue;
+		}
+		if (empty || (victim == NULL) || (s->added < victim->added)) {
+			victim = s;
+			victim_empty = empty;
+		}
+	}
+
+	if (slot == NULL) {
+		if (val == NULL) {
+			return true;
+		}
+		if (!victim_empty) {
+			DO_PROFILE_INC(statcache_shared_evictions);
+		}
+		slot = victim;
+	}
+
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	if (((seq & 1) != 0) ||
+	    !__atomic_compare_exchange_n(&slot->seq, &seq, seq + 1, false,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		/*
+		 * Someone else is writing this slot. For a delete, the
+		 * stat() on the next hit will catch it.
+		 */
+		DO_PROFILE_INC(statcache_shared_collisions);
+		return true;
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->hash = hash;
+	slot->generation = generation;
+	slot->keylen = keylen;
+	slot->vallen = vallen;
+	slot->added = time_mono(NULL);
+	memcpy(slot->data, key, keylen);
+	if (val != NULL) {
+		memcpy(slot->data + keylen, val, vallen);
+		DO_PROFILE_INC(statcache_shared_adds);
+	}
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	return true;
+}
+
 /**
  * Add an entry into the stat cache.
  *
+ * @param conn                 The connection the name was looked up in
  * @param full_orig_name       The original name as specified by the client
  * @param orig_translated_path The name on our filesystem.
  *
@@ -44,14 +304,16 @@
  *
  */
 
-void stat_cache_add( const char *full_orig_name,
-		char *translated_path,
-		bool case_sensitive)
+void stat_cache_add(connection_struct *conn,
+		    const char *full_orig_name,
+		    char *translated_path)
 {
 	size_t translated_path_length;
 	char *original_path;
 	size_t original_path_length;
 	char saved_char;
+	bool case_sensitive = conn->case_sensitive;
+	bool stored = false;
 	TALLOC_CTX *ctx = talloc_tos();
 
 	if (!lp_stat_cache()) {
@@ -132,10 +394,21 @@ void stat_cache_add( const char *full_orig_name,
 	 * New entry or replace old entry.
 	 */
 
-	memcache_add(
-		smbd_memcache(), STAT_CACHE,
-		data_blob_const(original_path, original_path_length),
-		data_blob_const(translated_path, translated_path_length + 1));
+	if (stat_cache_shared != NULL) {
+		char *key = stat_cache_shared_key(ctx, conn, original_path);
+
+		stored = ((key != NULL) &&
+			  stat_cache_shared_store(key, translated_path));
+		TALLOC_FREE(key);
+	}
+
+	if (!stored) {
+		memcache_add(
+			smbd_memcache(), STAT_CACHE,
+			data_blob_const(original_path, original_path_length),
+			data_blob_const(translated_path,
+					translated_path_length + 1));
+	}
 
 	DEBUG(5,("stat_cache_add: Added entry (%lx:size %x) %s -> %s\n",
 		 (unsigned long)translated_path,
@@ -147,6 +420,49 @@ void stat_cache_add( const char *full_orig_name,
 	TALLOC_FREE(original_path);
 }
 
+static char *stat_cache_fetch(connection_struct *conn,
+			      TALLOC_CTX *mem_ctx,
+			      const char *name)
+{
+	DATA_BLOB data_val;
+
+	if (stat_cache_shared != NULL) {
+		char *key = stat_cache_shared_key(talloc_tos(), conn, name);
+		char *translated_path = NULL;
+
+		if (key == NULL) {
+			return NULL;
+		}
+		translated_path = stat_cache_shared_fetch(mem_ctx, key);
+		TALLOC_FREE(key);
+		if (translated_path != NULL) {
+			return translated_path;
+		}
+	}
+
+	if (!memcache_lookup(smbd_memcache(), STAT_CACHE,
+			     data_blob_const(name, strlen(name)),
+			     &data_val)) {
+		return NULL;
+	}
+	return talloc_strdup(mem_ctx, (char *)data_val.data);
+}
+
+static void stat_cache_forget(connection_struct *conn, const char *name)
+{
+	if (stat_cache_shared != NULL) {
+		char *key = stat_cache_shared_key(talloc_tos(), conn, name);
+
+		if (key != NULL) {
+			stat_cache_shared_store(key, NULL);
+			TALLOC_FREE(key);
+		}
+	}
+
+	memcache_delete(smbd_memcache(), STAT_CACHE,
+			data_blob_const(name, strlen(name)));
+}
+
 /**
  * Look through the stat cache for an entry
  *
@@ -178,9 +494,8 @@ bool stat_cache_lookup(connection_struct *conn,
 	size_t namelen;
 	bool sizechanged = False;
 	unsigned int num_components = 0;
-	char *translated_path;
+	char *translated_path = NULL;
 	size_t translated_path_length;
-	DATA_BLOB data_val;
 	char *name;
 	TALLOC_CTX *ctx = talloc_tos();
 	struct smb_filename smb_fname;
@@ -232,12 +547,8 @@ bool stat_cache_lookup(connection_struct *conn,
 	while (1) {
 		char *sp;
 
-		data_val = data_blob_null;
-
-		if (memcache_lookup(
-			    smbd_memcache(), STAT_CACHE,
-			    data_blob_const(chk_name, strlen(chk_name)),
-			    &data_val)) {
+		translated_path = stat_cache_fetch(conn, ctx, chk_name);
+		if (translated_path != NULL) {
 			break;
 		}
 
@@ -271,11 +582,7 @@ bool stat_cache_lookup(connection_struct *conn,
 		}
 	}
 
-	translated_path = talloc_strdup(ctx,(char *)data_val.data);
-	if (!translated_path) {
-		smb_panic("talloc failed");
-	}
-	translated_path_length = data_val.length - 1;
+	translated_path_length = strlen(translated_path);
 
 	DEBUG(10,("stat_cache_lookup: lookup succeeded for name [%s] "
 		  "-> [%s]\n", chk_name, translated_path ));
@@ -292,8 +599,7 @@ bool stat_cache_lookup(connection_struct *conn,
 
 	if (ret != 0) {
 		/* Discard this entry - it doesn't exist in the filesystem. */
-		memcache_delete(smbd_memcache(), STAT_CACHE,
-				data_blob_const(chk_name, strlen(chk_name)));
+		stat_cache_forget(conn, chk_name);
 		TALLOC_FREE(chk_name);
 		TALLOC_FREE(translated_path);
 		return False;
@@ -382,6 +688,256 @@ void stat_cache_delete(const char *name)
 	TALLOC_FREE(lname);
 }
 
+/***************************************************************************
+ Negative stat cache entries.
+
+ Clients probe for lots of names that don't exist (desktop.ini, Thumbs.db
+ and friends). Remember for "negative stat cache timeout" seconds that the
+ last component of a name was not found, together with what unix_convert()
+ returned for it. Creates and renames in any smbd delete the entries via
+ MSG_SMB_NEGATIVE_STAT_CACHE_DELETE, directory removals and renames flush
+ all of them. Changes made outside of smbd are only seen once the entry
+ expired.
+**************************************************************************/
+
+struct stat_cache_negative {
+	time_t expires;
+	int snum;
+	/* followed by connectpath/translated_path including the '\0' */
+};
+
+static char *stat_cache_negative_key(TALLOC_CTX *mem_ctx,
+				     connection_struct *conn,
+				     const char *name)
+{
+	char *key = NULL;
+
+	/*
+	 * Keep in sync with stat_cache_delete_negative(), which
+	 * does not know about the share and deletes both variants.
+	 */
+	if (conn->case_sensitive &&
+	    (conn->fs_capabilities & FILE_CASE_SENSITIVE_SEARCH)) {
+		return talloc_asprintf(mem_ctx, "S%s/%s",
+				       conn->connectpath, name);
+	}
+
+	key = talloc_asprintf(mem_ctx, "I%s/%s", conn->connectpath, name);
+	if (key == NULL) {
+		return NULL;
+	}
+	if (!strupper_m(key + 1)) {
+		TALLOC_FREE(key);
+		return NULL;
+	}
+	return key;
+}
+
+/**
+ * Remember that the last component of a name does not exist
+ *
+ * @param conn            The connection the name was looked up in
+ * @param name            The name (without stream) to be converted
+ * @param translated_path What unix_convert() returned for it
+ */
+
+void stat_cache_add_negative(connection_struct *conn,
+			     const char *name,
+			     const char *translated_path)
+{
+	int timeout = lp_negative_stat_cache_timeout();
+	struct stat_cache_negative neg;
+	char *key = NULL;
+	uint8_t *val = NULL;
+	size_t pathlen, vallen;
+
+	if (!lp_stat_cache() || (timeout <= 0)) {
+		return;
+	}
+
+	key = stat_cache_negative_key(talloc_tos(), conn, name);
+	if (key == NULL) {
+		return;
+	}
+
+	neg = (struct stat_cache_negative) {
+		.expires = time_mono(NULL) + timeout,
+		.snum = SNUM(conn),
+	};
+
+	pathlen = strlen(conn->connectpath);
+	vallen = sizeof(neg) + pathlen + 1 + strlen(translated_path) + 1;
+
+	val = talloc_array(talloc_tos(), uint8_t, vallen);
+	if (val == NULL) {
+		TALLOC_FREE(key);
+		return;
+	}
+	memcpy(val, &neg, sizeof(neg));
+	snprintf((char *)val + sizeof(neg), vallen - sizeof(neg), "%s/%s",
+		 conn->connectpath, translated_path);
+
+	memcache_add(smbd_memcache(), STAT_CACHE_NEGATIVE,
+		     data_blob_const(key, strlen(key)),
+		     data_blob_const(val, vallen));
+
+	DBG_DEBUG("Added negative entry %s -> %s\n", key,
+		  (char *)val + sizeof(neg));
+
+	TALLOC_FREE(val);
+	TALLOC_FREE(key);
+}
+
+/**
+ * Look for a negative entry
+ *
+ * @param conn             The connection we look up in
+ * @param mem_ctx          Where to allocate *translated_path
+ * @param name             The name (without stream) to be converted
+ * @param translated_path  What unix_convert() returned for name before
+ *
+ * @return True if the last component of name is known not to exist
+ */
+
+bool stat_cache_lookup_negative(connection_struct *conn,
+				TALLOC_CTX *mem_ctx,
+				const char *name,
+				char **translated_path)
+{
+	struct stat_cache_negative neg;
+	DATA_BLOB key, val;
+	char *keystr = NULL;
+	const char *path = NULL;
+	size_t pathlen;
+
+	if (!lp_stat_cache() || (lp_negative_stat_cache_timeout() <= 0)) {
+		return false;
+	}
+
+	keystr = stat_cache_negative_key(talloc_tos(), conn, name);
+	if (keystr == NULL) {
+		return false;
+	}
+	key = data_blob_const(keystr, strlen(keystr));
+
+	if (!memcache_lookup(smbd_memcache(), STAT_CACHE_NEGATIVE,
+			     key, &val)) {
+		TALLOC_FREE(keystr);
+		return false;
+	}
+
+	if (val.length <= sizeof(neg)) {
+		memcache_delete(smbd_memcache(), STAT_CACHE_NEGATIVE, key);
+		TALLOC_FREE(keystr);
+		return false;
+	}
+	memcpy(&neg, val.data, sizeof(neg));
+
+	if (neg.expires < time_mono(NULL)) {
+		memcache_delete(smbd_memcache(), STAT_CACHE_NEGATIVE, key);
+		TALLOC_FREE(keystr);
+		return false;
+	}
+	TALLOC_FREE(keystr);
+
+	/*
+	 * Another share with the same path (case insensitively)
+	 * might have added it. Its parameters might make it
+	 * translate names differently.
+	 */
+	if (neg.snum != SNUM(conn)) {
+		return false;
+	}
+
+	path = (const char *)val.data + sizeof(neg);
+	pathlen = strlen(conn->connectpath);
+
+	if ((strncmp(path, conn->connectpath, pathlen) != 0) ||
+	    (path[pathlen] != '/')) {
+		return false;
+	}
+
+	*translated_path = talloc_strdup(mem_ctx, path + pathlen + 1);
+	if (*translated_path == NULL) {
+		return false;
+	}
+
+	DBG_DEBUG("Negative entry for %s -> %s\n", name, *translated_path);
+	return true;
+}
+
+/***************************************************************************
+ Delete the negative entries for a full path on disk. An empty path
+ deletes all of them.
+**************************************************************************/
+
+void stat_cache_delete_negative(const char *fullpath)
+{
+	char *key = NULL;
+
+	if (fullpath[0] == '\0') {
+		DBG_DEBUG("flushing negative entries\n");
+		memcache_flush(smbd_memcache(), STAT_CACHE_NEGATIVE);
+		return;
+	}
+
+	key = talloc_asprintf(talloc_tos(), "S%s", fullpath);
+	if (key == NULL) {
+		memcache_flush(smbd_memcache(), STAT_CACHE_NEGATIVE);
+		return;
+	}
+
+	memcache_delete(smbd_memcache(), STAT_CACHE_NEGATIVE,
+			data_blob_const(key, strlen(key)));
+
+	key[0] = 'I';
+	if (!strupper_m(key + 1)) {
+		TALLOC_FREE(key);
+		memcache_flush(smbd_memcache(), STAT_CACHE_NEGATIVE);
+		return;
+	}
+	memcache_delete(smbd_memcache(), STAT_CACHE_NEGATIVE,
+			data_blob_const(key, strlen(key)));
+
+	TALLOC_FREE(key);
+}
+
+/***************************************************************************
+ Name in conn has been created or renamed, tell all smbd's. A NULL name
+ invalidates all negative entries.
+**************************************************************************/
+
+void stat_cache_invalidate_negative(connection_struct *conn, const char *name)
+{
+	char *fullpath = NULL;
+
+	if (!lp_stat_cache() || (lp_negative_stat_cache_timeout() <= 0)) {
+		return;
+	}
+
+	if (name == NULL) {
+		fullpath = talloc_strdup(talloc_tos(), "");
+	} else if (ISDOT(name)) {
+		fullpath = talloc_strdup(talloc_tos(), conn->connectpath);
+	} else {
+		fullpath = talloc_asprintf(talloc_tos(), "%s/%s",
+					   conn->connectpath, name);
+	}
+	if (fullpath == NULL) {
+		memcache_flush(smbd_memcache(), STAT_CACHE_NEGATIVE);
+		return;
+	}
+
+	stat_cache_delete_negative(fullpath);
+
+	messaging_send_all(conn->sconn->msg_ctx,
+			   MSG_SMB_NEGATIVE_STAT_CACHE_DELETE,
+			   fullpath,
+			   strlen(fullpath)+1);
+
+	TALLOC_FREE(fullpath);
+}
+
 /***************************************************************
  Compute a hash value based on a string key value.
  The function returns the bucket index number for the hashed key.
@@ -408,6 +964,7 @@ bool reset_stat_cache( void )
 		return True;
 
 	memcache_flush(smbd_memcache(), STAT_CACHE);
+	stat_cache_shared_flush();
 
 	return True;
 }
@@ -411,6 +411,14 @@ ssize_t vfs_pwrite_data(struct smb_request *req,
 	if (req && req->unread_bytes) {
 		int sockfd = req->xconn->transport.sock;
 		SMB_ASSERT(req->unread_bytes == N);
+		if ((req->smb2req != NULL) &&
+		    (req->smb2req->recvfile_fd != -1)) {
+			/*
+			 * A signed payload, already received and
+			 * checked, see smbd_smb2_request_stage_recvfile().
+			 */
+			sockfd = req->smb2req->recvfile_fd;
+		}
 		/* VFS_RECVFILE must drain the socket
 		 * before returning. */
 		req->unread_bytes = 0;
@@ -85,6 +85,9 @@ bool torture_casetable(int dummy);
 
 bool run_posix_append(int dummy);
 bool run_case_insensitive_create(int dummy);
+bool run_case_insensitive_bench(int dummy);
+bool run_case_insensitive_index(int dummy);
+bool run_negative_stat_cache(int dummy);
 
 bool run_nbench2(int dummy);
 bool run_async_echo(int dummy);
@@ -114,6 +117,9 @@ bool run_notify_bench3(int dummy);
 bool run_dbwrap_watch1(int dummy);
 bool run_dbwrap_watch2(int dummy);
 bool run_dbwrap_do_locked1(int dummy);
+bool run_dbwrap_do_locked_bench(int dummy);
+bool run_dbwrap_do_locked_multi(int dummy);
+bool run_dbwrap_traverse_parallel_bench(int dummy);
 bool run_idmap_tdb_common_test(int dummy);
 bool run_local_dbwrap_ctdb(int dummy);
 bool run_qpathinfo_bufsize(int dummy);
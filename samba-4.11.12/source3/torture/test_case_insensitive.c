@@ -21,6 +21,9 @@
 #include "torture/proto.h"
 #include "system/filesys.h"
 #include "libsmb/libsmb.h"
+#include "libcli/security/security.h"
+
+extern int torture_numops;
 
 /*
  * Regression test file creates on case insensitive file systems (e.g. OS/X)
@@ -78,3 +81,388 @@ done:
 	torture_close_connection(cli);
 	return NT_STATUS_IS_OK(status);
 }
+
+/*
+ * Create torture_numops files with names that don't exist yet in a
+ * single directory and open them again with a different case. Every
+ * create and every open has to do a case-insensitive lookup in the
+ * directory, without an index on the server this is O(n) per name.
+ */
+
+static bool case_insensitive_bench_create(struct cli_state *cli,
+					  const char *fname,
+					  uint32_t disposition)
+{
+	uint16_t fnum;
+	NTSTATUS status;
+
+	status = cli_ntcreate(cli, fname, 0, SEC_FILE_READ_ATTRIBUTE,
+			      FILE_ATTRIBUTE_NORMAL,
+			      FILE_SHARE_READ|FILE_SHARE_WRITE|
+			      FILE_SHARE_DELETE,
+			      disposition, 0, 0, &fnum, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_ntcreate(%s) failed: %s\n", fname,
+		       nt_errstr(status));
+		return false;
+	}
+	status = cli_close(cli, fnum);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_close failed: %s\n", nt_errstr(status));
+		return false;
+	}
+	return true;
+}
+
+bool run_case_insensitive_bench(int dummy)
+{
+	const char *dname = "case_bench";
+	struct cli_state *cli;
+	struct timeval start;
+	double seconds;
+	NTSTATUS status;
+	bool ret = false;
+	int i;
+
+	printf("Starting case_insensitive_bench\n");
+
+	if (!torture_open_connection(&cli, 0)) {
+		return false;
+	}
+
+	status = cli_mkdir(cli, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_mkdir failed: %s\n", nt_errstr(status));
+		goto done;
+	}
+
+	start = timeval_current();
+
+	for (i=0; i<torture_numops; i++) {
+		char fname[64];
+
+		snprintf(fname, sizeof(fname), "%s\\File%08d", dname, i);
+
+		if (!case_insensitive_bench_create(cli, fname, FILE_CREATE)) {
+			goto cleanup;
+		}
+
+		if ((i+1) % 1000 == 0) {
+			seconds = timeval_elapsed(&start);
+			printf("%d creates in %.2f seconds: %d/sec\n",
+			       i+1, seconds, (int)((i+1)/seconds));
+		}
+	}
+
+	seconds = timeval_elapsed(&start);
+	printf("Created %d files in %.2f seconds: %d/sec\n",
+	       torture_numops, seconds, (int)(torture_numops/seconds));
+
+	start = timeval_current();
+
+	for (i=0; i<torture_numops; i++) {
+		char fname[64];
+
+		snprintf(fname, sizeof(fname), "%s\\FILE%08d", dname, i);
+
+		if (!case_insensitive_bench_create(cli, fname, FILE_OPEN)) {
+			goto cleanup;
+		}
+	}
+
+	seconds = timeval_elapsed(&start);
+	printf("Opened %d files in %.2f seconds: %d/sec\n",
+	       torture_numops, seconds, (int)(torture_numops/seconds));
+
+	ret = true;
+
+cleanup:
+	for (i=0; i<torture_numops; i++) {
+		char fname[64];
+
+		snprintf(fname, sizeof(fname), "%s\\File%08d", dname, i);
+		cli_unlink(cli, fname, FILE_ATTRIBUTE_SYSTEM |
+			   FILE_ATTRIBUTE_HIDDEN);
+	}
+	status = cli_rmdir(cli, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rmdir failed: %s\n", nt_errstr(status));
+		ret = false;
+	}
+done:
+	torture_close_connection(cli);
+	return ret;
+}
+
+/*
+ * Renames and creates done by another client have to be seen by the
+ * directory index of our smbd, also after we changed the directory
+ * ourselves.
+ */
+
+static bool case_insensitive_index_expect(struct cli_state *cli,
+					  const char *fname,
+					  uint32_t disposition,
+					  NTSTATUS expected)
+{
+	uint16_t fnum;
+	NTSTATUS status;
+
+	status = cli_ntcreate(cli, fname, 0, SEC_FILE_READ_ATTRIBUTE,
+			      FILE_ATTRIBUTE_NORMAL,
+			      FILE_SHARE_READ|FILE_SHARE_WRITE|
+			      FILE_SHARE_DELETE,
+			      disposition, 0, 0, &fnum, NULL);
+	if (!NT_STATUS_EQUAL(status, expected)) {
+		printf("cli_ntcreate(%s) returned %s, expected %s\n", fname,
+		       nt_errstr(status), nt_errstr(expected));
+		if (NT_STATUS_IS_OK(status)) {
+			cli_close(cli, fnum);
+		}
+		return false;
+	}
+	if (NT_STATUS_IS_OK(status)) {
+		cli_close(cli, fnum);
+	}
+	return true;
+}
+
+bool run_case_insensitive_index(int dummy)
+{
+	const char *dname = "case_index";
+	const char *fnames[] = {
+		"case_index\\File0", "case_index\\File1",
+		"case_index\\File2", "case_index\\Renamed1",
+		"case_index\\New1", "case_index\\Own1",
+		"case_index\\Own2",
+	};
+	struct cli_state *cli1 = NULL, *cli2 = NULL;
+	NTSTATUS status;
+	bool ret = false;
+	size_t i;
+
+	printf("Starting case_insensitive_index\n");
+
+	if (!torture_open_connection(&cli1, 0) ||
+	    !torture_open_connection(&cli2, 1)) {
+		return false;
+	}
+
+	status = cli_mkdir(cli1, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_mkdir failed: %s\n", nt_errstr(status));
+		goto done;
+	}
+
+	for (i=0; i<3; i++) {
+		if (!case_insensitive_bench_create(cli1, fnames[i],
+						   FILE_CREATE)) {
+			goto cleanup;
+		}
+	}
+
+	/* Looking up a name in a different case builds the index */
+	if (!case_insensitive_index_expect(cli1, "case_index\\FILE0",
+					   FILE_OPEN, NT_STATUS_OK)) {
+		goto cleanup;
+	}
+
+	/* The other client renames and creates behind our back */
+	status = cli_rename(cli2, "case_index\\File1",
+			    "case_index\\Renamed1", false);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rename failed: %s\n", nt_errstr(status));
+		goto cleanup;
+	}
+	if (!case_insensitive_bench_create(cli2, "case_index\\New1",
+					   FILE_CREATE)) {
+		goto cleanup;
+	}
+
+	/* Our own change must not hide the ones above */
+	if (!case_insensitive_bench_create(cli1, "case_index\\Own1",
+					   FILE_CREATE)) {
+		goto cleanup;
+	}
+
+	if (!case_insensitive_index_expect(
+		    cli1, "case_index\\RENAMED1", FILE_OPEN, NT_STATUS_OK) ||
+	    !case_insensitive_index_expect(
+		    cli1, "case_index\\FILE1", FILE_OPEN,
+		    NT_STATUS_OBJECT_NAME_NOT_FOUND) ||
+	    !case_insensitive_index_expect(
+		    cli1, "case_index\\NEW1", FILE_CREATE,
+		    NT_STATUS_OBJECT_NAME_COLLISION)) {
+		goto cleanup;
+	}
+
+	/* Same with a rename back while we change the directory */
+	status = cli_rename(cli2, "case_index\\Renamed1",
+			    "case_index\\File1", false);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rename failed: %s\n", nt_errstr(status));
+		goto cleanup;
+	}
+	if (!case_insensitive_bench_create(cli1, "case_index\\Own2",
+					   FILE_CREATE)) {
+		goto cleanup;
+	}
+	if (!case_insensitive_index_expect(
+		    cli1, "case_index\\FILE1", FILE_CREATE,
+		    NT_STATUS_OBJECT_NAME_COLLISION) ||
+	    !case_insensitive_index_expect(
+		    cli1, "case_index\\RENAMED1", FILE_OPEN,
+		    NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+		goto cleanup;
+	}
+
+	ret = true;
+
+cleanup:
+	for (i=0; i<ARRAY_SIZE(fnames); i++) {
+		cli_unlink(cli1, fnames[i], FILE_ATTRIBUTE_SYSTEM |
+			   FILE_ATTRIBUTE_HIDDEN);
+	}
+	status = cli_rmdir(cli1, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rmdir failed: %s\n", nt_errstr(status));
+		ret = false;
+	}
+done:
+	torture_close_connection(cli1);
+	torture_close_connection(cli2);
+	return ret;
+}
+
+/*
+ * A name another smbd found missing has to show up once a different
+ * client created or renamed it, in whatever case. The server needs
+ * "negative stat cache timeout" set well above the runtime of this
+ * test, so only the invalidation message can make the name visible.
+ */
+
+static NTSTATUS negative_stat_cache_open(struct cli_state *cli,
+					 const char *fname)
+{
+	uint16_t fnum;
+	NTSTATUS status;
+
+	status = cli_ntcreate(cli, fname, 0, SEC_FILE_READ_ATTRIBUTE,
+			      FILE_ATTRIBUTE_NORMAL,
+			      FILE_SHARE_READ|FILE_SHARE_WRITE|
+			      FILE_SHARE_DELETE,
+			      FILE_OPEN, 0, 0, &fnum, NULL);
+	if (NT_STATUS_IS_OK(status)) {
+		cli_close(cli, fnum);
+	}
+	return status;
+}
+
+static bool negative_stat_cache_wait(struct cli_state *cli,
+				     const char *fname)
+{
+	NTSTATUS status;
+	int i;
+
+	/*
+	 * The invalidation is a message between the smbds, it might
+	 * be processed after our next request.
+	 */
+	for (i=0; i<50; i++) {
+		status = negative_stat_cache_open(cli, fname);
+		if (NT_STATUS_IS_OK(status)) {
+			return true;
+		}
+		if (!NT_STATUS_EQUAL(status,
+				     NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+			break;
+		}
+		smb_msleep(100);
+	}
+	printf("open(%s) returned %s\n", fname, nt_errstr(status));
+	return false;
+}
+
+static bool negative_stat_cache_probe(struct cli_state *cli,
+				      const char *fname)
+{
+	NTSTATUS status;
+	int i;
+
+	/* The second probe is answered from the cache */
+	for (i=0; i<2; i++) {
+		status = negative_stat_cache_open(cli, fname);
+		if (!NT_STATUS_EQUAL(status,
+				     NT_STATUS_OBJECT_NAME_NOT_FOUND)) {
+			printf("open(%s) returned %s, expected "
+			       "NT_STATUS_OBJECT_NAME_NOT_FOUND\n",
+			       fname, nt_errstr(status));
+			return false;
+		}
+	}
+	return true;
+}
+
+bool run_negative_stat_cache(int dummy)
+{
+	const char *dname = "neg_stat_cache";
+	struct cli_state *cli1 = NULL, *cli2 = NULL;
+	NTSTATUS status;
+	bool ret = false;
+
+	printf("Starting negative_stat_cache\n");
+
+	if (!torture_open_connection(&cli1, 0) ||
+	    !torture_open_connection(&cli2, 1)) {
+		return false;
+	}
+
+	status = cli_mkdir(cli1, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_mkdir failed: %s\n", nt_errstr(status));
+		goto done;
+	}
+
+	/* Created by the other client in a different case */
+	if (!negative_stat_cache_probe(cli1, "neg_stat_cache\\NewFile")) {
+		goto cleanup;
+	}
+	if (!case_insensitive_bench_create(cli2, "neg_stat_cache\\newfile",
+					   FILE_CREATE)) {
+		goto cleanup;
+	}
+	if (!negative_stat_cache_wait(cli1, "neg_stat_cache\\NewFile")) {
+		goto cleanup;
+	}
+
+	/* Renamed by the other client in a different case */
+	if (!negative_stat_cache_probe(cli1, "neg_stat_cache\\RENAMED")) {
+		goto cleanup;
+	}
+	status = cli_rename(cli2, "neg_stat_cache\\newfile",
+			    "neg_stat_cache\\renamed", false);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rename failed: %s\n", nt_errstr(status));
+		goto cleanup;
+	}
+	if (!negative_stat_cache_wait(cli1, "neg_stat_cache\\RENAMED")) {
+		goto cleanup;
+	}
+
+	ret = true;
+
+cleanup:
+	cli_unlink(cli1, "neg_stat_cache\\newfile",
+		   FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	cli_unlink(cli1, "neg_stat_cache\\renamed",
+		   FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_HIDDEN);
+	status = cli_rmdir(cli1, dname);
+	if (!NT_STATUS_IS_OK(status)) {
+		printf("cli_rmdir failed: %s\n", nt_errstr(status));
+		ret = false;
+	}
+done:
+	torture_close_connection(cli1);
+	torture_close_connection(cli2);
+	return ret;
+}
@@ -24,6 +24,7 @@
 #include "lib/dbwrap/dbwrap_open.h"
 #include "lib/dbwrap/dbwrap_watch.h"
 #include "lib/util/util_tdb.h"
+#include "lib/util/sys_rw.h"
 #include "source3/include/util_tdb.h"
 
 struct do_locked1_state {
@@ -152,3 +153,495 @@ fail:
 	unlink(dbname);
 	return ret;
 }
+
+extern int torture_numops;
+extern int torture_nprocs;
+
+#define DO_LOCKED_BENCH_MAX_SHARDS 16
+
+struct do_locked_bench_state {
+	uint8_t buf[256];
+	size_t len;
+	NTSTATUS status;
+};
+
+static void do_locked_bench_cb(struct db_record *rec, void *private_data)
+{
+	struct do_locked_bench_state *state = private_data;
+
+	if (state->len == 0) {
+		state->status = dbwrap_record_delete(rec);
+		return;
+	}
+
+	state->status = dbwrap_record_store(
+		rec,
+		(TDB_DATA) { .dptr = state->buf, .dsize = state->len },
+		0);
+}
+
+static void do_locked_bench_dbname(fstring dbname, unsigned shard)
+{
+	snprintf(dbname, sizeof(fstring), "test_do_locked_bench.%u.tdb",
+		 shard);
+}
+
+static struct db_context *do_locked_bench_open(TALLOC_CTX *mem_ctx,
+					       unsigned shard)
+{
+	struct db_context *db = NULL;
+	fstring dbname;
+
+	do_locked_bench_dbname(dbname, shard);
+
+	/*
+	 * Same flags as locking.tdb, so that we get mutexes if
+	 * share_mode_lock.c gets them
+	 */
+	db = db_open(mem_ctx, dbname, SMB_OPEN_DATABASE_TDB_HASH_SIZE,
+		     TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|
+		     TDB_INCOMPATIBLE_HASH|TDB_SEQNUM,
+		     O_CREAT|O_RDWR, 0644,
+		     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		fprintf(stderr, "db_open(%s) failed: %s\n", dbname,
+			strerror(errno));
+	}
+	return db;
+}
+
+/*
+ * Every child adds and removes records of its own files. This is
+ * what a lot of processes opening and closing files do to
+ * locking.tdb, spread over num_shards databases like
+ * share_mode_lock.c does with "locking database shards".
+ */
+
+static bool do_locked_bench_child(unsigned child,
+				  unsigned num_shards,
+				  int start_fd)
+{
+	struct db_context *dbs[DO_LOCKED_BENCH_MAX_SHARDS];
+	struct do_locked_bench_state state = { .status = NT_STATUS_OK };
+	unsigned i;
+	char c;
+
+	for (i=0; i<num_shards; i++) {
+		dbs[i] = do_locked_bench_open(talloc_tos(), i);
+		if (dbs[i] == NULL) {
+			return false;
+		}
+	}
+
+	memset(state.buf, child, sizeof(state.buf));
+
+	if (sys_read(start_fd, &c, sizeof(c)) != 0) {
+		fprintf(stderr, "read from start pipe failed\n");
+		return false;
+	}
+
+	for (i=0; i<(unsigned)torture_numops; i++) {
+		struct file_id id = {
+			.devid = child, .inode = i % 64, .extid = 0,
+		};
+		uint64_t hash;
+		unsigned shard, phase;
+		NTSTATUS status;
+
+		hash = (id.devid ^ id.inode ^ id.extid) *
+			0x9e3779b97f4a7c15ULL;
+		shard = (hash >> 32) % num_shards;
+
+		/* Opens grow the record, the last close deletes it */
+		phase = (i / 64) % 4;
+		state.len = (phase == 3) ? 0 : (phase + 1) * 64;
+
+		status = dbwrap_do_locked(
+			dbs[shard],
+			make_tdb_data((uint8_t *)&id, sizeof(id)),
+			do_locked_bench_cb,
+			&state);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "dbwrap_do_locked failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
+		if (!NT_STATUS_IS_OK(state.status)) {
+			fprintf(stderr, "store/delete failed: %s\n",
+				nt_errstr(state.status));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool do_locked_bench_run(unsigned num_shards)
+{
+	struct db_context *dbs[DO_LOCKED_BENCH_MAX_SHARDS];
+	int start_pipe[2];
+	struct timeval start;
+	double secs;
+	unsigned i;
+	bool ret = true;
+
+	/* Create the databases, keep them open for CLEAR_IF_FIRST */
+	for (i=0; i<num_shards; i++) {
+		dbs[i] = do_locked_bench_open(talloc_tos(), i);
+		if (dbs[i] == NULL) {
+			return false;
+		}
+	}
+
+	if (pipe(start_pipe) != 0) {
+		perror("pipe failed");
+		return false;
+	}
+
+	for (i=0; i<(unsigned)torture_nprocs; i++) {
+		pid_t child = fork();
+
+		if (child == -1) {
+			perror("fork failed");
+			return false;
+		}
+		if (child == 0) {
+			bool ok;
+			close(start_pipe[1]);
+			ok = do_locked_bench_child(i, num_shards,
+						   start_pipe[0]);
+			exit(ok ? 0 : 1);
+		}
+	}
+
+	close(start_pipe[0]);
+
+	/* Give the children time to open the databases */
+	smb_msleep(100);
+
+	start = timeval_current();
+	close(start_pipe[1]);
+
+	for (i=0; i<(unsigned)torture_nprocs; i++) {
+		int status;
+
+		if (wait(&status) == -1) {
+			perror("wait failed");
+			return false;
+		}
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			ret = false;
+		}
+	}
+
+	secs = timeval_elapsed(&start);
+
+	printf("%2u shards: %10.0f ops/sec\n", num_shards,
+	       (double)torture_nprocs * torture_numops / secs);
+
+	for (i=0; i<num_shards; i++) {
+		fstring dbname;
+
+		TALLOC_FREE(dbs[i]);
+		do_locked_bench_dbname(dbname, i);
+		unlink(dbname);
+	}
+
+	return ret;
+}
+
+bool run_dbwrap_do_locked_bench(int dummy)
+{
+	unsigned num_shards;
+
+	printf("%d processes, %d operations each\n",
+	       torture_nprocs, torture_numops);
+
+	for (num_shards = 1;
+	     num_shards <= DO_LOCKED_BENCH_MAX_SHARDS;
+	     num_shards *= 2) {
+		bool ok = do_locked_bench_run(num_shards);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#define DO_LOCKED_MULTI_NUM_KEYS 8
+
+struct do_locked_multi_state {
+	uint32_t values[3];
+	NTSTATUS status;
+};
+
+static void do_locked_multi_store_cb(struct db_record **recs,
+				     size_t num_recs,
+				     void *private_data)
+{
+	struct do_locked_multi_state *state = private_data;
+	size_t i;
+
+	for (i=0; i<num_recs; i++) {
+		state->status = dbwrap_record_store(
+			recs[i],
+			make_tdb_data((uint8_t *)&state->values[i],
+				      sizeof(uint32_t)),
+			0);
+		if (!NT_STATUS_IS_OK(state->status)) {
+			return;
+		}
+	}
+}
+
+/*
+ * Move the value of the first record to the second one, like a
+ * rename does.
+ */
+static void do_locked_multi_move_cb(struct db_record **recs,
+				    size_t num_recs,
+				    void *private_data)
+{
+	struct do_locked_multi_state *state = private_data;
+	TDB_DATA value = dbwrap_record_get_value(recs[0]);
+
+	state->status = dbwrap_record_store(recs[1], value, 0);
+	if (!NT_STATUS_IS_OK(state->status)) {
+		return;
+	}
+	state->status = dbwrap_record_delete(recs[0]);
+}
+
+static void do_locked_multi_incr_cb(struct db_record **recs,
+				    size_t num_recs,
+				    void *private_data)
+{
+	struct do_locked_multi_state *state = private_data;
+	size_t i;
+
+	for (i=0; i<num_recs; i++) {
+		TDB_DATA value = dbwrap_record_get_value(recs[i]);
+		uint32_t val = 0;
+
+		if (value.dsize == sizeof(val)) {
+			memcpy(&val, value.dptr, sizeof(val));
+		}
+		val += 1;
+
+		state->status = dbwrap_record_store(
+			recs[i], make_tdb_data((uint8_t *)&val, sizeof(val)),
+			0);
+		if (!NT_STATUS_IS_OK(state->status)) {
+			return;
+		}
+	}
+}
+
+static void do_locked_multi_parse_u32(TDB_DATA key, TDB_DATA value,
+				      void *private_data)
+{
+	uint32_t *val = private_data;
+
+	if (value.dsize == sizeof(*val)) {
+		memcpy(val, value.dptr, sizeof(*val));
+	}
+}
+
+static TDB_DATA do_locked_multi_key(unsigned i)
+{
+	static const uint32_t keys[DO_LOCKED_MULTI_NUM_KEYS] = {
+		0, 1, 2, 3, 4, 5, 6, 7
+	};
+	return make_tdb_data((const uint8_t *)&keys[i], sizeof(keys[i]));
+}
+
+/*
+ * Every child increments three records per operation, handing the
+ * keys to dbwrap_do_locked_multi in a child-specific order. Without
+ * ordered locking the children would deadlock.
+ */
+static bool do_locked_multi_child(struct db_context *db, unsigned child)
+{
+	struct do_locked_multi_state state = { .status = NT_STATUS_OK };
+	unsigned i;
+
+	for (i=0; i<(unsigned)torture_numops; i++) {
+		unsigned k = i + child;
+		TDB_DATA keys[3];
+		NTSTATUS status;
+
+		keys[0] = do_locked_multi_key(k % DO_LOCKED_MULTI_NUM_KEYS);
+		keys[1] = do_locked_multi_key(
+			(k + 3) % DO_LOCKED_MULTI_NUM_KEYS);
+		keys[2] = do_locked_multi_key(
+			(k + 5) % DO_LOCKED_MULTI_NUM_KEYS);
+
+		if ((child % 2) == 1) {
+			TDB_DATA tmp = keys[0];
+			keys[0] = keys[2];
+			keys[2] = tmp;
+		}
+
+		status = dbwrap_do_locked_multi(
+			db, keys, ARRAY_SIZE(keys),
+			do_locked_multi_incr_cb, &state);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "dbwrap_do_locked_multi failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
+		if (!NT_STATUS_IS_OK(state.status)) {
+			fprintf(stderr, "store failed: %s\n",
+				nt_errstr(state.status));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool run_dbwrap_do_locked_multi(int dummy)
+{
+	struct messaging_context *msg;
+	struct db_context *backend;
+	struct db_context *db;
+	const char *dbname = "test_do_locked_multi.tdb";
+	struct do_locked_multi_state state = {
+		.values = { 1, 2, 3 },
+	};
+	TDB_DATA keys[3];
+	uint32_t val, sum;
+	unsigned i;
+	int ret = false;
+	NTSTATUS status;
+
+	msg = global_messaging_context();
+	if (msg == NULL) {
+		fprintf(stderr, "global_messaging_context() failed\n");
+		return false;
+	}
+
+	backend = db_open(talloc_tos(), dbname, 0,
+			  TDB_CLEAR_IF_FIRST, O_CREAT|O_RDWR, 0644,
+			  DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (backend == NULL) {
+		fprintf(stderr, "db_open failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	db = db_open_watched(talloc_tos(), &backend, msg);
+	if (db == NULL) {
+		fprintf(stderr, "db_open_watched failed: %s\n",
+			strerror(errno));
+		return false;
+	}
+
+	for (i=0; i<ARRAY_SIZE(keys); i++) {
+		keys[i] = do_locked_multi_key(i);
+	}
+
+	status = dbwrap_do_locked_multi(db, keys, ARRAY_SIZE(keys),
+					do_locked_multi_store_cb, &state);
+	if (!NT_STATUS_IS_OK(status) || !NT_STATUS_IS_OK(state.status)) {
+		fprintf(stderr, "dbwrap_do_locked_multi failed: %s/%s\n",
+			nt_errstr(status), nt_errstr(state.status));
+		goto fail;
+	}
+
+	for (i=0; i<ARRAY_SIZE(keys); i++) {
+		val = 0;
+		status = dbwrap_parse_record(db, keys[i],
+					     do_locked_multi_parse_u32, &val);
+		if (!NT_STATUS_IS_OK(status) || (val != state.values[i])) {
+			fprintf(stderr, "key %u: got %"PRIu32" (%s), "
+				"expected %"PRIu32"\n", i, val,
+				nt_errstr(status), state.values[i]);
+			goto fail;
+		}
+	}
+
+	keys[1] = do_locked_multi_key(7);
+	status = dbwrap_do_locked_multi(db, keys, 2,
+					do_locked_multi_move_cb, &state);
+	if (!NT_STATUS_IS_OK(status) || !NT_STATUS_IS_OK(state.status)) {
+		fprintf(stderr, "dbwrap_do_locked_multi failed: %s/%s\n",
+			nt_errstr(status), nt_errstr(state.status));
+		goto fail;
+	}
+	if (dbwrap_exists(db, keys[0])) {
+		fprintf(stderr, "moved record still exists\n");
+		goto fail;
+	}
+	val = 0;
+	status = dbwrap_parse_record(db, keys[1],
+				     do_locked_multi_parse_u32, &val);
+	if (!NT_STATUS_IS_OK(status) || (val != 1)) {
+		fprintf(stderr, "move target: got %"PRIu32" (%s)\n", val,
+			nt_errstr(status));
+		goto fail;
+	}
+
+	keys[2] = keys[1];
+	status = dbwrap_do_locked_multi(db, keys, 3,
+					do_locked_multi_store_cb, &state);
+	if (!NT_STATUS_EQUAL(status, NT_STATUS_INVALID_PARAMETER)) {
+		fprintf(stderr, "duplicate keys returned %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+
+	for (i=0; i<DO_LOCKED_MULTI_NUM_KEYS; i++) {
+		dbwrap_delete(db, do_locked_multi_key(i));
+	}
+
+	for (i=0; i<(unsigned)torture_nprocs; i++) {
+		pid_t child = fork();
+
+		if (child == -1) {
+			perror("fork failed");
+			goto fail;
+		}
+		if (child == 0) {
+			bool ok;
+			ok = do_locked_multi_child(db, i);
+			exit(ok ? 0 : 1);
+		}
+	}
+
+	ret = true;
+
+	for (i=0; i<(unsigned)torture_nprocs; i++) {
+		int wstatus;
+
+		if (wait(&wstatus) == -1) {
+			perror("wait failed");
+			ret = false;
+			break;
+		}
+		if (!WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0)) {
+			ret = false;
+		}
+	}
+	if (!ret) {
+		goto fail;
+	}
+
+	sum = 0;
+	for (i=0; i<DO_LOCKED_MULTI_NUM_KEYS; i++) {
+		val = 0;
+		dbwrap_parse_record(db, do_locked_multi_key(i),
+				    do_locked_multi_parse_u32, &val);
+		sum += val;
+	}
+	if (sum != (uint32_t)torture_nprocs * torture_numops * 3) {
+		fprintf(stderr, "Got %"PRIu32" increments, expected %d\n",
+			sum, torture_nprocs * torture_numops * 3);
+		ret = false;
+	}
+
+fail:
+	TALLOC_FREE(db);
+	unlink(dbname);
+	return ret;
+}
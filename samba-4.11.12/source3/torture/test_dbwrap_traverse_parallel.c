@@ -0,0 +1,192 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Benchmark dbwrap_traverse_read_parallel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "torture/proto.h"
+#include "system/filesys.h"
+#include "lib/dbwrap/dbwrap.h"
+#include "lib/dbwrap/dbwrap_open.h"
+#include "lib/util/util_tdb.h"
+
+extern int torture_numops;
+
+#define TRAVERSE_BENCH_RECORDS_PER_OP 1000
+#define TRAVERSE_BENCH_VALUE_SIZE 200
+#define TRAVERSE_BENCH_MAX_THREADS 8
+
+struct traverse_bench_state {
+	uint64_t sum;
+	uint64_t count;
+};
+
+/*
+ * Look at every byte of the value, like the parsers of smbstatus or
+ * the scavenger have to.
+ */
+static int traverse_bench_fn(struct db_record *rec, void *private_data)
+{
+	struct traverse_bench_state *state = private_data;
+	TDB_DATA value = dbwrap_record_get_value(rec);
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i=0; i<value.dsize; i++) {
+		sum += value.dptr[i];
+	}
+
+	__atomic_fetch_add(&state->sum, sum, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&state->count, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+/*
+ * Fill a database shaped like a busy locking.tdb: file_id keys with
+ * share mode entries of a few hundred bytes.
+ */
+static bool traverse_bench_fill(struct db_context *db, unsigned num_records,
+				uint64_t *expected)
+{
+	uint8_t value[TRAVERSE_BENCH_VALUE_SIZE];
+	unsigned i;
+	size_t j;
+
+	*expected = 0;
+
+	for (i=0; i<num_records; i++) {
+		uint64_t key[3] = { 0x801, i, 0 };
+		NTSTATUS status;
+
+		for (j=0; j<sizeof(value); j++) {
+			value[j] = (i + j) & 0xff;
+			*expected += value[j];
+		}
+
+		status = dbwrap_store(
+			db,
+			make_tdb_data((uint8_t *)key, sizeof(key)),
+			make_tdb_data(value, sizeof(value)),
+			0);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "dbwrap_store failed: %s\n",
+				nt_errstr(status));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool traverse_bench_check(const char *desc,
+				 const struct traverse_bench_state *state,
+				 int count, unsigned num_records,
+				 uint64_t expected, struct timeval *start)
+{
+	double secs = timeval_elapsed(start);
+
+	printf("%-12s %8.3f secs, %10.0f records/sec\n", desc, secs,
+	       num_records / secs);
+
+	if ((count != (int)num_records) ||
+	    (state->count != num_records) ||
+	    (state->sum != expected)) {
+		fprintf(stderr, "%s: got %d/%"PRIu64" records, sum %"PRIu64
+			", expected %u records, sum %"PRIu64"\n", desc,
+			count, state->count, state->sum, num_records,
+			expected);
+		return false;
+	}
+	return true;
+}
+
+bool run_dbwrap_traverse_parallel_bench(int dummy)
+{
+	const char *dbname = "test_traverse_parallel_bench.tdb";
+	struct db_context *db = NULL;
+	struct traverse_bench_state state;
+	struct timeval start;
+	unsigned num_records, num_threads;
+	uint64_t expected;
+	NTSTATUS status;
+	int count;
+	bool ret = false;
+	bool ok;
+
+	num_records = (unsigned)torture_numops * TRAVERSE_BENCH_RECORDS_PER_OP;
+
+	db = db_open(talloc_tos(), dbname, SMB_OPEN_DATABASE_TDB_HASH_SIZE,
+		     TDB_DEFAULT|TDB_VOLATILE|TDB_CLEAR_IF_FIRST|
+		     TDB_INCOMPATIBLE_HASH|TDB_SEQNUM,
+		     O_CREAT|O_RDWR, 0644,
+		     DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
+	if (db == NULL) {
+		fprintf(stderr, "db_open(%s) failed: %s\n", dbname,
+			strerror(errno));
+		return false;
+	}
+
+	ok = traverse_bench_fill(db, num_records, &expected);
+	if (!ok) {
+		goto fail;
+	}
+
+	printf("%u records\n", num_records);
+
+	state = (struct traverse_bench_state) { .sum = 0 };
+	start = timeval_current();
+	status = dbwrap_traverse_read(db, traverse_bench_fn, &state, &count);
+	if (!NT_STATUS_IS_OK(status)) {
+		fprintf(stderr, "dbwrap_traverse_read failed: %s\n",
+			nt_errstr(status));
+		goto fail;
+	}
+	ok = traverse_bench_check("sequential", &state, count, num_records,
+				  expected, &start);
+	if (!ok) {
+		goto fail;
+	}
+
+	for (num_threads = 1;
+	     num_threads <= TRAVERSE_BENCH_MAX_THREADS;
+	     num_threads *= 2) {
+		fstring desc;
+
+		state = (struct traverse_bench_state) { .sum = 0 };
+		start = timeval_current();
+		status = dbwrap_traverse_read_parallel(
+			db, traverse_bench_fn, &state, num_threads, &count);
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "dbwrap_traverse_read_parallel "
+				"failed: %s\n", nt_errstr(status));
+			goto fail;
+		}
+
+		snprintf(desc, sizeof(desc), "%u threads", num_threads);
+		ok = traverse_bench_check(desc, &state, count, num_records,
+					  expected, &start);
+		if (!ok) {
+			goto fail;
+		}
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(db);
+	unlink(dbname);
+	return ret;
+}
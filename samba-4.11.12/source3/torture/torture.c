@@ -13880,6 +13880,18 @@ static struct {
 		.name  = "CASE-INSENSITIVE-CREATE",
 		.fn    = run_case_insensitive_create,
 	},
+	{
+		.name  = "CASE-INSENSITIVE-BENCH",
+		.fn    = run_case_insensitive_bench,
+	},
+	{
+		.name  = "CASE-INSENSITIVE-INDEX",
+		.fn    = run_case_insensitive_index,
+	},
+	{
+		.name  = "NEGATIVE-STAT-CACHE",
+		.fn    = run_negative_stat_cache,
+	},
 	{
 		.name  = "ASYNC-ECHO",
 		.fn    = run_async_echo,
@@ -14154,6 +14166,18 @@ static struct {
 		.name  = "LOCAL-DBWRAP-DO-LOCKED1",
 		.fn    = run_dbwrap_do_locked1,
 	},
+	{
+		.name  = "LOCAL-DBWRAP-DO-LOCKED-BENCH",
+		.fn    = run_dbwrap_do_locked_bench,
+	},
+	{
+		.name  = "LOCAL-DBWRAP-DO-LOCKED-MULTI",
+		.fn    = run_dbwrap_do_locked_multi,
+	},
+	{
+		.name  = "LOCAL-DBWRAP-TRAVERSE-PARALLEL-BENCH",
+		.fn    = run_dbwrap_traverse_parallel_bench,
+	},
 	{
 		.name  = "LOCAL-MESSAGING-READ1",
 		.fn    = run_messaging_read1,
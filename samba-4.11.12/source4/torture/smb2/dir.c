@@ -1404,6 +1404,456 @@ done:
 	return ret;
 }
 
+/*
+  count the entries of DNAME, if stop_early is set only read the first
+  batch and close the handle in the middle of the listing
+*/
+
+static bool count_dir_entries(struct torture_context *tctx,
+			      struct smb2_tree *tree,
+			      bool stop_early,
+			      unsigned int *num_entries)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	struct smb2_create create;
+	struct smb2_handle h;
+	struct smb2_find f;
+	union smb_search_data *d;
+	NTSTATUS status;
+	bool ret = true;
+	unsigned int count;
+
+	*num_entries = 0;
+
+	ZERO_STRUCT(create);
+	create.in.desired_access = SEC_RIGHTS_DIR_ALL;
+	create.in.create_options = NTCREATEX_OPTIONS_DIRECTORY;
+	create.in.file_attributes = FILE_ATTRIBUTE_DIRECTORY;
+	create.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+				 NTCREATEX_SHARE_ACCESS_WRITE |
+				 NTCREATEX_SHARE_ACCESS_DELETE;
+	create.in.create_disposition = NTCREATEX_DISP_OPEN;
+	create.in.fname = DNAME;
+
+	status = smb2_create(tree, mem_ctx, &create);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "");
+	h = create.out.file.handle;
+
+	ZERO_STRUCT(f);
+	f.in.file.handle	= h;
+	f.in.pattern		= "*";
+	f.in.max_response_size	= 0x100;
+	f.in.level		= SMB2_FIND_BOTH_DIRECTORY_INFO;
+
+	do {
+		status = smb2_find_level(tree, mem_ctx, &f, &count, &d);
+		if (NT_STATUS_EQUAL(status, STATUS_NO_MORE_FILES)) {
+			break;
+		}
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, close,
+						"");
+		*num_entries += count;
+	} while (!stop_early && count != 0);
+
+ close:
+	smb2_util_close(tree, h);
+ done:
+	talloc_free(mem_ctx);
+	return ret;
+}
+
+/*
+  close directory handles in the middle of a listing, before and after
+  a complete listing has been read. This must neither upset a cached
+  listing on the server nor change the result of later listings.
+*/
+
+static bool test_partial_close(struct torture_context *tctx,
+			       struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	struct smb2_handle h;
+	struct file_elem files[NFILES] = {};
+	NTSTATUS status;
+	bool ret = true;
+	unsigned int num_entries;
+	int i;
+
+	status = populate_tree(tctx, mem_ctx, tree, files, NFILES, &h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "");
+	smb2_util_close(tree, h);
+
+	for (i = 0; i < 3; i++) {
+		ret = count_dir_entries(tctx, tree, true, &num_entries);
+		torture_assert_goto(tctx, ret, ret, done, "partial listing");
+		torture_assert_goto(tctx, num_entries > 0, ret, done,
+				    "no entries in partial listing");
+		torture_assert_goto(tctx, num_entries < NFILES + 2, ret, done,
+				    "partial listing is complete");
+	}
+
+	for (i = 0; i < 3; i++) {
+		ret = count_dir_entries(tctx, tree, false, &num_entries);
+		torture_assert_goto(tctx, ret, ret, done, "full listing");
+		torture_assert_int_equal_goto(tctx, num_entries, NFILES + 2,
+					      ret, done, "full listing");
+
+		ret = count_dir_entries(tctx, tree, true, &num_entries);
+		torture_assert_goto(tctx, ret, ret, done, "partial listing");
+		torture_assert_goto(tctx, num_entries > 0, ret, done,
+				    "no entries in partial listing");
+	}
+
+ done:
+	smb2_deltree(tree, DNAME);
+	talloc_free(mem_ctx);
+
+	return ret;
+}
+
+/*
+  find the size and attributes of NAME in a listing of DNAME
+*/
+
+static bool find_dir_entry(struct torture_context *tctx,
+			   struct smb2_tree *tree,
+			   const char *name,
+			   uint64_t *size,
+			   uint32_t *attrib)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	struct smb2_create create;
+	struct smb2_handle h;
+	struct smb2_find f;
+	union smb_search_data *d;
+	NTSTATUS status;
+	bool ret = true;
+	bool found = false;
+	unsigned int count, i;
+
+	ZERO_STRUCT(create);
+	create.in.desired_access = SEC_RIGHTS_DIR_ALL;
+	create.in.create_options = NTCREATEX_OPTIONS_DIRECTORY;
+	create.in.file_attributes = FILE_ATTRIBUTE_DIRECTORY;
+	create.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+				 NTCREATEX_SHARE_ACCESS_WRITE |
+				 NTCREATEX_SHARE_ACCESS_DELETE;
+	create.in.create_disposition = NTCREATEX_DISP_OPEN;
+	create.in.fname = DNAME;
+
+	status = smb2_create(tree, mem_ctx, &create);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "");
+	h = create.out.file.handle;
+
+	ZERO_STRUCT(f);
+	f.in.file.handle	= h;
+	f.in.pattern		= "*";
+	f.in.max_response_size	= 0x10000;
+	f.in.level		= SMB2_FIND_BOTH_DIRECTORY_INFO;
+
+	do {
+		status = smb2_find_level(tree, mem_ctx, &f, &count, &d);
+		if (NT_STATUS_EQUAL(status, STATUS_NO_MORE_FILES)) {
+			break;
+		}
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, close,
+						"");
+		for (i = 0; i < count; i++) {
+			if (strcmp(d[i].both_directory_info.name.s,
+				   name) == 0) {
+				*size = d[i].both_directory_info.size;
+				*attrib = d[i].both_directory_info.attrib;
+				found = true;
+			}
+		}
+	} while (count != 0);
+
+	torture_assert_goto(tctx, found, ret, close, "file not listed");
+
+ close:
+	smb2_util_close(tree, h);
+ done:
+	talloc_free(mem_ctx);
+	return ret;
+}
+
+/*
+  writing to a file changes neither the directory nor its timestamps,
+  listings must still show the new size
+*/
+
+static bool test_write_size(struct torture_context *tctx,
+			    struct smb2_tree *tree)
+{
+	const char *fname = DNAME "\\write_size.dat";
+	struct smb2_create create;
+	struct smb2_handle h = { .data = { 0 } };
+	uint8_t buf[4096];
+	uint64_t size;
+	uint32_t attrib;
+	NTSTATUS status;
+	bool ret = true;
+	int i;
+
+	smb2_deltree(tree, DNAME);
+
+	status = smb2_util_mkdir(tree, DNAME);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "mkdir");
+
+	ZERO_STRUCT(create);
+	create.in.desired_access = SEC_RIGHTS_FILE_ALL;
+	create.in.file_attributes = FILE_ATTRIBUTE_NORMAL;
+	create.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+				 NTCREATEX_SHARE_ACCESS_WRITE |
+				 NTCREATEX_SHARE_ACCESS_DELETE;
+	create.in.create_disposition = NTCREATEX_DISP_CREATE;
+	create.in.fname = fname;
+
+	status = smb2_create(tree, tctx, &create);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "create");
+	h = create.out.file.handle;
+
+	/* The second listing can come from the cache */
+	for (i = 0; i < 2; i++) {
+		ret = find_dir_entry(tctx, tree, "write_size.dat",
+				     &size, &attrib);
+		torture_assert_goto(tctx, ret, ret, done, "listing");
+		torture_assert_u64_equal_goto(tctx, size, 0, ret, done,
+					      "size before write");
+	}
+
+	memset(buf, 'x', sizeof(buf));
+
+	status = smb2_util_write(tree, h, buf, 0, sizeof(buf));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write");
+
+	ret = find_dir_entry(tctx, tree, "write_size.dat", &size, &attrib);
+	torture_assert_goto(tctx, ret, ret, done, "listing");
+	torture_assert_u64_equal_goto(tctx, size, sizeof(buf), ret, done,
+				      "size after write");
+
+	status = smb2_util_write(tree, h, buf, sizeof(buf), sizeof(buf));
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "write");
+
+	status = smb2_util_close(tree, h);
+	ZERO_STRUCT(h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "close");
+
+	ret = find_dir_entry(tctx, tree, "write_size.dat", &size, &attrib);
+	torture_assert_goto(tctx, ret, ret, done, "listing");
+	torture_assert_u64_equal_goto(tctx, size, 2 * sizeof(buf), ret, done,
+				      "size after close");
+
+ done:
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree, h);
+	}
+	smb2_deltree(tree, DNAME);
+	return ret;
+}
+
+/*
+  a write to an open file only updates its write time after
+  "smbd:writetimeupdatedelay", until then listings show the write time
+  from the open, which is kept in locking.tdb. Use enough files to
+  span several "smbd search batch size" batches.
+*/
+
+#define NUM_PENDING_FILES 40
+
+static bool test_pending_write_time(struct torture_context *tctx,
+				    struct smb2_tree *tree)
+{
+	const int num_files = NUM_PENDING_FILES;
+	struct smb2_handle h[NUM_PENDING_FILES];
+	NTTIME write_times[NUM_PENDING_FILES];
+	bool seen[NUM_PENDING_FILES];
+	struct smb2_create create;
+	struct smb2_handle dh = { .data = { 0 } };
+	struct smb2_find f;
+	union smb_search_data *d;
+	struct timeval start;
+	double delay;
+	unsigned int count, i;
+	uint8_t buf = 'x';
+	NTSTATUS status;
+	bool ret = true;
+	int n;
+
+	ZERO_STRUCT(h);
+	ZERO_STRUCT(seen);
+
+	delay = torture_setting_int(tctx, "writetimeupdatedelay", 2000000);
+
+	smb2_deltree(tree, DNAME);
+
+	status = smb2_util_mkdir(tree, DNAME);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "mkdir");
+
+	for (n = 0; n < num_files; n++) {
+		ZERO_STRUCT(create);
+		create.in.desired_access = SEC_RIGHTS_FILE_ALL;
+		create.in.file_attributes = FILE_ATTRIBUTE_NORMAL;
+		create.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+					 NTCREATEX_SHARE_ACCESS_WRITE |
+					 NTCREATEX_SHARE_ACCESS_DELETE;
+		create.in.create_disposition = NTCREATEX_DISP_CREATE;
+		create.in.fname = talloc_asprintf(tctx, DNAME "\\pending-%d",
+						  n);
+		torture_assert_goto(tctx, create.in.fname != NULL, ret, done,
+				    "talloc_asprintf");
+
+		status = smb2_create(tree, tctx, &create);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"create");
+		h[n] = create.out.file.handle;
+		write_times[n] = create.out.write_time;
+	}
+
+	/* Let the on-disk write times move on */
+	smb_msleep(100);
+
+	start = timeval_current();
+
+	for (n = 0; n < num_files; n++) {
+		status = smb2_util_write(tree, h[n], &buf, 0, 1);
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"write");
+	}
+
+	ZERO_STRUCT(create);
+	create.in.desired_access = SEC_RIGHTS_DIR_ALL;
+	create.in.create_options = NTCREATEX_OPTIONS_DIRECTORY;
+	create.in.file_attributes = FILE_ATTRIBUTE_DIRECTORY;
+	create.in.share_access = NTCREATEX_SHARE_ACCESS_READ |
+				 NTCREATEX_SHARE_ACCESS_WRITE |
+				 NTCREATEX_SHARE_ACCESS_DELETE;
+	create.in.create_disposition = NTCREATEX_DISP_OPEN;
+	create.in.fname = DNAME;
+
+	status = smb2_create(tree, tctx, &create);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"create dir");
+	dh = create.out.file.handle;
+
+	ZERO_STRUCT(f);
+	f.in.file.handle	= dh;
+	f.in.pattern		= "pending-*";
+	f.in.max_response_size	= 0x10000;
+	f.in.level		= SMB2_FIND_BOTH_DIRECTORY_INFO;
+
+	do {
+		status = smb2_find_level(tree, tctx, &f, &count, &d);
+		if (NT_STATUS_EQUAL(status, STATUS_NO_MORE_FILES)) {
+			break;
+		}
+		torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+						"find");
+
+		for (i = 0; i < count; i++) {
+			const char *name = d[i].both_directory_info.name.s;
+
+			if (sscanf(name, "pending-%d", &n) != 1 ||
+			    n < 0 || n >= num_files) {
+				continue;
+			}
+			seen[n] = true;
+
+			if (timeval_elapsed(&start) * 1000000 >= delay) {
+				continue;
+			}
+			torture_assert_u64_equal_goto(
+				tctx,
+				d[i].both_directory_info.write_time,
+				write_times[n],
+				ret, done,
+				talloc_asprintf(tctx, "write time of %s",
+						name));
+		}
+	} while (count != 0);
+
+	if (timeval_elapsed(&start) * 1000000 >= delay) {
+		torture_skip_goto(tctx, done,
+				  "listing took longer than the write time "
+				  "update delay\n");
+	}
+
+	for (n = 0; n < num_files; n++) {
+		torture_assert_goto(tctx, seen[n], ret, done,
+				    talloc_asprintf(tctx, "pending-%d not "
+						    "listed", n));
+	}
+
+ done:
+	if (!smb2_util_handle_empty(dh)) {
+		smb2_util_close(tree, dh);
+	}
+	for (n = 0; n < num_files; n++) {
+		if (!smb2_util_handle_empty(h[n])) {
+			smb2_util_close(tree, h[n]);
+		}
+	}
+	smb2_deltree(tree, DNAME);
+	return ret;
+}
+
+/*
+  changing the attributes of a file changes neither the directory nor
+  its timestamps, listings must still show the new attributes
+*/
+
+static bool test_attrib_change(struct torture_context *tctx,
+			       struct smb2_tree *tree)
+{
+	const char *fname = DNAME "\\attrib_change.dat";
+	struct smb2_handle h;
+	uint64_t size;
+	uint32_t attrib;
+	NTSTATUS status;
+	bool ret = true;
+	int i;
+
+	smb2_deltree(tree, DNAME);
+
+	status = smb2_util_mkdir(tree, DNAME);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "mkdir");
+
+	status = torture_smb2_testfile(tree, fname, &h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "create");
+	smb2_util_close(tree, h);
+
+	/* The second listing can come from the cache */
+	for (i = 0; i < 2; i++) {
+		ret = find_dir_entry(tctx, tree, "attrib_change.dat",
+				     &size, &attrib);
+		torture_assert_goto(tctx, ret, ret, done, "listing");
+		torture_assert_goto(tctx,
+				    !(attrib & FILE_ATTRIBUTE_HIDDEN),
+				    ret, done, "hidden before setatr");
+	}
+
+	status = smb2_util_setatr(tree, fname, FILE_ATTRIBUTE_HIDDEN);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "setatr");
+
+	ret = find_dir_entry(tctx, tree, "attrib_change.dat", &size, &attrib);
+	torture_assert_goto(tctx, ret, ret, done, "listing");
+	torture_assert_goto(tctx, (attrib & FILE_ATTRIBUTE_HIDDEN), ret, done,
+			    "not hidden after setatr");
+
+	status = smb2_util_setatr(tree, fname, FILE_ATTRIBUTE_NORMAL);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "setatr");
+
+	ret = find_dir_entry(tctx, tree, "attrib_change.dat", &size, &attrib);
+	torture_assert_goto(tctx, ret, ret, done, "listing");
+	torture_assert_goto(tctx,
+			    !(attrib & FILE_ATTRIBUTE_HIDDEN),
+			    ret, done, "hidden after second setatr");
+
+ done:
+	smb2_deltree(tree, DNAME);
+	return ret;
+}
+
 struct torture_suite *torture_smb2_dir_init(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite =
@@ -1417,6 +1867,12 @@ struct torture_suite *torture_smb2_dir_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "sorted", test_sorted);
 	torture_suite_add_1smb2_test(suite, "file-index", test_file_index);
 	torture_suite_add_1smb2_test(suite, "large-files", test_large_files);
+	torture_suite_add_1smb2_test(suite, "partial-close",
+				     test_partial_close);
+	torture_suite_add_1smb2_test(suite, "write-size", test_write_size);
+	torture_suite_add_1smb2_test(suite, "attrib-change", test_attrib_change);
+	torture_suite_add_1smb2_test(suite, "pending-write-time",
+				     test_pending_write_time);
 	suite->description = talloc_strdup(suite, "SMB2-DIR tests");
 
 	return suite;
@@ -2410,6 +2410,114 @@ done:
 	return ret;
 }
 
+/*
+  measure byte range lock performance with many locks on one file
+
+  One handle takes "numlocks" exclusive locks of 8 bytes with 8 byte
+  gaps. A second handle then tries to take conflicting locks and reads
+  from the gaps, which checks the locks on every read with strict
+  locking.
+*/
+bool test_smb2_bench_lock(struct torture_context *torture,
+			  struct smb2_tree *tree)
+{
+	NTSTATUS status;
+	bool ret = true;
+	struct smb2_handle h = {{0}};
+	struct smb2_handle h2 = {{0}};
+	struct smb2_lock lck;
+	struct smb2_lock_element el[1];
+	struct smb2_read rd;
+	int numlocks = torture_setting_int(torture, "numlocks", 5000);
+	uint8_t *buf = NULL;
+	struct timeval tv;
+	int i;
+
+	const char *fname = BASEDIR "\\lockstorm.dat";
+
+	status = torture_smb2_testdir(tree, BASEDIR, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+	smb2_util_close(tree, h);
+
+	status = torture_smb2_testfile(tree, fname, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	buf = talloc_zero_array(torture, uint8_t, numlocks * 16);
+	torture_assert_goto(torture, buf != NULL, ret, done, "talloc failed");
+	status = smb2_util_write(tree, h, buf, 0, numlocks * 16);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	status = torture_smb2_testfile(tree, fname, &h2);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	ZERO_STRUCT(lck);
+	lck.in.locks		= el;
+	lck.in.lock_count	= 0x0001;
+	el[0].length		= 8;
+	el[0].reserved		= 0x00000000;
+
+	torture_comment(torture, "Taking %d locks\n", numlocks);
+
+	lck.in.file.handle	= h;
+	el[0].flags		= SMB2_LOCK_FLAG_EXCLUSIVE |
+				  SMB2_LOCK_FLAG_FAIL_IMMEDIATELY;
+	tv = timeval_current();
+	for (i = 0; i < numlocks; i++) {
+		el[0].offset = (uint64_t)i * 16;
+		status = smb2_lock(tree, &lck);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+	torture_comment(torture, "  %.0f locks/sec\n",
+			numlocks / timeval_elapsed(&tv));
+
+	torture_comment(torture, "Trying %d conflicting locks\n", numlocks);
+
+	lck.in.file.handle	= h2;
+	tv = timeval_current();
+	for (i = 0; i < numlocks; i++) {
+		el[0].offset = (uint64_t)(numlocks - i - 1) * 16;
+		status = smb2_lock(tree, &lck);
+		CHECK_STATUS(status, NT_STATUS_LOCK_NOT_GRANTED);
+	}
+	torture_comment(torture, "  %.0f locks/sec\n",
+			numlocks / timeval_elapsed(&tv));
+
+	torture_comment(torture, "Reading %d unlocked ranges\n", numlocks);
+
+	tv = timeval_current();
+	for (i = 0; i < numlocks; i++) {
+		ZERO_STRUCT(rd);
+		rd.in.file.handle = h2;
+		rd.in.length = 8;
+		rd.in.offset = (uint64_t)i * 16 + 8;
+		status = smb2_read(tree, torture, &rd);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		data_blob_free(&rd.out.data);
+	}
+	torture_comment(torture, "  %.0f reads/sec\n",
+			numlocks / timeval_elapsed(&tv));
+
+	torture_comment(torture, "Releasing %d locks\n", numlocks);
+
+	lck.in.file.handle	= h;
+	el[0].flags		= SMB2_LOCK_FLAG_UNLOCK;
+	tv = timeval_current();
+	for (i = 0; i < numlocks; i++) {
+		el[0].offset = (uint64_t)i * 16;
+		status = smb2_lock(tree, &lck);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+	torture_comment(torture, "  %.0f unlocks/sec\n",
+			numlocks / timeval_elapsed(&tv));
+
+done:
+	TALLOC_FREE(buf);
+	smb2_util_close(tree, h2);
+	smb2_util_close(tree, h);
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
 /**
  * Test locker context
  * - test that pid does not affect the locker context
@@ -22,6 +22,7 @@
 #include "includes.h"
 #include "libcli/smb2/smb2.h"
 #include "libcli/smb2/smb2_calls.h"
+#include "../libcli/smb/smbXcli_base.h"
 #include <tevent.h>
 
 #include "torture/torture.h"
@@ -301,6 +302,94 @@ done:
 	return ret;
 }
 
+/*
+  measure the throughput of large reads of a single file
+
+  Run this with --signing=required against two shares, one with and
+  one without "smbd signed sendfile", to compare the signed sendfile
+  path with the normal read path.
+*/
+bool test_smb2_bench_read(struct torture_context *torture,
+			  struct smb2_tree *tree)
+{
+	bool ret = true;
+	NTSTATUS status;
+	struct smb2_handle h = {{0}};
+	struct smb2_read rd;
+	TALLOC_CTX *tmp_ctx = talloc_new(tree);
+	int timelimit = torture_setting_int(torture, "timelimit", 10);
+	uint64_t filesize = torture_setting_int(torture, "filesize",
+						64 * 1024 * 1024);
+	uint32_t iosize;
+	uint64_t ofs;
+	uint64_t nbytes = 0;
+	uint8_t *buf = NULL;
+	struct timeval tv;
+	double secs;
+
+	iosize = MIN(1024 * 1024,
+		     smb2cli_conn_max_read_size(tree->session->transport->conn));
+	iosize = MIN(iosize,
+		     smb2cli_conn_max_write_size(tree->session->transport->conn));
+
+	buf = talloc_zero_array(tmp_ctx, uint8_t, iosize);
+	torture_assert_goto(torture, buf != NULL, ret, done, "talloc failed");
+
+	smb2_util_unlink(tree, FNAME);
+
+	status = torture_smb2_testfile(tree, FNAME, &h);
+	CHECK_STATUS(status, NT_STATUS_OK);
+
+	torture_comment(torture, "Writing %llu bytes\n",
+			(unsigned long long)filesize);
+
+	for (ofs = 0; ofs < filesize; ofs += iosize) {
+		size_t len = MIN(iosize, filesize - ofs);
+
+		memset(buf, ofs / iosize, len);
+		status = smb2_util_write(tree, h, buf, ofs, len);
+		CHECK_STATUS(status, NT_STATUS_OK);
+	}
+
+	torture_comment(torture, "Reading with %u byte reads for %d seconds\n",
+			(unsigned)iosize, timelimit);
+
+	tv = timeval_current();
+	ofs = 0;
+
+	while (timeval_elapsed(&tv) < timelimit) {
+		ZERO_STRUCT(rd);
+		rd.in.file.handle = h;
+		rd.in.length = MIN(iosize, filesize - ofs);
+		rd.in.offset = ofs;
+
+		status = smb2_read(tree, tmp_ctx, &rd);
+		CHECK_STATUS(status, NT_STATUS_OK);
+		CHECK_VALUE(rd.out.data.length, rd.in.length);
+		torture_assert_goto(torture,
+				    rd.out.data.data[0] == (uint8_t)(ofs / iosize),
+				    ret, done, "Incorrect data");
+		data_blob_free(&rd.out.data);
+
+		nbytes += rd.in.length;
+		ofs += rd.in.length;
+		if (ofs >= filesize) {
+			ofs = 0;
+		}
+	}
+
+	secs = timeval_elapsed(&tv);
+	torture_comment(torture, "%.2f MB/sec\n", nbytes / secs / 1e6);
+
+done:
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree, h);
+	}
+	smb2_util_unlink(tree, FNAME);
+	talloc_free(tmp_ctx);
+	return ret;
+}
+
 /* 
    basic testing of SMB2 read
 */
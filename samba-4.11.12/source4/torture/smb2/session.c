@@ -1850,6 +1850,349 @@ done:
 	return ret;
 }
 
+/*
+ * Drop an encrypted connection while large READs and WRITEs are still
+ * queued on the server. With "smbd encryption offload size" some of
+ * them are being encrypted or decrypted in the thread pool when the
+ * connection goes away.
+ */
+static bool test_session_encryption_disconnect(struct torture_context *tctx)
+{
+	NTSTATUS status;
+	bool ret = false;
+	struct smbcli_options options;
+	const char *host = torture_setting_string(tctx, "host", NULL);
+	const char *share = torture_setting_string(tctx, "share", NULL);
+	struct cli_credentials *credentials = popt_get_cmdline_credentials();
+	struct smb2_tree *tree = NULL;
+	char fname[256] = "";
+	struct smb2_handle _h1;
+	struct smb2_handle *h1 = NULL;
+	struct smb2_create io1;
+	struct smb2_request *reqs[32];
+	struct smb2_write w[16];
+	struct smb2_read r[16];
+	const size_t chunk = 65536;
+	uint8_t *buf = NULL;
+	size_t i, num_pairs;
+
+	lpcfg_smbcli_options(tctx->lp_ctx, &options);
+
+	status = smb2_connect(tctx,
+			      host,
+			      lpcfg_smb_ports(tctx->lp_ctx),
+			      share,
+			      lpcfg_resolve_context(tctx->lp_ctx),
+			      credentials,
+			      &tree,
+			      tctx->ev,
+			      &options,
+			      lpcfg_socket_options(tctx->lp_ctx),
+			      lpcfg_gensec_settings(tctx, tctx->lp_ctx)
+			      );
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_connect failed");
+
+	status = smb2cli_session_encryption_on(tree->session->smbXcli);
+	if (!NT_STATUS_IS_OK(status)) {
+		torture_skip_goto(tctx, done,
+				  "smb2cli_session_encryption_on failed");
+	}
+
+	/* Add some random component to the file name. */
+	snprintf(fname, sizeof(fname), "session_encdisc_%s.dat",
+		 generate_random_str(tctx, 8));
+
+	smb2_util_unlink(tree, fname);
+
+	smb2_oplock_create_share(&io1, fname,
+				 smb2_util_share_access("RWD"),
+				 smb2_util_oplock_level(""));
+
+	status = smb2_create(tree, tctx, &io1);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_create failed");
+	_h1 = io1.out.file.handle;
+	h1 = &_h1;
+
+	buf = talloc_zero_size(tctx, ARRAY_SIZE(w) * chunk);
+	torture_assert_goto(tctx, buf != NULL, ret, done,
+			    "talloc_zero_size failed");
+
+	status = smb2_util_write(tree, *h1, buf, 0, ARRAY_SIZE(w) * chunk);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_util_write failed");
+
+	/* Each 64k READ and WRITE costs one credit */
+	num_pairs = smb2cli_conn_get_cur_credits(
+		tree->session->transport->conn) / 2;
+	num_pairs = MIN(num_pairs, ARRAY_SIZE(w));
+	torture_assert_goto(tctx, num_pairs >= 2, ret, done,
+			    "not enough credits");
+
+	for (i = 0; i < num_pairs; i++) {
+		ZERO_STRUCT(w[i]);
+		w[i].in.file.handle = *h1;
+		w[i].in.offset = i * chunk;
+		w[i].in.data = data_blob_const(buf + i * chunk, chunk);
+		reqs[2*i] = smb2_write_send(tree, &w[i]);
+		torture_assert_goto(tctx, reqs[2*i] != NULL, ret, done,
+				    "smb2_write_send failed");
+
+		ZERO_STRUCT(r[i]);
+		r[i].in.file.handle = *h1;
+		r[i].in.offset = i * chunk;
+		r[i].in.length = chunk;
+		reqs[2*i+1] = smb2_read_send(tree, &r[i]);
+		torture_assert_goto(tctx, reqs[2*i+1] != NULL, ret, done,
+				    "smb2_read_send failed");
+	}
+
+	/* Once the server works on the first one, hang up */
+	status = smb2_write_recv(reqs[0], &w[0]);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_write_recv failed");
+
+	smbXcli_conn_disconnect(tree->session->transport->conn,
+				NT_STATUS_LOCAL_DISCONNECT);
+
+	for (i = 1; i < num_pairs * 2; i++) {
+		if ((i % 2) == 0) {
+			(void)smb2_write_recv(reqs[i], &w[i/2]);
+		} else {
+			(void)smb2_read_recv(reqs[i], tctx, &r[i/2]);
+		}
+	}
+	h1 = NULL;
+	TALLOC_FREE(tree);
+
+	/* The server must still serve new connections and the file */
+	status = smb2_connect(tctx,
+			      host,
+			      lpcfg_smb_ports(tctx->lp_ctx),
+			      share,
+			      lpcfg_resolve_context(tctx->lp_ctx),
+			      credentials,
+			      &tree,
+			      tctx->ev,
+			      &options,
+			      lpcfg_socket_options(tctx->lp_ctx),
+			      lpcfg_gensec_settings(tctx, tctx->lp_ctx)
+			      );
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_connect failed");
+
+	status = smb2cli_session_encryption_on(tree->session->smbXcli);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2cli_session_encryption_on failed");
+
+	smb2_oplock_create_share(&io1, fname,
+				 smb2_util_share_access("RWD"),
+				 smb2_util_oplock_level(""));
+	io1.in.create_disposition = NTCREATEX_DISP_OPEN;
+
+	status = smb2_create(tree, tctx, &io1);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_create failed");
+	_h1 = io1.out.file.handle;
+	h1 = &_h1;
+
+	ZERO_STRUCT(r[0]);
+	r[0].in.file.handle = *h1;
+	r[0].in.length = chunk;
+	status = smb2_read(tree, tctx, &r[0]);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_read failed");
+	torture_assert_int_equal_goto(tctx, r[0].out.data.length, chunk,
+				      ret, done, "short read");
+
+	ret = true;
+done:
+	if (tree != NULL) {
+		if (h1 != NULL) {
+			smb2_util_close(tree, *h1);
+		}
+		if (fname[0] != '\0') {
+			smb2_util_unlink(tree, fname);
+		}
+		talloc_free(tree);
+	}
+
+	return ret;
+}
+
+/*
+ * Signed WRITEs with a bad signature must fail with ACCESS_DENIED and
+ * leave the file alone. With "min receivefile size" and "smbd signed
+ * recvfile" the payloads are received into a staging file and checked
+ * there, and writes that fail before that point must still check the
+ * signature before answering.
+ */
+static bool test_session_signing_bad_write(struct torture_context *tctx)
+{
+	NTSTATUS status;
+	bool ret = false;
+	struct smbcli_options options;
+	const char *host = torture_setting_string(tctx, "host", NULL);
+	const char *share = torture_setting_string(tctx, "share", NULL);
+	struct cli_credentials *credentials = popt_get_cmdline_credentials();
+	struct smb2_tree *tree = NULL;
+	char fname[256] = "";
+	struct smb2_handle _h1;
+	struct smb2_handle *h1 = NULL;
+	struct smb2_handle _h2;
+	struct smb2_handle *h2 = NULL;
+	struct smb2_create io;
+	struct smb2_read r;
+	struct smb2_lock lck;
+	struct smb2_lock_element el;
+	const size_t chunk = 65536;
+	uint8_t *buf = NULL;
+	size_t i;
+
+	lpcfg_smbcli_options(tctx->lp_ctx, &options);
+	options.signing = SMB_SIGNING_REQUIRED;
+
+	status = smb2_connect(tctx,
+			      host,
+			      lpcfg_smb_ports(tctx->lp_ctx),
+			      share,
+			      lpcfg_resolve_context(tctx->lp_ctx),
+			      credentials,
+			      &tree,
+			      tctx->ev,
+			      &options,
+			      lpcfg_socket_options(tctx->lp_ctx),
+			      lpcfg_gensec_settings(tctx, tctx->lp_ctx)
+			      );
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_connect failed");
+
+	if (smb2cli_tcon_is_encryption_on(tree->smbXcli)) {
+		torture_skip_goto(tctx, done, "share requires encryption");
+	}
+
+	/* Add some random component to the file name. */
+	snprintf(fname, sizeof(fname), "session_badsig_%s.dat",
+		 generate_random_str(tctx, 8));
+
+	smb2_util_unlink(tree, fname);
+
+	smb2_oplock_create_share(&io, fname,
+				 smb2_util_share_access("RWD"),
+				 smb2_util_oplock_level(""));
+
+	status = smb2_create(tree, tctx, &io);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_create failed");
+	_h1 = io.out.file.handle;
+	h1 = &_h1;
+
+	buf = talloc_size(tctx, chunk);
+	torture_assert_goto(tctx, buf != NULL, ret, done,
+			    "talloc_size failed");
+	for (i = 0; i < chunk; i++) {
+		buf[i] = i % 251;
+	}
+
+	torture_comment(tctx, "Extend the file with a good signature\n");
+
+	status = smb2_util_write(tree, *h1, buf, 0, chunk);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_util_write failed");
+
+	ZERO_STRUCT(r);
+	r.in.file.handle = *h1;
+	r.in.length = chunk;
+	status = smb2_read(tree, tctx, &r);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_read failed");
+	torture_assert_goto(tctx,
+			    (r.out.data.length == chunk) &&
+			    (memcmp(r.out.data.data, buf, chunk) == 0),
+			    ret, done, "read back wrong data");
+
+	torture_comment(tctx, "Extend the file with a bad signature\n");
+
+	memset(buf, 0xcc, chunk);
+
+	smb2cli_session_torture_corrupt_signature(tree->session->smbXcli);
+	status = smb2_util_write(tree, *h1, buf, chunk, chunk);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_ACCESS_DENIED,
+					   ret, done,
+					   "bad signature not detected");
+
+	ZERO_STRUCT(r);
+	r.in.file.handle = *h1;
+	r.in.offset = chunk;
+	r.in.length = chunk;
+	status = smb2_read(tree, tctx, &r);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_END_OF_FILE,
+					   ret, done,
+					   "unchecked data left in the file");
+
+	torture_comment(tctx, "Fail a write with a bad signature "
+			"before it reaches the file\n");
+
+	io.in.create_disposition = NTCREATEX_DISP_OPEN;
+	status = smb2_create(tree, tctx, &io);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_create failed");
+	_h2 = io.out.file.handle;
+	h2 = &_h2;
+
+	ZERO_STRUCT(lck);
+	ZERO_STRUCT(el);
+	lck.in.locks = &el;
+	lck.in.lock_count = 1;
+	lck.in.file.handle = *h2;
+	el.offset = chunk;
+	el.length = chunk;
+	el.flags = SMB2_LOCK_FLAG_EXCLUSIVE |
+		   SMB2_LOCK_FLAG_FAIL_IMMEDIATELY;
+	status = smb2_lock(tree, &lck);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done,
+					"smb2_lock failed");
+
+	smb2cli_session_torture_corrupt_signature(tree->session->smbXcli);
+	status = smb2_util_write(tree, *h1, buf, chunk, chunk);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_ACCESS_DENIED,
+					   ret, done,
+					   "bad signature not detected");
+
+	status = smb2_util_write(tree, *h1, buf, chunk, chunk);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_FILE_LOCK_CONFLICT,
+					   ret, done,
+					   "write into locked range");
+
+	status = smb2_read(tree, tctx, &r);
+	torture_assert_ntstatus_equal_goto(tctx, status,
+					   NT_STATUS_END_OF_FILE,
+					   ret, done,
+					   "unchecked data left in the file");
+
+	ret = true;
+done:
+	if (tree != NULL) {
+		if (h2 != NULL) {
+			smb2_util_close(tree, *h2);
+		}
+		if (h1 != NULL) {
+			smb2_util_close(tree, *h1);
+		}
+		if (fname[0] != '\0') {
+			smb2_util_unlink(tree, fname);
+		}
+		talloc_free(tree);
+	}
+
+	return ret;
+}
+
 struct torture_suite *torture_smb2_session_init(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite =
@@ -1871,6 +2214,10 @@ struct torture_suite *torture_smb2_session_init(TALLOC_CTX *ctx)
 	torture_suite_add_simple_test(suite, "expire_disconnect",
 				      test_session_expire_disconnect);
 	torture_suite_add_1smb2_test(suite, "bind1", test_session_bind1);
+	torture_suite_add_simple_test(suite, "encryption-disconnect",
+				      test_session_encryption_disconnect);
+	torture_suite_add_simple_test(suite, "signing-bad-write",
+				      test_session_signing_bad_write);
 
 	suite->description = talloc_strdup(suite, "SMB2-SESSION tests");
 